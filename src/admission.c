@@ -0,0 +1,129 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "redstore.h"
+
+
+// Admission control: requests are put into one of several queues by
+// the redhttp server as they arrive, and the queues are served in
+// order of priority. A queue that is too long, or a request that has
+// waited for too long, gets a 503 response with a Retry-After header.
+
+typedef struct admission_class_s {
+  const char *name;
+  int max_depth;
+  int max_wait;
+} admission_class_t;
+
+// Indexed by admission_class_type_t, which is also the order of priority
+static const admission_class_t admission_classes[] = {
+  {"admin", 32, 0},
+  {"interactive", 64, 10},
+  {"write", 64, 30},
+  {"batch", 16, 60}
+};
+
+
+static int is_path(const char *path, const char *prefix)
+{
+  size_t len = strlen(prefix);
+  return (strncmp(path, prefix, len) == 0 && (path[len] == '\0' || path[len] == '/'));
+}
+
+static const char *get_priority(redhttp_request_t * request)
+{
+  const char *priority = redhttp_request_get_argument(request, "priority");
+  if (!priority)
+    priority = redhttp_request_get_header(request, "X-Priority");
+  return priority;
+}
+
+int redstore_classify_request(redhttp_request_t * request, void *user_data)
+{
+  const char *method = redhttp_request_get_method(request);
+  const char *path = redhttp_request_get_path(request);
+  const char *priority = get_priority(request);
+  int is_read = (strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0);
+  admission_class_type_t type = ADMISSION_INTERACTIVE;
+
+  if (!path)
+    return ADMISSION_ADMIN;
+
+  // Requests for other datasets are classified by their path within the dataset
+  if (strncmp(path, "/ds/", 4) == 0) {
+    path = strchr(path + 4, '/');
+    if (!path)
+      path = "/";
+  }
+
+  if (strcmp(path, "/") == 0 || is_path(path, "/description") ||
+      is_path(path, "/robots.txt") || is_path(path, "/favicon.ico") ||
+      strcmp(method, "OPTIONS") == 0) {
+    // Health checks and static pages
+    return ADMISSION_ADMIN;
+  }
+
+  if (is_path(path, "/query") || is_path(path, "/sparql")) {
+    // A POST to the SPARQL endpoint may be a query or an update
+    if (!is_read && !redhttp_request_argument_exists(request, "query"))
+      type = ADMISSION_WRITE;
+  } else if (is_path(path, "/data")) {
+    if (!is_read) {
+      type = ADMISSION_WRITE;
+    } else if (redhttp_request_argument_exists(request, "default")) {
+      // Downloading the whole store
+      type = ADMISSION_BATCH;
+    }
+  } else if (is_path(path, "/insert") || is_path(path, "/delete") ||
+             is_path(path, "/load") || is_path(path, "/patch") || is_path(path, "/update")) {
+    if (!is_read)
+      type = ADMISSION_WRITE;
+  }
+
+  // Reads may ask for a different priority
+  if (type != ADMISSION_WRITE && priority) {
+    if (strcasecmp(priority, "batch") == 0 || strcasecmp(priority, "low") == 0) {
+      type = ADMISSION_BATCH;
+    } else if (strcasecmp(priority, "interactive") == 0 || strcasecmp(priority, "high") == 0) {
+      type = ADMISSION_INTERACTIVE;
+    }
+  }
+
+  return type;
+}
+
+void admission_init(redhttp_server_t * server)
+{
+  int i;
+
+  for (i = 0; i < ADMISSION_CLASS_COUNT; i++) {
+    const admission_class_t *queue = &admission_classes[i];
+    redstore_debug("Admission queue '%s': depth=%d wait=%ds",
+                   queue->name, queue->max_depth, queue->max_wait);
+    redhttp_server_set_queue_limits(server, i, queue->max_depth, queue->max_wait);
+  }
+
+  redhttp_server_set_classifier(server, redstore_classify_request, NULL);
+}
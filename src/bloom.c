@@ -0,0 +1,149 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "redstore.h"
+
+
+// A Bloom filter of 64-bit hashes. It can say for certain that a hash
+// has never been added, but may wrongly say that one has; with
+// BLOOM_BITS_PER_ENTRY bits for each entry that it was sized for, that
+// happens about 1% of the time. The probes are derived from the
+// two halves of the hash.
+//
+// Once a filter holds as many entries as it was sized for, it grows by
+// starting a new stage twice the size, rather than by adding all the
+// entries again. New entries go in the newest stage, and a hash may have
+// been added if any of the stages may contain it.
+
+struct bloom_s {
+  uint64_t *bits;
+  uint64_t mask;
+  unsigned long capacity;
+  unsigned long count;
+  struct bloom_s *older;
+};
+
+
+bloom_t *bloom_new(unsigned long capacity)
+{
+  bloom_t *bloom = NULL;
+  uint64_t nbits = 64;
+
+  if (capacity < BLOOM_MIN_CAPACITY)
+    capacity = BLOOM_MIN_CAPACITY;
+
+  // Round up to a power of two, so that probes can be masked
+  while (nbits < (uint64_t) capacity * BLOOM_BITS_PER_ENTRY)
+    nbits *= 2;
+
+  bloom = calloc(1, sizeof(bloom_t));
+  if (!bloom)
+    return NULL;
+
+  bloom->bits = calloc(nbits / 64, sizeof(uint64_t));
+  if (!bloom->bits) {
+    free(bloom);
+    return NULL;
+  }
+
+  bloom->mask = nbits - 1;
+  bloom->capacity = (unsigned long) (nbits / BLOOM_BITS_PER_ENTRY);
+
+  return bloom;
+}
+
+// Starts a new stage that takes twice as many entries as the current one.
+// It is given twice the bits for each entry, so that the false positives
+// of all the stages together stay close to those of a single filter.
+// A filter that can't grow any more still works, it just lets through
+// more hashes.
+static void bloom_grow(bloom_t * bloom)
+{
+  bloom_t *stage = NULL, tmp;
+  unsigned long capacity = bloom->capacity * 2;
+
+  if ((uint64_t) capacity * 2 > BLOOM_MAX_CAPACITY)
+    return;
+
+  stage = bloom_new(capacity * 2);
+  if (!stage)
+    return;
+  stage->capacity = capacity;
+
+  // The newest stage is always the one that callers point to
+  tmp = *bloom;
+  *bloom = *stage;
+  *stage = tmp;
+  bloom->older = stage;
+}
+
+void bloom_add(bloom_t * bloom, uint64_t hash)
+{
+  uint64_t h1 = hash, h2 = (hash >> 32) | (hash << 32) | 1;
+  int i;
+
+  if (bloom->count >= bloom->capacity)
+    bloom_grow(bloom);
+
+  for (i = 0; i < BLOOM_PROBES; i++) {
+    uint64_t bit = (h1 + i * h2) & bloom->mask;
+    bloom->bits[bit / 64] |= (uint64_t) 1 << (bit % 64);
+  }
+  bloom->count++;
+}
+
+static int bloom_stage_may_contain(bloom_t * stage, uint64_t hash)
+{
+  uint64_t h1 = hash, h2 = (hash >> 32) | (hash << 32) | 1;
+  int i;
+
+  for (i = 0; i < BLOOM_PROBES; i++) {
+    uint64_t bit = (h1 + i * h2) & stage->mask;
+    if (!(stage->bits[bit / 64] & ((uint64_t) 1 << (bit % 64))))
+      return 0;
+  }
+
+  return 1;
+}
+
+// Returns 0 if the hash has definitely not been added
+int bloom_may_contain(bloom_t * bloom, uint64_t hash)
+{
+  for (; bloom; bloom = bloom->older) {
+    if (bloom_stage_may_contain(bloom, hash))
+      return 1;
+  }
+
+  return 0;
+}
+
+void bloom_free(bloom_t * bloom)
+{
+  while (bloom) {
+    bloom_t *older = bloom->older;
+    free(bloom->bits);
+    free(bloom);
+    bloom = older;
+  }
+}
@@ -0,0 +1,608 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "redstore_config.h"
+#include "native/native.h"
+
+
+// redstore-bulkload: parses N-Triples and N-Quads files on every core and
+// writes a snapshot of a native store, which redstore can then serve with:
+//   redstore -s native -t "snapshot='filename'"
+//
+// The input files are mapped into memory and split into chunks at line
+// boundaries; each thread parses one chunk at a time.
+
+#define BULKLOAD_CHUNK_SIZE     (16 * 1024 * 1024)
+#define BULKLOAD_MAX_WARNINGS   (20)
+
+typedef struct bulkload_file_s {
+  const char *filename;
+  const char *data;
+  size_t len;
+} bulkload_file_t;
+
+typedef struct bulkload_chunk_s {
+  bulkload_file_t *file;
+  const char *start;
+  const char *end;
+} bulkload_chunk_t;
+
+typedef struct bulkload_term_s {
+  unsigned char *key;
+  size_t len;
+  size_t size;
+} bulkload_term_t;
+
+static native_bulk_t *bulk = NULL;
+static bulkload_chunk_t *chunks = NULL;
+static size_t chunk_count = 0;
+static size_t next_chunk = 0;
+static unsigned long errors = 0;
+static int failed = 0;
+static int quiet = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void warn_line(bulkload_chunk_t * chunk, const char *line, const char *message)
+{
+  pthread_mutex_lock(&lock);
+  if (errors++ < BULKLOAD_MAX_WARNINGS)
+    fprintf(stderr, "%s: byte %lu: %s\n", chunk->file->filename,
+            (unsigned long) (line - chunk->file->data), message);
+  pthread_mutex_unlock(&lock);
+}
+
+static int term_append(bulkload_term_t * term, const void *data, size_t len)
+{
+  if (term->len + len > term->size) {
+    size_t size = term->size ? term->size : 256;
+    unsigned char *tmp = NULL;
+    while (term->len + len > size)
+      size *= 2;
+    tmp = realloc(term->key, size);
+    if (!tmp)
+      return 1;
+    term->key = tmp;
+    term->size = size;
+  }
+  memcpy(term->key + term->len, data, len);
+  term->len += len;
+
+  return 0;
+}
+
+static int term_append_utf8(bulkload_term_t * term, unsigned long c)
+{
+  unsigned char buf[4];
+  size_t len;
+
+  if (c < 0x80) {
+    buf[0] = (unsigned char) c;
+    len = 1;
+  } else if (c < 0x800) {
+    buf[0] = (unsigned char) (0xC0 | (c >> 6));
+    buf[1] = (unsigned char) (0x80 | (c & 0x3F));
+    len = 2;
+  } else if (c < 0x10000) {
+    buf[0] = (unsigned char) (0xE0 | (c >> 12));
+    buf[1] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+    buf[2] = (unsigned char) (0x80 | (c & 0x3F));
+    len = 3;
+  } else if (c < 0x110000) {
+    buf[0] = (unsigned char) (0xF0 | (c >> 18));
+    buf[1] = (unsigned char) (0x80 | ((c >> 12) & 0x3F));
+    buf[2] = (unsigned char) (0x80 | ((c >> 6) & 0x3F));
+    buf[3] = (unsigned char) (0x80 | (c & 0x3F));
+    len = 4;
+  } else {
+    return 1;
+  }
+
+  return term_append(term, buf, len);
+}
+
+static int hex_value(const char *str, int digits, unsigned long *value)
+{
+  int i;
+
+  *value = 0;
+  for (i = 0; i < digits; i++) {
+    char c = str[i];
+    *value <<= 4;
+    if (c >= '0' && c <= '9')
+      *value |= c - '0';
+    else if (c >= 'a' && c <= 'f')
+      *value |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      *value |= c - 'A' + 10;
+    else
+      return 1;
+  }
+
+  return 0;
+}
+
+// Appends an escaped character, returning the position after it, or NULL if it is invalid
+static const char *parse_escape(const char *ptr, const char *end, bulkload_term_t * term, int uchar_only)
+{
+  unsigned long c;
+  char ch;
+
+  if (ptr + 1 >= end)
+    return NULL;
+
+  switch (ptr[1]) {
+  case 'u':
+  case 'U':
+    if (ptr + (ptr[1] == 'u' ? 6 : 10) > end || hex_value(ptr + 2, ptr[1] == 'u' ? 4 : 8, &c))
+      return NULL;
+    if (term_append_utf8(term, c))
+      return NULL;
+    return ptr + (ptr[1] == 'u' ? 6 : 10);
+  case 't':
+    ch = '\t';
+    break;
+  case 'b':
+    ch = '\b';
+    break;
+  case 'n':
+    ch = '\n';
+    break;
+  case 'r':
+    ch = '\r';
+    break;
+  case 'f':
+    ch = '\f';
+    break;
+  case '"':
+  case '\'':
+  case '\\':
+    ch = ptr[1];
+    break;
+  default:
+    return NULL;
+  }
+
+  if (uchar_only || term_append(term, &ch, 1))
+    return NULL;
+
+  return ptr + 2;
+}
+
+static const char *parse_iri(const char *ptr, const char *end, bulkload_term_t * term)
+{
+  // ptr is at the opening '<'
+  ptr++;
+  while (ptr < end && *ptr != '>') {
+    if (*ptr == '\\') {
+      ptr = parse_escape(ptr, end, term, 1);
+      if (!ptr)
+        return NULL;
+    } else {
+      const char *start = ptr;
+      while (ptr < end && *ptr != '>' && *ptr != '\\')
+        ptr++;
+      if (term_append(term, start, ptr - start))
+        return NULL;
+    }
+  }
+
+  return ptr < end ? ptr + 1 : NULL;
+}
+
+// Parses a term into a key in the same form as native_storage.c;
+// value is used to unescape literals
+static const char *parse_term(const char *ptr, const char *end, bulkload_term_t * term,
+                              bulkload_term_t * value)
+{
+  static const unsigned char nul = '\0';
+  const char *start = NULL;
+
+  term->len = 0;
+  value->len = 0;
+
+  if (*ptr == '<') {
+    if (term_append(term, "U", 1))
+      return NULL;
+    return parse_iri(ptr, end, term);
+  }
+
+  if (*ptr == '_' && ptr + 1 < end && ptr[1] == ':') {
+    ptr += 2;
+    start = ptr;
+    while (ptr < end && *ptr != ' ' && *ptr != '\t' && *ptr != '<' && *ptr != '"')
+      ptr++;
+    // A label can't end with a full stop
+    while (ptr > start && ptr[-1] == '.')
+      ptr--;
+    if (ptr == start || term_append(term, "B", 1) || term_append(term, start, ptr - start))
+      return NULL;
+    return ptr;
+  }
+
+  if (*ptr != '"')
+    return NULL;
+
+  // Unescape the value first, as the language and datatype come first in the key
+  ptr++;
+  while (ptr < end && *ptr != '"') {
+    if (*ptr == '\\') {
+      ptr = parse_escape(ptr, end, value, 0);
+      if (!ptr)
+        return NULL;
+    } else {
+      start = ptr;
+      while (ptr < end && *ptr != '"' && *ptr != '\\')
+        ptr++;
+      if (term_append(value, start, ptr - start))
+        return NULL;
+    }
+  }
+  if (ptr >= end)
+    return NULL;
+  ptr++;
+
+  if (term_append(term, "L", 1))
+    return NULL;
+
+  if (ptr < end && *ptr == '@') {
+    start = ++ptr;
+    while (ptr < end && (*ptr == '-' || (*ptr >= 'a' && *ptr <= 'z') ||
+                         (*ptr >= 'A' && *ptr <= 'Z') || (*ptr >= '0' && *ptr <= '9')))
+      ptr++;
+    if (ptr == start || term_append(term, start, ptr - start) ||
+        term_append(term, &nul, 1) || term_append(term, &nul, 1))
+      return NULL;
+  } else if (ptr + 2 < end && ptr[0] == '^' && ptr[1] == '^' && ptr[2] == '<') {
+    if (term_append(term, &nul, 1))
+      return NULL;
+    ptr = parse_iri(ptr + 2, end, term);
+    if (!ptr || term_append(term, &nul, 1))
+      return NULL;
+  } else if (term_append(term, &nul, 1) || term_append(term, &nul, 1)) {
+    return NULL;
+  }
+
+  if (value->len && term_append(term, value->key, value->len))
+    return NULL;
+
+  return ptr;
+}
+
+static const char *skip_space(const char *ptr, const char *end)
+{
+  while (ptr < end && (*ptr == ' ' || *ptr == '\t'))
+    ptr++;
+  return ptr;
+}
+
+// Returns 0 if a quad was parsed, 1 for a blank line or comment and -1 on error
+static int parse_line(const char *ptr, const char *end, bulkload_term_t terms[5], int *count)
+{
+  ptr = skip_space(ptr, end);
+  if (ptr == end || *ptr == '#')
+    return 1;
+
+  for (*count = 0; *count < 4; (*count)++) {
+    if (ptr == end || *ptr == '.')
+      break;
+    ptr = parse_term(ptr, end, &terms[*count], &terms[4]);
+    if (!ptr)
+      return -1;
+    ptr = skip_space(ptr, end);
+  }
+
+  if (*count < 3 || ptr == end || *ptr != '.')
+    return -1;
+
+  // Only IRIs and blank nodes may be graph names
+  if (*count == 4 && terms[3].key[0] == 'L')
+    return -1;
+
+  ptr = skip_space(ptr + 1, end);
+  if (ptr != end && *ptr != '#')
+    return -1;
+
+  return 0;
+}
+
+static void *parse_chunks(void *arg)
+{
+  native_bulk_worker_t *worker = native_bulk_worker_new(bulk);
+  bulkload_term_t terms[5];
+  int i;
+
+  (void) arg;
+  memset(terms, 0, sizeof(terms));
+
+  if (!worker) {
+    pthread_mutex_lock(&lock);
+    failed = 1;
+    pthread_mutex_unlock(&lock);
+    return NULL;
+  }
+
+  while (1) {
+    bulkload_chunk_t *chunk = NULL;
+    const char *line = NULL;
+
+    pthread_mutex_lock(&lock);
+    if (next_chunk < chunk_count && !failed)
+      chunk = &chunks[next_chunk++];
+    pthread_mutex_unlock(&lock);
+    if (!chunk)
+      break;
+
+    for (line = chunk->start; line < chunk->end;) {
+      const char *eol = memchr(line, '\n', chunk->end - line);
+      const unsigned char *keys[4] = { NULL, NULL, NULL, NULL };
+      size_t lens[4] = { 0, 0, 0, 0 };
+      int count = 0, result;
+
+      if (!eol)
+        eol = chunk->end;
+
+      result = parse_line(line, (eol > line && eol[-1] == '\r') ? eol - 1 : eol, terms, &count);
+      if (result < 0) {
+        warn_line(chunk, line, "invalid line skipped");
+      } else if (result == 0) {
+        for (i = 0; i < count; i++) {
+          keys[i] = terms[i].key;
+          lens[i] = terms[i].len;
+        }
+        if (native_bulk_worker_add(worker, keys, lens)) {
+          pthread_mutex_lock(&lock);
+          failed = 1;
+          pthread_mutex_unlock(&lock);
+          break;
+        }
+      }
+
+      line = eol + 1;
+    }
+  }
+
+  if (native_bulk_worker_free(worker)) {
+    pthread_mutex_lock(&lock);
+    failed = 1;
+    pthread_mutex_unlock(&lock);
+  }
+
+  for (i = 0; i < 5; i++) {
+    if (terms[i].key)
+      free(terms[i].key);
+  }
+
+  return NULL;
+}
+
+// Splits a file into chunks that end at a line boundary
+static int add_chunks(bulkload_file_t * file)
+{
+  const char *ptr = file->data, *end = file->data + file->len;
+
+  while (ptr < end) {
+    const char *chunk_end = ptr + BULKLOAD_CHUNK_SIZE;
+    bulkload_chunk_t *tmp = NULL;
+
+    if (chunk_end >= end) {
+      chunk_end = end;
+    } else {
+      chunk_end = memchr(chunk_end, '\n', end - chunk_end);
+      chunk_end = chunk_end ? chunk_end + 1 : end;
+    }
+
+    tmp = realloc(chunks, (chunk_count + 1) * sizeof(bulkload_chunk_t));
+    if (!tmp)
+      return 1;
+    chunks = tmp;
+    chunks[chunk_count].file = file;
+    chunks[chunk_count].start = ptr;
+    chunks[chunk_count].end = chunk_end;
+    chunk_count++;
+
+    ptr = chunk_end;
+  }
+
+  return 0;
+}
+
+static int map_file(bulkload_file_t * file)
+{
+  struct stat st;
+  void *map = NULL;
+  int fd;
+
+  fd = open(file->filename, O_RDONLY);
+  if (fd < 0) {
+    perror(file->filename);
+    return 1;
+  }
+
+  if (fstat(fd, &st)) {
+    perror(file->filename);
+    close(fd);
+    return 1;
+  }
+
+  file->len = st.st_size;
+  if (file->len > 0) {
+    map = mmap(NULL, file->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      perror(file->filename);
+      close(fd);
+      return 1;
+    }
+    posix_madvise(map, file->len, POSIX_MADV_SEQUENTIAL);
+    file->data = map;
+  }
+  close(fd);
+
+  return 0;
+}
+
+static double elapsed(struct timeval *start)
+{
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+static void usage()
+{
+  printf("%s version %s\n\n", PACKAGE_NAME, PACKAGE_VERSION);
+  printf("Usage: redstore-bulkload [options] <snapshot> <file>...\n");
+  printf("Loads N-Triples and N-Quads files into a snapshot for the native storage type.\n\n");
+  printf("   -j <threads>    Number of parsing threads (default number of CPUs)\n");
+  printf("   -m <quads>      Quads to sort in memory, per thread (default %d)\n", NATIVE_BULK_RUN_SIZE);
+  printf("   -T <directory>  Directory for temporary files (default $TMPDIR or /tmp)\n");
+  printf("   -q              Enable quiet mode\n");
+  printf("\nThe snapshot can be served using: redstore -s native -t \"snapshot='<snapshot>'\"\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *tmpdir = getenv("TMPDIR");
+  const char *snapshot_filename = NULL;
+  bulkload_file_t *files = NULL;
+  pthread_t *threads = NULL;
+  native_store_t *store = NULL;
+  struct timeval start;
+  long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t run_size = NATIVE_BULK_RUN_SIZE, quads;
+  int file_count = 0, started = 0, opt = -1, i, status = EXIT_FAILURE;
+
+  while ((opt = getopt(argc, argv, "j:m:T:qh")) != -1) {
+    switch (opt) {
+    case 'j':
+      thread_count = atol(optarg);
+      break;
+    case 'm':
+      run_size = (size_t) atol(optarg);
+      break;
+    case 'T':
+      tmpdir = optarg;
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      usage();
+      break;
+    }
+  }
+
+  argc -= optind;
+  argv += optind;
+  if (argc < 2 || run_size == 0)
+    usage();
+  if (thread_count < 1)
+    thread_count = 1;
+  if (!tmpdir || !*tmpdir)
+    tmpdir = "/tmp";
+
+  snapshot_filename = argv[0];
+  file_count = argc - 1;
+  files = calloc(file_count, sizeof(bulkload_file_t));
+  threads = calloc(thread_count, sizeof(pthread_t));
+  bulk = native_bulk_new(tmpdir, run_size);
+  if (!files || !threads || !bulk) {
+    fprintf(stderr, "Failed to allocate memory.\n");
+    goto CLEANUP;
+  }
+
+  for (i = 0; i < file_count; i++) {
+    files[i].filename = argv[i + 1];
+    if (map_file(&files[i]) || add_chunks(&files[i]))
+      goto CLEANUP;
+  }
+
+  gettimeofday(&start, NULL);
+  for (started = 0; started < thread_count; started++) {
+    if (pthread_create(&threads[started], NULL, parse_chunks, NULL))
+      break;
+  }
+  for (i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  if (started == 0 || failed) {
+    fprintf(stderr, "Failed to load input files.\n");
+    goto CLEANUP;
+  }
+
+  quads = native_bulk_count(bulk);
+  if (!quiet) {
+    printf("Parsed %lu quads using %d threads in %.1f seconds (%.0f quads/second)\n",
+           (unsigned long) quads, started, elapsed(&start), quads / elapsed(&start));
+    if (errors)
+      printf("Skipped %lu invalid lines\n", errors);
+  }
+
+  gettimeofday(&start, NULL);
+  if (native_bulk_write_snapshot(bulk, snapshot_filename)) {
+    fprintf(stderr, "Failed to write snapshot: %s\n", snapshot_filename);
+    goto CLEANUP;
+  }
+
+  store = native_store_open_snapshot(snapshot_filename);
+  if (!store) {
+    fprintf(stderr, "Failed to open new snapshot: %s\n", snapshot_filename);
+    goto CLEANUP;
+  }
+  if (!quiet) {
+    printf("Wrote %lu quads and %lu terms to %s in %.1f seconds\n",
+           (unsigned long) native_store_size(store),
+           (unsigned long) native_dict_count(native_store_get_dict(store)),
+           snapshot_filename, elapsed(&start));
+  }
+  status = EXIT_SUCCESS;
+
+CLEANUP:
+  if (store)
+    native_store_free(store);
+  if (bulk)
+    native_bulk_free(bulk);
+  if (files) {
+    for (i = 0; i < file_count; i++) {
+      if (files[i].data)
+        munmap((void *) files[i].data, files[i].len);
+    }
+    free(files);
+  }
+  if (threads)
+    free(threads);
+  if (chunks)
+    free(chunks);
+
+  return status;
+}
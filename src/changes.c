@@ -0,0 +1,428 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "redstore.h"
+
+
+// The change feed: every group of changes that is committed to the store
+// is kept in memory as an RDF Patch transaction, with a sequence number.
+// Followers ask /changes for the changes after the last one that they
+// have seen; if there aren't any yet, the request is held open until
+// there are, or until it times out.
+//
+// Only the most recent max_size bytes of changes are kept. Emptying the
+// whole store starts a new epoch without any history. A follower that
+// asks for changes from another epoch, or from before the oldest change
+// that is still kept, has to copy the whole store again.
+
+typedef struct change_s {
+  unsigned long sequence;
+  char *text;
+  size_t len;
+} change_t;
+
+typedef struct waiter_s {
+  redhttp_request_t *request;
+  unsigned long since;
+  unsigned long epoch;
+  time_t deadline;
+} waiter_t;
+
+// Maximum size of the changes that are kept; 0 means that the feed is disabled
+static size_t max_size = 0;
+
+// Rows for the changes that haven't been committed yet
+static char *pending = NULL;
+static size_t pending_len = 0;
+static size_t pending_size = 0;
+
+// Set if a change could not be recorded; followers then have to start again
+static int lost = 0;
+
+// Committed changes, oldest first, in a ring
+static change_t *changes = NULL;
+static size_t changes_first = 0;
+static size_t changes_count = 0;
+static size_t changes_capacity = 0;
+static size_t changes_size = 0;
+
+static unsigned long sequence = 0;
+static unsigned long epoch = 0;
+
+// Requests waiting for new changes
+static waiter_t waiters[CHANGES_MAX_WAITING];
+static int waiting = 0;
+
+
+void changes_init(size_t size)
+{
+  max_size = size;
+  epoch = (unsigned long) time(NULL);
+
+  if (max_size)
+    redstore_info("Keeping up to %lu bytes of changes for followers.", (unsigned long) max_size);
+}
+
+int changes_is_enabled(void)
+{
+  return max_size > 0;
+}
+
+static int pending_append(const char *str, size_t len)
+{
+  if (pending_len + len > pending_size) {
+    size_t size = pending_size ? pending_size : 4096;
+    char *tmp = NULL;
+    while (pending_len + len > size)
+      size *= 2;
+    tmp = realloc(pending, size);
+    if (!tmp)
+      return 1;
+    pending = tmp;
+    pending_size = size;
+  }
+
+  memcpy(pending + pending_len, str, len);
+  pending_len += len;
+
+  return 0;
+}
+
+static int pending_append_node(librdf_node * node)
+{
+  unsigned char *str = librdf_node_to_string(node);
+  int err = 1;
+
+  if (str) {
+    err = pending_append(" ", 1) || pending_append((char *) str, strlen((char *) str));
+    free(str);
+  }
+
+  return err;
+}
+
+static void pending_append_row(int remove, librdf_node * graph, librdf_statement * statement)
+{
+  size_t mark = pending_len;
+
+  if (pending_append(remove ? "D" : "A", 1) ||
+      pending_append_node(librdf_statement_get_subject(statement)) ||
+      pending_append_node(librdf_statement_get_predicate(statement)) ||
+      pending_append_node(librdf_statement_get_object(statement)) ||
+      (graph && pending_append_node(graph)) || pending_append(" .\n", 3)) {
+    redstore_error("Failed to add change to the feed");
+    pending_len = mark;
+    lost = 1;
+  }
+}
+
+void changes_log_statement(int remove, librdf_node * graph, librdf_statement * statement)
+{
+  if (max_size)
+    pending_append_row(remove, graph, statement);
+}
+
+// Called before a named graph is removed, so that there is a row for each statement in it
+void changes_log_graph(librdf_node * graph)
+{
+  librdf_stream *stream = NULL;
+
+  if (!max_size)
+    return;
+
+  stream = librdf_model_context_as_stream(model, graph);
+  if (!stream) {
+    redstore_error("Failed to stream graph for the change feed");
+    lost = 1;
+    return;
+  }
+
+  while (!librdf_stream_end(stream)) {
+    pending_append_row(1, graph, librdf_stream_get_object(stream));
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+}
+
+static void changes_drop_oldest(void)
+{
+  free(changes[changes_first].text);
+  changes_size -= changes[changes_first].len;
+  changes_first = (changes_first + 1) % changes_capacity;
+  changes_count--;
+}
+
+// Called when the whole store has been emptied
+void changes_reset(void)
+{
+  if (!max_size)
+    return;
+
+  while (changes_count > 0)
+    changes_drop_oldest();
+  pending_len = 0;
+  lost = 0;
+
+  // Make sure that the epoch changes, even if the clock hasn't
+  if ((unsigned long) time(NULL) > epoch) {
+    epoch = (unsigned long) time(NULL);
+  } else {
+    epoch++;
+  }
+  redstore_info("Started a new epoch of the change feed: %lu", epoch);
+}
+
+// Returns a mark that changes_rollback() can go back to
+size_t changes_get_mark(void)
+{
+  return pending_len;
+}
+
+// Forgets changes that haven't been committed yet
+void changes_rollback(size_t mark)
+{
+  if (mark < pending_len)
+    pending_len = mark;
+}
+
+static int changes_grow(void)
+{
+  size_t capacity = changes_capacity ? changes_capacity * 2 : 64, i;
+  change_t *tmp = calloc(capacity, sizeof(change_t));
+
+  if (!tmp)
+    return 1;
+
+  for (i = 0; i < changes_count; i++)
+    tmp[i] = changes[(changes_first + i) % changes_capacity];
+  if (changes)
+    free(changes);
+
+  changes = tmp;
+  changes_first = 0;
+  changes_capacity = capacity;
+
+  return 0;
+}
+
+// Makes the pending changes into a transaction in the feed
+void changes_commit(void)
+{
+  change_t *change = NULL;
+  const char *begin = "TX .\n", *end = "TC .\n";
+
+  if (!max_size)
+    return;
+
+  // Followers can't be given an incomplete history
+  if (lost) {
+    changes_reset();
+    return;
+  }
+
+  if (pending_len == 0)
+    return;
+
+  if (changes_count == changes_capacity && changes_grow()) {
+    changes_reset();
+    return;
+  }
+
+  change = &changes[(changes_first + changes_count) % changes_capacity];
+  change->len = strlen(begin) + pending_len + strlen(end);
+  change->text = malloc(change->len);
+  if (!change->text) {
+    changes_reset();
+    return;
+  }
+  memcpy(change->text, begin, strlen(begin));
+  memcpy(change->text + strlen(begin), pending, pending_len);
+  memcpy(change->text + strlen(begin) + pending_len, end, strlen(end));
+  change->sequence = ++sequence;
+  pending_len = 0;
+
+  changes_count++;
+  changes_size += change->len;
+
+  // Always keep the newest change, however large it is
+  while (changes_size > max_size && changes_count > 1)
+    changes_drop_oldest();
+}
+
+// Sends the changes after since; the request must be from the current epoch
+static redhttp_response_t *format_changes(redhttp_request_t * request, unsigned long since)
+{
+  redhttp_response_t *response =
+      redhttp_response_new_with_type(REDHTTP_OK, NULL, "application/rdf-patch");
+  FILE *socket = redhttp_request_get_socket(request);
+  size_t i;
+
+  if (!response)
+    return NULL;
+
+  redhttp_response_send(response, request);
+
+  fprintf(socket, "H epoch \"%lu\" .\n", epoch);
+  fprintf(socket, "H sequence \"%lu\" .\n", sequence);
+  for (i = 0; i < changes_count; i++) {
+    change_t *change = &changes[(changes_first + i) % changes_capacity];
+    if (change->sequence > since)
+      fwrite(change->text, 1, change->len, socket);
+  }
+
+  return response;
+}
+
+// True if the changes after since are no longer all kept
+static int changes_are_gone(unsigned long since, unsigned long since_epoch)
+{
+  unsigned long oldest = sequence + 1 - changes_count;
+
+  return since_epoch != epoch || since > sequence || since + 1 < oldest;
+}
+
+static redhttp_response_t *changes_gone_page(redhttp_request_t * request)
+{
+  return redstore_page_new_with_message(
+    request, LIBRDF_LOG_INFO, REDHTTP_GONE,
+    "The changes since then are no longer available; copy the whole store again."
+  );
+}
+
+static void changes_respond(waiter_t * waiter)
+{
+  redhttp_response_t *response = NULL;
+
+  if (changes_are_gone(waiter->since, waiter->epoch)) {
+    redhttp_request_send_deferred(waiter->request, changes_gone_page(waiter->request));
+    return;
+  }
+
+  response = format_changes(waiter->request, waiter->since);
+  redhttp_request_free(waiter->request);
+  if (response)
+    redhttp_response_free(response);
+}
+
+// Called from the main loop: answers the requests that have new changes, or have waited long enough
+void changes_tick(void)
+{
+  time_t now = time(NULL);
+  int i;
+
+  for (i = 0; i < waiting;) {
+    waiter_t *waiter = &waiters[i];
+
+    if (waiter->since < sequence || waiter->epoch != epoch || now >= waiter->deadline) {
+      changes_respond(waiter);
+      waiters[i] = waiters[--waiting];
+    } else {
+      i++;
+    }
+  }
+}
+
+redhttp_response_t *handle_changes(redhttp_request_t * request, void *user_data)
+{
+  const char *since_arg = redhttp_request_get_argument(request, "since");
+  const char *epoch_arg = redhttp_request_get_argument(request, "epoch");
+  unsigned long since = 0, since_epoch = epoch;
+  long timeout = 0;
+  char *end = NULL;
+
+  // Only changes to the default dataset are in the feed
+  if (!max_size || !datasets_is_default()) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_NOT_FOUND, "The change feed is not enabled."
+    );
+  }
+
+  // Without a starting point, just say where the feed is up to
+  if (!since_arg || since_arg[0] == '\0')
+    return format_changes(request, sequence);
+
+  since = strtoul(since_arg, &end, 10);
+  if (*end != '\0') {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "The 'since' argument must be a number."
+    );
+  }
+
+  if (epoch_arg && epoch_arg[0] != '\0') {
+    since_epoch = strtoul(epoch_arg, &end, 10);
+    if (*end != '\0') {
+      return redstore_page_new_with_message(
+        request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "The 'epoch' argument must be a number."
+      );
+    }
+  }
+
+  if (redstore_get_integer_argument(request, "timeout", CHANGES_POLL_TIMEOUT, &timeout) ||
+      timeout > CHANGES_MAX_POLL_TIMEOUT) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST,
+      "The 'timeout' argument must be between 0 and %d.", CHANGES_MAX_POLL_TIMEOUT
+    );
+  }
+
+  if (changes_are_gone(since, since_epoch))
+    return changes_gone_page(request);
+
+  // Wait for something to happen, unless there is something to send already
+  if (since < sequence || timeout == 0 || waiting >= CHANGES_MAX_WAITING)
+    return format_changes(request, since);
+
+  waiters[waiting].request = request;
+  waiters[waiting].since = since;
+  waiters[waiting].epoch = since_epoch;
+  waiters[waiting].deadline = time(NULL) + timeout;
+  waiting++;
+
+  return redhttp_request_defer(request);
+}
+
+void changes_free(void)
+{
+  int i;
+
+  // Let anyone still waiting know that there is nothing new
+  for (i = 0; i < waiting; i++)
+    changes_respond(&waiters[i]);
+  waiting = 0;
+
+  while (changes_count > 0)
+    changes_drop_oldest();
+  if (changes)
+    free(changes);
+  changes = NULL;
+  changes_capacity = 0;
+
+  if (pending)
+    free(pending);
+  pending = NULL;
+  pending_len = pending_size = 0;
+  max_size = 0;
+}
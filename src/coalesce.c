@@ -0,0 +1,315 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "redstore.h"
+
+
+// Write coalescing: small inserts and deletes that arrive close together
+// are applied in a single transaction and a single write to the log.
+//
+// The first write starts a group. Each write is applied straight away,
+// but its response is held back until the group is committed, either
+// when the window has passed or when the group is large enough. Any
+// other request commits the group first, so that it only ever sees
+// committed changes.
+
+// Length of the window in milliseconds; 0 means that coalescing is disabled
+static int window = 0;
+
+// True while a group is open
+static int group_open = 0;
+static struct timeval group_started;
+static unsigned long group_statements = 0;
+
+// Requests waiting for the group to be committed, and their responses
+static redhttp_request_t **requests = NULL;
+static redhttp_response_t **responses = NULL;
+static size_t waiting_count = 0;
+static size_t waiting_size = 0;
+
+
+void coalesce_init(int window_ms)
+{
+  window = window_ms;
+}
+
+int coalesce_is_enabled(void)
+{
+  return window > 0;
+}
+
+// Returns non-zero if a group could not be started. Without a transaction,
+// a failed change can't be undone without affecting the other requests in
+// the group, so coalescing is turned off if the storage doesn't support them.
+static int coalesce_begin(void)
+{
+  if (group_open)
+    return 0;
+
+  store_batch_start();
+  if (store_transaction_start()) {
+    store_batch_end();
+    redstore_info("Storage does not support transactions; writes will not be coalesced.");
+    window = 0;
+    return 1;
+  }
+
+  gettimeofday(&group_started, NULL);
+  group_statements = 0;
+  group_open = 1;
+
+  return 0;
+}
+
+// Sends the responses to all the waiting requests, or an error page instead
+static void coalesce_respond(const char *error)
+{
+  size_t i;
+
+  for (i = 0; i < waiting_count; i++) {
+    redhttp_response_t *response = responses[i];
+
+    if (error) {
+      redhttp_response_free(response);
+      response = redstore_page_new_with_message(
+        requests[i], LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "%s", error
+      );
+    }
+    redhttp_request_send_deferred(requests[i], response);
+  }
+
+  waiting_count = 0;
+  group_open = 0;
+}
+
+// Commits the open group, and then responds to the requests in it
+void coalesce_flush(void)
+{
+  int err = 0;
+
+  if (!group_open)
+    return;
+
+  if (store_transaction_commit())
+    err = 1;
+  if (store_batch_end())
+    err = 1;
+
+  redstore_debug("Committed %lu statements from %lu requests", group_statements,
+                 (unsigned long) waiting_count);
+
+  coalesce_respond(err ? "Failed to commit the changes." : NULL);
+}
+
+// Called when a change in the group could not be applied
+static const char *coalesce_abort(void)
+{
+  const char *message = "Failed to apply a group of changes. Some of the changes may have been applied.";
+
+  if (store_transaction_rollback() == 0)
+    message = "Failed to apply a group of changes. No changes were made.";
+  store_batch_end();
+
+  coalesce_respond(message);
+
+  return message;
+}
+
+// Called from the main loop
+void coalesce_tick(void)
+{
+  struct timeval now;
+  long elapsed;
+
+  if (!group_open)
+    return;
+
+  gettimeofday(&now, NULL);
+  elapsed = (now.tv_sec - group_started.tv_sec) * 1000 +
+      (now.tv_usec - group_started.tv_usec) / 1000;
+
+  if (elapsed >= window || group_statements >= COALESCE_MAX_STATEMENTS)
+    coalesce_flush();
+}
+
+static int coalesce_can_join(redhttp_request_t * request)
+{
+  const char *method = redhttp_request_get_method(request);
+  const char *path = redhttp_request_get_path(request);
+
+  if (strcmp(method, "POST") != 0)
+    return 0;
+
+  return strcmp(path, "/insert") == 0 || strcmp(path, "/delete") == 0 ||
+      strncmp(path, "/data", 5) == 0;
+}
+
+// Commits the open group before any request that can't be part of it
+redhttp_response_t *handle_coalesce(redhttp_request_t * request, void *user_data)
+{
+  if (group_open && !coalesce_can_join(request))
+    coalesce_flush();
+
+  return NULL;
+}
+
+static void free_statements(librdf_statement ** statements, size_t count)
+{
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    librdf_free_statement(statements[i]);
+  if (statements)
+    free(statements);
+}
+
+// Adds the statements in a stream to the open group, or removes them, and defers the response
+redhttp_response_t *coalesce_stream(redhttp_request_t * request, librdf_stream * stream,
+                                    librdf_node * graph, int remove)
+{
+  librdf_statement **statements = NULL;
+  redhttp_response_t *response = NULL;
+  redhttp_request_t **tmp_requests = NULL;
+  redhttp_response_t **tmp_responses = NULL;
+  size_t count = 0, size = 0, i;
+  unsigned long removed = 0;
+  const char *graph_str = "the default graph.";
+
+  // Handle the request on its own if a group can't be started
+  if (coalesce_begin()) {
+    if (remove)
+      return delete_stream_from_graph(request, stream, graph);
+    return load_stream_into_graph(request, stream, graph);
+  }
+
+  // Parse everything first, so that a syntax error doesn't affect the rest of the group
+  while (!librdf_stream_end(stream)) {
+    librdf_statement *statement = librdf_stream_get_object(stream);
+    if (count == size) {
+      librdf_statement **tmp;
+      size = size ? size * 2 : 64;
+      tmp = realloc(statements, size * sizeof(librdf_statement *));
+      if (!tmp) {
+        free_statements(statements, count);
+        return redstore_page_new_with_message(
+          request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Out of memory."
+        );
+      }
+      statements = tmp;
+    }
+    statements[count] = librdf_new_statement_from_statement(statement);
+    if (statements[count])
+      count++;
+    librdf_stream_next(stream);
+  }
+
+  if (graph && librdf_node_get_uri(graph))
+    graph_str = (const char *) librdf_uri_as_string(librdf_node_get_uri(graph));
+
+  if (error_buffer) {
+    free_statements(statements, count);
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_INTERNAL_SERVER_ERROR,
+      "Error while %s triples. No changes were made.", remove ? "deleting" : "adding"
+    );
+  }
+
+  // Make room for the request before changing anything
+  if (waiting_count == waiting_size) {
+    size_t new_size = waiting_size ? waiting_size * 2 : 16;
+    tmp_requests = realloc(requests, new_size * sizeof(redhttp_request_t *));
+    if (tmp_requests)
+      requests = tmp_requests;
+    tmp_responses = realloc(responses, new_size * sizeof(redhttp_response_t *));
+    if (tmp_responses)
+      responses = tmp_responses;
+    if (!tmp_requests || !tmp_responses) {
+      free_statements(statements, count);
+      return redstore_page_new_with_message(
+        request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Out of memory."
+      );
+    }
+    waiting_size = new_size;
+  }
+
+  // Commit the requests already waiting if these would take the group over its limit
+  if (group_statements > 0 && group_statements + count > COALESCE_MAX_STATEMENTS)
+    coalesce_flush();
+  if (coalesce_begin()) {
+    free_statements(statements, count);
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
+      "Failed to start a transaction. No changes were made."
+    );
+  }
+
+  for (i = 0; i < count; i++) {
+    if (remove) {
+      if (store_remove_statement(graph, statements[i]) == 0)
+        removed++;
+    } else if (store_add_statement(graph, statements[i]) < 0) {
+      free_statements(statements, count);
+      return redstore_page_new_with_message(
+        request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "%s", coalesce_abort()
+      );
+    }
+  }
+  free_statements(statements, count);
+  group_statements += count;
+
+  // This is the response that is sent once the group has been committed
+  if (!remove) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_OK, "Successfully added triples to: %s", graph_str
+    );
+  } else if (removed > 0) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_OK, "Successfully deleted %lu triples.", removed
+    );
+  } else {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_OK, "No triples deleted."
+    );
+  }
+
+  requests[waiting_count] = request;
+  responses[waiting_count] = response;
+  waiting_count++;
+
+  return redhttp_request_defer(request);
+}
+
+void coalesce_free(void)
+{
+  coalesce_flush();
+
+  if (requests)
+    free(requests);
+  requests = NULL;
+  if (responses)
+    free(responses);
+  responses = NULL;
+  waiting_size = 0;
+}
@@ -118,59 +118,7 @@ CLEANUP:
 
 static redhttp_response_t *remove_all_statements(redhttp_request_t *request)
 {
-  librdf_iterator *iterator = NULL;
-  librdf_stream *stream = NULL;
-  int err = 0;
-
-  // FIXME: re-implement using librdf_model_remove_statements()
-
-  // First:  delete all the named graphs
-  iterator = librdf_storage_get_contexts(storage);
-  if (!iterator) {
-    return redstore_page_new_with_message(
-      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to get list of graphs."
-    );
-  }
-
-  while (!librdf_iterator_end(iterator)) {
-    librdf_node *graph = (librdf_node *) librdf_iterator_get_object(iterator);
-    if (!graph) {
-      redstore_error("librdf_iterator_get_next returned NULL");
-      break;
-    }
-
-    if (librdf_model_context_remove_statements(model, graph))
-      err++;
-
-    librdf_iterator_next(iterator);
-  }
-  librdf_free_iterator(iterator);
-
-
-  // Second: delete the remaining triples
-  stream = librdf_model_as_stream(model);
-  if (!stream) {
-    return redstore_page_new_with_message(
-      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
-      "Failed to stream model."
-    );
-  }
-
-  while (!librdf_stream_end(stream)) {
-    librdf_statement *statement = (librdf_statement *) librdf_stream_get_object(stream);
-    if (!statement) {
-      redstore_error("librdf_stream_next returned NULL in remove_all_statements()");
-      break;
-    }
-
-    if (librdf_model_remove_statement(model, statement))
-      err++;
-
-    librdf_stream_next(stream);
-  }
-  librdf_free_stream(stream);
-
-  if (err || error_buffer) {
+  if (store_remove_all() || error_buffer) {
     return redstore_page_new_with_message(
       request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Error deleting some statements."
     );
@@ -196,7 +144,7 @@ static redhttp_response_t *post_to_new_graph(redhttp_request_t * request)
       );
     }
 
-    if (!librdf_model_contains_context(model, graph_node)) {
+    if (!stats_lookup_graph(graph_node)) {
       break;
     } else {
       librdf_uri *graph_uri = librdf_node_get_uri(graph_node);
@@ -244,6 +192,8 @@ redhttp_response_t *handle_data_head(redhttp_request_t * request, void *user_dat
 
   if (has_default) {
     response = redhttp_response_new(REDHTTP_OK, NULL);
+    if (response)
+      redhttp_response_add_time_header(response, "Last-Modified", stats_get_modified(NULL));
   } else {
     librdf_node *graph_node = get_graph_node(request);
 
@@ -253,8 +203,10 @@ redhttp_response_t *handle_data_head(redhttp_request_t * request, void *user_dat
       );
     }
 
-    if (librdf_model_contains_context(model, graph_node)) {
+    if (stats_lookup_graph(graph_node)) {
       response = redhttp_response_new(REDHTTP_OK, NULL);
+      if (response)
+        redhttp_response_add_time_header(response, "Last-Modified", stats_get_modified(graph_node));
     } else {
       response = redstore_page_new_with_message(
         request, LIBRDF_LOG_INFO, REDHTTP_NOT_FOUND, "Graph not found."
@@ -308,7 +260,7 @@ redhttp_response_t *handle_data_get(redhttp_request_t * request, void *user_data
     }
 
     // Check if the graph exists
-    if (!librdf_model_contains_context(model, graph_node)) {
+    if (!stats_lookup_graph(graph_node)) {
       response = redstore_page_new_with_message(request,
         LIBRDF_LOG_INFO, REDHTTP_NOT_FOUND, "Graph not found."
       );
@@ -325,7 +277,10 @@ redhttp_response_t *handle_data_get(redhttp_request_t * request, void *user_data
     }
   }
 
-  response = format_graph_stream(request, stream);
+  response = redhttp_response_new(REDHTTP_OK, NULL);
+  if (response)
+    redhttp_response_add_time_header(response, "Last-Modified", stats_get_modified(graph_node));
+  response = format_graph_stream_with_response(request, stream, response);
 
 CLEANUP:
   if (stream)
@@ -350,7 +305,9 @@ redhttp_response_t *handle_data_post(redhttp_request_t * request, void *user_dat
     );
   }
 
-  if (has_default) {
+  if (has_default && jobs_requested(request)) {
+    response = jobs_load_request_body(request, NULL);
+  } else if (has_default) {
     response = parse_data_from_request_body(request, NULL, load_stream_into_graph);
   } else if (has_graph || has_path) {
     librdf_node *graph_node = get_graph_node(request);
@@ -360,7 +317,11 @@ redhttp_response_t *handle_data_post(redhttp_request_t * request, void *user_dat
       );
     }
 
-    response = parse_data_from_request_body(request, graph_node, load_stream_into_graph);
+    if (jobs_requested(request)) {
+      response = jobs_load_request_body(request, graph_node);
+    } else {
+      response = parse_data_from_request_body(request, graph_node, load_stream_into_graph);
+    }
 
     librdf_free_node(graph_node);
   } else {
@@ -443,14 +404,14 @@ redhttp_response_t *handle_data_delete(redhttp_request_t * request, void *user_d
     }
 
     // Check if the graph exists
-    if (!librdf_model_contains_context(model, graph_node)) {
+    if (!stats_lookup_graph(graph_node)) {
       librdf_free_node(graph_node);
       return redstore_page_new_with_message(
         request, LIBRDF_LOG_INFO, REDHTTP_NOT_FOUND, "Graph not found."
       );
     }
 
-    if (librdf_model_context_remove_statements(model, graph_node)) {
+    if (store_remove_graph(graph_node)) {
       response = redstore_page_new_with_message(
         request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
         "Error while trying to delete graph"
@@ -0,0 +1,307 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "redstore.h"
+
+
+// Datasets: stores other than the default one, each with its own storage,
+// served under /ds/<name>/ by the same server. Requests are handled one at
+// a time, so the dataset that a request is for is swapped into the globals
+// (storage, model and the statement counts) before it is handled, and the
+// path is rewritten so that the usual handlers serve it.
+//
+// The write-ahead log, the change feed, following and background jobs only
+// work with the default dataset, which is the one in use between requests.
+
+typedef struct dataset_s {
+  char *name;
+  const char *storage_name;
+  const char *storage_type;
+  const char *storage_options;
+  char *public_storage_options;
+  librdf_storage *storage;
+  librdf_model *model;
+  stats_state_t *stats;
+} dataset_t;
+
+static dataset_t datasets[DATASETS_MAX];
+static int dataset_count = 0;
+
+// Holds the default dataset while another one is in use
+static dataset_t default_dataset;
+
+// The dataset in use; NULL for the default one
+static dataset_t *selected = NULL;
+
+
+static int dataset_name_is_valid(const char *name, size_t len)
+{
+  size_t i;
+
+  if (len == 0)
+    return 0;
+
+  for (i = 0; i < len; i++) {
+    if (!isalnum((unsigned char) name[i]) && name[i] != '-' && name[i] != '_')
+      return 0;
+  }
+
+  return 1;
+}
+
+static dataset_t *dataset_find(const char *name, size_t len)
+{
+  int i;
+
+  for (i = 0; i < dataset_count; i++) {
+    if (strlen(datasets[i].name) == len && strncmp(datasets[i].name, name, len) == 0)
+      return &datasets[i];
+  }
+
+  return NULL;
+}
+
+// Parses a dataset given on the command line as <name>:<type>[:<options>]
+int datasets_add(const char *spec)
+{
+  const char *colon = strchr(spec, ':');
+  dataset_t *dataset = NULL;
+  char *type = NULL;
+
+  if (!colon || !dataset_name_is_valid(spec, colon - spec)) {
+    redstore_error("Datasets must be given as <name>:<type>[:<options>]: %s", spec);
+    return 1;
+  }
+
+  if (dataset_count >= DATASETS_MAX) {
+    redstore_error("There can't be more than %d datasets.", DATASETS_MAX);
+    return 1;
+  }
+
+  if (dataset_find(spec, colon - spec)) {
+    redstore_error("There is already a dataset called: %.*s", (int) (colon - spec), spec);
+    return 1;
+  }
+
+  dataset = &datasets[dataset_count];
+  memset(dataset, 0, sizeof(dataset_t));
+  dataset->name = malloc(strlen(spec) + 1);
+  if (!dataset->name)
+    return 1;
+
+  // The name, type and options are kept in one string, split at the colons
+  strcpy(dataset->name, spec);
+  type = dataset->name + (colon - spec);
+  *type++ = '\0';
+  dataset->storage_name = dataset->name;
+  dataset->storage_type = type;
+  dataset->storage_options = "";
+
+  colon = strchr(type, ':');
+  if (colon) {
+    dataset->storage_options = colon + 1;
+    type[colon - type] = '\0';
+  }
+
+  dataset_count++;
+
+  return 0;
+}
+
+int datasets_get_count(void)
+{
+  return dataset_count;
+}
+
+static void dataset_save(dataset_t * dataset)
+{
+  dataset->storage_name = storage_name;
+  dataset->storage_type = storage_type;
+  dataset->storage_options = storage_options;
+  dataset->public_storage_options = public_storage_options;
+  dataset->storage = storage;
+  dataset->model = model;
+  stats_swap(dataset->stats);
+}
+
+static void dataset_restore(dataset_t * dataset)
+{
+  storage_name = dataset->storage_name;
+  storage_type = dataset->storage_type;
+  storage_options = dataset->storage_options;
+  public_storage_options = dataset->public_storage_options;
+  storage = dataset->storage;
+  model = dataset->model;
+  stats_swap(dataset->stats);
+}
+
+// Makes a dataset the one in use; NULL for the default dataset
+static void dataset_select(dataset_t * dataset)
+{
+  if (dataset == selected)
+    return;
+
+  // A group of writes must be committed to the dataset that it was for
+  coalesce_flush();
+
+  dataset_save(selected ? selected : &default_dataset);
+  dataset_restore(dataset ? dataset : &default_dataset);
+  store_set_logging(dataset == NULL);
+  selected = dataset;
+}
+
+int datasets_is_default(void)
+{
+  return selected == NULL;
+}
+
+int datasets_init(void)
+{
+  int i;
+
+  if (dataset_count == 0)
+    return 0;
+
+  default_dataset.stats = stats_state_new();
+  if (!default_dataset.stats)
+    return 1;
+
+  for (i = 0; i < dataset_count; i++) {
+    dataset_t *dataset = &datasets[i];
+    librdf_storage *new_storage = NULL;
+    char *public_options = NULL;
+    int err = 0;
+
+    dataset->stats = stats_state_new();
+    if (!dataset->stats)
+      return 1;
+
+    redstore_info("Opening dataset: %s", dataset->name);
+    new_storage = redstore_setup_storage(dataset->storage_name, dataset->storage_type,
+                                         dataset->storage_options, 0, &public_options);
+    if (!new_storage)
+      return 1;
+
+    dataset_select(dataset);
+    storage = new_storage;
+    public_storage_options = public_options;
+    model = librdf_new_model(world, storage, NULL);
+    if (!model) {
+      redstore_error("Failed to create librdf model for dataset: %s", dataset->name);
+      err = 1;
+    } else if (stats_init()) {
+      err = 1;
+    }
+    dataset_select(NULL);
+
+    if (err)
+      return 1;
+  }
+
+  return 0;
+}
+
+// Called before each request: makes the dataset that it is for the one in use
+redhttp_response_t *handle_datasets(redhttp_request_t * request, void *user_data)
+{
+  const char *path = redhttp_request_get_path(request);
+  dataset_t *dataset = NULL;
+  const char *name = NULL;
+  const char *rest = NULL;
+  char *new_path = NULL;
+
+  if (dataset_count == 0)
+    return NULL;
+
+  if (strncmp(path, "/ds/", 4) != 0) {
+    dataset_select(NULL);
+    return NULL;
+  }
+
+  name = path + 4;
+  rest = strchr(name, '/');
+  if (!rest)
+    rest = name + strlen(name);
+
+  dataset = dataset_find(name, rest - name);
+  if (!dataset) {
+    dataset_select(NULL);
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_NOT_FOUND, "Unknown dataset."
+    );
+  }
+
+  // The request's URL is left as it is, so graphs are named after the dataset's paths
+  new_path = malloc(strlen(rest) + 2);
+  if (!new_path) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Out of memory."
+    );
+  }
+  strcpy(new_path, *rest ? rest : "/");
+  redhttp_request_set_path(request, new_path);
+  free(new_path);
+
+  dataset_select(dataset);
+
+  return NULL;
+}
+
+// Called from the main loop: everything done between requests is for the default dataset
+void datasets_tick(void)
+{
+  dataset_select(NULL);
+}
+
+void datasets_free(void)
+{
+  int i;
+
+  for (i = 0; i < dataset_count; i++) {
+    dataset_t *dataset = &datasets[i];
+
+    if (dataset->stats) {
+      dataset_select(dataset);
+      stats_free();
+      if (model)
+        librdf_free_model(model);
+      if (storage)
+        librdf_free_storage(storage);
+      if (public_storage_options)
+        free(public_storage_options);
+      model = NULL;
+      storage = NULL;
+      public_storage_options = NULL;
+      dataset_select(NULL);
+      free(dataset->stats);
+    }
+    free(dataset->name);
+  }
+  dataset_count = 0;
+
+  if (default_dataset.stats)
+    free(default_dataset.stats);
+  default_dataset.stats = NULL;
+}
@@ -21,7 +21,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 
 #include "redstore.h"
 
@@ -31,31 +30,6 @@ librdf_uri *format_ns_uri = NULL;
 librdf_uri *sd_ns_uri = NULL;
 librdf_uri *void_ns_uri = NULL;
 
-static librdf_node *new_node_from_integer(librdf_world * world, int i)
-{
-  librdf_uri *xsd_integer_uri = NULL;
-  librdf_node *node = NULL;
-  unsigned char *string = NULL;
-
-#define INTEGER_BUFFER_SIZE 20
-  string = (unsigned char *) malloc(INTEGER_BUFFER_SIZE + 1);
-  if (!string)
-    return NULL;
-
-  // snprintf() takes as length the buffer size including NULL
-  snprintf((char *) string, INTEGER_BUFFER_SIZE + 1, "%d", i);
-
-  xsd_integer_uri =
-      librdf_new_uri(world, (unsigned char *) "http://www.w3.org/2001/XMLSchema#integer");
-
-  node = librdf_new_node_from_typed_literal(world, string, NULL, xsd_integer_uri);
-
-  if (xsd_integer_uri)
-    librdf_free_uri(xsd_integer_uri);
-
-  return node;
-}
-
 static librdf_node* sd_get_endpoint_node(const char * request_url_str)
 {
   librdf_uri *request_uri = NULL, *endpoint_uri = NULL;
@@ -89,30 +63,6 @@ CLEANUP:
 }
 
 
-static int context_count(librdf_storage * storage)
-{
-  librdf_iterator *iterator = NULL;
-  int count = 0;
-
-  assert(storage != NULL);
-
-  iterator = librdf_storage_get_contexts(storage);
-  if (!iterator) {
-    redstore_error("librdf_storage_get_contexts returned NULL");
-    return -1;
-  }
-
-  while (!librdf_iterator_end(iterator)) {
-    count++;
-    librdf_iterator_next(iterator);
-  }
-
-  librdf_free_iterator(iterator);
-
-  return count;
-}
-
-
 static int sd_add_format_descriptions(librdf_model *sd_model, librdf_node *service_node, description_proc_t desc_proc, const char *type)
 {
   librdf_node *format_node = NULL;
@@ -227,6 +177,9 @@ static int sd_add_query_languages(librdf_model *sd_model, librdf_node *service_n
       } else if (strcmp(desc->names[n], "sparql11-query")==0) {
         lang_node = librdf_new_node_from_uri_local_name(world, sd_ns_uri, (unsigned char *) "SPARQL11Query");
         break;
+      } else if (strcmp(desc->names[n], "sparql11-update")==0) {
+        lang_node = librdf_new_node_from_uri_local_name(world, sd_ns_uri, (unsigned char *) "SPARQL11Update");
+        break;
       }
     }
 
@@ -264,7 +217,7 @@ static int sd_add_query_languages(librdf_model *sd_model, librdf_node *service_n
 static int sd_add_dataset_description(librdf_model *sd_model, librdf_node *service_node)
 {
   librdf_node *dataset_node = NULL, *default_graph_node = NULL;
-  int triple_count = librdf_storage_size(storage);
+  unsigned long triple_count = stats_get_total();
 
   dataset_node = librdf_new_node(world);
   if (!dataset_node) {
@@ -304,13 +257,11 @@ static int sd_add_dataset_description(librdf_model *sd_model, librdf_node *servi
                    librdf_new_node_from_uri_local_name(world, sd_ns_uri, (const unsigned char *) "Graph")
       );
 
-  if (triple_count>=0) {
-    librdf_model_add(sd_model,
-                     librdf_new_node_from_node(default_graph_node),
-                     librdf_new_node_from_uri_local_name(world, void_ns_uri, (const unsigned char *) "triples"),
-                     new_node_from_integer(world, triple_count)
-        );
-  }
+  librdf_model_add(sd_model,
+                   librdf_new_node_from_node(default_graph_node),
+                   librdf_new_node_from_uri_local_name(world, void_ns_uri, (const unsigned char *) "triples"),
+                   redstore_new_node_from_integer(triple_count)
+      );
 
   if (dataset_node)
     librdf_free_node(dataset_node);
@@ -463,11 +414,11 @@ static redhttp_response_t *handle_html_description(redhttp_request_t * request,
   redstore_page_append_strings(response, "<tr><th>Storage Options</th><td>", public_storage_options, "</td></tr>\n", NULL);
 
   redstore_page_append_string(response, "<tr><th>Triple Count</th><td>");
-  redstore_page_append_decimal(response, librdf_storage_size(storage));
+  redstore_page_append_decimal(response, stats_get_total());
   redstore_page_append_string(response, "</td></tr>\n");
 
   redstore_page_append_string(response, "<tr><th>Named Graph Count</th><td>");
-  redstore_page_append_decimal(response, context_count(storage));
+  redstore_page_append_decimal(response, stats_get_graph_count());
   redstore_page_append_string(response, "</td></tr>\n");
 
   redstore_page_append_string(response, "<tr><th>HTTP Request Count</th><td>");
@@ -481,6 +432,27 @@ static redhttp_response_t *handle_html_description(redhttp_request_t * request,
   redstore_page_append_string(response, "<tr><th>SPARQL Query Count</th><td>");
   redstore_page_append_decimal(response, query_count);
   redstore_page_append_string(response, "</td></tr>\n");
+
+  if (follower_is_enabled()) {
+    long lag = follower_get_lag();
+
+    redstore_page_append_string(response, "<tr><th>Following</th><td>");
+    redstore_page_append_escaped(response, follower_get_primary(), 0);
+    redstore_page_append_string(response, "</td></tr>\n");
+
+    redstore_page_append_string(response, "<tr><th>Last Change Applied</th><td>");
+    redstore_page_append_decimal(response, (int) follower_get_sequence());
+    redstore_page_append_string(response, "</td></tr>\n");
+
+    redstore_page_append_string(response, "<tr><th>Replication Lag</th><td>");
+    if (lag < 0) {
+      redstore_page_append_string(response, "Not caught up yet");
+    } else {
+      redstore_page_append_decimal(response, (int) lag);
+      redstore_page_append_string(response, " seconds");
+    }
+    redstore_page_append_string(response, "</td></tr>\n");
+  }
   redstore_page_append_string(response, "</table>\n");
 
   description_html_table("Query Languages", librdf_query_language_get_description, response);
@@ -0,0 +1,217 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "redstore.h"
+
+
+// Replaces the contents of a graph by applying only the differences
+// between the old and new contents. The new statements are read into a
+// hash table, and each statement already in the graph is looked up in it:
+// those that aren't there are deleted, and the new statements that were
+// never matched are added. Statements that are in both are not touched.
+
+typedef struct diff_entry_s {
+  librdf_statement *statement;
+  uint64_t hash;
+  int matched;
+} diff_entry_t;
+
+typedef struct diff_set_s {
+  diff_entry_t *entries;
+  size_t size;
+  size_t count;
+} diff_set_t;
+
+
+// Returns the entry for a statement, or the empty entry where it would go
+static diff_entry_t *diff_set_find(diff_set_t * set, librdf_statement * statement, uint64_t hash)
+{
+  size_t mask = set->size - 1;
+  size_t i = (size_t) hash & mask;
+
+  while (set->entries[i].statement) {
+    diff_entry_t *entry = &set->entries[i];
+    if (entry->hash == hash && librdf_statement_equals(entry->statement, statement))
+      return entry;
+    i = (i + 1) & mask;
+  }
+
+  return &set->entries[i];
+}
+
+static int diff_set_grow(diff_set_t * set)
+{
+  diff_entry_t *old = set->entries;
+  size_t old_size = set->size, i;
+
+  set->size = old_size ? old_size * 2 : 1024;
+  set->entries = calloc(set->size, sizeof(diff_entry_t));
+  if (!set->entries) {
+    set->entries = old;
+    set->size = old_size;
+    return 1;
+  }
+
+  for (i = 0; i < old_size; i++) {
+    if (old[i].statement)
+      *diff_set_find(set, old[i].statement, old[i].hash) = old[i];
+  }
+  if (old)
+    free(old);
+
+  return 0;
+}
+
+// Returns non-zero if the statement could not be added
+static int diff_set_add(diff_set_t * set, librdf_statement * statement)
+{
+  uint64_t hash = redstore_statement_hash(statement);
+  diff_entry_t *entry = NULL;
+
+  // Keep the table at most half full
+  if ((set->count + 1) * 2 > set->size && diff_set_grow(set))
+    return 1;
+
+  entry = diff_set_find(set, statement, hash);
+  if (entry->statement)
+    return 0;
+
+  entry->statement = librdf_new_statement_from_statement(statement);
+  if (!entry->statement)
+    return 1;
+  entry->hash = hash;
+  set->count++;
+
+  return 0;
+}
+
+static void diff_set_free(diff_set_t * set)
+{
+  size_t i;
+
+  for (i = 0; i < set->size; i++) {
+    if (set->entries[i].statement)
+      librdf_free_statement(set->entries[i].statement);
+  }
+  if (set->entries)
+    free(set->entries);
+}
+
+static void free_statements(librdf_statement ** statements, size_t count)
+{
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    librdf_free_statement(statements[i]);
+  if (statements)
+    free(statements);
+}
+
+// Makes the named graph contain exactly the statements in the stream.
+// Returns 0 on success, >0 if the stream could not be read, in which case
+// nothing was changed, and <0 if the graph could not be changed.
+int diff_replace_graph(librdf_node * graph, librdf_stream * stream,
+                       unsigned long *added, unsigned long *removed)
+{
+  librdf_statement **old = NULL;
+  librdf_stream *stored = NULL;
+  diff_set_t set;
+  size_t old_count = 0, old_size = 0, i;
+  int err = 1;
+
+  memset(&set, 0, sizeof(set));
+  *added = 0;
+  *removed = 0;
+
+  while (!librdf_stream_end(stream)) {
+    if (diff_set_add(&set, librdf_stream_get_object(stream)))
+      goto CLEANUP;
+    librdf_stream_next(stream);
+  }
+  if (error_buffer)
+    goto CLEANUP;
+
+  // Find the statements that are only in the old graph
+  stored = librdf_model_context_as_stream(model, graph);
+  if (!stored)
+    goto CLEANUP;
+  while (!librdf_stream_end(stored)) {
+    librdf_statement *statement = librdf_stream_get_object(stored);
+    diff_entry_t *entry = NULL;
+
+    if (set.size) {
+      entry = diff_set_find(&set, statement, redstore_statement_hash(statement));
+      if (entry->statement) {
+        entry->matched = 1;
+        librdf_stream_next(stored);
+        continue;
+      }
+    }
+
+    if (old_count == old_size) {
+      librdf_statement **tmp;
+      old_size = old_size ? old_size * 2 : 64;
+      tmp = realloc(old, old_size * sizeof(librdf_statement *));
+      if (!tmp)
+        goto CLEANUP;
+      old = tmp;
+    }
+    old[old_count] = librdf_new_statement_from_statement(statement);
+    if (!old[old_count])
+      goto CLEANUP;
+    old_count++;
+    librdf_stream_next(stored);
+  }
+  librdf_free_stream(stored);
+  stored = NULL;
+
+  // Nothing has been changed up to this point
+  err = -1;
+
+  for (i = 0; i < old_count; i++) {
+    if (store_remove_statement(graph, old[i]) == 0)
+      (*removed)++;
+  }
+
+  for (i = 0; i < set.size; i++) {
+    diff_entry_t *entry = &set.entries[i];
+    if (!entry->statement || entry->matched)
+      continue;
+    if (store_add_statement(graph, entry->statement) < 0)
+      goto CLEANUP;
+    (*added)++;
+  }
+
+  redstore_debug("Replaced graph: %lu statements added, %lu removed and %lu unchanged",
+                 *added, *removed, (unsigned long) set.count - *added);
+  err = 0;
+
+CLEANUP:
+  if (stored)
+    librdf_free_stream(stored);
+  free_statements(old, old_count);
+  diff_set_free(&set);
+
+  return err;
+}
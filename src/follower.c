@@ -0,0 +1,641 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+
+#include "redstore.h"
+
+
+// Follower mode: the store is kept as a read-only copy of another
+// RedStore (the primary) by following the primary's change feed.
+//
+// A new follower first asks where the primary's feed is up to, then
+// copies the primary's whole store, then asks for the changes since
+// that position and applies them, over and over. The copy may already
+// contain some of those changes, but applying an add or a delete a
+// second time doesn't make any difference, as long as they are applied
+// in order.
+//
+// Requests to the primary are made without blocking, from the main
+// loop, so that the follower keeps answering queries while it waits.
+
+typedef enum {
+  FOLLOWER_POSITION = 0,        // Ask where the primary's change feed is up to
+  FOLLOWER_COPY,                // Copy the primary's whole store
+  FOLLOWER_CHANGES              // Wait for the changes after the last one applied
+} follower_step_t;
+
+// The primary's URL, and the parts of it needed to make requests
+static char *primary = NULL;
+static char *host = NULL;
+static char *port = NULL;
+static char *base_path = NULL;
+
+// File that the position is saved in, so that it can carry on after a restart
+static const char *state_filename = NULL;
+
+// Position in the primary's change feed of the last change applied; epoch 0 for none
+static unsigned long epoch = 0;
+static unsigned long sequence = 0;
+
+// Where the primary's feed was up to before its store was copied
+static unsigned long copy_epoch = 0;
+static unsigned long copy_sequence = 0;
+
+static follower_step_t step = FOLLOWER_POSITION;
+
+// The request that is in progress
+static struct addrinfo *addresses = NULL;
+static struct addrinfo *address = NULL;
+static int sock = -1;
+static int connected = 0;
+static time_t deadline = 0;
+static int request_timeout = 0;
+static char *request_text = NULL;
+static size_t request_len = 0;
+static size_t request_sent = 0;
+static char *buffer = NULL;
+static size_t buffer_len = 0;
+static size_t buffer_size = 0;
+
+// When to try again after something went wrong
+static time_t next_attempt = 0;
+
+// Set while the store has every change that the primary has; otherwise,
+// synced is when it last did
+static int in_sync = 0;
+static time_t synced = 0;
+
+
+static char *copy_string(const char *start, size_t len)
+{
+  char *str = malloc(len + 1);
+  if (str) {
+    memcpy(str, start, len);
+    str[len] = '\0';
+  }
+  return str;
+}
+
+// Splits a URL like http://host:port/path/ into its parts
+static int follower_parse_url(const char *url)
+{
+  const char *start = NULL, *end = NULL, *path = NULL;
+  size_t path_len;
+
+  if (strncmp(url, "http://", 7) != 0)
+    return 1;
+
+  start = url + 7;
+  path = strchr(start, '/');
+  if (!path)
+    path = start + strlen(start);
+
+  if (*start == '[') {
+    end = memchr(start, ']', path - start);
+    if (!end)
+      return 1;
+    host = copy_string(start + 1, end - start - 1);
+    end++;
+  } else {
+    end = memchr(start, ':', path - start);
+    if (!end)
+      end = path;
+    host = copy_string(start, end - start);
+  }
+
+  if (*end == ':') {
+    port = copy_string(end + 1, path - end - 1);
+  } else if (end == path) {
+    port = copy_string("80", 2);
+  } else {
+    return 1;
+  }
+
+  // The paths of the primary's endpoints are relative to a directory
+  path_len = strlen(path);
+  base_path = malloc(path_len + 2);
+  if (base_path) {
+    strcpy(base_path, path);
+    if (path_len == 0 || path[path_len - 1] != '/')
+      strcat(base_path, "/");
+  }
+
+  return !host || !port || !base_path || host[0] == '\0' || port[0] == '\0';
+}
+
+static void follower_load_state(void)
+{
+  FILE *file = NULL;
+
+  if (!state_filename)
+    return;
+
+  file = fopen(state_filename, "r");
+  if (!file)
+    return;
+
+  if (fscanf(file, "%lu %lu", &epoch, &sequence) != 2) {
+    redstore_warn("Ignoring invalid follower position in: %s", state_filename);
+    epoch = sequence = 0;
+  }
+  fclose(file);
+}
+
+// Writes the position to another file first, so that a crash can't leave half of it
+static int follower_save_state(void)
+{
+  char *tmp_filename = NULL;
+  FILE *file = NULL;
+  int err = 1;
+
+  if (!state_filename)
+    return 0;
+
+  tmp_filename = malloc(strlen(state_filename) + 5);
+  if (!tmp_filename)
+    goto CLEANUP;
+  sprintf(tmp_filename, "%s.new", state_filename);
+
+  file = fopen(tmp_filename, "w");
+  if (!file)
+    goto CLEANUP;
+
+  if (fprintf(file, "%lu %lu\n", epoch, sequence) < 0 || fflush(file) || fsync(fileno(file)))
+    goto CLEANUP;
+
+  if (fclose(file) == 0) {
+    file = NULL;
+    err = rename(tmp_filename, state_filename);
+  }
+
+CLEANUP:
+  if (file)
+    fclose(file);
+  if (err) {
+    redstore_error("Failed to save follower position to: %s", state_filename);
+    if (tmp_filename)
+      unlink(tmp_filename);
+  }
+  if (tmp_filename)
+    free(tmp_filename);
+
+  return err;
+}
+
+int follower_init(const char *url, const char *filename)
+{
+  if (!url)
+    return 0;
+
+  if (follower_parse_url(url)) {
+    redstore_error("Can only follow a primary with an http:// URL: %s", url);
+    return 1;
+  }
+
+  primary = copy_string(url, strlen(url));
+  if (!primary)
+    return 1;
+
+  state_filename = filename;
+  follower_load_state();
+
+  // An empty store can't have anything from the primary, wherever the file says it was up to
+  if (epoch && stats_get_total() == 0) {
+    redstore_info("Store is empty; ignoring the saved follower position.");
+    epoch = sequence = 0;
+  }
+
+  if (epoch) {
+    redstore_info("Following %s from change %lu of epoch %lu", primary, sequence, epoch);
+    step = FOLLOWER_CHANGES;
+  } else {
+    redstore_info("Following %s, starting with a copy of its store", primary);
+    step = FOLLOWER_POSITION;
+  }
+
+  return 0;
+}
+
+int follower_is_enabled(void)
+{
+  return primary != NULL;
+}
+
+// Stops the request that is in progress
+static void follower_close(void)
+{
+  if (sock >= 0)
+    close(sock);
+  sock = -1;
+  connected = 0;
+
+  if (addresses)
+    freeaddrinfo(addresses);
+  addresses = address = NULL;
+
+  if (request_text)
+    free(request_text);
+  request_text = NULL;
+  request_len = request_sent = 0;
+  buffer_len = 0;
+}
+
+static void follower_fail(const char *message)
+{
+  redstore_error("Failed to follow %s: %s", primary, message);
+  follower_close();
+
+  if (in_sync)
+    synced = time(NULL);
+  in_sync = 0;
+  next_attempt = time(NULL) + FOLLOWER_RETRY_INTERVAL;
+}
+
+// Starts connecting to the next of the primary's addresses
+static int follower_connect(void)
+{
+  while (address) {
+    sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (sock >= 0) {
+      if (fcntl(sock, F_SETFL, O_NONBLOCK) == 0 &&
+          (connect(sock, address->ai_addr, address->ai_addrlen) == 0 || errno == EINPROGRESS))
+        return 0;
+      close(sock);
+      sock = -1;
+    }
+    address = address->ai_next;
+  }
+
+  return 1;
+}
+
+static void follower_start(void)
+{
+  struct addrinfo hints;
+  const char *path = "changes";
+  char query[128] = "";
+  size_t len;
+  int timeout = 0;
+
+  follower_close();
+
+  if (step == FOLLOWER_COPY) {
+    path = "data?default&format=nquads";
+  } else if (step == FOLLOWER_CHANGES) {
+    timeout = CHANGES_POLL_TIMEOUT;
+    snprintf(query, sizeof(query), "?since=%lu&epoch=%lu&timeout=%d", sequence, epoch, timeout);
+  }
+
+  len = strlen(base_path) + strlen(path) + strlen(query) + strlen(host) + strlen(port) + 64;
+  request_text = malloc(len);
+  if (!request_text) {
+    follower_fail("Out of memory");
+    return;
+  }
+  request_len = snprintf(request_text, len, "GET %s%s%s HTTP/1.0\r\n", base_path, path, query);
+  request_len += snprintf(request_text + request_len, len - request_len,
+                          strchr(host, ':') ? "Host: [%s]:%s\r\n" : "Host: %s:%s\r\n", host, port);
+  request_len += snprintf(request_text + request_len, len - request_len, "Accept: */*\r\n\r\n");
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &addresses)) {
+    addresses = NULL;
+    follower_fail("Failed to look up the primary's address");
+    return;
+  }
+
+  address = addresses;
+  if (follower_connect()) {
+    follower_fail(strerror(errno));
+    return;
+  }
+
+  // Give up on a primary that has stopped answering
+  request_timeout = timeout + FOLLOWER_RETRY_INTERVAL;
+  deadline = time(NULL) + request_timeout;
+}
+
+// Reads the position from the headers at the start of the primary's change feed
+static int follower_read_position(const char *body, unsigned long *e, unsigned long *s)
+{
+  return sscanf(body, "H epoch \"%lu\" .\nH sequence \"%lu\" .", e, s) != 2;
+}
+
+// Replaces the contents of the store with a copy of the primary's
+static int follower_copy(const char *body, size_t len)
+{
+  librdf_parser *parser = NULL;
+  librdf_uri *base_uri = NULL;
+  librdf_stream *stream = NULL;
+  unsigned long count = 0;
+  int err = 1;
+
+  parser = librdf_new_parser(world, "nquads", NULL, NULL);
+  if (!parser) {
+    redstore_error("Failed to create N-Quads parser");
+    goto CLEANUP;
+  }
+
+  base_uri = librdf_new_uri(world, (unsigned char *) primary);
+  if (!base_uri)
+    goto CLEANUP;
+
+  // Forget the old position first, so that an interrupted copy is started again
+  epoch = sequence = 0;
+  follower_save_state();
+
+  if (store_remove_all())
+    goto CLEANUP;
+
+  if (error_buffer) {
+    raptor_free_stringbuffer(error_buffer);
+    error_buffer = NULL;
+  }
+
+  stream = librdf_parser_parse_counted_string_as_stream(parser, (unsigned char *) body,
+                                                        len, base_uri);
+  if (!stream)
+    goto CLEANUP;
+
+  store_batch_start();
+  while (!librdf_stream_end(stream)) {
+    librdf_statement *statement = librdf_stream_get_object(stream);
+    if (!statement ||
+        store_add_statement(librdf_stream_get_context2(stream), statement) < 0)
+      break;
+    count++;
+    librdf_stream_next(stream);
+  }
+  err = store_batch_end() || !librdf_stream_end(stream) ||
+      (error_buffer && raptor_stringbuffer_length(error_buffer) > 0);
+
+  if (!err)
+    redstore_info("Copied %lu triples from %s", count, primary);
+
+CLEANUP:
+  if (stream)
+    librdf_free_stream(stream);
+  if (base_uri)
+    librdf_free_uri(base_uri);
+  if (parser)
+    librdf_free_parser(parser);
+
+  return err;
+}
+
+// Applies the changes sent by the primary since the last ones
+static void follower_apply_changes(int status, char *body)
+{
+  unsigned long feed_epoch = 0, feed_sequence = 0;
+
+  if (status == REDHTTP_OK && follower_read_position(body, &feed_epoch, &feed_sequence)) {
+    follower_fail("Invalid response from the change feed");
+    return;
+  }
+
+  // The changes are no longer kept, or the primary has started again
+  if (status == REDHTTP_GONE || (status == REDHTTP_OK && feed_epoch != epoch)) {
+    redstore_info("Primary no longer has the changes since %lu; copying its store again.",
+                  sequence);
+    if (in_sync)
+      synced = time(NULL);
+    in_sync = 0;
+    epoch = sequence = 0;
+    step = FOLLOWER_POSITION;
+    follower_start();
+    return;
+  }
+
+  if (status != REDHTTP_OK) {
+    follower_fail("Change feed did not return OK");
+    return;
+  }
+
+  if (feed_sequence != sequence) {
+    if (patch_apply(body)) {
+      follower_fail("Failed to apply changes");
+      return;
+    }
+    redstore_debug("Applied changes %lu to %lu", sequence + 1, feed_sequence);
+    sequence = feed_sequence;
+    follower_save_state();
+  }
+
+  in_sync = 1;
+  follower_start();
+}
+
+static void follower_handle_response(void)
+{
+  char *body = NULL;
+  int status = 0;
+
+  buffer[buffer_len] = '\0';
+  body = strstr(buffer, "\r\n\r\n");
+  if (sscanf(buffer, "HTTP/%*d.%*d %d", &status) != 1 || !body) {
+    follower_fail("Invalid response");
+    return;
+  }
+  body += 4;
+
+  switch (step) {
+  case FOLLOWER_POSITION:
+    if (status != REDHTTP_OK || follower_read_position(body, &copy_epoch, &copy_sequence)) {
+      follower_fail("Failed to get the position of the change feed");
+      return;
+    }
+    step = FOLLOWER_COPY;
+    follower_start();
+    break;
+
+  case FOLLOWER_COPY:
+    if (status != REDHTTP_OK) {
+      step = FOLLOWER_POSITION;
+      follower_fail("Failed to download the store");
+      return;
+    }
+    if (follower_copy(body, buffer_len - (body - buffer))) {
+      step = FOLLOWER_POSITION;
+      follower_fail("Failed to copy the store");
+      return;
+    }
+    epoch = copy_epoch;
+    sequence = copy_sequence;
+    follower_save_state();
+    step = FOLLOWER_CHANGES;
+    follower_start();
+    break;
+
+  case FOLLOWER_CHANGES:
+    follower_apply_changes(status, body);
+    break;
+  }
+}
+
+// Called from the main loop: moves the request to the primary along as far as it can without waiting
+void follower_tick(void)
+{
+  if (!primary)
+    return;
+
+  if (sock < 0) {
+    if (time(NULL) >= next_attempt)
+      follower_start();
+    return;
+  }
+
+  if (time(NULL) > deadline) {
+    follower_fail("Timed out waiting for the primary");
+    return;
+  }
+
+  if (!connected) {
+    struct timeval timeout = { 0, 0 };
+    socklen_t len = sizeof(int);
+    fd_set wfd;
+    int err = 0;
+
+    FD_ZERO(&wfd);
+    FD_SET(sock, &wfd);
+    if (select(sock + 1, NULL, &wfd, NULL, &timeout) <= 0)
+      return;
+
+    // Try the next address if this one didn't work
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+      close(sock);
+      sock = -1;
+      address = address->ai_next;
+      if (follower_connect())
+        follower_fail(err ? strerror(err) : "Failed to connect");
+      return;
+    }
+    connected = 1;
+  }
+
+  while (request_sent < request_len) {
+    ssize_t sent = send(sock, request_text + request_sent, request_len - request_sent, 0);
+    if (sent < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        follower_fail(strerror(errno));
+      return;
+    }
+    request_sent += sent;
+  }
+
+  // The primary closes the connection at the end of the response
+  while (1) {
+    ssize_t got;
+
+    // Leave room for a terminating null
+    if (buffer_len + 1 >= buffer_size) {
+      size_t size = buffer_size ? buffer_size * 2 : 65536;
+      char *tmp = realloc(buffer, size);
+      if (!tmp) {
+        follower_fail("Out of memory");
+        return;
+      }
+      buffer = tmp;
+      buffer_size = size;
+    }
+
+    got = recv(sock, buffer + buffer_len, buffer_size - buffer_len - 1, 0);
+    if (got > 0) {
+      buffer_len += got;
+      deadline = time(NULL) + request_timeout;
+    } else if (got == 0) {
+      break;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return;
+    } else if (errno != EINTR) {
+      follower_fail(strerror(errno));
+      return;
+    }
+  }
+
+  close(sock);
+  sock = -1;
+  follower_handle_response();
+}
+
+// Stops clients from changing a store that is following another one
+redhttp_response_t *handle_follower(redhttp_request_t * request, void *user_data)
+{
+  if (!primary || redstore_classify_request(request, NULL) != ADMISSION_WRITE)
+    return NULL;
+
+  return redstore_page_new_with_message(
+    request, LIBRDF_LOG_INFO, REDHTTP_FORBIDDEN,
+    "This store is a read-only copy of %s; make changes there instead.", primary
+  );
+}
+
+const char *follower_get_primary(void)
+{
+  return primary;
+}
+
+unsigned long follower_get_sequence(void)
+{
+  return sequence;
+}
+
+// Returns the number of seconds that the store may be behind the primary, or -1 if it has never caught up
+long follower_get_lag(void)
+{
+  if (in_sync)
+    return 0;
+  if (!synced)
+    return -1;
+  return (long) (time(NULL) - synced);
+}
+
+void follower_free(void)
+{
+  follower_close();
+
+  if (buffer)
+    free(buffer);
+  buffer = NULL;
+  buffer_size = 0;
+
+  if (primary)
+    free(primary);
+  if (host)
+    free(host);
+  if (port)
+    free(port);
+  if (base_path)
+    free(base_path);
+  primary = host = port = base_path = NULL;
+}
@@ -26,15 +26,25 @@
 
 
 redhttp_response_t *format_graph_stream(redhttp_request_t * request, librdf_stream * stream)
+{
+  return format_graph_stream_with_response(request, stream, NULL);
+}
+
+// Serialise a stream, sending the headers of a prepared response first.
+// Takes ownership of response; a new one is created if it is NULL.
+redhttp_response_t *format_graph_stream_with_response(redhttp_request_t * request,
+                                                      librdf_stream * stream,
+                                                      redhttp_response_t * response)
 {
   FILE *socket = redhttp_request_get_socket(request);
   const raptor_syntax_description* desc = NULL;
-  redhttp_response_t *response = NULL;
   librdf_serializer *serialiser = NULL;
   const char* mime_type = NULL;
 
   desc = redstore_negotiate_format(request, librdf_serializer_get_description, DEFAULT_GRAPH_FORMAT, &mime_type);
   if (!desc) {
+    if (response)
+      redhttp_response_free(response);
     response = redstore_page_new_with_message(
       request, LIBRDF_LOG_INFO, REDHTTP_NOT_ACCEPTABLE,
       "Results format not supported for graph query type."
@@ -44,6 +54,8 @@ redhttp_response_t *format_graph_stream(redhttp_request_t * request, librdf_stre
 
   serialiser = librdf_new_serializer(world, desc->names[0], NULL, NULL);
   if (!serialiser) {
+    if (response)
+      redhttp_response_free(response);
     response = redstore_page_new_with_message(
       request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to create serialiser."
     );
@@ -57,7 +69,8 @@ redhttp_response_t *format_graph_stream(redhttp_request_t * request, librdf_stre
   librdf_serializer_set_namespace(serialiser, void_ns_uri, "void");
 
   // Send back the response headers
-  response = redhttp_response_new(REDHTTP_OK, NULL);
+  if (!response)
+    response = redhttp_response_new(REDHTTP_OK, NULL);
   if (mime_type)
     redhttp_response_add_header(response, "Content-Type", mime_type);
   redhttp_response_send(response, request);
@@ -133,3 +146,248 @@ CLEANUP:
 
   return response;
 }
+
+
+static void write_json_string(raptor_iostream * iostream, const char *str)
+{
+  raptor_iostream_write_byte('"', iostream);
+  for (; *str; str++) {
+    unsigned char c = (unsigned char) *str;
+    if (c == '"' || c == '\\') {
+      raptor_iostream_write_byte('\\', iostream);
+      raptor_iostream_write_byte(c, iostream);
+    } else if (c == '\n') {
+      raptor_iostream_string_write("\\n", iostream);
+    } else if (c == '\r') {
+      raptor_iostream_string_write("\\r", iostream);
+    } else if (c == '\t') {
+      raptor_iostream_string_write("\\t", iostream);
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      raptor_iostream_string_write(escaped, iostream);
+    } else {
+      raptor_iostream_write_byte(c, iostream);
+    }
+  }
+  raptor_iostream_write_byte('"', iostream);
+}
+
+static void write_xml_escaped(raptor_iostream * iostream, const char *str, char quote)
+{
+  raptor_xml_escape_string_write((const unsigned char *) str, strlen(str), quote, iostream);
+}
+
+static const char *node_value_string(librdf_node * node)
+{
+  if (librdf_node_is_resource(node)) {
+    return (const char *) librdf_uri_as_string(librdf_node_get_uri(node));
+  } else if (librdf_node_is_blank(node)) {
+    return (const char *) librdf_node_get_blank_identifier(node);
+  } else {
+    return (const char *) librdf_node_get_literal_value(node);
+  }
+}
+
+static void write_xml_binding(raptor_iostream * iostream, const char *name, librdf_node * node)
+{
+  const char *value = node_value_string(node);
+
+  raptor_iostream_string_write("      <binding name=\"", iostream);
+  write_xml_escaped(iostream, name, '"');
+  raptor_iostream_string_write("\">", iostream);
+  if (librdf_node_is_resource(node)) {
+    raptor_iostream_string_write("<uri>", iostream);
+    write_xml_escaped(iostream, value, 0);
+    raptor_iostream_string_write("</uri>", iostream);
+  } else if (librdf_node_is_blank(node)) {
+    raptor_iostream_string_write("<bnode>", iostream);
+    write_xml_escaped(iostream, value, 0);
+    raptor_iostream_string_write("</bnode>", iostream);
+  } else {
+    const char *lang = librdf_node_get_literal_value_language(node);
+    librdf_uri *datatype = librdf_node_get_literal_value_datatype_uri(node);
+    raptor_iostream_string_write("<literal", iostream);
+    if (lang) {
+      raptor_iostream_string_write(" xml:lang=\"", iostream);
+      write_xml_escaped(iostream, lang, '"');
+      raptor_iostream_string_write("\"", iostream);
+    } else if (datatype) {
+      raptor_iostream_string_write(" datatype=\"", iostream);
+      write_xml_escaped(iostream, (const char *) librdf_uri_as_string(datatype), '"');
+      raptor_iostream_string_write("\"", iostream);
+    }
+    raptor_iostream_string_write(">", iostream);
+    write_xml_escaped(iostream, value, 0);
+    raptor_iostream_string_write("</literal>", iostream);
+  }
+  raptor_iostream_string_write("</binding>\n", iostream);
+}
+
+static void write_json_binding(raptor_iostream * iostream, const char *name, librdf_node * node)
+{
+  write_json_string(iostream, name);
+  raptor_iostream_string_write(" : { \"type\" : ", iostream);
+  if (librdf_node_is_resource(node)) {
+    raptor_iostream_string_write("\"uri\"", iostream);
+  } else if (librdf_node_is_blank(node)) {
+    raptor_iostream_string_write("\"bnode\"", iostream);
+  } else {
+    const char *lang = librdf_node_get_literal_value_language(node);
+    librdf_uri *datatype = librdf_node_get_literal_value_datatype_uri(node);
+    raptor_iostream_string_write("\"literal\"", iostream);
+    if (lang) {
+      raptor_iostream_string_write(", \"xml:lang\" : ", iostream);
+      write_json_string(iostream, lang);
+    } else if (datatype) {
+      raptor_iostream_string_write(", \"datatype\" : ", iostream);
+      write_json_string(iostream, (const char *) librdf_uri_as_string(datatype));
+    }
+  }
+  raptor_iostream_string_write(", \"value\" : ", iostream);
+  write_json_string(iostream, node_value_string(node));
+  raptor_iostream_string_write(" }", iostream);
+}
+
+static void write_csv_value(raptor_iostream * iostream, librdf_node * node)
+{
+  const char *value = node_value_string(node);
+
+  if (librdf_node_is_blank(node))
+    raptor_iostream_string_write("_:", iostream);
+
+  if (strpbrk(value, "\",\r\n")) {
+    raptor_iostream_write_byte('"', iostream);
+    for (; *value; value++) {
+      if (*value == '"')
+        raptor_iostream_write_byte('"', iostream);
+      raptor_iostream_write_byte(*value, iostream);
+    }
+    raptor_iostream_write_byte('"', iostream);
+  } else {
+    raptor_iostream_string_write(value, iostream);
+  }
+}
+
+static void write_tsv_value(raptor_iostream * iostream, librdf_node * node)
+{
+  unsigned char *str = librdf_node_to_string(node);
+  if (str) {
+    raptor_iostream_string_write(str, iostream);
+    free(str);
+  }
+}
+
+// Write a table of bindings without going through rasqal.
+// values is an array of rows*width nodes, which may contain NULLs for unbound values.
+// Returns NULL if the negotiated format is not one that can be written directly.
+redhttp_response_t *format_bindings_table(redhttp_request_t * request,
+                                          const char **names, int width,
+                                          librdf_node ** values, int rows)
+{
+  raptor_world *raptor = librdf_world_get_raptor(world);
+  const raptor_syntax_description *desc = NULL;
+  redhttp_response_t *response = NULL;
+  raptor_iostream *iostream = NULL;
+  const char *mime_type = NULL;
+  const char *format = NULL;
+  void *buffer = NULL;
+  size_t buffer_len = 0;
+  int r, c;
+
+  desc = redstore_negotiate_format(request, librdf_query_results_formats_get_description,
+                                   DEFAULT_RESULTS_FORMAT, &mime_type);
+  if (!desc)
+    return NULL;
+
+  format = desc->names[0];
+  if (strcmp(format, "xml") && strcmp(format, "json") &&
+      strcmp(format, "csv") && strcmp(format, "tsv"))
+    return NULL;
+
+  iostream = raptor_new_iostream_to_string(raptor, &buffer, &buffer_len, NULL);
+  if (!iostream)
+    return NULL;
+
+  if (strcmp(format, "xml") == 0) {
+    raptor_iostream_string_write("<?xml version=\"1.0\"?>\n"
+                                 "<sparql xmlns=\"http://www.w3.org/2005/sparql-results#\">\n"
+                                 "  <head>\n", iostream);
+    for (c = 0; c < width; c++) {
+      raptor_iostream_string_write("    <variable name=\"", iostream);
+      write_xml_escaped(iostream, names[c], '"');
+      raptor_iostream_string_write("\"/>\n", iostream);
+    }
+    raptor_iostream_string_write("  </head>\n  <results>\n", iostream);
+    for (r = 0; r < rows; r++) {
+      raptor_iostream_string_write("    <result>\n", iostream);
+      for (c = 0; c < width; c++) {
+        if (values[r * width + c])
+          write_xml_binding(iostream, names[c], values[r * width + c]);
+      }
+      raptor_iostream_string_write("    </result>\n", iostream);
+    }
+    raptor_iostream_string_write("  </results>\n</sparql>\n", iostream);
+  } else if (strcmp(format, "json") == 0) {
+    raptor_iostream_string_write("{\n  \"head\": {\n    \"vars\": [ ", iostream);
+    for (c = 0; c < width; c++) {
+      if (c)
+        raptor_iostream_string_write(", ", iostream);
+      write_json_string(iostream, names[c]);
+    }
+    raptor_iostream_string_write(" ]\n  },\n  \"results\": {\n    \"bindings\" : [\n", iostream);
+    for (r = 0; r < rows; r++) {
+      int first = 1;
+      raptor_iostream_string_write(r ? ",\n      { " : "      { ", iostream);
+      for (c = 0; c < width; c++) {
+        if (!values[r * width + c])
+          continue;
+        if (!first)
+          raptor_iostream_string_write(", ", iostream);
+        write_json_binding(iostream, names[c], values[r * width + c]);
+        first = 0;
+      }
+      raptor_iostream_string_write(" }", iostream);
+    }
+    raptor_iostream_string_write("\n    ]\n  }\n}\n", iostream);
+  } else {
+    int is_csv = (strcmp(format, "csv") == 0);
+    for (c = 0; c < width; c++) {
+      if (c)
+        raptor_iostream_write_byte(is_csv ? ',' : '\t', iostream);
+      if (!is_csv)
+        raptor_iostream_write_byte('?', iostream);
+      raptor_iostream_string_write(names[c], iostream);
+    }
+    raptor_iostream_string_write(is_csv ? "\r\n" : "\n", iostream);
+    for (r = 0; r < rows; r++) {
+      for (c = 0; c < width; c++) {
+        librdf_node *node = values[r * width + c];
+        if (c)
+          raptor_iostream_write_byte(is_csv ? ',' : '\t', iostream);
+        if (!node)
+          continue;
+        if (is_csv)
+          write_csv_value(iostream, node);
+        else
+          write_tsv_value(iostream, node);
+      }
+      raptor_iostream_string_write(is_csv ? "\r\n" : "\n", iostream);
+    }
+  }
+
+  raptor_free_iostream(iostream);
+
+  response = redhttp_response_new(REDHTTP_OK, NULL);
+  if (mime_type)
+    redhttp_response_add_header(response, "Content-Type", mime_type);
+  if (buffer_len > 0) {
+    redhttp_response_set_content(response, buffer, buffer_len, free);
+  } else if (buffer) {
+    free(buffer);
+  }
+
+  redstore_debug("Query returned %d results", rows);
+
+  return response;
+}
@@ -0,0 +1,436 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
+
+#include "redstore.h"
+
+
+// Triple Pattern Fragments: a single triple pattern is looked up directly
+// in the store, without going through the SPARQL engine. With a 'min' or
+// 'max' value, the objects are restricted to a range of numbers or dates,
+// which is looked up in the range index, in order of value.
+
+typedef struct fragment_s {
+  librdf_statement **statements;
+  librdf_node **contexts;
+  int count;
+  int pos;
+} fragment_t;
+
+
+// Set when the server starts, so that ETags from a previous run never match
+static time_t etag_epoch = 0;
+
+
+void fragments_init(void)
+{
+  etag_epoch = time(NULL);
+}
+
+
+static librdf_node *new_literal_node(const char *str)
+{
+  const char *end = strrchr(str, '"');
+  librdf_node *node = NULL;
+  librdf_uri *datatype = NULL;
+  const char *lang = NULL;
+  char *value = NULL;
+
+  if (!end || end == str)
+    return NULL;
+
+  if (end[1] == '@') {
+    lang = end + 2;
+  } else if (end[1] == '^' && end[2] == '^') {
+    const char *dt = end + 3;
+    size_t dt_len = strlen(dt);
+    if (dt[0] == '<' && dt_len >= 2 && dt[dt_len - 1] == '>') {
+      char *dt_str = calloc(1, dt_len - 1);
+      if (!dt_str)
+        return NULL;
+      memcpy(dt_str, dt + 1, dt_len - 2);
+      datatype = librdf_new_uri(world, (unsigned char *) dt_str);
+      free(dt_str);
+    } else {
+      datatype = librdf_new_uri(world, (unsigned char *) dt);
+    }
+    if (!datatype)
+      return NULL;
+  } else if (end[1] != '\0') {
+    return NULL;
+  }
+
+  value = redstore_unescape_string(str + 1, end - str - 1);
+  if (value) {
+    node = librdf_new_node_from_typed_literal(world, (unsigned char *) value, lang, datatype);
+    free(value);
+  }
+
+  if (datatype)
+    librdf_free_uri(datatype);
+
+  return node;
+}
+
+// Parses a term written in N-Triples syntax, or a plain IRI.
+// Returns 0 on success; node is set to NULL if the term is a wildcard.
+static int parse_pattern_term(const char *str, librdf_node ** node)
+{
+  size_t len;
+
+  *node = NULL;
+  if (!str || str[0] == '\0' || str[0] == '?')
+    return 0;
+
+  len = strlen(str);
+  if (str[0] == '<') {
+    char *uri_str;
+    if (len < 3 || str[len - 1] != '>')
+      return 1;
+    uri_str = calloc(1, len - 1);
+    if (!uri_str)
+      return 1;
+    memcpy(uri_str, str + 1, len - 2);
+    *node = librdf_new_node_from_uri_string(world, (unsigned char *) uri_str);
+    free(uri_str);
+  } else if (str[0] == '"') {
+    *node = new_literal_node(str);
+  } else if (str[0] == '_' && str[1] == ':') {
+    *node = librdf_new_node_from_blank_identifier(world, (unsigned char *) str + 2);
+  } else {
+    *node = librdf_new_node_from_uri_string(world, (unsigned char *) str);
+  }
+
+  return (*node == NULL);
+}
+
+
+static int fragment_stream_end(void *context)
+{
+  fragment_t *fragment = (fragment_t *) context;
+  return fragment->pos >= fragment->count;
+}
+
+static int fragment_stream_next(void *context)
+{
+  fragment_t *fragment = (fragment_t *) context;
+  fragment->pos++;
+  return fragment->pos >= fragment->count;
+}
+
+static void *fragment_stream_get(void *context, int flags)
+{
+  fragment_t *fragment = (fragment_t *) context;
+
+  if (fragment->pos >= fragment->count)
+    return NULL;
+
+  switch (flags) {
+  case LIBRDF_STREAM_GET_METHOD_GET_OBJECT:
+    return fragment->statements[fragment->pos];
+  case LIBRDF_STREAM_GET_METHOD_GET_CONTEXT:
+    return fragment->contexts[fragment->pos];
+  default:
+    return NULL;
+  }
+}
+
+static void fragment_free(void *context)
+{
+  fragment_t *fragment = (fragment_t *) context;
+  int i;
+
+  for (i = 0; i < fragment->count; i++) {
+    librdf_free_statement(fragment->statements[i]);
+    if (fragment->contexts[i])
+      librdf_free_node(fragment->contexts[i]);
+  }
+  free(fragment->statements);
+  free(fragment->contexts);
+  free(fragment);
+}
+
+// Copies one page of matches out of the store, while counting the total
+// number of matches up to FRAGMENTS_COUNT_LIMIT.
+static fragment_t *fragment_new(librdf_stream * matches, librdf_node * graph,
+                                long offset, long limit, unsigned long *count)
+{
+  fragment_t *fragment = calloc(1, sizeof(fragment_t));
+  unsigned long matched = 0;
+
+  if (!fragment)
+    return NULL;
+
+  fragment->statements = calloc(limit + 1, sizeof(librdf_statement *));
+  fragment->contexts = calloc(limit + 1, sizeof(librdf_node *));
+  if (!fragment->statements || !fragment->contexts) {
+    fragment_free(fragment);
+    return NULL;
+  }
+
+  while (!librdf_stream_end(matches)) {
+    if (matched >= (unsigned long) offset && fragment->count < limit) {
+      librdf_statement *statement = librdf_stream_get_object(matches);
+      librdf_node *context = graph ? graph : librdf_stream_get_context2(matches);
+      int i = fragment->count;
+
+      fragment->statements[i] = librdf_new_statement_from_statement(statement);
+      if (!fragment->statements[i])
+        break;
+      fragment->contexts[i] = context ? librdf_new_node_from_node(context) : NULL;
+      fragment->count++;
+    } else if (matched >= FRAGMENTS_COUNT_LIMIT && matched >= (unsigned long) (offset + limit)) {
+      break;
+    }
+
+    matched++;
+    librdf_stream_next(matches);
+  }
+
+  *count = matched;
+
+  return fragment;
+}
+
+static void append_next_argument(raptor_stringbuffer * buffer, const char *key, const char *value)
+{
+  char *escaped;
+
+  if (!value || value[0] == '\0')
+    return;
+
+  escaped = redhttp_url_escape(value);
+  if (escaped) {
+    raptor_stringbuffer_append_string(buffer, (unsigned char *) key, 1);
+    raptor_stringbuffer_append_string(buffer, (unsigned char *) "=", 1);
+    raptor_stringbuffer_append_string(buffer, (unsigned char *) escaped, 1);
+    raptor_stringbuffer_append_string(buffer, (unsigned char *) "&", 1);
+    free(escaped);
+  }
+}
+
+static void add_next_page_header(redhttp_request_t * request, redhttp_response_t * response,
+                                 long offset, long limit)
+{
+  raptor_stringbuffer *buffer = raptor_new_stringbuffer();
+  const char *keys[] = { "s", "p", "o", "g", "min", "max", NULL };
+  int i;
+
+  if (!buffer)
+    return;
+
+  // A reference relative to the request's own URI, so that the link is right
+  // whatever scheme and host the client used, including through a proxy
+  raptor_stringbuffer_append_string(buffer, (unsigned char *) "<", 1);
+  raptor_stringbuffer_append_string(buffer, (unsigned char *) redhttp_request_get_path(request), 1);
+  raptor_stringbuffer_append_string(buffer, (unsigned char *) "?", 1);
+  for (i = 0; keys[i]; i++)
+    append_next_argument(buffer, keys[i], redhttp_request_get_argument(request, keys[i]));
+  raptor_stringbuffer_append_string(buffer, (unsigned char *) "limit=", 1);
+  raptor_stringbuffer_append_decimal(buffer, limit);
+  raptor_stringbuffer_append_string(buffer, (unsigned char *) "&offset=", 1);
+  raptor_stringbuffer_append_decimal(buffer, offset + limit);
+  raptor_stringbuffer_append_string(buffer, (unsigned char *) ">; rel=\"next\"", 1);
+
+  redhttp_response_add_header(response, "Link",
+                              (const char *) raptor_stringbuffer_as_string(buffer));
+
+  raptor_free_stringbuffer(buffer);
+}
+
+redhttp_response_t *handle_fragments(redhttp_request_t * request, void *user_data)
+{
+  const char *if_none_match = redhttp_request_get_header(request, "If-None-Match");
+  redhttp_response_t *response = NULL;
+  librdf_node *nodes[4] = { NULL, NULL, NULL, NULL };
+  const char *keys[] = { "s", "p", "o", "g" };
+  const char *bound_keys[] = { "min", "max" };
+  librdf_node *bounds[2] = { NULL, NULL };
+  double range[2] = { -HUGE_VAL, HUGE_VAL };
+  int range_kind = -1;
+  librdf_statement *pattern = NULL;
+  librdf_stream *matches = NULL;
+  librdf_stream *stream = NULL;
+  fragment_t *fragment = NULL;
+  unsigned long count = 0;
+  long offset, limit;
+  char etag[64];
+  char str[32];
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    if (parse_pattern_term(redhttp_request_get_argument(request, keys[i]), &nodes[i])) {
+      response = redstore_page_new_with_message(
+        request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST,
+        "Invalid term in the '%s' argument.", keys[i]
+      );
+      goto CLEANUP;
+    }
+  }
+
+  if (nodes[3] && !librdf_node_is_resource(nodes[3])) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "The 'g' argument must be an IRI."
+    );
+    goto CLEANUP;
+  }
+
+  for (i = 0; i < 2; i++) {
+    const char *arg = redhttp_request_get_argument(request, bound_keys[i]);
+    int kind;
+
+    if (!arg || arg[0] == '\0')
+      continue;
+
+    if (parse_pattern_term(arg, &bounds[i]) || range_node_value(bounds[i], &kind, &range[i]) ||
+        (range_kind >= 0 && kind != range_kind)) {
+      response = redstore_page_new_with_message(
+        request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST,
+        "The '%s' argument must be a number, date or dateTime, like the other bound.", bound_keys[i]
+      );
+      goto CLEANUP;
+    }
+    range_kind = kind;
+  }
+
+  if (range_kind >= 0 && (!nodes[1] || nodes[2])) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST,
+      "A range of values needs a 'p' argument, and no 'o' argument."
+    );
+    goto CLEANUP;
+  }
+
+  if (range_kind >= 0 && !range_is_enabled()) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_NOT_IMPLEMENTED, "The range index is not enabled."
+    );
+    goto CLEANUP;
+  }
+
+  if (redstore_get_integer_argument(request, "limit", FRAGMENTS_PAGE_SIZE, &limit) ||
+      limit < 1 || limit > FRAGMENTS_MAX_PAGE_SIZE) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST,
+      "The 'limit' argument must be between 1 and %d.", FRAGMENTS_MAX_PAGE_SIZE
+    );
+    goto CLEANUP;
+  }
+
+  // The offset of the next page has to fit in an int
+  if (redstore_get_integer_argument(request, "offset", 0, &offset) || offset > INT_MAX - limit) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "Invalid 'offset' argument."
+    );
+    goto CLEANUP;
+  }
+
+  // The fragment only changes when the contents of the store change
+  snprintf(etag, sizeof(etag), "W/\"%lx-%lx\"",
+           (unsigned long) etag_epoch, store_get_generation());
+  if (if_none_match && strcmp(if_none_match, etag) == 0) {
+    response = redhttp_response_new_empty(REDHTTP_NOT_MODIFIED);
+    redhttp_response_add_header(response, "ETag", etag);
+    goto CLEANUP;
+  }
+
+  // Nodes are copied, because the statement takes ownership of them
+  pattern = librdf_new_statement_from_nodes(world,
+                                            nodes[0] ? librdf_new_node_from_node(nodes[0]) : NULL,
+                                            nodes[1] ? librdf_new_node_from_node(nodes[1]) : NULL,
+                                            nodes[2] ? librdf_new_node_from_node(nodes[2]) : NULL);
+  if (!pattern) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to create triple pattern."
+    );
+    goto CLEANUP;
+  }
+
+  if (range_kind >= 0) {
+    matches = range_find(nodes[1], range_kind, range[0], range[1], nodes[0], nodes[3]);
+  } else if (nodes[3]) {
+    matches = librdf_model_find_statements_in_context(model, pattern, nodes[3]);
+  } else {
+    matches = librdf_model_find_statements(model, pattern);
+  }
+  if (!matches) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to find statements."
+    );
+    goto CLEANUP;
+  }
+
+  fragment = fragment_new(matches, nodes[3], offset, limit, &count);
+  if (!fragment) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to create fragment."
+    );
+    goto CLEANUP;
+  }
+
+  // An unbound pattern matches the whole graph, which has already been counted
+  if (!nodes[0] && !nodes[1] && !nodes[2])
+    count = nodes[3] ? stats_get_graph_size(nodes[3]) : stats_get_total();
+
+  response = redhttp_response_new(REDHTTP_OK, NULL);
+  snprintf(str, sizeof(str), "%lu", count);
+  redhttp_response_add_header(response, "X-Cardinality", str);
+  redhttp_response_add_header(response, "ETag", etag);
+  redhttp_response_add_header(response, "Vary", "Accept");
+  if (count > (unsigned long) (offset + limit))
+    add_next_page_header(request, response, offset, limit);
+
+  stream = librdf_new_stream(world, fragment, fragment_stream_end, fragment_stream_next,
+                             fragment_stream_get, fragment_free);
+  if (!stream) {
+    fragment_free(fragment);
+    redhttp_response_free(response);
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to create stream."
+    );
+    goto CLEANUP;
+  }
+
+  response = format_graph_stream_with_response(request, stream, response);
+
+CLEANUP:
+  if (stream)
+    librdf_free_stream(stream);
+  if (matches)
+    librdf_free_stream(matches);
+  if (pattern)
+    librdf_free_statement(pattern);
+  for (i = 0; i < 4; i++) {
+    if (nodes[i])
+      librdf_free_node(nodes[i]);
+  }
+  for (i = 0; i < 2; i++) {
+    if (bounds[i])
+      librdf_free_node(bounds[i]);
+  }
+
+  return response;
+}
@@ -31,6 +31,7 @@ unsigned long import_count = 0;
 unsigned long request_count = 0;
 const char *storage_name = NULL;
 const char *storage_type = NULL;
+const char *storage_options = NULL;
 char *public_storage_options = NULL;
 
 librdf_world *world = NULL;
@@ -40,58 +40,79 @@ static char* server_root_url(redhttp_request_t * request)
     return url;
 }
 
+// There is no iterator when there are no named graphs
+static int graphs_end(raptor_avltree_iterator * iterator)
+{
+  return !iterator || raptor_avltree_iterator_is_end(iterator);
+}
+
+// Moves the iterator past the first offset graphs
+static void skip_graphs(raptor_avltree_iterator * iterator, long offset)
+{
+  while (offset-- > 0 && !graphs_end(iterator))
+    raptor_avltree_iterator_next(iterator);
+}
+
 static redhttp_response_t *handle_html_graph_index(redhttp_request_t * request,
-                                                   librdf_iterator * iterator)
+                                                   raptor_avltree_iterator * iterator,
+                                                   long offset, long limit)
 {
   redhttp_response_t *response = redstore_page_new(REDHTTP_OK, "Named Graphs");
   char *root_url = server_root_url(request);
+  long count = 0;
 
   if (!root_url || !response)
     goto CLEANUP;
 
-  if (!librdf_iterator_end(iterator)) {
+  skip_graphs(iterator, offset);
+  if (!graphs_end(iterator)) {
     redstore_page_append_string(response, "<ul>\n");
 
-    while (!librdf_iterator_end(iterator)) {
-      librdf_uri *uri;
-      librdf_node *node;
-      char *uri_str, *escaped;
+    while (!graphs_end(iterator) && (!limit || count < limit)) {
+      graph_stats_t *gs = (graph_stats_t *) raptor_avltree_iterator_get(iterator);
+      char *escaped;
 
-      node = (librdf_node *) librdf_iterator_get_object(iterator);
-      if (!node) {
-        redstore_error("librdf_iterator_get_next returned NULL");
+      if (!gs) {
+        redstore_error("raptor_avltree_iterator_get returned NULL");
         break;
       }
 
-      uri = librdf_node_get_uri(node);
-      if (!uri) {
-        redstore_error("Failed to get URI for context node");
-        break;
-      }
-
-      uri_str = (char*)librdf_uri_as_string(uri);
-      if (strstr(uri_str, root_url)) {
+      if (gs->blank) {
+        // A blank node can't be linked to
+        redstore_page_append_string(response, "<li>");
+        redstore_page_append_escaped(response, gs->uri, 0);
+        redstore_page_append_string(response, "</li>\n");
+      } else if (strstr(gs->uri, root_url)) {
         // Direct graph identification
         redstore_page_append_string(response, "<li><a href=\"");
-        redstore_page_append_escaped(response, uri_str, 0);
+        redstore_page_append_escaped(response, gs->uri, 0);
         redstore_page_append_string(response, "\">");
-        redstore_page_append_escaped(response, uri_str, 0);
+        redstore_page_append_escaped(response, gs->uri, 0);
         redstore_page_append_string(response, "</a></li>\n");
       } else {
         // Indirect graph identification
-        escaped = redhttp_url_escape(uri_str);
+        escaped = redhttp_url_escape(gs->uri);
         redstore_page_append_string(response, "<li><a href=\"/data/?graph=");
         redstore_page_append_escaped(response, escaped, 0);
         redstore_page_append_string(response, "\">");
-        redstore_page_append_escaped(response, uri_str, 0);
+        redstore_page_append_escaped(response, gs->uri, 0);
         redstore_page_append_string(response, "</a></li>\n");
         free(escaped);
       }
 
-      librdf_iterator_next(iterator);
+      count++;
+      raptor_avltree_iterator_next(iterator);
     }
     redstore_page_append_string(response, "</ul>\n");
 
+    if (!graphs_end(iterator)) {
+      redstore_page_append_string(response, "<p><a href=\"/graphs?offset=");
+      redstore_page_append_decimal(response, offset + count);
+      redstore_page_append_string(response, "&amp;limit=");
+      redstore_page_append_decimal(response, limit);
+      redstore_page_append_string(response, "\">Next page</a></p>\n");
+    }
+
     redstore_page_append_string(response,
                                 "<p>This document is also available as <a href=\"/graphs?format=text\">plain text</a>.</p>\n");
 
@@ -109,66 +130,83 @@ CLEANUP:
 }
 
 static redhttp_response_t *handle_text_graph_index(redhttp_request_t * request,
-                                                   librdf_iterator * iterator)
+                                                   raptor_avltree_iterator * iterator,
+                                                   long offset, long limit)
 {
   redhttp_response_t *response = redhttp_response_new_with_type(REDHTTP_OK, NULL, "text/plain");
   FILE *socket = redhttp_request_get_socket(request);
+  long count = 0;
 
   if (!response)
     return NULL;
 
   redhttp_response_send(response, request);
 
-  while (!librdf_iterator_end(iterator)) {
-    librdf_uri *uri;
-    librdf_node *node;
-
-    node = (librdf_node *) librdf_iterator_get_object(iterator);
-    if (!node) {
-      redstore_error("librdf_iterator_get_next returned NULL");
-      break;
-    }
+  skip_graphs(iterator, offset);
+  while (!graphs_end(iterator) && (!limit || count < limit)) {
+    graph_stats_t *gs = (graph_stats_t *) raptor_avltree_iterator_get(iterator);
 
-    uri = librdf_node_get_uri(node);
-    if (!uri) {
-      redstore_error("Failed to get URI for context node");
+    if (!gs) {
+      redstore_error("raptor_avltree_iterator_get returned NULL");
       break;
     }
 
-    fprintf(socket, "%s\n", librdf_uri_as_string(uri));
+    fprintf(socket, "%s\n", gs->uri);
 
-    librdf_iterator_next(iterator);
+    count++;
+    raptor_avltree_iterator_next(iterator);
   }
 
   return response;
 }
 
 
+// Lists the named graphs from the statistics table, rather than asking the storage
 redhttp_response_t *handle_graph_index(redhttp_request_t * request, void *user_data)
 {
-  char *format_str = redstore_negotiate_string(request, "text/plain,text/html,application/xhtml+xml", "text/plain");
+  char *format_str = NULL;
   redhttp_response_t *response = NULL;
-  librdf_iterator *iterator = NULL;
+  raptor_avltree_iterator *iterator = NULL;
+  long offset = 0, limit = 0;
+
+  if (redstore_get_integer_argument(request, "offset", 0, &offset)) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "Invalid 'offset' argument."
+    );
+  }
 
-  iterator = librdf_storage_get_contexts(storage);
-  if (!iterator) {
+  if (redstore_get_integer_argument(request, "limit", 0, &limit)) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "Invalid 'limit' argument."
+    );
+  }
+
+  iterator = stats_new_graph_iterator();
+  if (!iterator && stats_get_graph_count() > 0) {
     return redstore_page_new_with_message(
       request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to get list of graphs."
     );
   }
 
-  if (redstore_is_text_format(format_str)) {
-    response = handle_text_graph_index(request, iterator);
+  format_str = redstore_negotiate_string(request, "text/plain,text/html,application/xhtml+xml", "text/plain");
+  if (!format_str) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to negotiate format."
+    );
+  } else if (redstore_is_text_format(format_str)) {
+    response = handle_text_graph_index(request, iterator, offset, limit);
   } else if (redstore_is_html_format(format_str)) {
-    response = handle_html_graph_index(request, iterator);
+    response = handle_html_graph_index(request, iterator, offset, limit);
   } else {
     response = redstore_page_new_with_message(
       request, LIBRDF_LOG_INFO, REDHTTP_NOT_ACCEPTABLE, "No acceptable format supported."
     );
   }
 
-  free(format_str);
-  librdf_free_iterator(iterator);
+  if (format_str)
+    free(format_str);
+  if (iterator)
+    raptor_free_avltree_iterator(iterator);
 
   return response;
 }
@@ -0,0 +1,697 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "redstore.h"
+
+
+// Load jobs: documents that are parsed and added to the store in the
+// background, while other requests carry on being served.
+//
+// The storages can only be used from one thread, so rather than running
+// on a thread of its own, each job adds a slice of statements every time
+// around the main loop. Each slice is a single write to the log.
+
+typedef enum {
+  JOB_RUNNING,
+  JOB_FINISHED,
+  JOB_FAILED,
+  JOB_CANCELLED
+} job_state_t;
+
+typedef struct job_s {
+  unsigned long id;
+  job_state_t state;
+  char *source;
+  librdf_node *graph;
+  librdf_parser *parser;
+  librdf_stream *stream;
+  FILE *file;                   // NULL when loading from a URI
+  unsigned char *buffer;        // Request body that file reads from, if any
+  long bytes_total;             // -1 if unknown
+  long bytes_read;
+  unsigned long statements;
+  time_t started;
+  time_t finished;
+  char *message;
+} job_t;
+
+static const char *job_state_names[] = { "running", "finished", "failed", "cancelled" };
+
+static job_t *jobs[JOBS_MAX];
+static unsigned long last_job_id = 0;
+
+// Directory that files may be loaded from; NULL if loading files is disabled
+static char *jobs_dir = NULL;
+
+
+int jobs_init(const char *dir)
+{
+  if (!dir)
+    return 0;
+
+  jobs_dir = realpath(dir, NULL);
+  if (!jobs_dir) {
+    redstore_error("Failed to find directory for loading files: %s", dir);
+    return -1;
+  }
+
+  redstore_info("Files may be loaded from: %s", jobs_dir);
+
+  return 0;
+}
+
+// True if the client has asked for the request to be handled in the background
+int jobs_requested(redhttp_request_t * request)
+{
+  const char *prefer = redhttp_request_get_header(request, "Prefer");
+
+  // Jobs carry on between requests, when the default dataset is in use
+  if (!datasets_is_default())
+    return 0;
+
+  if (redhttp_request_argument_exists(request, "async"))
+    return 1;
+
+  return prefer && strstr(prefer, "respond-async") != NULL;
+}
+
+static void job_close(job_t * job)
+{
+  if (job->stream)
+    librdf_free_stream(job->stream);
+  job->stream = NULL;
+  if (job->parser)
+    librdf_free_parser(job->parser);
+  job->parser = NULL;
+  if (job->file) {
+    job->bytes_read = ftell(job->file);
+    fclose(job->file);
+  }
+  job->file = NULL;
+  if (job->buffer)
+    free(job->buffer);
+  job->buffer = NULL;
+  if (job->graph)
+    librdf_free_node(job->graph);
+  job->graph = NULL;
+}
+
+static void job_free(job_t * job)
+{
+  job_close(job);
+  if (job->source)
+    free(job->source);
+  if (job->message)
+    free(job->message);
+  free(job);
+}
+
+static void job_end(job_t * job, job_state_t state, const char *message)
+{
+  job_close(job);
+  job->state = state;
+  job->finished = time(NULL);
+  if (message && !job->message) {
+    job->message = calloc(1, strlen(message) + 1);
+    if (job->message)
+      strcpy(job->message, message);
+  }
+
+  if (state == JOB_FAILED) {
+    redstore_error("Job %lu failed after %lu statements: %s", job->id, job->statements,
+                   message ? message : "unknown error");
+  } else {
+    redstore_info("Job %lu %s after %lu statements", job->id, job_state_names[state],
+                  job->statements);
+  }
+}
+
+// Finds a free slot, by forgetting the oldest job that has ended if need be
+static int job_slot(void)
+{
+  int i, oldest = -1;
+
+  for (i = 0; i < JOBS_MAX; i++) {
+    if (!jobs[i])
+      return i;
+    if (jobs[i]->state != JOB_RUNNING && (oldest < 0 || jobs[i]->id < jobs[oldest]->id))
+      oldest = i;
+  }
+
+  if (oldest >= 0) {
+    job_free(jobs[oldest]);
+    jobs[oldest] = NULL;
+  }
+
+  return oldest;
+}
+
+static job_t *job_lookup(redhttp_request_t * request)
+{
+  const char *glob = redhttp_request_get_path_glob(request);
+  unsigned long id;
+  char *end = NULL;
+  int i;
+
+  if (!glob || glob[0] == '\0')
+    return NULL;
+
+  id = strtoul(glob, &end, 10);
+  if (*end != '\0')
+    return NULL;
+
+  for (i = 0; i < JOBS_MAX; i++) {
+    if (jobs[i] && jobs[i]->id == id)
+      return jobs[i];
+  }
+
+  return NULL;
+}
+
+// Creates a job for a stream, and responds with where to find its progress.
+// Takes ownership of everything passed in, even on error.
+static redhttp_response_t *job_start(redhttp_request_t * request, const char *source,
+                                     librdf_parser * parser, librdf_stream * stream,
+                                     librdf_node * graph, FILE * file, unsigned char *buffer,
+                                     long bytes_total)
+{
+  redhttp_response_t *response = NULL;
+  job_t *job = NULL;
+  char location[32];
+  int slot;
+
+  job = calloc(1, sizeof(job_t));
+  if (!job) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Out of memory."
+    );
+    goto CLEANUP;
+  }
+
+  job->parser = parser;
+  job->stream = stream;
+  job->graph = graph;
+  job->file = file;
+  job->buffer = buffer;
+  job->bytes_total = bytes_total;
+  job->started = time(NULL);
+  parser = NULL;
+  stream = NULL;
+  graph = NULL;
+  file = NULL;
+  buffer = NULL;
+
+  job->source = calloc(1, strlen(source) + 1);
+  if (!job->source) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Out of memory."
+    );
+    goto CLEANUP;
+  }
+  strcpy(job->source, source);
+
+  slot = job_slot();
+  if (slot < 0) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_SERVICE_UNAVAILABLE,
+      "Too many jobs are running; please try again later."
+    );
+    redhttp_response_add_header(response, "Retry-After", "10");
+    goto CLEANUP;
+  }
+
+  job->id = ++last_job_id;
+  job->state = JOB_RUNNING;
+  jobs[slot] = job;
+
+  redstore_info("Started job %lu: %s", job->id, job->source);
+  import_count++;
+
+  snprintf(location, sizeof(location), "/jobs/%lu", job->id);
+  response = redstore_page_new_with_message(
+    request, LIBRDF_LOG_DEBUG, REDHTTP_ACCEPTED,
+    "Loading in the background. The progress of the job is at: %s", location
+  );
+  redhttp_response_add_header(response, "Location", location);
+  job = NULL;
+
+CLEANUP:
+  if (job)
+    job_free(job);
+  if (stream)
+    librdf_free_stream(stream);
+  if (parser)
+    librdf_free_parser(parser);
+  if (graph)
+    librdf_free_node(graph);
+  if (file)
+    fclose(file);
+  if (buffer)
+    free(buffer);
+
+  return response;
+}
+
+// Starts a job that loads from a URI
+redhttp_response_t *jobs_load_uri(redhttp_request_t * request, librdf_parser * parser,
+                                  librdf_uri * uri, librdf_uri * base_uri, librdf_node * graph)
+{
+  librdf_stream *stream = librdf_parser_parse_as_stream(parser, uri, base_uri);
+
+  if (!stream) {
+    librdf_free_parser(parser);
+    librdf_free_node(graph);
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to parse RDF as stream."
+    );
+  }
+
+  return job_start(request, (const char *) librdf_uri_as_string(uri), parser, stream, graph,
+                   NULL, NULL, -1);
+}
+
+// Starts a job that loads a file from the jobs directory
+redhttp_response_t *jobs_load_file(redhttp_request_t * request, const char *filename,
+                                   const char *parser_name, const char *base_arg,
+                                   const char *graph_arg)
+{
+  redhttp_response_t *response = NULL;
+  librdf_parser *parser = NULL;
+  librdf_stream *stream = NULL;
+  librdf_uri *base_uri = NULL;
+  librdf_node *graph = NULL;
+  char *path = NULL, *resolved = NULL, *file_uri = NULL;
+  size_t dir_len;
+  FILE *file = NULL;
+  long size;
+
+  if (!jobs_dir) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_FORBIDDEN, "Loading files on the server is not enabled."
+    );
+  }
+
+  if (!datasets_is_default()) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_FORBIDDEN,
+      "Files on the server can only be loaded into the default dataset."
+    );
+  }
+
+  // Only files inside the jobs directory may be loaded, even through symbolic links
+  dir_len = strlen(jobs_dir);
+  path = malloc(dir_len + strlen(filename) + 2);
+  if (!path) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Out of memory."
+    );
+    goto CLEANUP;
+  }
+  sprintf(path, "%s/%s", jobs_dir, filename);
+
+  resolved = realpath(path, NULL);
+  if (!resolved || strncmp(resolved, jobs_dir, dir_len) != 0 || resolved[dir_len] != '/') {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_NOT_FOUND, "File not found."
+    );
+    goto CLEANUP;
+  }
+
+  file = fopen(resolved, "rb");
+  if (!file) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_NOT_FOUND, "Failed to open file."
+    );
+    goto CLEANUP;
+  }
+  if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0) {
+    rewind(file);
+  } else {
+    size = -1;
+  }
+
+  file_uri = malloc(strlen(resolved) + 8);
+  if (!file_uri) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Out of memory."
+    );
+    goto CLEANUP;
+  }
+  sprintf(file_uri, "file://%s", resolved);
+
+  base_uri = librdf_new_uri(world, (const unsigned char *) (base_arg ? base_arg : file_uri));
+  graph = librdf_new_node_from_uri_string(world,
+                                          (const unsigned char *) (graph_arg ? graph_arg : file_uri));
+  if (!base_uri || !graph) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_BAD_REQUEST, "librdf_new_uri failed for Base or Graph URI"
+    );
+    goto CLEANUP;
+  }
+
+  if (!parser_name)
+    parser_name = librdf_parser_guess_name2(world, NULL, NULL, (const unsigned char *) resolved);
+  parser = librdf_new_parser(world, parser_name ? parser_name : "guess", NULL, NULL);
+  if (!parser) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to create parser"
+    );
+    goto CLEANUP;
+  }
+
+  stream = librdf_parser_parse_file_handle_as_stream(parser, file, 0, base_uri);
+  if (!stream) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to parse RDF as stream."
+    );
+    goto CLEANUP;
+  }
+
+  response = job_start(request, file_uri, parser, stream, graph, file, NULL, size);
+  parser = NULL;
+  stream = NULL;
+  graph = NULL;
+  file = NULL;
+
+CLEANUP:
+  if (stream)
+    librdf_free_stream(stream);
+  if (parser)
+    librdf_free_parser(parser);
+  if (file)
+    fclose(file);
+  if (graph)
+    librdf_free_node(graph);
+  if (base_uri)
+    librdf_free_uri(base_uri);
+  if (file_uri)
+    free(file_uri);
+  if (resolved)
+    free(resolved);
+  if (path)
+    free(path);
+
+  return response;
+}
+
+// Starts a job that loads the body of the request into a graph
+redhttp_response_t *jobs_load_request_body(redhttp_request_t * request, librdf_node * graph)
+{
+  const char *content_type = redhttp_request_get_header(request, "Content-Type");
+  redhttp_response_t *response = NULL;
+  unsigned char *buffer = NULL;
+  const char *parser_name = NULL;
+  librdf_parser *parser = NULL;
+  librdf_stream *stream = NULL;
+  librdf_uri *base_uri = NULL;
+  librdf_node *graph_copy = NULL;
+  FILE *file = NULL;
+  size_t length;
+
+  response = read_request_body(request, &buffer, &length);
+  if (response)
+    goto CLEANUP;
+
+  parser_name = librdf_parser_guess_name2(world, content_type, buffer, NULL);
+  if (!parser_name) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to guess parser type."
+    );
+    goto CLEANUP;
+  }
+
+  parser = librdf_new_parser(world, parser_name, NULL, NULL);
+  base_uri = librdf_new_uri(world, (const unsigned char *) redhttp_request_get_url(request));
+  file = fmemopen(buffer, length, "rb");
+  if (graph)
+    graph_copy = librdf_new_node_from_node(graph);
+  if (!parser || !base_uri || !file || (graph && !graph_copy)) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to create parser"
+    );
+    goto CLEANUP;
+  }
+
+  stream = librdf_parser_parse_file_handle_as_stream(parser, file, 0, base_uri);
+  if (!stream) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to parse data."
+    );
+    goto CLEANUP;
+  }
+
+  response = job_start(request, redhttp_request_get_url(request), parser, stream, graph_copy,
+                       file, buffer, (long) length);
+  parser = NULL;
+  stream = NULL;
+  graph_copy = NULL;
+  file = NULL;
+  buffer = NULL;
+
+CLEANUP:
+  if (stream)
+    librdf_free_stream(stream);
+  if (parser)
+    librdf_free_parser(parser);
+  if (file)
+    fclose(file);
+  if (buffer)
+    free(buffer);
+  if (graph_copy)
+    librdf_free_node(graph_copy);
+  if (base_uri)
+    librdf_free_uri(base_uri);
+
+  return response;
+}
+
+// Adds the next slice of statements from a job to the store
+static void job_run(job_t * job)
+{
+  unsigned long count = 0;
+  int err = 0;
+
+  // Parse errors are collected in the same buffer as those for requests
+  if (error_buffer) {
+    raptor_free_stringbuffer(error_buffer);
+    error_buffer = NULL;
+  }
+
+  store_batch_start();
+  while (count < JOBS_SLICE_STATEMENTS && !librdf_stream_end(job->stream)) {
+    librdf_statement *statement = librdf_stream_get_object(job->stream);
+    if (!statement || store_add_statement(job->graph, statement) < 0) {
+      err = 1;
+      break;
+    }
+    count++;
+    librdf_stream_next(job->stream);
+  }
+  if (store_batch_end())
+    err = 1;
+
+  job->statements += count;
+  if (job->file)
+    job->bytes_read = ftell(job->file);
+
+  if (error_buffer && raptor_stringbuffer_length(error_buffer) > 0) {
+    job_end(job, JOB_FAILED, (const char *) raptor_stringbuffer_as_string(error_buffer));
+  } else if (err) {
+    job_end(job, JOB_FAILED, "Failed to add statements to the store.");
+  } else if (librdf_stream_end(job->stream)) {
+    job_end(job, JOB_FINISHED, NULL);
+  }
+}
+
+// Called from the main loop; returns non-zero if there is more work to do
+int jobs_tick(void)
+{
+  int i, running = 0;
+
+  for (i = 0; i < JOBS_MAX; i++) {
+    if (jobs[i] && jobs[i]->state == JOB_RUNNING) {
+      // Don't add to a group of writes that is waiting to be committed
+      coalesce_flush();
+      job_run(jobs[i]);
+      if (jobs[i]->state == JOB_RUNNING)
+        running++;
+    }
+  }
+
+  return running;
+}
+
+static redhttp_response_t *format_job_text(redhttp_request_t * request, job_t * job,
+                                           unsigned long elapsed)
+{
+  redhttp_response_t *response = redhttp_response_new_with_type(REDHTTP_OK, NULL, "text/plain");
+  FILE *socket = redhttp_request_get_socket(request);
+
+  if (!response)
+    return NULL;
+
+  redhttp_response_send(response, request);
+
+  fprintf(socket, "id: %lu\n", job->id);
+  fprintf(socket, "state: %s\n", job_state_names[job->state]);
+  fprintf(socket, "source: %s\n", job->source);
+  fprintf(socket, "statements: %lu\n", job->statements);
+  fprintf(socket, "bytes-read: %ld\n", job->bytes_read);
+  if (job->bytes_total >= 0)
+    fprintf(socket, "bytes-total: %ld\n", job->bytes_total);
+  fprintf(socket, "elapsed: %lu\n", elapsed);
+  fprintf(socket, "rate: %lu\n", elapsed ? job->statements / elapsed : job->statements);
+  if (job->message)
+    fprintf(socket, "error: %s\n", job->message);
+
+  return response;
+}
+
+static void append_job_row(redhttp_response_t * response, const char *name, const char *value)
+{
+  redstore_page_append_strings(response, "<tr><th>", name, "</th><td>", NULL);
+  redstore_page_append_escaped(response, value, 0);
+  redstore_page_append_string(response, "</td></tr>\n");
+}
+
+static redhttp_response_t *format_job_html(redhttp_request_t * request, job_t * job,
+                                           unsigned long elapsed)
+{
+  redhttp_response_t *response = NULL;
+  char title[32], value[64];
+
+  snprintf(title, sizeof(title), "Load Job %lu", job->id);
+  response = redstore_page_new(REDHTTP_OK, title);
+  if (!response)
+    return NULL;
+
+  redstore_page_append_string(response, "<table border=\"1\">\n");
+  append_job_row(response, "State", job_state_names[job->state]);
+  append_job_row(response, "Source", job->source);
+  snprintf(value, sizeof(value), "%lu", job->statements);
+  append_job_row(response, "Statements", value);
+  if (job->bytes_total >= 0) {
+    snprintf(value, sizeof(value), "%ld of %ld", job->bytes_read, job->bytes_total);
+  } else {
+    snprintf(value, sizeof(value), "%ld", job->bytes_read);
+  }
+  append_job_row(response, "Bytes read", value);
+  snprintf(value, sizeof(value), "%lu seconds", elapsed);
+  append_job_row(response, "Elapsed", value);
+  snprintf(value, sizeof(value), "%lu statements per second",
+           elapsed ? job->statements / elapsed : job->statements);
+  append_job_row(response, "Rate", value);
+  if (job->message)
+    append_job_row(response, "Error", job->message);
+  redstore_page_append_string(response, "</table>\n");
+
+  if (job->state == JOB_RUNNING) {
+    redstore_page_append_string(response,
+                                "<p>The job can be cancelled by sending a DELETE request to this page.</p>\n");
+  }
+
+  redstore_page_end(response);
+
+  return response;
+}
+
+redhttp_response_t *handle_job_get(redhttp_request_t * request, void *user_data)
+{
+  char *format_str = NULL;
+  redhttp_response_t *response = NULL;
+  job_t *job = job_lookup(request);
+  unsigned long elapsed;
+
+  if (!job) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_NOT_FOUND, "Job not found."
+    );
+  }
+
+  elapsed = (job->state == JOB_RUNNING ? time(NULL) : job->finished) - job->started;
+
+  format_str = redstore_negotiate_string(request, "text/plain,text/html,application/xhtml+xml", "text/plain");
+  if (!format_str) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to negotiate format."
+    );
+  } else if (redstore_is_text_format(format_str)) {
+    response = format_job_text(request, job, elapsed);
+  } else if (redstore_is_html_format(format_str)) {
+    response = format_job_html(request, job, elapsed);
+  } else {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_NOT_ACCEPTABLE, "No acceptable format supported."
+    );
+  }
+
+  if (format_str)
+    free(format_str);
+
+  return response;
+}
+
+// Cancels a job; the statements that it has already added are kept
+redhttp_response_t *handle_job_delete(redhttp_request_t * request, void *user_data)
+{
+  job_t *job = job_lookup(request);
+
+  if (!job) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_NOT_FOUND, "Job not found."
+    );
+  }
+
+  if (job->state != JOB_RUNNING) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_OK, "Job has already %s.", job_state_names[job->state]
+    );
+  }
+
+  job_end(job, JOB_CANCELLED, NULL);
+
+  return redstore_page_new_with_message(
+    request, LIBRDF_LOG_INFO, REDHTTP_OK,
+    "Cancelled job after adding %lu statements.", job->statements
+  );
+}
+
+void jobs_free(void)
+{
+  int i;
+
+  for (i = 0; i < JOBS_MAX; i++) {
+    if (jobs[i]) {
+      if (jobs[i]->state == JOB_RUNNING)
+        redstore_warn("Job %lu did not finish: %s", jobs[i]->id, jobs[i]->source);
+      job_free(jobs[i]);
+      jobs[i] = NULL;
+    }
+  }
+
+  if (jobs_dir)
+    free(jobs_dir);
+  jobs_dir = NULL;
+}
@@ -0,0 +1,201 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "redstore.h"
+
+
+// A very small SPARQL tokeniser, used to recognise queries that
+// can be answered without going through rasqal. It is not a parser:
+// anything it doesn't understand should simply fall through to rasqal.
+
+static int is_single_punct(char c)
+{
+  return (c && strchr("{}(),;.", c) != NULL);
+}
+
+static int is_operator(char c)
+{
+  return (c && strchr("<>=!&|+-*/^", c) != NULL);
+}
+
+static const char *skip_whitespace(const char *ptr)
+{
+  while (*ptr) {
+    if (isspace((unsigned char) *ptr)) {
+      ptr++;
+    } else if (*ptr == '#') {
+      // Comment until the end of the line
+      while (*ptr && *ptr != '\n')
+        ptr++;
+    } else {
+      break;
+    }
+  }
+  return ptr;
+}
+
+static const char *scan_string(const char *ptr)
+{
+  char quote = *ptr;
+
+  if (ptr[1] == quote && ptr[2] == quote) {
+    // Long string
+    ptr += 3;
+    while (*ptr) {
+      if (*ptr == '\\' && ptr[1]) {
+        ptr += 2;
+      } else if (ptr[0] == quote && ptr[1] == quote && ptr[2] == quote) {
+        return ptr + 3;
+      } else {
+        ptr++;
+      }
+    }
+    return NULL;
+  }
+
+  ptr++;
+  while (*ptr && *ptr != quote) {
+    if (*ptr == '\\' && ptr[1])
+      ptr++;
+    ptr++;
+  }
+
+  return *ptr ? ptr + 1 : NULL;
+}
+
+// Returns a pointer to the character after the token, or NULL on a syntax error
+const char *lexer_next(const char *ptr, lexer_token_t * token)
+{
+  const char *end = NULL;
+
+  ptr = skip_whitespace(ptr);
+  token->start = ptr;
+  token->len = 0;
+
+  if (*ptr == '\0') {
+    token->type = TOKEN_END;
+    return ptr;
+  }
+
+  if (*ptr == '<') {
+    // Is it an IRI or the less-than operator?
+    for (end = ptr + 1; *end && *end != '>' && !isspace((unsigned char) *end); end++)
+      continue;
+    if (*end == '>') {
+      token->type = TOKEN_IRI;
+      token->len = end + 1 - ptr;
+      return end + 1;
+    }
+  }
+
+  if (*ptr == '"' || *ptr == '\'') {
+    end = scan_string(ptr);
+    if (!end)
+      return NULL;
+    token->type = TOKEN_STRING;
+  } else if (*ptr == '?' || *ptr == '$') {
+    for (end = ptr + 1; isalnum((unsigned char) *end) || *end == '_'; end++)
+      continue;
+    token->type = TOKEN_VAR;
+  } else if (is_single_punct(*ptr) && !(*ptr == '.' && isdigit((unsigned char) ptr[1]))) {
+    end = ptr + 1;
+    token->type = TOKEN_PUNCT;
+  } else if (is_operator(*ptr)) {
+    for (end = ptr + 1; is_operator(*end); end++)
+      continue;
+    token->type = TOKEN_PUNCT;
+  } else {
+    for (end = ptr + 1; *end && !isspace((unsigned char) *end); end++) {
+      // Full stops are allowed inside of names and numbers, but not at the end
+      if (*end == '.' && (isalnum((unsigned char) end[1]) || end[1] == '_' || end[1] == ':'))
+        continue;
+      if (*end == '-')
+        continue;
+      if (*end == '#' || *end == '"' || *end == '\'' || is_operator(*end) || is_single_punct(*end))
+        break;
+    }
+    token->type = TOKEN_WORD;
+  }
+
+  token->len = end - ptr;
+  return end;
+}
+
+// Case-insensitive comparison of a keyword or punctuation token
+int lexer_token_is(const lexer_token_t * token, const char *str)
+{
+  if (token->type != TOKEN_WORD && token->type != TOKEN_PUNCT)
+    return 0;
+  return (strlen(str) == token->len && strncasecmp(token->start, str, token->len) == 0);
+}
+
+// Returns a newly allocated copy of a token's text; IRIs and variables are stripped
+// of their delimiters.
+char *lexer_token_value(const lexer_token_t * token)
+{
+  const char *start = token->start;
+  size_t len = token->len;
+  char *value = NULL;
+
+  if (token->type == TOKEN_IRI && len >= 2) {
+    start++;
+    len -= 2;
+  } else if (token->type == TOKEN_VAR && len >= 1) {
+    start++;
+    len--;
+  }
+
+  value = malloc(len + 1);
+  if (value) {
+    memcpy(value, start, len);
+    value[len] = '\0';
+  }
+
+  return value;
+}
+
+// Skip over any PREFIX and BASE declarations at the start of a query
+const char *lexer_skip_prologue(const char *ptr)
+{
+  lexer_token_t token;
+  const char *next;
+
+  while (ptr) {
+    next = lexer_next(ptr, &token);
+    if (lexer_token_is(&token, "BASE")) {
+      next = lexer_next(next, &token);
+    } else if (lexer_token_is(&token, "PREFIX")) {
+      next = lexer_next(next, &token);
+      if (next)
+        next = lexer_next(next, &token);
+    } else {
+      break;
+    }
+    ptr = next;
+  }
+
+  return ptr;
+}
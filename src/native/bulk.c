@@ -0,0 +1,704 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "native_private.h"
+
+
+// Builds a snapshot from more quads than fit in memory, using several threads.
+//
+// Each thread has a worker, which interns terms in one of the dictionary
+// shards and collects quads. When a worker's buffer is full, it is sorted
+// into the order of each index and written to a run file. Finally, the runs
+// for each index are merged in parallel, removing duplicates.
+//
+// While loading, a term's ID is its position in its shard and the shard
+// number. These IDs are in the same order as the IDs in the final,
+// merged, dictionary, so the runs can be sorted before the final IDs
+// are known. Inline IDs are the same while loading and afterwards.
+
+#define NATIVE_BULK_SHARD_BITS    (6)
+#define NATIVE_BULK_SHARDS        (1 << NATIVE_BULK_SHARD_BITS)
+#define NATIVE_BULK_CACHE_SIZE    (4096)
+#define NATIVE_BULK_READ_BUFFER   (256 * 1024)
+
+typedef struct native_bulk_shard_s {
+  native_dict_t *dict;
+  pthread_mutex_t lock;
+} native_bulk_shard_t;
+
+struct native_bulk_s {
+  native_bulk_shard_t shards[NATIVE_BULK_SHARDS];
+  char *tmpdir;
+  size_t run_size;
+  pthread_mutex_t lock;         // Protects the fields below
+  unsigned long run_count;
+  size_t quad_count;
+
+  // Used while merging
+  native_id_t *level_base;      // Number of terms in lower levels
+  uint64_t *level_shards;       // Bitmask of shards that have a term at each level
+  size_t level_count;
+};
+
+typedef struct native_bulk_cache_s {
+  uint64_t hash;
+  native_id_t id;
+  unsigned char *key;
+  size_t len;
+} native_bulk_cache_t;
+
+struct native_bulk_worker_s {
+  native_bulk_t *bulk;
+  native_id_t *quads;
+  native_id_t *sorted;
+  size_t count;
+  native_bulk_cache_t cache[NATIVE_BULK_CACHE_SIZE];
+};
+
+
+static uint64_t bulk_hash(const unsigned char *key, size_t len)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= key[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+static int popcount(uint64_t bits)
+{
+  int count = 0;
+
+  while (bits) {
+    bits &= bits - 1;
+    count++;
+  }
+
+  return count;
+}
+
+static char *run_filename(native_bulk_t * bulk, unsigned long run, int index)
+{
+  char *filename = malloc(strlen(bulk->tmpdir) + 64);
+
+  if (filename)
+    sprintf(filename, "%s/redstore-bulk-%ld-%lu.%d", bulk->tmpdir, (long) getpid(), run, index);
+
+  return filename;
+}
+
+// Run files are written to tmpdir; each holds up to run_size quads
+native_bulk_t *native_bulk_new(const char *tmpdir, size_t run_size)
+{
+  native_bulk_t *bulk = calloc(1, sizeof(native_bulk_t));
+  int i;
+
+  if (!bulk)
+    return NULL;
+
+  bulk->tmpdir = malloc(strlen(tmpdir) + 1);
+  if (!bulk->tmpdir) {
+    free(bulk);
+    return NULL;
+  }
+  strcpy(bulk->tmpdir, tmpdir);
+  bulk->run_size = run_size ? run_size : NATIVE_BULK_RUN_SIZE;
+  pthread_mutex_init(&bulk->lock, NULL);
+  for (i = 0; i < NATIVE_BULK_SHARDS; i++)
+    pthread_mutex_init(&bulk->shards[i].lock, NULL);
+
+  for (i = 0; i < NATIVE_BULK_SHARDS; i++) {
+    bulk->shards[i].dict = native_dict_new();
+    if (!bulk->shards[i].dict) {
+      native_bulk_free(bulk);
+      return NULL;
+    }
+  }
+
+  return bulk;
+}
+
+// Each thread adding quads needs its own worker
+native_bulk_worker_t *native_bulk_worker_new(native_bulk_t * bulk)
+{
+  native_bulk_worker_t *worker = calloc(1, sizeof(native_bulk_worker_t));
+
+  if (!worker)
+    return NULL;
+
+  worker->bulk = bulk;
+  worker->quads = malloc(bulk->run_size * 4 * sizeof(native_id_t));
+  worker->sorted = malloc(bulk->run_size * 4 * sizeof(native_id_t));
+  if (!worker->quads || !worker->sorted) {
+    native_bulk_worker_free(worker);
+    return NULL;
+  }
+
+  return worker;
+}
+
+static native_id_t worker_intern(native_bulk_worker_t * worker, const unsigned char *key, size_t len)
+{
+  uint64_t hash = bulk_hash(key, len);
+  native_bulk_cache_t *entry = &worker->cache[hash % NATIVE_BULK_CACHE_SIZE];
+  int shard = (int) (hash >> (64 - NATIVE_BULK_SHARD_BITS));
+  native_bulk_shard_t *s = &worker->bulk->shards[shard];
+  native_id_t id = native_inline_encode(key, len);
+
+  // Small literals don't need to go in a shard
+  if (id != NATIVE_NONE)
+    return id;
+
+  // Common terms, such as predicates, are found without taking a lock
+  if (entry->key && entry->hash == hash && entry->len == len && memcmp(entry->key, key, len) == 0)
+    return entry->id;
+
+  pthread_mutex_lock(&s->lock);
+  id = native_dict_intern(s->dict, key, len);
+  pthread_mutex_unlock(&s->lock);
+  if (id == NATIVE_NONE)
+    return NATIVE_NONE;
+
+  id = (id << NATIVE_BULK_SHARD_BITS) | (native_id_t) shard;
+
+  if (entry->len < len || !entry->key) {
+    unsigned char *tmp = realloc(entry->key, len ? len : 1);
+    if (!tmp)
+      return id;
+    entry->key = tmp;
+  }
+  memcpy(entry->key, key, len);
+  entry->len = len;
+  entry->hash = hash;
+  entry->id = id;
+
+  return id;
+}
+
+static int compare_quads(const native_id_t * qa, const native_id_t * qb)
+{
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    if (qa[i] != qb[i])
+      return qa[i] < qb[i] ? -1 : 1;
+  }
+
+  return 0;
+}
+
+static void swap_quads(native_id_t * a, native_id_t * b)
+{
+  native_id_t tmp[4];
+
+  memcpy(tmp, a, sizeof(tmp));
+  memcpy(a, b, sizeof(tmp));
+  memcpy(b, tmp, sizeof(tmp));
+}
+
+// Quicksort for arrays of quads, which is much faster than calling qsort()
+static void sort_quads(native_id_t * quads, size_t count)
+{
+  while (count > 16) {
+    native_id_t pivot[4];
+    size_t i = 0, j = count - 1, mid = count / 2;
+
+    // Median of three
+    if (compare_quads(&quads[mid * 4], &quads[0]) < 0)
+      swap_quads(&quads[mid * 4], &quads[0]);
+    if (compare_quads(&quads[j * 4], &quads[0]) < 0)
+      swap_quads(&quads[j * 4], &quads[0]);
+    if (compare_quads(&quads[j * 4], &quads[mid * 4]) < 0)
+      swap_quads(&quads[j * 4], &quads[mid * 4]);
+    memcpy(pivot, &quads[mid * 4], sizeof(pivot));
+
+    while (1) {
+      while (compare_quads(&quads[i * 4], pivot) < 0)
+        i++;
+      while (compare_quads(pivot, &quads[j * 4]) < 0)
+        j--;
+      if (i >= j)
+        break;
+      swap_quads(&quads[i * 4], &quads[j * 4]);
+      i++;
+      j--;
+    }
+
+    // Recurse into the smaller part, to limit the depth of the stack
+    if (j + 1 < count - j - 1) {
+      sort_quads(quads, j + 1);
+      quads += (j + 1) * 4;
+      count -= j + 1;
+    } else {
+      sort_quads(&quads[(j + 1) * 4], count - j - 1);
+      count = j + 1;
+    }
+  }
+
+  // Insertion sort for short ranges
+  if (count > 1) {
+    size_t i, j;
+    for (i = 1; i < count; i++) {
+      for (j = i; j > 0 && compare_quads(&quads[(j - 1) * 4], &quads[j * 4]) > 0; j--)
+        swap_quads(&quads[(j - 1) * 4], &quads[j * 4]);
+    }
+  }
+}
+
+// Sorts the worker's quads into the order of each index, and writes them out
+static int worker_write_runs(native_bulk_worker_t * worker)
+{
+  native_bulk_t *bulk = worker->bulk;
+  unsigned long run;
+  int index, err = 0;
+
+  if (worker->count == 0)
+    return 0;
+
+  pthread_mutex_lock(&bulk->lock);
+  run = bulk->run_count++;
+  bulk->quad_count += worker->count;
+  pthread_mutex_unlock(&bulk->lock);
+
+  for (index = 0; index < NATIVE_INDEX_COUNT && !err; index++) {
+    const int *order = native_orders[index];
+    char *filename = run_filename(bulk, run, index);
+    FILE *file = NULL;
+    size_t i, count = 0;
+
+    for (i = 0; i < worker->count; i++) {
+      native_id_t *quad = &worker->quads[i * 4];
+      native_id_t *entry = &worker->sorted[i * 4];
+      entry[0] = quad[order[0]];
+      entry[1] = quad[order[1]];
+      entry[2] = quad[order[2]];
+      entry[3] = quad[order[3]];
+    }
+    sort_quads(worker->sorted, worker->count);
+
+    // Remove duplicates within the run
+    for (i = 0; i < worker->count; i++) {
+      if (count && compare_quads(&worker->sorted[(count - 1) * 4], &worker->sorted[i * 4]) == 0)
+        continue;
+      if (count != i)
+        memcpy(&worker->sorted[count * 4], &worker->sorted[i * 4], 4 * sizeof(native_id_t));
+      count++;
+    }
+
+    file = filename ? fopen(filename, "wb") : NULL;
+    if (!file || fwrite(worker->sorted, 4 * sizeof(native_id_t), count, file) != count)
+      err = 1;
+    if (file && fclose(file))
+      err = 1;
+    if (filename)
+      free(filename);
+  }
+
+  worker->count = 0;
+
+  return err;
+}
+
+// Adds a quad, given the key of each term; a NULL graph key means the default graph
+int native_bulk_worker_add(native_bulk_worker_t * worker, const unsigned char *keys[4],
+                           const size_t lens[4])
+{
+  native_id_t *quad = NULL;
+  int i;
+
+  if (worker->count == worker->bulk->run_size && worker_write_runs(worker))
+    return 1;
+
+  quad = &worker->quads[worker->count * 4];
+  for (i = 0; i < 4; i++) {
+    if (keys[i]) {
+      quad[i] = worker_intern(worker, keys[i], lens[i]);
+      if (quad[i] == NATIVE_NONE)
+        return 1;
+    } else if (i == NATIVE_G) {
+      quad[i] = NATIVE_NONE;
+    } else {
+      return 1;
+    }
+  }
+  worker->count++;
+
+  return 0;
+}
+
+// Writes out any remaining quads; returns non-zero if that failed
+int native_bulk_worker_free(native_bulk_worker_t * worker)
+{
+  int err = 0, i;
+
+  if (!worker)
+    return 0;
+
+  if (worker->quads)
+    err = worker_write_runs(worker);
+
+  for (i = 0; i < NATIVE_BULK_CACHE_SIZE; i++) {
+    if (worker->cache[i].key)
+      free(worker->cache[i].key);
+  }
+  if (worker->quads)
+    free(worker->quads);
+  if (worker->sorted)
+    free(worker->sorted);
+  free(worker);
+
+  return err;
+}
+
+// Returns the number of quads added so far, including duplicates
+size_t native_bulk_count(native_bulk_t * bulk)
+{
+  size_t count;
+
+  pthread_mutex_lock(&bulk->lock);
+  count = bulk->quad_count;
+  pthread_mutex_unlock(&bulk->lock);
+
+  return count;
+}
+
+// Terms are numbered level by level: the first term in each shard, then the second...
+static native_dict_t *merge_dicts(native_bulk_t * bulk)
+{
+  native_dict_t *dict = native_dict_new();
+  native_id_t base = 0;
+  size_t level;
+  int shard;
+
+  if (!dict)
+    return NULL;
+
+  for (shard = 0; shard < NATIVE_BULK_SHARDS; shard++) {
+    size_t count = native_dict_count(bulk->shards[shard].dict);
+    if (count > bulk->level_count)
+      bulk->level_count = count;
+  }
+
+  bulk->level_base = calloc(bulk->level_count + 1, sizeof(native_id_t));
+  bulk->level_shards = calloc(bulk->level_count + 1, sizeof(uint64_t));
+  if (!bulk->level_base || !bulk->level_shards)
+    goto FAIL;
+
+  for (level = 1; level <= bulk->level_count; level++) {
+    bulk->level_base[level] = base;
+    for (shard = 0; shard < NATIVE_BULK_SHARDS; shard++) {
+      native_dict_t *shard_dict = bulk->shards[shard].dict;
+      const unsigned char *key = NULL;
+      size_t len = 0;
+
+      key = native_dict_get(shard_dict, (native_id_t) level, &len);
+      if (!key)
+        continue;
+
+      bulk->level_shards[level] |= (uint64_t) 1 << shard;
+      if (native_dict_intern(dict, key, len) != base + 1)
+        goto FAIL;
+      base++;
+    }
+  }
+
+  return dict;
+
+FAIL:
+  native_dict_free(dict);
+  return NULL;
+}
+
+static native_id_t final_id(native_bulk_t * bulk, native_id_t id)
+{
+  native_id_t level = id >> NATIVE_BULK_SHARD_BITS;
+  int shard = (int) (id & (NATIVE_BULK_SHARDS - 1));
+
+  if (id == NATIVE_NONE || NATIVE_ID_IS_INLINE(id))
+    return id;
+
+  return bulk->level_base[level] + 1 +
+      popcount(bulk->level_shards[level] & (((uint64_t) 1 << shard) - 1));
+}
+
+typedef struct native_bulk_reader_s {
+  FILE *file;
+  char *buffer;
+  native_id_t quad[4];
+} native_bulk_reader_t;
+
+typedef struct native_bulk_merge_s {
+  native_bulk_t *bulk;
+  int index;
+  char *filename;
+  size_t count;
+  int err;
+} native_bulk_merge_t;
+
+static int reader_next(native_bulk_reader_t * reader)
+{
+  return fread(reader->quad, sizeof(native_id_t), 4, reader->file) == 4;
+}
+
+static void heap_down(native_bulk_reader_t ** heap, size_t size, size_t i)
+{
+  while (1) {
+    size_t smallest = i, left = i * 2 + 1, right = i * 2 + 2;
+    native_bulk_reader_t *tmp;
+
+    if (left < size && compare_quads(heap[left]->quad, heap[smallest]->quad) < 0)
+      smallest = left;
+    if (right < size && compare_quads(heap[right]->quad, heap[smallest]->quad) < 0)
+      smallest = right;
+    if (smallest == i)
+      break;
+
+    tmp = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = tmp;
+    i = smallest;
+  }
+}
+
+// Merges the runs for one index into a single file, with the final IDs
+static void *merge_index(void *arg)
+{
+  native_bulk_merge_t *merge = arg;
+  native_bulk_t *bulk = merge->bulk;
+  native_bulk_reader_t *readers = NULL;
+  native_bulk_reader_t **heap = NULL;
+  native_id_t last[4] = { 0, 0, 0, 0 };
+  size_t size = 0, i;
+  FILE *output = NULL;
+
+  merge->err = 1;
+  readers = calloc(bulk->run_count, sizeof(native_bulk_reader_t));
+  heap = calloc(bulk->run_count, sizeof(native_bulk_reader_t *));
+  if ((bulk->run_count && (!readers || !heap)) || !merge->filename)
+    goto CLEANUP;
+
+  for (i = 0; i < bulk->run_count; i++) {
+    char *filename = run_filename(bulk, i, merge->index);
+    readers[i].file = filename ? fopen(filename, "rb") : NULL;
+    if (filename)
+      free(filename);
+    if (!readers[i].file)
+      goto CLEANUP;
+    readers[i].buffer = malloc(NATIVE_BULK_READ_BUFFER);
+    if (readers[i].buffer)
+      setvbuf(readers[i].file, readers[i].buffer, _IOFBF, NATIVE_BULK_READ_BUFFER);
+    if (reader_next(&readers[i]))
+      heap[size++] = &readers[i];
+  }
+
+  for (i = size; i > 0; i--)
+    heap_down(heap, size, i - 1);
+
+  output = fopen(merge->filename, "wb");
+  if (!output)
+    goto CLEANUP;
+
+  merge->count = 0;
+  while (size > 0) {
+    native_bulk_reader_t *reader = heap[0];
+
+    if (merge->count == 0 || compare_quads(last, reader->quad) != 0) {
+      native_id_t entry[4];
+      memcpy(last, reader->quad, sizeof(last));
+      for (i = 0; i < 4; i++)
+        entry[i] = final_id(bulk, reader->quad[i]);
+      if (fwrite(entry, sizeof(native_id_t), 4, output) != 4)
+        goto CLEANUP;
+      merge->count++;
+    }
+
+    if (!reader_next(reader))
+      heap[0] = heap[--size];
+    heap_down(heap, size, 0);
+  }
+
+  if (fclose(output) == 0)
+    merge->err = 0;
+  output = NULL;
+
+CLEANUP:
+  if (output)
+    fclose(output);
+  if (readers) {
+    for (i = 0; i < bulk->run_count; i++) {
+      if (readers[i].file)
+        fclose(readers[i].file);
+      if (readers[i].buffer)
+        free(readers[i].buffer);
+    }
+    free(readers);
+  }
+  if (heap)
+    free(heap);
+
+  return NULL;
+}
+
+static int append_file(FILE * output, const char *filename)
+{
+  char buffer[NATIVE_BULK_READ_BUFFER];
+  FILE *input = fopen(filename, "rb");
+  size_t len;
+  int err = 0;
+
+  if (!input)
+    return 1;
+
+  while ((len = fread(buffer, 1, sizeof(buffer), input)) > 0) {
+    if (fwrite(buffer, 1, len, output) != len) {
+      err = 1;
+      break;
+    }
+  }
+  if (ferror(input))
+    err = 1;
+  fclose(input);
+
+  return err;
+}
+
+// Merges the runs and writes a snapshot that can be opened with
+// native_store_open_snapshot(). All the workers must have been freed first.
+int native_bulk_write_snapshot(native_bulk_t * bulk, const char *filename)
+{
+  native_bulk_merge_t merges[NATIVE_INDEX_COUNT];
+  pthread_t threads[NATIVE_INDEX_COUNT];
+  native_dict_t *dict = NULL;
+  char *tmp_filename = NULL;
+  FILE *file = NULL;
+  int index, started = 0, err = 1;
+
+  memset(merges, 0, sizeof(merges));
+
+  dict = merge_dicts(bulk);
+  if (!dict)
+    goto CLEANUP;
+
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    merges[index].bulk = bulk;
+    merges[index].index = index;
+    merges[index].filename = run_filename(bulk, bulk->run_count, index);
+  }
+
+  for (started = 0; started < NATIVE_INDEX_COUNT; started++) {
+    if (pthread_create(&threads[started], NULL, merge_index, &merges[started]))
+      break;
+  }
+  for (index = 0; index < started; index++)
+    pthread_join(threads[index], NULL);
+  if (started < NATIVE_INDEX_COUNT)
+    goto CLEANUP;
+
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    if (merges[index].err || merges[index].count != merges[0].count)
+      goto CLEANUP;
+  }
+
+  tmp_filename = malloc(strlen(filename) + 5);
+  if (!tmp_filename)
+    goto CLEANUP;
+  sprintf(tmp_filename, "%s.tmp", filename);
+
+  file = fopen(tmp_filename, "wb");
+  if (!file || native_snapshot_write_header(file, dict, merges[0].count))
+    goto CLEANUP;
+
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    if (append_file(file, merges[index].filename))
+      goto CLEANUP;
+  }
+
+  if (fflush(file) || fsync(fileno(file)))
+    goto CLEANUP;
+
+  err = fclose(file);
+  file = NULL;
+  if (!err)
+    err = rename(tmp_filename, filename);
+
+CLEANUP:
+  if (file)
+    fclose(file);
+  if (tmp_filename) {
+    if (err)
+      unlink(tmp_filename);
+    free(tmp_filename);
+  }
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    if (merges[index].filename) {
+      unlink(merges[index].filename);
+      free(merges[index].filename);
+    }
+  }
+  if (dict)
+    native_dict_free(dict);
+
+  return err;
+}
+
+// Frees the dictionaries and deletes the run files
+void native_bulk_free(native_bulk_t * bulk)
+{
+  unsigned long run;
+  int i;
+
+  if (!bulk)
+    return;
+
+  for (run = 0; run < bulk->run_count; run++) {
+    for (i = 0; i < NATIVE_INDEX_COUNT; i++) {
+      char *filename = run_filename(bulk, run, i);
+      if (filename) {
+        unlink(filename);
+        free(filename);
+      }
+    }
+  }
+
+  for (i = 0; i < NATIVE_BULK_SHARDS; i++) {
+    if (bulk->shards[i].dict)
+      native_dict_free(bulk->shards[i].dict);
+    pthread_mutex_destroy(&bulk->shards[i].lock);
+  }
+  pthread_mutex_destroy(&bulk->lock);
+
+  if (bulk->level_base)
+    free(bulk->level_base);
+  if (bulk->level_shards)
+    free(bulk->level_shards);
+  if (bulk->tmpdir)
+    free(bulk->tmpdir);
+  free(bulk);
+}
@@ -0,0 +1,370 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_private.h"
+
+
+// The term dictionary: each term is stored once, as a length-prefixed key
+// in one large buffer, and is found again using an open-addressed hash
+// table of IDs. The ID of a term is its position in the offsets array.
+//
+// Most IRIs share their namespace with many others, so the namespace,
+// everything up to the last '/' or '#', is stored once in a second,
+// smaller, table. The IRI's key is then 'N', the ID of its namespace and
+// the local name. Small typed literals don't have a key at all: their
+// value is encoded in the ID (see inline.c).
+
+// Shorter namespaces are left in the key
+#define NATIVE_DICT_MIN_NAMESPACE  (8)
+
+static uint64_t hash_key(const unsigned char *key, size_t len)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= key[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+static const unsigned char *dict_key(native_dict_t * dict, native_id_t id, size_t * len)
+{
+  const unsigned char *entry = dict->keys + dict->offsets[id];
+  uint32_t key_len;
+
+  memcpy(&key_len, entry, sizeof(key_len));
+  *len = key_len;
+
+  return entry + sizeof(key_len);
+}
+
+// Returns the slot that the key is in, or the empty slot where it should go
+static native_id_t *dict_slot(native_dict_t * dict, const unsigned char *key, size_t len)
+{
+  size_t mask = dict->slots_size - 1;
+  size_t i = (size_t) hash_key(key, len) & mask;
+
+  while (dict->slots[i] != NATIVE_NONE) {
+    size_t found_len;
+    const unsigned char *found = dict_key(dict, dict->slots[i], &found_len);
+    if (found_len == len && memcmp(found, key, len) == 0)
+      break;
+    i = (i + 1) & mask;
+  }
+
+  return &dict->slots[i];
+}
+
+static int dict_grow_slots(native_dict_t * dict)
+{
+  native_id_t *old_slots = dict->slots;
+  size_t old_size = dict->slots_size;
+  size_t i;
+
+  dict->slots_size = old_size ? old_size * 2 : 1024;
+  dict->slots = calloc(dict->slots_size, sizeof(native_id_t));
+  if (!dict->slots) {
+    dict->slots = old_slots;
+    dict->slots_size = old_size;
+    return 1;
+  }
+
+  for (i = 0; i < old_size; i++) {
+    if (old_slots[i] != NATIVE_NONE) {
+      size_t len;
+      const unsigned char *key = dict_key(dict, old_slots[i], &len);
+      *dict_slot(dict, key, len) = old_slots[i];
+    }
+  }
+
+  if (old_slots)
+    free(old_slots);
+
+  return 0;
+}
+
+static native_dict_t *dict_new(void)
+{
+  native_dict_t *dict = calloc(1, sizeof(native_dict_t));
+  if (!dict)
+    return NULL;
+
+  // ID 0 is not used
+  dict->count = 1;
+  dict->offsets_size = 1024;
+  dict->offsets = calloc(dict->offsets_size, sizeof(uint64_t));
+  if (!dict->offsets || dict_grow_slots(dict)) {
+    native_dict_free(dict);
+    return NULL;
+  }
+
+  return dict;
+}
+
+native_dict_t *native_dict_new(void)
+{
+  native_dict_t *dict = dict_new();
+  if (!dict)
+    return NULL;
+
+  dict->namespaces = dict_new();
+  if (!dict->namespaces) {
+    native_dict_free(dict);
+    return NULL;
+  }
+
+  return dict;
+}
+
+// Adds a key exactly as it is
+static native_id_t dict_intern(native_dict_t * dict, const unsigned char *key, size_t len)
+{
+  native_id_t *slot = dict_slot(dict, key, len);
+  uint32_t key_len = (uint32_t) len;
+  native_id_t id;
+
+  if (*slot != NATIVE_NONE || dict->readonly)
+    return *slot;
+
+  if (len > UINT32_MAX)
+    return NATIVE_NONE;
+
+  // Keep the hash table at most half full
+  if ((dict->count + 1) * 2 > dict->slots_size) {
+    if (dict_grow_slots(dict))
+      return NATIVE_NONE;
+    slot = dict_slot(dict, key, len);
+  }
+
+  if (dict->count == dict->offsets_size) {
+    uint64_t *tmp = realloc(dict->offsets, dict->offsets_size * 2 * sizeof(uint64_t));
+    if (!tmp)
+      return NATIVE_NONE;
+    dict->offsets = tmp;
+    dict->offsets_size *= 2;
+  }
+
+  if (dict->keys_len + sizeof(key_len) + len > dict->keys_size) {
+    size_t size = dict->keys_size ? dict->keys_size : 65536;
+    unsigned char *tmp;
+    while (dict->keys_len + sizeof(key_len) + len > size)
+      size *= 2;
+    tmp = realloc(dict->keys, size);
+    if (!tmp)
+      return NATIVE_NONE;
+    dict->keys = tmp;
+    dict->keys_size = size;
+  }
+
+  id = dict->count++;
+  dict->offsets[id] = dict->keys_len;
+  memcpy(dict->keys + dict->keys_len, &key_len, sizeof(key_len));
+  memcpy(dict->keys + dict->keys_len + sizeof(key_len), key, len);
+  dict->keys_len += sizeof(key_len) + len;
+  *slot = id;
+
+  return id;
+}
+
+// Returns the length of the namespace of an IRI key, not counting the
+// 'U', or 0 if the IRI should be stored as it is
+static size_t namespace_len(const unsigned char *key, size_t len)
+{
+  size_t i;
+
+  if (len < 1 || key[0] != 'U')
+    return 0;
+
+  for (i = len - 1; i > 0; i--) {
+    if (key[i] == '/' || key[i] == '#')
+      break;
+  }
+
+  return (i >= NATIVE_DICT_MIN_NAMESPACE) ? i : 0;
+}
+
+// Looks up, or adds, the key of an IRI in a namespace
+static native_id_t dict_namespaced(native_dict_t * dict, native_id_t namespace,
+                                   const unsigned char *local, size_t local_len, int create)
+{
+  unsigned char buffer[256], *key = buffer;
+  uint32_t ns = (uint32_t) namespace;
+  size_t len = 1 + sizeof(ns) + local_len;
+  native_id_t id;
+
+  if (len > sizeof(buffer)) {
+    key = malloc(len);
+    if (!key)
+      return NATIVE_NONE;
+  }
+
+  key[0] = 'N';
+  memcpy(key + 1, &ns, sizeof(ns));
+  if (local_len)
+    memcpy(key + 1 + sizeof(ns), local, local_len);
+
+  if (create) {
+    id = dict_intern(dict, key, len);
+  } else {
+    id = *dict_slot(dict, key, len);
+  }
+
+  if (key != buffer)
+    free(key);
+
+  return id;
+}
+
+// Returns the ID of a term, or NATIVE_NONE if it isn't in the dictionary.
+// Keys start with 'U', 'B' or 'L'.
+native_id_t native_dict_lookup(native_dict_t * dict, const unsigned char *key, size_t len)
+{
+  native_id_t id = native_inline_encode(key, len);
+  size_t ns_len = namespace_len(key, len);
+
+  if (id != NATIVE_NONE)
+    return id;
+
+  if (ns_len) {
+    native_id_t namespace = *dict_slot(dict->namespaces, key + 1, ns_len);
+    if (namespace == NATIVE_NONE)
+      return NATIVE_NONE;
+    if (namespace <= UINT32_MAX)
+      return dict_namespaced(dict, namespace, key + 1 + ns_len, len - 1 - ns_len, 0);
+  }
+
+  return *dict_slot(dict, key, len);
+}
+
+// Returns the ID of a term, adding it if necessary, or NATIVE_NONE on error
+native_id_t native_dict_intern(native_dict_t * dict, const unsigned char *key, size_t len)
+{
+  native_id_t id = native_inline_encode(key, len);
+  size_t ns_len = namespace_len(key, len);
+
+  if (id != NATIVE_NONE)
+    return id;
+
+  if (dict->readonly)
+    return native_dict_lookup(dict, key, len);
+
+  if (ns_len) {
+    native_id_t namespace = dict_intern(dict->namespaces, key + 1, ns_len);
+    if (namespace == NATIVE_NONE)
+      return NATIVE_NONE;
+    if (namespace <= UINT32_MAX)
+      return dict_namespaced(dict, namespace, key + 1 + ns_len, len - 1 - ns_len, 1);
+  }
+
+  return dict_intern(dict, key, len);
+}
+
+static unsigned char *dict_buffer(native_dict_t * dict, size_t len)
+{
+  if (len > dict->buffer_size) {
+    unsigned char *tmp = realloc(dict->buffer, len);
+    if (!tmp)
+      return NULL;
+    dict->buffer = tmp;
+    dict->buffer_size = len;
+  }
+
+  return dict->buffer;
+}
+
+// Returns the key of a term, or NULL if there is no such ID. The key may
+// be in a buffer owned by the dictionary, which is reused by the next call.
+const unsigned char *native_dict_get(native_dict_t * dict, native_id_t id, size_t * len)
+{
+  const unsigned char *key = NULL, *namespace = NULL;
+  unsigned char *buffer = NULL;
+  size_t key_len, ns_len;
+  uint32_t ns;
+
+  if (NATIVE_ID_IS_INLINE(id)) {
+    buffer = dict_buffer(dict, NATIVE_INLINE_MAX_KEY);
+    if (!buffer)
+      return NULL;
+    *len = native_inline_decode(id, buffer, NATIVE_INLINE_MAX_KEY);
+    return *len ? buffer : NULL;
+  }
+
+  if (id == NATIVE_NONE || id >= dict->count)
+    return NULL;
+
+  key = dict_key(dict, id, &key_len);
+  if (key_len < 1 + sizeof(ns) || key[0] != 'N' || !dict->namespaces) {
+    *len = key_len;
+    return key;
+  }
+
+  // Put the namespace back in front of the local name
+  memcpy(&ns, key + 1, sizeof(ns));
+  if (ns == NATIVE_NONE || ns >= dict->namespaces->count)
+    return NULL;
+  namespace = dict_key(dict->namespaces, ns, &ns_len);
+  key_len -= 1 + sizeof(ns);
+
+  buffer = dict_buffer(dict, 1 + ns_len + key_len);
+  if (!buffer)
+    return NULL;
+  buffer[0] = 'U';
+  memcpy(buffer + 1, namespace, ns_len);
+  if (key_len)
+    memcpy(buffer + 1 + ns_len, key + 1 + sizeof(ns), key_len);
+  *len = 1 + ns_len + key_len;
+
+  return buffer;
+}
+
+// Returns the number of terms in the dictionary
+size_t native_dict_count(native_dict_t * dict)
+{
+  return dict->count - 1;
+}
+
+void native_dict_free(native_dict_t * dict)
+{
+  if (!dict)
+    return;
+
+  // The arrays of a read-only dictionary belong to a snapshot
+  if (!dict->readonly) {
+    if (dict->keys)
+      free(dict->keys);
+    if (dict->offsets)
+      free(dict->offsets);
+    if (dict->slots)
+      free(dict->slots);
+  }
+
+  if (dict->namespaces)
+    native_dict_free(dict->namespaces);
+  if (dict->buffer)
+    free(dict->buffer);
+  free(dict);
+}
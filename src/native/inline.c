@@ -0,0 +1,202 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "native_private.h"
+
+
+// Small typed literals are encoded in their ID, instead of being given an
+// entry in the dictionary. The top bit of an inline ID is set, the next
+// seven bits are the datatype and the other 56 bits are the value. Only
+// values in their canonical form are encoded, so that exactly the same key
+// can be made again from the ID. For each datatype, the IDs are in the
+// same order as the values.
+
+#define NATIVE_INLINE_TYPE_SHIFT    (56)
+#define NATIVE_INLINE_VALUE_MASK    (((native_id_t) 1 << NATIVE_INLINE_TYPE_SHIFT) - 1)
+#define NATIVE_INLINE_INTEGER_BIAS  ((native_id_t) 1 << 55)
+
+#define NATIVE_INLINE_INTEGER       (1)
+#define NATIVE_INLINE_BOOLEAN       (2)
+#define NATIVE_INLINE_DATE          (3)
+#define NATIVE_INLINE_TYPE_COUNT    (4)
+
+#define XSD_NS "http://www.w3.org/2001/XMLSchema#"
+
+static const char *const inline_datatypes[NATIVE_INLINE_TYPE_COUNT] = {
+  NULL,
+  XSD_NS "integer",
+  XSD_NS "boolean",
+  XSD_NS "date"
+};
+
+
+static native_id_t inline_id(int type, native_id_t value)
+{
+  return NATIVE_INLINE_BIT | ((native_id_t) type << NATIVE_INLINE_TYPE_SHIFT) | value;
+}
+
+static int is_digit(unsigned char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+// Up to 17 digits, without a plus sign, leading zeros or a negative zero
+static native_id_t encode_integer(const unsigned char *str, size_t len)
+{
+  int negative = (len > 0 && str[0] == '-');
+  uint64_t value = 0;
+  size_t i;
+
+  str += negative;
+  len -= negative;
+  if (len == 0 || len > 17 || (str[0] == '0' && (len > 1 || negative)))
+    return NATIVE_NONE;
+
+  for (i = 0; i < len; i++) {
+    if (!is_digit(str[i]))
+      return NATIVE_NONE;
+    value = value * 10 + (str[i] - '0');
+  }
+
+  if (negative) {
+    if (value > NATIVE_INLINE_INTEGER_BIAS)
+      return NATIVE_NONE;
+    return inline_id(NATIVE_INLINE_INTEGER, NATIVE_INLINE_INTEGER_BIAS - value);
+  } else {
+    if (value >= NATIVE_INLINE_INTEGER_BIAS)
+      return NATIVE_NONE;
+    return inline_id(NATIVE_INLINE_INTEGER, NATIVE_INLINE_INTEGER_BIAS + value);
+  }
+}
+
+static native_id_t encode_boolean(const unsigned char *str, size_t len)
+{
+  if (len == 4 && memcmp(str, "true", 4) == 0)
+    return inline_id(NATIVE_INLINE_BOOLEAN, 1);
+  if (len == 5 && memcmp(str, "false", 5) == 0)
+    return inline_id(NATIVE_INLINE_BOOLEAN, 0);
+
+  return NATIVE_NONE;
+}
+
+// YYYY-MM-DD, without a timezone
+static native_id_t encode_date(const unsigned char *str, size_t len)
+{
+  unsigned int year, month, day;
+  size_t i;
+
+  if (len != 10 || str[4] != '-' || str[7] != '-')
+    return NATIVE_NONE;
+  for (i = 0; i < len; i++) {
+    if (i != 4 && i != 7 && !is_digit(str[i]))
+      return NATIVE_NONE;
+  }
+
+  year = (str[0] - '0') * 1000 + (str[1] - '0') * 100 + (str[2] - '0') * 10 + (str[3] - '0');
+  month = (str[5] - '0') * 10 + (str[6] - '0');
+  day = (str[8] - '0') * 10 + (str[9] - '0');
+  if (month < 1 || month > 12 || day < 1 || day > 31)
+    return NATIVE_NONE;
+
+  return inline_id(NATIVE_INLINE_DATE, ((native_id_t) year << 9) | (month << 5) | day);
+}
+
+// Returns the inline ID for a literal key, or NATIVE_NONE if it has to go in the dictionary
+native_id_t native_inline_encode(const unsigned char *key, size_t len)
+{
+  const unsigned char *datatype = NULL, *value = NULL;
+  size_t datatype_len;
+  int type;
+
+  // Literals without a language are "L\0<datatype>\0<value>"
+  if (len < 3 || key[0] != 'L' || key[1] != '\0')
+    return NATIVE_NONE;
+
+  datatype = key + 2;
+  value = memchr(datatype, '\0', len - 2);
+  if (!value)
+    return NATIVE_NONE;
+  datatype_len = value - datatype;
+  value++;
+
+  for (type = 1; type < NATIVE_INLINE_TYPE_COUNT; type++) {
+    if (strlen(inline_datatypes[type]) == datatype_len &&
+        memcmp(inline_datatypes[type], datatype, datatype_len) == 0)
+      break;
+  }
+
+  switch (type) {
+  case NATIVE_INLINE_INTEGER:
+    return encode_integer(value, key + len - value);
+  case NATIVE_INLINE_BOOLEAN:
+    return encode_boolean(value, key + len - value);
+  case NATIVE_INLINE_DATE:
+    return encode_date(value, key + len - value);
+  }
+
+  return NATIVE_NONE;
+}
+
+// Writes the key for an inline ID into a buffer of at least NATIVE_INLINE_MAX_KEY
+// bytes; returns the length of the key, or 0 if the ID isn't a valid inline ID
+size_t native_inline_decode(native_id_t id, unsigned char *key, size_t size)
+{
+  int type = (int) ((id & ~NATIVE_INLINE_BIT) >> NATIVE_INLINE_TYPE_SHIFT);
+  native_id_t value = id & NATIVE_INLINE_VALUE_MASK;
+  char str[32];
+  size_t datatype_len, len;
+
+  if (!NATIVE_ID_IS_INLINE(id) || type < 1 || type >= NATIVE_INLINE_TYPE_COUNT)
+    return 0;
+
+  switch (type) {
+  case NATIVE_INLINE_INTEGER:
+    if (value >= NATIVE_INLINE_INTEGER_BIAS) {
+      sprintf(str, "%llu", (unsigned long long) (value - NATIVE_INLINE_INTEGER_BIAS));
+    } else {
+      sprintf(str, "-%llu", (unsigned long long) (NATIVE_INLINE_INTEGER_BIAS - value));
+    }
+    break;
+  case NATIVE_INLINE_BOOLEAN:
+    strcpy(str, value ? "true" : "false");
+    break;
+  case NATIVE_INLINE_DATE:
+    sprintf(str, "%04u-%02u-%02u", (unsigned int) (value >> 9) % 10000,
+            (unsigned int) (value >> 5) & 15, (unsigned int) value & 31);
+    break;
+  }
+
+  datatype_len = strlen(inline_datatypes[type]);
+  len = 2 + datatype_len + 1 + strlen(str);
+  if (len > size)
+    return 0;
+
+  key[0] = 'L';
+  key[1] = '\0';
+  memcpy(key + 2, inline_datatypes[type], datatype_len);
+  key[2 + datatype_len] = '\0';
+  memcpy(key + 3 + datatype_len, str, strlen(str));
+
+  return len;
+}
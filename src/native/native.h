@@ -0,0 +1,103 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#ifndef _NATIVE_H_
+#define _NATIVE_H_
+
+// Every term is given a 64-bit ID by the dictionary; 0 is never used for
+// a term, so it means the default graph in a quad and 'any' in a pattern
+typedef uint64_t native_id_t;
+
+#define NATIVE_NONE     ((native_id_t)0)
+
+// Small typed literals are encoded in the ID itself, with the top bit set,
+// and have no entry in the dictionary
+#define NATIVE_INLINE_BIT           ((native_id_t)1 << 63)
+#define NATIVE_ID_IS_INLINE(id)     (((id) & NATIVE_INLINE_BIT) != 0)
+
+// Size of a buffer that can hold the key for any inline ID
+#define NATIVE_INLINE_MAX_KEY       (128)
+
+// Positions of the terms in a quad
+#define NATIVE_S        (0)
+#define NATIVE_P        (1)
+#define NATIVE_O        (2)
+#define NATIVE_G        (3)
+
+// GSPO, GPOS, GOSP, SPOG, POSG and OSPG
+#define NATIVE_INDEX_COUNT  (6)
+
+// Pending changes are merged into the indexes once there are this many
+#define NATIVE_MIN_PENDING  (4096)
+
+// Default number of quads in each sorted run written by a bulk load
+#define NATIVE_BULK_RUN_SIZE  (1024 * 1024)
+
+
+typedef struct native_dict_s native_dict_t;
+typedef struct native_store_s native_store_t;
+typedef struct native_cursor_s native_cursor_t;
+typedef struct native_bulk_s native_bulk_t;
+typedef struct native_bulk_worker_s native_bulk_worker_t;
+
+
+native_dict_t *native_dict_new(void);
+native_id_t native_dict_lookup(native_dict_t * dict, const unsigned char *key, size_t len);
+native_id_t native_dict_intern(native_dict_t * dict, const unsigned char *key, size_t len);
+// The key returned is only valid until the next call to native_dict_get() or
+// native_dict_intern() on the same dictionary; copy it to keep it for longer
+const unsigned char *native_dict_get(native_dict_t * dict, native_id_t id, size_t * len);
+size_t native_dict_count(native_dict_t * dict);
+void native_dict_free(native_dict_t * dict);
+
+native_id_t native_inline_encode(const unsigned char *key, size_t len);
+size_t native_inline_decode(native_id_t id, unsigned char *key, size_t size);
+
+native_store_t *native_store_new(void);
+native_dict_t *native_store_get_dict(native_store_t * store);
+int native_store_add(native_store_t * store, const native_id_t quad[4]);
+int native_store_remove(native_store_t * store, const native_id_t quad[4]);
+int native_store_contains(native_store_t * store, const native_id_t quad[4]);
+size_t native_store_remove_graph(native_store_t * store, native_id_t graph);
+size_t native_store_size(native_store_t * store);
+int native_store_flush(native_store_t * store);
+void native_store_free(native_store_t * store);
+
+int native_store_write_snapshot(native_store_t * store, const char *filename);
+native_store_t *native_store_open_snapshot(const char *filename);
+int native_store_is_readonly(native_store_t * store);
+
+native_cursor_t *native_store_find(native_store_t * store, const native_id_t pattern[4]);
+native_cursor_t *native_store_graphs(native_store_t * store);
+int native_cursor_next(native_cursor_t * cursor, native_id_t quad[4]);
+void native_cursor_free(native_cursor_t * cursor);
+
+native_bulk_t *native_bulk_new(const char *tmpdir, size_t run_size);
+native_bulk_worker_t *native_bulk_worker_new(native_bulk_t * bulk);
+int native_bulk_worker_add(native_bulk_worker_t * worker, const unsigned char *keys[4],
+                           const size_t lens[4]);
+int native_bulk_worker_free(native_bulk_worker_t * worker);
+size_t native_bulk_count(native_bulk_t * bulk);
+int native_bulk_write_snapshot(native_bulk_t * bulk, const char *filename);
+void native_bulk_free(native_bulk_t * bulk);
+
+#endif
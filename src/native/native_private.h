@@ -0,0 +1,85 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+
+#include "native.h"
+
+
+#ifndef _NATIVE_PRIVATE_H_
+#define _NATIVE_PRIVATE_H_
+
+struct native_dict_s {
+  unsigned char *keys;          // Length-prefixed keys, one after another
+  size_t keys_len;
+  size_t keys_size;
+  uint64_t *offsets;            // Offset of each term's key, indexed by ID
+  size_t offsets_size;
+  native_id_t count;            // Next ID to be given out
+  native_id_t *slots;           // Hash table of IDs
+  size_t slots_size;
+  struct native_dict_s *namespaces;     // Namespaces of the IRIs; NULL in the namespace table itself
+  unsigned char *buffer;        // Keys that are put together by native_dict_get()
+  size_t buffer_size;
+  int readonly;                 // The arrays are part of a mapped snapshot
+};
+
+// A hash set of quads, used for changes that haven't been merged yet
+typedef struct native_quadset_s {
+  native_id_t *slots;           // Four IDs per slot; an empty slot has a subject of 0
+  size_t size;
+  size_t count;
+  int keylen;                   // Number of IDs in each slot that are compared
+} native_quadset_t;
+
+struct native_store_s {
+  native_dict_t *dict;
+  native_id_t *indexes[NATIVE_INDEX_COUNT];     // Four IDs per entry, in the order of the index
+  size_t count;                 // Number of entries in each index
+  native_quadset_t added;
+  native_quadset_t removed;
+  unsigned long generation;     // Incremented whenever the indexes change
+  unsigned long added_generation;       // Incremented whenever quads are added to the pending set
+  native_id_t *sorted[NATIVE_INDEX_COUNT];      // Pending additions, in the order of each index
+  size_t sorted_count[NATIVE_INDEX_COUNT];
+  unsigned long sorted_generation[NATIVE_INDEX_COUNT];  // The added_generation each was sorted at
+  void *map;                    // Mapped snapshot, if the store was opened from one
+  size_t map_len;
+};
+
+struct native_cursor_s {
+  native_store_t *store;
+  int index;
+  int prefix;                   // Number of bound terms at the start of the index order
+  int graphs;                   // Only return the first quad in each named graph
+  int single;                   // Looking for a single quad
+  native_id_t pattern[4];       // In the order of the index
+  native_id_t last[4];
+  int started;
+  size_t pos;
+  unsigned long generation;
+  unsigned long added_generation;
+  size_t added_pos;             // Position in the store's sorted pending additions
+};
+
+// The order of the terms in each index
+extern const int native_orders[NATIVE_INDEX_COUNT][4];
+
+int native_snapshot_write_header(FILE * file, native_dict_t * dict, size_t quad_count);
+
+#endif
@@ -0,0 +1,722 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "native_private.h"
+
+
+// Quads are kept in six sorted arrays, one for each order of the terms,
+// so that any pattern can be answered with a binary search followed by
+// a sequential scan. Changes are collected in two hash sets and merged
+// into the arrays in batches, once there are enough of them. Until then,
+// each scan merges the pending additions that match its pattern into the
+// quads that it reads from the arrays, and skips the pending removals.
+// The pending additions are sorted into the order of an index the first
+// time a scan needs them, and kept until more quads are added.
+
+const int native_orders[NATIVE_INDEX_COUNT][4] = {
+  {NATIVE_G, NATIVE_S, NATIVE_P, NATIVE_O},
+  {NATIVE_G, NATIVE_P, NATIVE_O, NATIVE_S},
+  {NATIVE_G, NATIVE_O, NATIVE_S, NATIVE_P},
+  {NATIVE_S, NATIVE_P, NATIVE_O, NATIVE_G},
+  {NATIVE_P, NATIVE_O, NATIVE_S, NATIVE_G},
+  {NATIVE_O, NATIVE_S, NATIVE_P, NATIVE_G}
+};
+
+// The SPOG index has the terms in the same order as a quad
+#define NATIVE_SPOG     (3)
+
+
+static void permute(int index, const native_id_t * quad, native_id_t * entry)
+{
+  int i;
+  for (i = 0; i < 4; i++)
+    entry[i] = quad[native_orders[index][i]];
+}
+
+static void unpermute(int index, const native_id_t * entry, native_id_t * quad)
+{
+  int i;
+  for (i = 0; i < 4; i++)
+    quad[native_orders[index][i]] = entry[i];
+}
+
+static int compare_prefix(const native_id_t * a, const native_id_t * b, int len)
+{
+  int i;
+  for (i = 0; i < len; i++) {
+    if (a[i] < b[i])
+      return -1;
+    if (a[i] > b[i])
+      return 1;
+  }
+  return 0;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+  return compare_prefix((const native_id_t *) a, (const native_id_t *) b, 4);
+}
+
+// Returns the position of the first entry whose prefix is not less than the key's
+static size_t lower_bound(const native_id_t * entries, size_t count, const native_id_t * key, int len)
+{
+  size_t low = 0, high = count;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (compare_prefix(&entries[mid * 4], key, len) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+// Returns the position of the first entry greater than the key
+static size_t upper_bound(const native_id_t * entries, size_t count, const native_id_t * key)
+{
+  size_t low = 0, high = count;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (compare_prefix(&entries[mid * 4], key, 4) <= 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+
+static size_t quadset_hash(native_quadset_t * set, const native_id_t * quad)
+{
+  uint64_t hash = 0;
+  int i;
+
+  for (i = 0; i < set->keylen; i++) {
+    hash ^= quad[i] + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    hash *= 0xC2B2AE3D27D4EB4FULL;
+  }
+
+  return (size_t) (hash ^ (hash >> 29));
+}
+
+// Returns the slot that the quad is in, or the empty slot where it should go
+static size_t quadset_slot(native_quadset_t * set, const native_id_t * quad)
+{
+  size_t mask = set->size - 1;
+  size_t i = quadset_hash(set, quad) & mask;
+
+  while (set->slots[i * 4] != NATIVE_NONE) {
+    if (memcmp(&set->slots[i * 4], quad, set->keylen * sizeof(native_id_t)) == 0)
+      break;
+    i = (i + 1) & mask;
+  }
+
+  return i;
+}
+
+static int quadset_contains(native_quadset_t * set, const native_id_t * quad)
+{
+  if (set->count == 0)
+    return 0;
+
+  return set->slots[quadset_slot(set, quad) * 4] != NATIVE_NONE;
+}
+
+static int quadset_grow(native_quadset_t * set)
+{
+  native_id_t *old_slots = set->slots;
+  size_t old_size = set->size;
+  size_t i;
+
+  set->size = old_size ? old_size * 2 : 256;
+  set->slots = calloc(set->size, 4 * sizeof(native_id_t));
+  if (!set->slots) {
+    set->slots = old_slots;
+    set->size = old_size;
+    return 1;
+  }
+
+  for (i = 0; i < old_size; i++) {
+    if (old_slots[i * 4] != NATIVE_NONE) {
+      size_t slot = quadset_slot(set, &old_slots[i * 4]);
+      memcpy(&set->slots[slot * 4], &old_slots[i * 4], 4 * sizeof(native_id_t));
+    }
+  }
+
+  if (old_slots)
+    free(old_slots);
+
+  return 0;
+}
+
+static int quadset_insert(native_quadset_t * set, const native_id_t * quad)
+{
+  size_t slot;
+
+  if ((set->count + 1) * 2 > set->size && quadset_grow(set))
+    return -1;
+
+  slot = quadset_slot(set, quad);
+  if (set->slots[slot * 4] != NATIVE_NONE)
+    return 1;
+
+  memcpy(&set->slots[slot * 4], quad, 4 * sizeof(native_id_t));
+  set->count++;
+
+  return 0;
+}
+
+// Removes a quad, moving back any quads that were displaced past it
+static int quadset_remove(native_quadset_t * set, const native_id_t * quad)
+{
+  size_t mask = set->size - 1;
+  size_t i, j;
+
+  if (set->count == 0)
+    return 1;
+
+  i = quadset_slot(set, quad);
+  if (set->slots[i * 4] == NATIVE_NONE)
+    return 1;
+
+  for (j = (i + 1) & mask; set->slots[j * 4] != NATIVE_NONE; j = (j + 1) & mask) {
+    size_t home = quadset_hash(set, &set->slots[j * 4]) & mask;
+    // Can the quad in slot j be moved into the hole at i?
+    if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+      memcpy(&set->slots[i * 4], &set->slots[j * 4], 4 * sizeof(native_id_t));
+      i = j;
+    }
+  }
+
+  set->slots[i * 4] = NATIVE_NONE;
+  set->count--;
+
+  return 0;
+}
+
+// Copies the quads in the set into an array, sorted in the order of an index
+static void quadset_sorted(native_quadset_t * set, int index, native_id_t * entries)
+{
+  size_t i, n = 0;
+
+  for (i = 0; i < set->size; i++) {
+    if (set->slots[i * 4] != NATIVE_NONE) {
+      permute(index, &set->slots[i * 4], &entries[n * 4]);
+      n++;
+    }
+  }
+
+  qsort(entries, n, 4 * sizeof(native_id_t), compare_entries);
+}
+
+static void quadset_clear(native_quadset_t * set)
+{
+  if (set->slots)
+    free(set->slots);
+  set->slots = NULL;
+  set->size = 0;
+  set->count = 0;
+}
+
+// Makes sure that the sorted copy of the pending additions for an index
+// is up to date; returns non-zero on error. Quads that have been removed
+// since it was sorted are left in, so scans check that each is still there.
+static int sort_added(native_store_t * store, int index)
+{
+  native_id_t *sorted = NULL;
+
+  if (store->sorted_generation[index] == store->added_generation)
+    return 0;
+
+  if (store->added.count > 0) {
+    sorted = realloc(store->sorted[index], store->added.count * 4 * sizeof(native_id_t));
+    if (!sorted)
+      return 1;
+    store->sorted[index] = sorted;
+    quadset_sorted(&store->added, index, sorted);
+  }
+  store->sorted_count[index] = store->added.count;
+  store->sorted_generation[index] = store->added_generation;
+
+  return 0;
+}
+
+static void free_sorted(native_store_t * store)
+{
+  int index;
+
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    if (store->sorted[index])
+      free(store->sorted[index]);
+    store->sorted[index] = NULL;
+    store->sorted_count[index] = 0;
+    store->sorted_generation[index] = store->added_generation;
+  }
+}
+
+
+native_store_t *native_store_new(void)
+{
+  native_store_t *store = calloc(1, sizeof(native_store_t));
+  if (!store)
+    return NULL;
+
+  store->added.keylen = 4;
+  store->removed.keylen = 4;
+
+  store->dict = native_dict_new();
+  if (!store->dict) {
+    free(store);
+    return NULL;
+  }
+
+  return store;
+}
+
+native_dict_t *native_store_get_dict(native_store_t * store)
+{
+  return store->dict;
+}
+
+static int index_contains(native_store_t * store, const native_id_t * quad)
+{
+  const native_id_t *entries = store->indexes[NATIVE_SPOG];
+  size_t pos;
+
+  if (store->count == 0)
+    return 0;
+
+  pos = lower_bound(entries, store->count, quad, 4);
+  return (pos < store->count && compare_prefix(&entries[pos * 4], quad, 4) == 0);
+}
+
+// Merges the pending changes into the indexes; returns non-zero on error
+int native_store_flush(native_store_t * store)
+{
+  size_t added_count = store->added.count;
+  size_t removed_count = store->removed.count;
+  size_t count = store->count + added_count - removed_count;
+  native_id_t *added = NULL, *removed = NULL;
+  int index, err = 0;
+
+  if (added_count == 0 && removed_count == 0)
+    return 0;
+
+  added = malloc((added_count ? added_count : 1) * 4 * sizeof(native_id_t));
+  removed = malloc((removed_count ? removed_count : 1) * 4 * sizeof(native_id_t));
+  if (!added || !removed) {
+    err = 1;
+    goto CLEANUP;
+  }
+
+  // Make room in all of the indexes first, so that a failure leaves them unchanged
+  if (count > store->count) {
+    for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+      native_id_t *tmp = realloc(store->indexes[index], count * 4 * sizeof(native_id_t));
+      if (!tmp) {
+        err = 1;
+        goto CLEANUP;
+      }
+      store->indexes[index] = tmp;
+    }
+  }
+
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    native_id_t *entries = store->indexes[index];
+    size_t o, a, m = 0, r = 0;
+
+    quadset_sorted(&store->added, index, added);
+    quadset_sorted(&store->removed, index, removed);
+
+    // Take out the removed quads
+    for (o = 0; o < store->count; o++) {
+      if (r < removed_count && compare_prefix(&entries[o * 4], &removed[r * 4], 4) == 0) {
+        r++;
+        continue;
+      }
+      if (o != m)
+        memcpy(&entries[m * 4], &entries[o * 4], 4 * sizeof(native_id_t));
+      m++;
+    }
+
+    // Merge in the added quads, working back from the end
+    o = m;
+    a = added_count;
+    m = count;
+    while (a > 0) {
+      m--;
+      if (o > 0 && compare_prefix(&entries[(o - 1) * 4], &added[(a - 1) * 4], 4) > 0) {
+        o--;
+        memcpy(&entries[m * 4], &entries[o * 4], 4 * sizeof(native_id_t));
+      } else {
+        a--;
+        memcpy(&entries[m * 4], &added[a * 4], 4 * sizeof(native_id_t));
+      }
+    }
+  }
+
+  store->count = count;
+  quadset_clear(&store->added);
+  quadset_clear(&store->removed);
+  store->generation++;
+  store->added_generation++;
+  free_sorted(store);
+
+CLEANUP:
+  if (added)
+    free(added);
+  if (removed)
+    free(removed);
+
+  return err;
+}
+
+static void maybe_flush(native_store_t * store)
+{
+  size_t pending = store->added.count + store->removed.count;
+
+  if (pending >= NATIVE_MIN_PENDING && pending >= store->count / 8)
+    native_store_flush(store);
+}
+
+// Returns 0 if the quad was added, >0 if it was already there and <0 on error
+int native_store_add(native_store_t * store, const native_id_t quad[4])
+{
+  int result;
+
+  if (store->map || quad[NATIVE_S] == NATIVE_NONE || quad[NATIVE_P] == NATIVE_NONE ||
+      quad[NATIVE_O] == NATIVE_NONE)
+    return -1;
+
+  if (quadset_remove(&store->removed, quad) == 0)
+    return 0;
+
+  if (index_contains(store, quad))
+    return 1;
+
+  result = quadset_insert(&store->added, quad);
+  if (result == 0) {
+    store->added_generation++;
+    maybe_flush(store);
+  }
+
+  return result;
+}
+
+// Returns 0 if the quad was removed and non-zero otherwise
+int native_store_remove(native_store_t * store, const native_id_t quad[4])
+{
+  if (store->map)
+    return 1;
+
+  if (quadset_remove(&store->added, quad) == 0)
+    return 0;
+
+  if (!index_contains(store, quad) || quadset_contains(&store->removed, quad))
+    return 1;
+
+  if (quadset_insert(&store->removed, quad))
+    return 1;
+
+  maybe_flush(store);
+
+  return 0;
+}
+
+int native_store_contains(native_store_t * store, const native_id_t quad[4])
+{
+  if (quadset_contains(&store->added, quad))
+    return 1;
+
+  return index_contains(store, quad) && !quadset_contains(&store->removed, quad);
+}
+
+// Removes every quad in a graph and returns how many there were
+size_t native_store_remove_graph(native_store_t * store, native_id_t graph)
+{
+  size_t start, end, removed;
+  int index;
+
+  if (store->map)
+    return 0;
+
+  native_store_flush(store);
+
+  // The first three indexes are sorted by graph
+  start = lower_bound(store->indexes[0], store->count, &graph, 1);
+  for (end = start; end < store->count && store->indexes[0][end * 4] == graph; end++)
+    continue;
+  removed = end - start;
+  if (removed == 0)
+    return 0;
+
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    native_id_t *entries = store->indexes[index];
+    int g = 0;
+    size_t i, m = 0;
+
+    while (native_orders[index][g] != NATIVE_G)
+      g++;
+
+    for (i = 0; i < store->count; i++) {
+      if (entries[i * 4 + g] != graph) {
+        if (i != m)
+          memcpy(&entries[m * 4], &entries[i * 4], 4 * sizeof(native_id_t));
+        m++;
+      }
+    }
+  }
+
+  store->count -= removed;
+  store->generation++;
+
+  return removed;
+}
+
+// Stores opened from a snapshot can't be changed
+int native_store_is_readonly(native_store_t * store)
+{
+  return store->map != NULL;
+}
+
+size_t native_store_size(native_store_t * store)
+{
+  return store->count + store->added.count - store->removed.count;
+}
+
+void native_store_free(native_store_t * store)
+{
+  int index;
+
+  if (!store)
+    return;
+
+  if (store->map) {
+    munmap(store->map, store->map_len);
+  } else {
+    for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+      if (store->indexes[index])
+        free(store->indexes[index]);
+    }
+  }
+  quadset_clear(&store->added);
+  quadset_clear(&store->removed);
+  free_sorted(store);
+  native_dict_free(store->dict);
+
+  free(store);
+}
+
+
+// Does an entry, in the order of the cursor's index, match the cursor?
+static int cursor_matches(native_cursor_t * cursor, const native_id_t * entry)
+{
+  int i;
+
+  if (cursor->graphs)
+    return entry[0] > cursor->last[0];
+
+  for (i = 0; i < 4; i++) {
+    if (cursor->pattern[i] != NATIVE_NONE && cursor->pattern[i] != entry[i])
+      return 0;
+  }
+
+  return 1;
+}
+
+// Returns a cursor over all the quads matching a pattern;
+// NATIVE_NONE in the pattern matches anything
+native_cursor_t *native_store_find(native_store_t * store, const native_id_t pattern[4])
+{
+  native_cursor_t *cursor = NULL;
+  int index;
+
+  cursor = calloc(1, sizeof(native_cursor_t));
+  if (!cursor)
+    return NULL;
+
+  // Checking for a single quad is common when adding statements
+  if (pattern[NATIVE_S] != NATIVE_NONE && pattern[NATIVE_P] != NATIVE_NONE &&
+      pattern[NATIVE_O] != NATIVE_NONE && pattern[NATIVE_G] != NATIVE_NONE)
+    cursor->single = 1;
+
+  // Use the index with the longest prefix of bound terms
+  cursor->store = store;
+  cursor->prefix = -1;
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    int prefix = 0;
+    while (prefix < 4 && pattern[native_orders[index][prefix]] != NATIVE_NONE)
+      prefix++;
+    if (prefix > cursor->prefix) {
+      cursor->index = index;
+      cursor->prefix = prefix;
+    }
+  }
+  permute(cursor->index, pattern, cursor->pattern);
+
+  if (!cursor->single && sort_added(store, cursor->index)) {
+    free(cursor);
+    return NULL;
+  }
+
+  return cursor;
+}
+
+// Returns a cursor over the first quad of each named graph
+native_cursor_t *native_store_graphs(native_store_t * store)
+{
+  native_cursor_t *cursor = calloc(1, sizeof(native_cursor_t));
+  if (!cursor)
+    return NULL;
+
+  // The GSPO index is sorted by graph
+  cursor->store = store;
+  cursor->index = 0;
+  cursor->graphs = 1;
+  if (sort_added(store, cursor->index)) {
+    free(cursor);
+    return NULL;
+  }
+
+  return cursor;
+}
+
+// Returns the next entry in the index that matches the cursor, without moving past it
+static const native_id_t *next_index_entry(native_cursor_t * cursor)
+{
+  native_store_t *store = cursor->store;
+  const native_id_t *entries = store->indexes[cursor->index];
+  native_id_t quad[4];
+
+  for (; cursor->pos < store->count; cursor->pos++) {
+    const native_id_t *entry = &entries[cursor->pos * 4];
+
+    if (compare_prefix(entry, cursor->pattern, cursor->prefix) != 0)
+      break;
+    if (!cursor_matches(cursor, entry))
+      continue;
+
+    unpermute(cursor->index, entry, quad);
+    if (!quadset_contains(&store->removed, quad))
+      return entry;
+  }
+
+  return NULL;
+}
+
+// Returns the next pending addition that matches the cursor, without moving past it
+static const native_id_t *next_added_entry(native_cursor_t * cursor)
+{
+  native_store_t *store = cursor->store;
+  const native_id_t *entries = store->sorted[cursor->index];
+  native_id_t quad[4];
+
+  for (; cursor->added_pos < store->sorted_count[cursor->index]; cursor->added_pos++) {
+    const native_id_t *entry = &entries[cursor->added_pos * 4];
+
+    if (compare_prefix(entry, cursor->pattern, cursor->prefix) != 0)
+      break;
+    if (!cursor_matches(cursor, entry))
+      continue;
+
+    unpermute(cursor->index, entry, quad);
+    if (quadset_contains(&store->added, quad))
+      return entry;
+  }
+
+  return NULL;
+}
+
+// Returns 0 and fills in the quad, or non-zero when there are no more quads
+int native_cursor_next(native_cursor_t * cursor, native_id_t quad[4])
+{
+  native_store_t *store = cursor->store;
+  const native_id_t *entry = NULL, *added = NULL;
+  const native_id_t *sorted = NULL;
+  size_t sorted_count;
+
+  if (cursor->single) {
+    if (cursor->started)
+      return 1;
+    cursor->started = 1;
+    unpermute(cursor->index, cursor->pattern, quad);
+    return !native_store_contains(store, quad);
+  }
+
+  if (sort_added(store, cursor->index))
+    return 1;
+  sorted = store->sorted[cursor->index];
+  sorted_count = store->sorted_count[cursor->index];
+
+  if (cursor->graphs) {
+    // Skip to the next graph after the last one returned
+    native_id_t next = cursor->last[0] + 1;
+    cursor->pos = lower_bound(store->indexes[cursor->index], store->count, &next, 1);
+    cursor->added_pos = lower_bound(sorted, sorted_count, &next, 1);
+    cursor->started = 1;
+  } else if (!cursor->started) {
+    cursor->pos = lower_bound(store->indexes[cursor->index], store->count,
+                              cursor->pattern, cursor->prefix);
+    cursor->added_pos = lower_bound(sorted, sorted_count, cursor->pattern, cursor->prefix);
+    cursor->started = 1;
+  } else {
+    // The indexes or the pending additions have changed;
+    // carry on from after the last quad
+    if (cursor->generation != store->generation)
+      cursor->pos = upper_bound(store->indexes[cursor->index], store->count, cursor->last);
+    if (cursor->added_generation != store->added_generation)
+      cursor->added_pos = upper_bound(sorted, sorted_count, cursor->last);
+  }
+  cursor->generation = store->generation;
+  cursor->added_generation = store->added_generation;
+
+  entry = next_index_entry(cursor);
+  added = next_added_entry(cursor);
+
+  if (added && (!entry || compare_prefix(added, entry, 4) < 0)) {
+    entry = added;
+    cursor->added_pos++;
+  } else if (entry) {
+    cursor->pos++;
+  } else {
+    return 1;
+  }
+
+  memcpy(cursor->last, entry, 4 * sizeof(native_id_t));
+  unpermute(cursor->index, entry, quad);
+
+  return 0;
+}
+
+void native_cursor_free(native_cursor_t * cursor)
+{
+  free(cursor);
+}
@@ -0,0 +1,258 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "native_private.h"
+
+
+// A snapshot is the dictionary and the indexes written out exactly as
+// they are in memory, so that it can be mapped back in and used without
+// any parsing. Every section is a multiple of 8 bytes long.
+//
+//   header
+//   term offsets      (term_count x uint64)
+//   term keys         (keys_len bytes, padded)
+//   dictionary slots  (slots_size x uint64)
+//   namespace offsets (namespace_count x uint64)
+//   namespace keys    (namespace_keys_len bytes, padded)
+//   namespace slots   (namespace_slots_size x uint64)
+//   indexes           (6 x quad_count x 4 x uint64)
+
+#define NATIVE_SNAPSHOT_MAGIC       "RSNAP002"
+#define NATIVE_SNAPSHOT_BYTE_ORDER  (0x0102030405060708ULL)
+
+typedef struct native_snapshot_header_s {
+  char magic[8];
+  uint64_t byte_order;
+  uint64_t term_count;
+  uint64_t keys_len;
+  uint64_t slots_size;
+  uint64_t namespace_count;
+  uint64_t namespace_keys_len;
+  uint64_t namespace_slots_size;
+  uint64_t quad_count;
+} native_snapshot_header_t;
+
+
+static size_t padded(size_t len)
+{
+  return (len + 7) & ~((size_t) 7);
+}
+
+static size_t snapshot_size(const native_snapshot_header_t * header)
+{
+  return sizeof(native_snapshot_header_t) +
+      header->term_count * sizeof(uint64_t) +
+      padded(header->keys_len) +
+      header->slots_size * sizeof(native_id_t) +
+      header->namespace_count * sizeof(uint64_t) +
+      padded(header->namespace_keys_len) +
+      header->namespace_slots_size * sizeof(native_id_t) +
+      NATIVE_INDEX_COUNT * header->quad_count * 4 * sizeof(native_id_t);
+}
+
+static int write_section(FILE * file, const void *data, size_t len)
+{
+  static const char zeros[8] = { 0 };
+
+  if (len && fwrite(data, 1, len, file) != len)
+    return 1;
+  if (padded(len) != len && fwrite(zeros, 1, padded(len) - len, file) != padded(len) - len)
+    return 1;
+
+  return 0;
+}
+
+static int write_dict(FILE * file, native_dict_t * dict)
+{
+  return write_section(file, dict->offsets, dict->count * sizeof(uint64_t)) ||
+      write_section(file, dict->keys, dict->keys_len) ||
+      write_section(file, dict->slots, dict->slots_size * sizeof(native_id_t));
+}
+
+// Points a read-only dictionary at its arrays in a snapshot; returns the end of them
+static unsigned char *map_dict(native_dict_t * dict, unsigned char *ptr, uint64_t count,
+                               uint64_t keys_len, uint64_t slots_size)
+{
+  dict->readonly = 1;
+  dict->count = count;
+  dict->offsets = (uint64_t *) ptr;
+  dict->offsets_size = count;
+  ptr += count * sizeof(uint64_t);
+  dict->keys = ptr;
+  dict->keys_len = keys_len;
+  dict->keys_size = keys_len;
+  ptr += padded(keys_len);
+  dict->slots = (native_id_t *) ptr;
+  dict->slots_size = slots_size;
+  ptr += slots_size * sizeof(native_id_t);
+
+  return ptr;
+}
+
+// Writes the header and the dictionary; the indexes, of quad_count
+// entries each, must follow
+int native_snapshot_write_header(FILE * file, native_dict_t * dict, size_t quad_count)
+{
+  native_snapshot_header_t header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, NATIVE_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.byte_order = NATIVE_SNAPSHOT_BYTE_ORDER;
+  header.term_count = dict->count;
+  header.keys_len = dict->keys_len;
+  header.slots_size = dict->slots_size;
+  header.namespace_count = dict->namespaces->count;
+  header.namespace_keys_len = dict->namespaces->keys_len;
+  header.namespace_slots_size = dict->namespaces->slots_size;
+  header.quad_count = quad_count;
+
+  if (write_section(file, &header, sizeof(header)) ||
+      write_dict(file, dict) || write_dict(file, dict->namespaces))
+    return 1;
+
+  return 0;
+}
+
+// Writes the contents of the store to a file; returns non-zero on error
+int native_store_write_snapshot(native_store_t * store, const char *filename)
+{
+  char *tmp_filename = NULL;
+  FILE *file = NULL;
+  int index, err = 1;
+
+  if (native_store_flush(store))
+    return 1;
+
+  // Write to a temporary file, so that an existing snapshot is only replaced once complete
+  tmp_filename = malloc(strlen(filename) + 5);
+  if (!tmp_filename)
+    return 1;
+  sprintf(tmp_filename, "%s.tmp", filename);
+
+  file = fopen(tmp_filename, "wb");
+  if (!file)
+    goto CLEANUP;
+
+  if (native_snapshot_write_header(file, store->dict, store->count))
+    goto CLEANUP;
+
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    if (write_section(file, store->indexes[index], store->count * 4 * sizeof(native_id_t)))
+      goto CLEANUP;
+  }
+
+  if (fflush(file) || fsync(fileno(file)))
+    goto CLEANUP;
+
+  err = fclose(file);
+  file = NULL;
+  if (!err)
+    err = rename(tmp_filename, filename);
+
+CLEANUP:
+  if (file)
+    fclose(file);
+  if (err)
+    unlink(tmp_filename);
+  free(tmp_filename);
+
+  return err;
+}
+
+// Maps a snapshot into memory; the store that is returned can't be changed
+native_store_t *native_store_open_snapshot(const char *filename)
+{
+  native_snapshot_header_t header;
+  native_store_t *store = NULL;
+  native_dict_t *dict = NULL;
+  struct stat st;
+  unsigned char *ptr = NULL;
+  void *map = MAP_FAILED;
+  int fd = -1, index;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &st) || (size_t) st.st_size < sizeof(header))
+    goto CLEANUP;
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    goto CLEANUP;
+
+  memcpy(&header, map, sizeof(header));
+  if (memcmp(header.magic, NATIVE_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.byte_order != NATIVE_SNAPSHOT_BYTE_ORDER ||
+      header.term_count == 0 || header.slots_size == 0 ||
+      (header.slots_size & (header.slots_size - 1)) != 0 ||
+      header.namespace_count == 0 || header.namespace_slots_size == 0 ||
+      (header.namespace_slots_size & (header.namespace_slots_size - 1)) != 0 ||
+      snapshot_size(&header) != (size_t) st.st_size)
+    goto CLEANUP;
+
+  store = calloc(1, sizeof(native_store_t));
+  dict = calloc(1, sizeof(native_dict_t));
+  if (!store || !dict)
+    goto CLEANUP;
+  dict->namespaces = calloc(1, sizeof(native_dict_t));
+  if (!dict->namespaces)
+    goto CLEANUP;
+
+  ptr = (unsigned char *) map + sizeof(header);
+  ptr = map_dict(dict, ptr, header.term_count, header.keys_len, header.slots_size);
+  ptr = map_dict(dict->namespaces, ptr, header.namespace_count,
+                 header.namespace_keys_len, header.namespace_slots_size);
+
+  store->dict = dict;
+  store->count = header.quad_count;
+  for (index = 0; index < NATIVE_INDEX_COUNT; index++) {
+    store->indexes[index] = (native_id_t *) ptr;
+    ptr += header.quad_count * 4 * sizeof(native_id_t);
+  }
+  store->added.keylen = 4;
+  store->removed.keylen = 4;
+  store->map = map;
+  store->map_len = st.st_size;
+
+  close(fd);
+
+  return store;
+
+CLEANUP:
+  if (store)
+    free(store);
+  if (dict)
+    native_dict_free(dict);
+  if (map != MAP_FAILED)
+    munmap(map, st.st_size);
+  close(fd);
+
+  return NULL;
+}
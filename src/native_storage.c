@@ -0,0 +1,746 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "redstore.h"
+#include "native/native.h"
+
+
+// A librdf storage module for the native quad store: librdf nodes are
+// turned into dictionary keys on the way in. On the way out, the nodes for
+// the IDs that were used most recently are kept in a cache with a fixed
+// number of entries, NATIVE_NODE_CACHE_SIZE, which is a power of two.
+
+#define NODE_CACHE_NONE  (UINT32_MAX)
+
+typedef struct node_cache_entry_s {
+  native_id_t id;
+  librdf_node *node;
+  uint32_t prev;                // Least recently used list
+  uint32_t next;
+  uint32_t chain;               // Next entry in the same hash bucket
+} node_cache_entry_t;
+
+typedef struct native_storage_s {
+  native_store_t *store;
+  node_cache_entry_t *cache;
+  uint32_t *cache_buckets;
+  uint32_t cache_count;
+  uint32_t cache_first;         // Most recently used
+  uint32_t cache_last;          // Least recently used
+} native_storage_t;
+
+typedef struct native_stream_s {
+  librdf_world *world;
+  native_storage_t *instance;
+  native_cursor_t *cursor;
+  native_id_t quad[4];
+  int finished;
+  librdf_statement *statement;
+  librdf_node *context;
+} native_stream_t;
+
+
+// Keys are a type character, followed by the URI or blank node identifier;
+// literals have their language and datatype first, so that the value may
+// contain anything.
+static unsigned char *node_to_key(librdf_node * node, size_t * key_len)
+{
+  const unsigned char *value = NULL, *language = NULL, *datatype = NULL;
+  size_t value_len = 0, language_len = 0, datatype_len = 0;
+  unsigned char *key = NULL, *ptr = NULL;
+  char type;
+
+  if (librdf_node_is_resource(node)) {
+    type = 'U';
+    value = librdf_uri_as_counted_string(librdf_node_get_uri(node), &value_len);
+  } else if (librdf_node_is_blank(node)) {
+    type = 'B';
+    value = librdf_node_get_blank_identifier(node);
+    value_len = strlen((const char *) value);
+  } else if (librdf_node_is_literal(node)) {
+    librdf_uri *datatype_uri = librdf_node_get_literal_value_datatype_uri(node);
+    type = 'L';
+    value = librdf_node_get_literal_value_as_counted_string(node, &value_len);
+    language = (const unsigned char *) librdf_node_get_literal_value_language(node);
+    if (language)
+      language_len = strlen((const char *) language);
+    if (datatype_uri)
+      datatype = librdf_uri_as_counted_string(datatype_uri, &datatype_len);
+  } else {
+    return NULL;
+  }
+
+  *key_len = 1 + value_len;
+  if (type == 'L')
+    *key_len += language_len + 1 + datatype_len + 1;
+
+  key = malloc(*key_len);
+  if (!key)
+    return NULL;
+
+  ptr = key;
+  *ptr++ = type;
+  if (type == 'L') {
+    if (language_len)
+      memcpy(ptr, language, language_len);
+    ptr += language_len;
+    *ptr++ = '\0';
+    if (datatype_len)
+      memcpy(ptr, datatype, datatype_len);
+    ptr += datatype_len;
+    *ptr++ = '\0';
+  }
+  if (value_len)
+    memcpy(ptr, value, value_len);
+
+  return key;
+}
+
+static librdf_node *key_to_node(librdf_world * world, const unsigned char *key, size_t key_len)
+{
+  const char *language = NULL, *datatype = NULL;
+  librdf_uri *datatype_uri = NULL;
+  librdf_node *node = NULL;
+  char *copy = NULL;
+  size_t len;
+
+  // Make a nul-terminated copy of everything after the type character
+  copy = malloc(key_len);
+  if (!copy)
+    return NULL;
+  memcpy(copy, key + 1, key_len - 1);
+  copy[key_len - 1] = '\0';
+
+  switch (key[0]) {
+  case 'U':
+    node = librdf_new_node_from_uri_string(world, (unsigned char *) copy);
+    break;
+  case 'B':
+    node = librdf_new_node_from_blank_identifier(world, (unsigned char *) copy);
+    break;
+  case 'L':
+    language = copy;
+    datatype = language + strlen(language) + 1;
+    len = (datatype + strlen(datatype) + 1) - copy;
+    if (*datatype)
+      datatype_uri = librdf_new_uri(world, (const unsigned char *) datatype);
+    node = librdf_new_node_from_typed_counted_literal(world,
+                                                      (unsigned char *) copy + len,
+                                                      key_len - 1 - len,
+                                                      *language ? language : NULL,
+                                                      strlen(language), datatype_uri);
+    if (datatype_uri)
+      librdf_free_uri(datatype_uri);
+    break;
+  }
+
+  free(copy);
+
+  return node;
+}
+
+// Returns the ID for a node, or NATIVE_NONE if it is not in the store and create is false
+static native_id_t node_to_id(native_storage_t * instance, librdf_node * node, int create)
+{
+  native_dict_t *dict = native_store_get_dict(instance->store);
+  unsigned char *key = NULL;
+  size_t key_len = 0;
+  native_id_t id;
+
+  if (!node)
+    return NATIVE_NONE;
+
+  key = node_to_key(node, &key_len);
+  if (!key)
+    return NATIVE_NONE;
+
+  if (create) {
+    id = native_dict_intern(dict, key, key_len);
+  } else {
+    id = native_dict_lookup(dict, key, key_len);
+  }
+  free(key);
+
+  return id;
+}
+
+static uint32_t node_cache_bucket(native_id_t id)
+{
+  return (uint32_t) ((id * 11400714819323198485ULL) >> 32) & (NATIVE_NODE_CACHE_SIZE - 1);
+}
+
+static void node_cache_unlink(native_storage_t * instance, uint32_t index)
+{
+  node_cache_entry_t *entry = &instance->cache[index];
+
+  if (entry->prev != NODE_CACHE_NONE) {
+    instance->cache[entry->prev].next = entry->next;
+  } else {
+    instance->cache_first = entry->next;
+  }
+  if (entry->next != NODE_CACHE_NONE) {
+    instance->cache[entry->next].prev = entry->prev;
+  } else {
+    instance->cache_last = entry->prev;
+  }
+}
+
+static void node_cache_push(native_storage_t * instance, uint32_t index)
+{
+  node_cache_entry_t *entry = &instance->cache[index];
+
+  entry->prev = NODE_CACHE_NONE;
+  entry->next = instance->cache_first;
+  if (instance->cache_first != NODE_CACHE_NONE)
+    instance->cache[instance->cache_first].prev = index;
+  instance->cache_first = index;
+  if (instance->cache_last == NODE_CACHE_NONE)
+    instance->cache_last = index;
+}
+
+// Takes the least recently used entry out of the cache, to be used again
+static uint32_t node_cache_evict(native_storage_t * instance)
+{
+  uint32_t index = instance->cache_last;
+  node_cache_entry_t *entry = &instance->cache[index];
+  uint32_t *ptr = &instance->cache_buckets[node_cache_bucket(entry->id)];
+
+  while (*ptr != index)
+    ptr = &instance->cache[*ptr].chain;
+  *ptr = entry->chain;
+
+  node_cache_unlink(instance, index);
+  librdf_free_node(entry->node);
+  entry->node = NULL;
+
+  return index;
+}
+
+// Returns a node that belongs to the storage. It may be freed by a later
+// call, so callers must copy it if they keep it.
+static librdf_node *id_to_node(librdf_world * world, native_storage_t * instance, native_id_t id)
+{
+  unsigned char buffer[NATIVE_INLINE_MAX_KEY];
+  const unsigned char *key = NULL;
+  size_t key_len = 0;
+  librdf_node *node = NULL;
+  uint32_t bucket, index;
+
+  if (id == NATIVE_NONE)
+    return NULL;
+
+  if (!instance->cache) {
+    instance->cache = calloc(NATIVE_NODE_CACHE_SIZE, sizeof(node_cache_entry_t));
+    instance->cache_buckets = malloc(NATIVE_NODE_CACHE_SIZE * sizeof(uint32_t));
+    if (!instance->cache || !instance->cache_buckets) {
+      if (instance->cache)
+        free(instance->cache);
+      instance->cache = NULL;
+      return NULL;
+    }
+    memset(instance->cache_buckets, 0xff, NATIVE_NODE_CACHE_SIZE * sizeof(uint32_t));
+    instance->cache_first = instance->cache_last = NODE_CACHE_NONE;
+  }
+
+  bucket = node_cache_bucket(id);
+  for (index = instance->cache_buckets[bucket]; index != NODE_CACHE_NONE;
+       index = instance->cache[index].chain) {
+    if (instance->cache[index].id == id) {
+      node_cache_unlink(instance, index);
+      node_cache_push(instance, index);
+      return instance->cache[index].node;
+    }
+  }
+
+  // Inline IDs have no entry in the dictionary
+  if (NATIVE_ID_IS_INLINE(id)) {
+    key_len = native_inline_decode(id, buffer, sizeof(buffer));
+    key = key_len ? buffer : NULL;
+  } else {
+    key = native_dict_get(native_store_get_dict(instance->store), id, &key_len);
+  }
+  if (key)
+    node = key_to_node(world, key, key_len);
+  if (!node)
+    return NULL;
+
+  if (instance->cache_count < NATIVE_NODE_CACHE_SIZE) {
+    index = instance->cache_count++;
+  } else {
+    index = node_cache_evict(instance);
+  }
+
+  instance->cache[index].id = id;
+  instance->cache[index].node = node;
+  instance->cache[index].chain = instance->cache_buckets[bucket];
+  instance->cache_buckets[bucket] = index;
+  node_cache_push(instance, index);
+
+  return node;
+}
+
+// Returns 0 if every term in the statement has an ID
+static int statement_to_quad(native_storage_t * instance, librdf_statement * statement,
+                             librdf_node * context, native_id_t quad[4], int create)
+{
+  librdf_node *nodes[4];
+  int i;
+
+  nodes[NATIVE_S] = statement ? librdf_statement_get_subject(statement) : NULL;
+  nodes[NATIVE_P] = statement ? librdf_statement_get_predicate(statement) : NULL;
+  nodes[NATIVE_O] = statement ? librdf_statement_get_object(statement) : NULL;
+  nodes[NATIVE_G] = context;
+
+  for (i = 0; i < 4; i++) {
+    quad[i] = node_to_id(instance, nodes[i], create);
+    if (nodes[i] && quad[i] == NATIVE_NONE)
+      return 1;
+  }
+
+  return 0;
+}
+
+
+static int native_stream_is_end(void *context)
+{
+  native_stream_t *scontext = (native_stream_t *) context;
+  return scontext->finished;
+}
+
+static int native_stream_next(void *context)
+{
+  native_stream_t *scontext = (native_stream_t *) context;
+
+  if (scontext->statement) {
+    librdf_free_statement(scontext->statement);
+    scontext->statement = NULL;
+  }
+  if (scontext->context) {
+    librdf_free_node(scontext->context);
+    scontext->context = NULL;
+  }
+
+  if (!scontext->finished)
+    scontext->finished = native_cursor_next(scontext->cursor, scontext->quad);
+
+  return scontext->finished;
+}
+
+// The stream keeps its own copy of the graph node, which it frees when it moves on
+static librdf_node *native_stream_get_context(native_stream_t * scontext)
+{
+  if (!scontext->context) {
+    librdf_node *node = id_to_node(scontext->world, scontext->instance, scontext->quad[NATIVE_G]);
+    if (node)
+      scontext->context = librdf_new_node_from_node(node);
+  }
+
+  return scontext->context;
+}
+
+static void *native_stream_get(void *context, int flags)
+{
+  native_stream_t *scontext = (native_stream_t *) context;
+  native_storage_t *instance = scontext->instance;
+  librdf_world *world = scontext->world;
+
+  switch (flags) {
+  case LIBRDF_STREAM_GET_METHOD_GET_OBJECT:
+    if (!scontext->statement) {
+      librdf_node *nodes[3];
+      int i;
+
+      // Each node is copied before the next one might push it out of the cache
+      for (i = 0; i < 3; i++) {
+        nodes[i] = id_to_node(world, instance, scontext->quad[i]);
+        if (nodes[i])
+          nodes[i] = librdf_new_node_from_node(nodes[i]);
+        if (!nodes[i]) {
+          while (i-- > 0)
+            librdf_free_node(nodes[i]);
+          return NULL;
+        }
+      }
+      scontext->statement = librdf_new_statement_from_nodes(world, nodes[NATIVE_S],
+                                                            nodes[NATIVE_P], nodes[NATIVE_O]);
+    }
+    return scontext->statement;
+
+  case LIBRDF_STREAM_GET_METHOD_GET_CONTEXT:
+    return native_stream_get_context(scontext);
+
+  default:
+    redstore_error("Unknown iterator method flag %d", flags);
+    return NULL;
+  }
+}
+
+static void native_stream_finished(void *context)
+{
+  native_stream_t *scontext = (native_stream_t *) context;
+
+  if (scontext->statement)
+    librdf_free_statement(scontext->statement);
+  if (scontext->context)
+    librdf_free_node(scontext->context);
+  if (scontext->cursor)
+    native_cursor_free(scontext->cursor);
+  free(scontext);
+}
+
+static native_stream_t *native_stream_new(librdf_storage * storage, native_cursor_t * cursor)
+{
+  native_stream_t *scontext = NULL;
+
+  scontext = calloc(1, sizeof(native_stream_t));
+  if (!scontext) {
+    native_cursor_free(cursor);
+    return NULL;
+  }
+
+  scontext->world = librdf_storage_get_world(storage);
+  scontext->instance = (native_storage_t *) librdf_storage_get_instance(storage);
+  scontext->cursor = cursor;
+  scontext->finished = native_cursor_next(cursor, scontext->quad);
+
+  return scontext;
+}
+
+
+static int native_storage_init(librdf_storage * storage, const char *name, librdf_hash * options)
+{
+  native_storage_t *instance = calloc(1, sizeof(native_storage_t));
+  char *snapshot = NULL;
+
+  // A new store starts empty, rather than with the contents of the snapshot
+  if (options) {
+    if (librdf_hash_get_as_boolean(options, "new") <= 0)
+      snapshot = librdf_hash_get(options, "snapshot");
+    librdf_free_hash(options);
+  }
+
+  if (!instance)
+    goto CLEANUP;
+
+  if (snapshot) {
+    // Map a snapshot into memory; the store is then read-only
+    instance->store = native_store_open_snapshot(snapshot);
+    if (instance->store) {
+      redstore_info("Opened snapshot: %s", snapshot);
+    } else {
+      redstore_error("Failed to open snapshot: %s", snapshot);
+    }
+  } else {
+    instance->store = native_store_new();
+  }
+
+  if (!instance->store) {
+    free(instance);
+    instance = NULL;
+    goto CLEANUP;
+  }
+
+  librdf_storage_set_instance(storage, instance);
+
+CLEANUP:
+  if (snapshot)
+    librdf_free_memory(snapshot);
+
+  return instance ? 0 : 1;
+}
+
+static void native_storage_terminate(librdf_storage * storage)
+{
+  native_storage_t *instance = (native_storage_t *) librdf_storage_get_instance(storage);
+  size_t i;
+
+  if (!instance)
+    return;
+
+  for (i = 0; i < instance->cache_count; i++) {
+    if (instance->cache[i].node)
+      librdf_free_node(instance->cache[i].node);
+  }
+  if (instance->cache)
+    free(instance->cache);
+  if (instance->cache_buckets)
+    free(instance->cache_buckets);
+
+  native_store_free(instance->store);
+  free(instance);
+}
+
+static int native_storage_open(librdf_storage * storage, librdf_model * model)
+{
+  return 0;
+}
+
+static int native_storage_close(librdf_storage * storage)
+{
+  return 0;
+}
+
+static int native_storage_size(librdf_storage * storage)
+{
+  native_storage_t *instance = (native_storage_t *) librdf_storage_get_instance(storage);
+  return (int) native_store_size(instance->store);
+}
+
+static int native_storage_context_add_statement(librdf_storage * storage, librdf_node * context,
+                                                librdf_statement * statement)
+{
+  native_storage_t *instance = (native_storage_t *) librdf_storage_get_instance(storage);
+  native_id_t quad[4];
+
+  if (statement_to_quad(instance, statement, context, quad, 1))
+    return 1;
+
+  return native_store_add(instance->store, quad) < 0;
+}
+
+static int native_storage_add_statement(librdf_storage * storage, librdf_statement * statement)
+{
+  return native_storage_context_add_statement(storage, NULL, statement);
+}
+
+static int native_storage_add_statements(librdf_storage * storage, librdf_stream * stream)
+{
+  int err = 0;
+
+  while (!librdf_stream_end(stream)) {
+    librdf_statement *statement = librdf_stream_get_object(stream);
+    if (!statement || native_storage_add_statement(storage, statement)) {
+      err = 1;
+      break;
+    }
+    librdf_stream_next(stream);
+  }
+
+  return err;
+}
+
+static int native_storage_context_remove_statement(librdf_storage * storage,
+                                                   librdf_node * context,
+                                                   librdf_statement * statement)
+{
+  native_storage_t *instance = (native_storage_t *) librdf_storage_get_instance(storage);
+  native_id_t quad[4];
+
+  if (statement_to_quad(instance, statement, context, quad, 0))
+    return 1;
+
+  return native_store_remove(instance->store, quad);
+}
+
+static int native_storage_remove_statement(librdf_storage * storage, librdf_statement * statement)
+{
+  return native_storage_context_remove_statement(storage, NULL, statement);
+}
+
+static int native_storage_context_remove_statements(librdf_storage * storage, librdf_node * context)
+{
+  native_storage_t *instance = (native_storage_t *) librdf_storage_get_instance(storage);
+  native_id_t graph = node_to_id(instance, context, 0);
+
+  if (context && graph == NATIVE_NONE)
+    return 0;
+
+  native_store_remove_graph(instance->store, graph);
+
+  return 0;
+}
+
+static librdf_stream *native_storage_find_statements_in_context(librdf_storage * storage,
+                                                                librdf_statement * statement,
+                                                                librdf_node * context)
+{
+  native_storage_t *instance = (native_storage_t *) librdf_storage_get_instance(storage);
+  librdf_world *world = librdf_storage_get_world(storage);
+  native_cursor_t *cursor = NULL;
+  native_stream_t *scontext = NULL;
+  native_id_t pattern[4];
+  librdf_stream *stream = NULL;
+
+  // A term that isn't in the dictionary can't match anything
+  if (statement_to_quad(instance, statement, context, pattern, 0))
+    return librdf_new_empty_stream(world);
+
+  cursor = native_store_find(instance->store, pattern);
+  if (!cursor)
+    return NULL;
+
+  scontext = native_stream_new(storage, cursor);
+  if (!scontext)
+    return NULL;
+
+  stream = librdf_new_stream(world, scontext, native_stream_is_end,
+                             native_stream_next, native_stream_get, native_stream_finished);
+  if (!stream)
+    native_stream_finished(scontext);
+
+  return stream;
+}
+
+static librdf_stream *native_storage_find_statements(librdf_storage * storage,
+                                                     librdf_statement * statement)
+{
+  return native_storage_find_statements_in_context(storage, statement, NULL);
+}
+
+static librdf_stream *native_storage_serialise(librdf_storage * storage)
+{
+  return native_storage_find_statements_in_context(storage, NULL, NULL);
+}
+
+static librdf_stream *native_storage_context_serialise(librdf_storage * storage,
+                                                       librdf_node * context)
+{
+  if (!context)
+    return librdf_new_empty_stream(librdf_storage_get_world(storage));
+
+  return native_storage_find_statements_in_context(storage, NULL, context);
+}
+
+static int native_storage_contains_statement(librdf_storage * storage,
+                                             librdf_statement * statement)
+{
+  librdf_stream *stream = native_storage_find_statements(storage, statement);
+  int found = 0;
+
+  if (stream) {
+    found = !librdf_stream_end(stream);
+    librdf_free_stream(stream);
+  }
+
+  return found;
+}
+
+static int native_contexts_is_end(void *context)
+{
+  return native_stream_is_end(context);
+}
+
+static int native_contexts_next(void *context)
+{
+  return native_stream_next(context);
+}
+
+static void *native_contexts_get(void *context, int flags)
+{
+  native_stream_t *scontext = (native_stream_t *) context;
+
+  switch (flags) {
+  case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+    return native_stream_get_context(scontext);
+
+  case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+    return NULL;
+
+  default:
+    redstore_error("Unknown iterator method flag %d", flags);
+    return NULL;
+  }
+}
+
+static void native_contexts_finished(void *context)
+{
+  native_stream_finished(context);
+}
+
+static librdf_iterator *native_storage_get_contexts(librdf_storage * storage)
+{
+  native_storage_t *instance = (native_storage_t *) librdf_storage_get_instance(storage);
+  native_cursor_t *cursor = NULL;
+  native_stream_t *scontext = NULL;
+  librdf_iterator *iterator = NULL;
+
+  cursor = native_store_graphs(instance->store);
+  if (!cursor)
+    return NULL;
+
+  scontext = native_stream_new(storage, cursor);
+  if (!scontext)
+    return NULL;
+
+  iterator = librdf_new_iterator(librdf_storage_get_world(storage), scontext,
+                                 native_contexts_is_end, native_contexts_next,
+                                 native_contexts_get, native_contexts_finished);
+  if (!iterator)
+    native_stream_finished(scontext);
+
+  return iterator;
+}
+
+static librdf_node *native_storage_get_feature(librdf_storage * storage, librdf_uri * feature)
+{
+  const char *uri = NULL;
+
+  if (!feature)
+    return NULL;
+
+  uri = (const char *) librdf_uri_as_string(feature);
+  if (uri && strcmp(uri, LIBRDF_MODEL_FEATURE_CONTEXTS) == 0) {
+    return librdf_new_node_from_typed_literal(librdf_storage_get_world(storage),
+                                              (const unsigned char *) "1", NULL, NULL);
+  }
+
+  return NULL;
+}
+
+static void native_storage_register_factory(librdf_storage_factory * factory)
+{
+  factory->version = LIBRDF_STORAGE_INTERFACE_VERSION;
+  factory->init = native_storage_init;
+  factory->terminate = native_storage_terminate;
+  factory->open = native_storage_open;
+  factory->close = native_storage_close;
+  factory->size = native_storage_size;
+  factory->add_statement = native_storage_add_statement;
+  factory->add_statements = native_storage_add_statements;
+  factory->remove_statement = native_storage_remove_statement;
+  factory->contains_statement = native_storage_contains_statement;
+  factory->serialise = native_storage_serialise;
+  factory->find_statements = native_storage_find_statements;
+  factory->context_add_statement = native_storage_context_add_statement;
+  factory->context_remove_statement = native_storage_context_remove_statement;
+  factory->context_remove_statements = native_storage_context_remove_statements;
+  factory->context_serialise = native_storage_context_serialise;
+  factory->find_statements_in_context = native_storage_find_statements_in_context;
+  factory->get_contexts = native_storage_get_contexts;
+  factory->get_feature = native_storage_get_feature;
+}
+
+// Writes the contents of a native storage to a snapshot file
+int native_storage_write_snapshot(librdf_storage * storage, const char *filename)
+{
+  native_storage_t *instance = (native_storage_t *) librdf_storage_get_instance(storage);
+  return native_store_write_snapshot(instance->store, filename);
+}
+
+// Register the 'native' storage module with librdf
+int native_storage_register(librdf_world * world)
+{
+  return librdf_storage_register_factory(world, "native", "RedStore native quad store",
+                                         native_storage_register_factory);
+}
@@ -0,0 +1,642 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "redstore.h"
+
+
+// RDF Patch: a list of quads to add and delete, grouped into transactions
+// with TX (begin), TC (commit) and TA (abort) rows. Each transaction in a
+// patch is applied as a single transaction in the store, so applying a
+// patch only costs as much as the changes in it, however large the graphs
+// that it changes are.
+//
+// Rows before the first TX, or between transactions, are applied together
+// as if they were in a transaction of their own.
+
+typedef struct patch_s {
+  char **prefixes;
+  char **iris;
+  int prefix_count;
+  int prefix_size;
+
+  // Set when the patch can't be applied
+  const char *error;
+  int error_line;
+  int status;
+
+  // State of the transaction that is currently open
+  int open;
+  int explicit;
+  int transaction;
+  unsigned long added;
+  unsigned long deleted;
+
+  unsigned long committed;
+  unsigned long aborted;
+  unsigned long total_added;
+  unsigned long total_deleted;
+} patch_t;
+
+
+static char *copy_string(const char *start, size_t len)
+{
+  char *str = malloc(len + 1);
+  if (str) {
+    memcpy(str, start, len);
+    str[len] = '\0';
+  }
+  return str;
+}
+
+static char *skip_space(char *ptr)
+{
+  while (*ptr == ' ' || *ptr == '\t' || *ptr == '\r')
+    ptr++;
+  return ptr;
+}
+
+// Returns the length of a bare word, such as a prefixed name or a blank
+// node label. A full stop that ends the row is not part of the word.
+static size_t word_length(const char *ptr)
+{
+  size_t len = 0;
+
+  while (ptr[len] && !isspace((unsigned char) ptr[len])) {
+    if (ptr[len] == '.' && (ptr[len + 1] == '\0' || isspace((unsigned char) ptr[len + 1])))
+      break;
+    len++;
+  }
+
+  return len;
+}
+
+static int patch_find_prefix(patch_t * patch, const char *prefix, size_t len)
+{
+  int i;
+
+  for (i = 0; i < patch->prefix_count; i++) {
+    if (strlen(patch->prefixes[i]) == len && strncmp(patch->prefixes[i], prefix, len) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+// Reads an IRI, written in full or as a prefixed name
+static librdf_uri *patch_read_uri(patch_t * patch, char **ptr)
+{
+  librdf_uri *uri = NULL;
+  char *start = *ptr;
+  char *colon = NULL;
+  char *iri = NULL;
+  size_t len;
+  int i;
+
+  if (*start == '<') {
+    char *end = strchr(start, '>');
+    if (!end) {
+      patch->error = "Unterminated IRI";
+      return NULL;
+    }
+    *end = '\0';
+    uri = librdf_new_uri(world, (unsigned char *) start + 1);
+    *ptr = end + 1;
+    return uri;
+  }
+
+  len = word_length(start);
+  colon = memchr(start, ':', len);
+  if (!colon) {
+    patch->error = "Expected an IRI";
+    return NULL;
+  }
+
+  i = patch_find_prefix(patch, start, colon - start);
+  if (i < 0) {
+    patch->error = "Undefined prefix";
+    return NULL;
+  }
+
+  iri = malloc(strlen(patch->iris[i]) + (start + len - colon));
+  if (!iri)
+    return NULL;
+  strcpy(iri, patch->iris[i]);
+  strncat(iri, colon + 1, start + len - colon - 1);
+  uri = librdf_new_uri(world, (unsigned char *) iri);
+  free(iri);
+
+  *ptr = start + len;
+  return uri;
+}
+
+static librdf_node *patch_read_literal(patch_t * patch, char **ptr)
+{
+  librdf_node *node = NULL;
+  librdf_uri *datatype = NULL;
+  char *start = *ptr;
+  char *end = start + 1;
+  char *value = NULL;
+  char *lang = NULL;
+
+  while (*end && *end != *start) {
+    if (*end == '\\' && end[1])
+      end++;
+    end++;
+  }
+  if (!*end) {
+    patch->error = "Unterminated string";
+    return NULL;
+  }
+
+  value = redstore_unescape_string(start + 1, end - start - 1);
+  if (!value)
+    return NULL;
+
+  end++;
+  if (*end == '@') {
+    size_t len = 0;
+    while (isalnum((unsigned char) end[1 + len]) || end[1 + len] == '-')
+      len++;
+    lang = copy_string(end + 1, len);
+    if (!lang)
+      goto CLEANUP;
+    end += 1 + len;
+  } else if (end[0] == '^' && end[1] == '^') {
+    end += 2;
+    datatype = patch_read_uri(patch, &end);
+    if (!datatype)
+      goto CLEANUP;
+  }
+
+  node = librdf_new_node_from_typed_literal(world, (unsigned char *) value, lang, datatype);
+  *ptr = end;
+
+CLEANUP:
+  if (datatype)
+    librdf_free_uri(datatype);
+  if (lang)
+    free(lang);
+  free(value);
+
+  return node;
+}
+
+// Reads a term in Turtle syntax; returns NULL and sets the error if there isn't one
+static librdf_node *patch_read_term(patch_t * patch, char **ptr)
+{
+  librdf_node *node = NULL;
+  char *start = skip_space(*ptr);
+
+  if (*start == '"' || *start == '\'') {
+    node = patch_read_literal(patch, &start);
+  } else if (start[0] == '_' && start[1] == ':') {
+    size_t len = word_length(start);
+    char *label = (len > 2) ? copy_string(start + 2, len - 2) : NULL;
+    if (label) {
+      node = librdf_new_node_from_blank_identifier(world, (unsigned char *) label);
+      free(label);
+    }
+    start += len;
+  } else if (*start && *start != '.') {
+    librdf_uri *uri = patch_read_uri(patch, &start);
+    if (uri) {
+      node = librdf_new_node_from_uri(world, uri);
+      librdf_free_uri(uri);
+    }
+  } else {
+    patch->error = "Expected an RDF term";
+  }
+
+  if (!node && !patch->error)
+    patch->error = "Invalid RDF term";
+
+  *ptr = start;
+  return node;
+}
+
+// Checks that nothing but the full stop follows a row
+static int patch_row_end(patch_t * patch, char *ptr)
+{
+  ptr = skip_space(ptr);
+  if (*ptr == '.')
+    ptr = skip_space(ptr + 1);
+  if (*ptr && *ptr != '#') {
+    patch->error = "Unexpected text at the end of a row";
+    return 1;
+  }
+  return 0;
+}
+
+static int patch_add_prefix(patch_t * patch, char *ptr)
+{
+  librdf_uri *uri = NULL;
+  char *prefix = skip_space(ptr);
+  size_t len = word_length(prefix);
+  const char *iri = NULL;
+  int i;
+
+  if (len == 0 || prefix[len - 1] != ':') {
+    patch->error = "Expected a prefix";
+    return 1;
+  }
+
+  ptr = skip_space(prefix + len);
+  if (*ptr != '<') {
+    patch->error = "Expected an IRI";
+    return 1;
+  }
+  uri = patch_read_uri(patch, &ptr);
+  if (!uri || patch_row_end(patch, ptr)) {
+    if (uri)
+      librdf_free_uri(uri);
+    return 1;
+  }
+
+  i = patch_find_prefix(patch, prefix, len - 1);
+  if (i < 0) {
+    if (patch->prefix_count == patch->prefix_size) {
+      int new_size = patch->prefix_size ? patch->prefix_size * 2 : 16;
+      char **tmp_prefixes = realloc(patch->prefixes, new_size * sizeof(char *));
+      char **tmp_iris = NULL;
+      if (tmp_prefixes)
+        patch->prefixes = tmp_prefixes;
+      tmp_iris = realloc(patch->iris, new_size * sizeof(char *));
+      if (tmp_iris)
+        patch->iris = tmp_iris;
+      if (!tmp_prefixes || !tmp_iris) {
+        librdf_free_uri(uri);
+        patch->error = "Out of memory";
+        return 1;
+      }
+      patch->prefix_size = new_size;
+    }
+    i = patch->prefix_count;
+    patch->prefixes[i] = copy_string(prefix, len - 1);
+    patch->iris[i] = NULL;
+    patch->prefix_count++;
+  } else {
+    free(patch->iris[i]);
+  }
+  iri = (const char *) librdf_uri_as_string(uri);
+  patch->iris[i] = copy_string(iri, strlen(iri));
+  librdf_free_uri(uri);
+
+  if (!patch->prefixes[i] || !patch->iris[i]) {
+    patch->error = "Out of memory";
+    return 1;
+  }
+
+  return 0;
+}
+
+static int patch_delete_prefix(patch_t * patch, char *ptr)
+{
+  char *prefix = skip_space(ptr);
+  size_t len = word_length(prefix);
+  int i;
+
+  if (len == 0 || prefix[len - 1] != ':') {
+    patch->error = "Expected a prefix";
+    return 1;
+  }
+  if (patch_row_end(patch, prefix + len))
+    return 1;
+
+  i = patch_find_prefix(patch, prefix, len - 1);
+  if (i >= 0) {
+    free(patch->prefixes[i]);
+    free(patch->iris[i]);
+    patch->prefix_count--;
+    patch->prefixes[i] = patch->prefixes[patch->prefix_count];
+    patch->iris[i] = patch->iris[patch->prefix_count];
+  }
+
+  return 0;
+}
+
+static void patch_begin(patch_t * patch, int explicit)
+{
+  patch->open = 1;
+  patch->explicit = explicit;
+  patch->transaction = (store_transaction_start() == 0);
+  patch->added = 0;
+  patch->deleted = 0;
+}
+
+static int patch_commit(patch_t * patch)
+{
+  patch->open = 0;
+  if (patch->transaction && store_transaction_commit()) {
+    patch->error = "Failed to commit a transaction";
+    patch->status = REDHTTP_INTERNAL_SERVER_ERROR;
+    return 1;
+  }
+
+  patch->committed++;
+  patch->total_added += patch->added;
+  patch->total_deleted += patch->deleted;
+  return 0;
+}
+
+// Returns non-zero if the changes in the transaction could not all be undone
+static int patch_abort(patch_t * patch)
+{
+  patch->open = 0;
+  if (patch->transaction)
+    return store_transaction_rollback();
+
+  // Without a transaction, the changes have already been made
+  return patch->added != 0 || patch->deleted != 0;
+}
+
+// Applies an A (add) or D (delete) row
+static int patch_apply_quad(patch_t * patch, char *ptr, int remove)
+{
+  librdf_statement *statement = NULL;
+  librdf_node *nodes[4] = { NULL, NULL, NULL, NULL };
+  int err = 1, i;
+
+  for (i = 0; i < 3; i++) {
+    nodes[i] = patch_read_term(patch, &ptr);
+    if (!nodes[i])
+      goto CLEANUP;
+  }
+
+  ptr = skip_space(ptr);
+  if (*ptr && *ptr != '.' && *ptr != '#') {
+    nodes[3] = patch_read_term(patch, &ptr);
+    if (!nodes[3])
+      goto CLEANUP;
+  }
+
+  if (patch_row_end(patch, ptr))
+    goto CLEANUP;
+
+  if (librdf_node_is_literal(nodes[0]) || !librdf_node_is_resource(nodes[1]) ||
+      (nodes[3] && !librdf_node_is_resource(nodes[3]))) {
+    patch->error = "Invalid quad";
+    goto CLEANUP;
+  }
+
+  // The statement takes ownership of the subject, predicate and object
+  statement = librdf_new_statement_from_nodes(world, nodes[0], nodes[1], nodes[2]);
+  nodes[0] = nodes[1] = nodes[2] = NULL;
+  if (!statement) {
+    patch->error = "Failed to create a statement";
+    goto CLEANUP;
+  }
+
+  if (!patch->open)
+    patch_begin(patch, 0);
+
+  if (remove) {
+    if (store_remove_statement(nodes[3], statement) == 0)
+      patch->deleted++;
+  } else {
+    int added = store_add_statement(nodes[3], statement);
+    if (added < 0) {
+      patch->error = "Failed to add a triple";
+      patch->status = REDHTTP_INTERNAL_SERVER_ERROR;
+      goto CLEANUP;
+    } else if (added == 0) {
+      patch->added++;
+    }
+  }
+
+  err = 0;
+
+CLEANUP:
+  if (statement)
+    librdf_free_statement(statement);
+  for (i = 0; i < 4; i++) {
+    if (nodes[i])
+      librdf_free_node(nodes[i]);
+  }
+
+  return err;
+}
+
+static int patch_apply_row(patch_t * patch, char *ptr)
+{
+  char *code = skip_space(ptr);
+  size_t len = 0;
+
+  while (isalpha((unsigned char) code[len]))
+    len++;
+  ptr = code + len;
+
+  if (len == 0) {
+    if (*code && *code != '#') {
+      patch->error = "Expected a row code";
+      return 1;
+    }
+    return 0;
+  } else if (len == 1 && code[0] == 'A') {
+    return patch_apply_quad(patch, ptr, 0);
+  } else if (len == 1 && code[0] == 'D') {
+    return patch_apply_quad(patch, ptr, 1);
+  } else if (len == 1 && code[0] == 'H') {
+    // Headers, such as the patch's id, are not needed to apply it
+    return 0;
+  } else if (len == 2 && strncmp(code, "PA", 2) == 0) {
+    return patch_add_prefix(patch, ptr);
+  } else if (len == 2 && strncmp(code, "PD", 2) == 0) {
+    return patch_delete_prefix(patch, ptr);
+  } else if (len == 2 && strncmp(code, "TX", 2) == 0) {
+    if (patch_row_end(patch, ptr))
+      return 1;
+    if (patch->open && patch->explicit) {
+      patch->error = "Transactions can not be nested";
+      return 1;
+    }
+    if (patch->open && patch_commit(patch))
+      return 1;
+    patch_begin(patch, 1);
+  } else if (len == 2 && strncmp(code, "TC", 2) == 0) {
+    if (patch_row_end(patch, ptr))
+      return 1;
+    if (!patch->open || !patch->explicit) {
+      patch->error = "TC without TX";
+      return 1;
+    }
+    return patch_commit(patch);
+  } else if (len == 2 && strncmp(code, "TA", 2) == 0) {
+    if (patch_row_end(patch, ptr))
+      return 1;
+    if (!patch->open || !patch->explicit) {
+      patch->error = "TA without TX";
+      return 1;
+    }
+    if (patch_abort(patch)) {
+      patch->error = "Failed to abort a transaction";
+      patch->status = REDHTTP_INTERNAL_SERVER_ERROR;
+      return 1;
+    }
+    patch->aborted++;
+  } else {
+    patch->error = "Unknown row code";
+    return 1;
+  }
+
+  return 0;
+}
+
+static void patch_free(patch_t * patch)
+{
+  int i;
+
+  for (i = 0; i < patch->prefix_count; i++) {
+    free(patch->prefixes[i]);
+    free(patch->iris[i]);
+  }
+  if (patch->prefixes)
+    free(patch->prefixes);
+  if (patch->iris)
+    free(patch->iris);
+}
+
+// Applies each row of a patch in turn, stopping at the first error. If
+// that leaves a transaction open, abandoned is set to say what became of it.
+static void patch_apply_text(patch_t * patch, char *text, const char **abandoned)
+{
+  char *line = NULL;
+  int line_number = 1;
+
+  *abandoned = "";
+
+  for (line = text; line && *line; line_number++) {
+    char *next = strchr(line, '\n');
+    if (next)
+      *next++ = '\0';
+
+    if (patch_apply_row(patch, line)) {
+      if (!patch->error)
+        patch->error = "Invalid row";
+      patch->error_line = line_number;
+      break;
+    }
+    line = next;
+  }
+
+  if (!patch->error && patch->open) {
+    if (patch->explicit) {
+      patch->error = "The patch ended inside a transaction";
+    } else {
+      patch_commit(patch);
+    }
+  }
+
+  if (patch->error && patch->open) {
+    *abandoned = patch_abort(patch) ?
+        "Some of the changes in that transaction may have been applied. " :
+        "No changes from that transaction were made. ";
+  }
+}
+
+// Applies a patch that didn't arrive in a request, such as one from
+// another store's change feed. Returns non-zero if it could not all be applied.
+int patch_apply(char *text)
+{
+  const char *abandoned = NULL;
+  patch_t patch;
+  int err = 0;
+
+  memset(&patch, 0, sizeof(patch));
+
+  store_batch_start();
+  patch_apply_text(&patch, text, &abandoned);
+  if (store_batch_end() && !patch.error) {
+    redstore_error("Failed to write the changes in a patch to the log.");
+    err = 1;
+  } else if (patch.error) {
+    redstore_error("Failed to apply patch: %s. %s%lu earlier transactions were applied.",
+                   patch.error, abandoned, patch.committed);
+    err = 1;
+  }
+
+  patch_free(&patch);
+
+  return err;
+}
+
+redhttp_response_t *handle_patch_post(redhttp_request_t * request, void *user_data)
+{
+  redhttp_response_t *response = NULL;
+  unsigned char *buffer = NULL;
+  const char *abandoned = NULL;
+  char *text = NULL;
+  size_t length = 0;
+  patch_t patch;
+
+  memset(&patch, 0, sizeof(patch));
+  patch.status = REDHTTP_BAD_REQUEST;
+
+  response = read_request_body(request, &buffer, &length);
+  if (response)
+    return response;
+
+  text = realloc(buffer, length + 1);
+  if (!text) {
+    free(buffer);
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Out of memory."
+    );
+  }
+  text[length] = '\0';
+
+  // The transactions in a patch are written to the log together
+  store_batch_start();
+  patch_apply_text(&patch, text, &abandoned);
+
+  if (store_batch_end() && !patch.error) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
+      "Failed to write the changes to the log."
+    );
+  } else if (patch.error && patch.error_line) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, patch.status,
+      "%s on line %d. %s%lu earlier transactions were applied.",
+      patch.error, patch.error_line, abandoned, patch.committed
+    );
+  } else if (patch.error) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, patch.status,
+      "%s. %s%lu earlier transactions were applied.",
+      patch.error, abandoned, patch.committed
+    );
+  } else {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_OK,
+      "Applied %lu transactions: %lu triples added and %lu deleted, %lu transactions aborted.",
+      patch.committed, patch.total_added, patch.total_deleted, patch.aborted
+    );
+  }
+
+  patch_free(&patch);
+  free(text);
+
+  return response;
+}
@@ -24,6 +24,179 @@
 
 #include "redstore.h"
 
+
+typedef enum {
+  COUNT_SCOPE_ALL,
+  COUNT_SCOPE_GRAPH,
+  COUNT_SCOPE_NAMED_GRAPHS
+} count_scope_t;
+
+// Matches '?s ?p ?o' with three different variables, followed by an optional '.'
+static const char *match_any_triple(const char *ptr, const char *graph_var)
+{
+  lexer_token_t vars[3], token;
+  const char *next;
+  int i, j;
+
+  for (i = 0; i < 3; i++) {
+    ptr = lexer_next(ptr, &vars[i]);
+    if (!ptr || vars[i].type != TOKEN_VAR)
+      return NULL;
+    for (j = 0; j < i; j++) {
+      if (vars[j].len == vars[i].len && strncmp(vars[j].start + 1, vars[i].start + 1, vars[i].len - 1) == 0)
+        return NULL;
+    }
+    if (graph_var && strlen(graph_var) == vars[i].len - 1 &&
+        strncmp(graph_var, vars[i].start + 1, vars[i].len - 1) == 0)
+      return NULL;
+  }
+
+  next = lexer_next(ptr, &token);
+  if (next && lexer_token_is(&token, "."))
+    ptr = next;
+
+  return ptr;
+}
+
+// Recognise queries of the form:
+//   SELECT (COUNT(*) AS ?count) WHERE { ?s ?p ?o }
+//   SELECT (COUNT(*) AS ?count) WHERE { GRAPH <uri> { ?s ?p ?o } }
+//   SELECT (COUNT(*) AS ?count) WHERE { GRAPH ?g { ?s ?p ?o } }
+// which can be answered from the maintained statement counts.
+static int parse_count_query(const char *query_string, char **var_name, char **graph_uri,
+                             count_scope_t * scope)
+{
+  static const char *prefix[] = { "SELECT", "(", "COUNT", "(", "*", ")", "AS", NULL };
+  const char *ptr = lexer_skip_prologue(query_string);
+  char *graph_var = NULL;
+  lexer_token_t token;
+  int i;
+
+  *var_name = NULL;
+  *graph_uri = NULL;
+  *scope = COUNT_SCOPE_ALL;
+
+  for (i = 0; prefix[i]; i++) {
+    if (ptr)
+      ptr = lexer_next(ptr, &token);
+    if (!ptr || !lexer_token_is(&token, prefix[i]))
+      return 0;
+  }
+
+  if (!(ptr = lexer_next(ptr, &token)) || token.type != TOKEN_VAR)
+    goto FAIL;
+  *var_name = lexer_token_value(&token);
+
+  if (!(ptr = lexer_next(ptr, &token)) || !lexer_token_is(&token, ")"))
+    goto FAIL;
+
+  if (!(ptr = lexer_next(ptr, &token)))
+    goto FAIL;
+  if (lexer_token_is(&token, "WHERE") && !(ptr = lexer_next(ptr, &token)))
+    goto FAIL;
+  if (!lexer_token_is(&token, "{"))
+    goto FAIL;
+
+  if (!(ptr = lexer_next(ptr, &token)))
+    goto FAIL;
+  if (lexer_token_is(&token, "GRAPH")) {
+    if (!(ptr = lexer_next(ptr, &token)))
+      goto FAIL;
+    if (token.type == TOKEN_IRI) {
+      *graph_uri = lexer_token_value(&token);
+      *scope = COUNT_SCOPE_GRAPH;
+    } else if (token.type == TOKEN_VAR) {
+      graph_var = lexer_token_value(&token);
+      *scope = COUNT_SCOPE_NAMED_GRAPHS;
+    } else {
+      goto FAIL;
+    }
+
+    if (!(ptr = lexer_next(ptr, &token)) || !lexer_token_is(&token, "{"))
+      goto FAIL;
+    if (!(ptr = match_any_triple(ptr, graph_var)))
+      goto FAIL;
+    if (!(ptr = lexer_next(ptr, &token)) || !lexer_token_is(&token, "}"))
+      goto FAIL;
+  } else {
+    if (!(ptr = match_any_triple(token.start, NULL)))
+      goto FAIL;
+  }
+
+  if (!(ptr = lexer_next(ptr, &token)) || !lexer_token_is(&token, "}"))
+    goto FAIL;
+  if (!(ptr = lexer_next(ptr, &token)) || token.type != TOKEN_END)
+    goto FAIL;
+
+  if (graph_var)
+    free(graph_var);
+
+  return 1;
+
+FAIL:
+  if (graph_var)
+    free(graph_var);
+  if (*var_name)
+    free(*var_name);
+  if (*graph_uri)
+    free(*graph_uri);
+  *var_name = NULL;
+  *graph_uri = NULL;
+  return 0;
+}
+
+// Answer simple COUNT queries from the statement counters, without scanning the store.
+// Returns NULL if the query isn't one that can be answered this way.
+static redhttp_response_t *perform_count_query(redhttp_request_t * request, const char *query_string)
+{
+  redhttp_response_t *response = NULL;
+  librdf_node *count_node = NULL;
+  char *var_name = NULL, *graph_uri = NULL;
+  unsigned long count = 0;
+  count_scope_t scope;
+
+  // The counters are for the whole dataset, not one chosen by the protocol
+  if (redhttp_request_get_argument(request, "default-graph-uri") ||
+      redhttp_request_get_argument(request, "named-graph-uri"))
+    return NULL;
+
+  if (!parse_count_query(query_string, &var_name, &graph_uri, &scope))
+    return NULL;
+
+  if (scope == COUNT_SCOPE_GRAPH) {
+    librdf_node *graph = librdf_new_node_from_uri_string(world, (unsigned char *) graph_uri);
+    if (graph) {
+      count = stats_get_graph_size(graph);
+      librdf_free_node(graph);
+    } else {
+      goto CLEANUP;
+    }
+  } else if (scope == COUNT_SCOPE_NAMED_GRAPHS) {
+    count = stats_get_named_total();
+  } else {
+    count = stats_get_total();
+  }
+
+  count_node = redstore_new_node_from_integer(count);
+  if (!count_node)
+    goto CLEANUP;
+
+  redstore_debug("Answering COUNT query from statement counters");
+  response = format_bindings_table(request, (const char **) &var_name, 1, &count_node, 1);
+  if (response)
+    query_count++;
+
+CLEANUP:
+  if (count_node)
+    librdf_free_node(count_node);
+  if (var_name)
+    free(var_name);
+  if (graph_uri)
+    free(graph_uri);
+
+  return response;
+}
+
 static redhttp_response_t *perform_query(redhttp_request_t * request, const char *query_string)
 {
   librdf_query *query = NULL;
@@ -37,6 +210,12 @@ static redhttp_response_t *perform_query(redhttp_request_t * request, const char
   redstore_debug("query_lang='%s'", lang);
   redstore_debug("query_string='%s'", query_string);
 
+  if (strncmp(lang, "sparql", 6) == 0 || strcmp(lang, "laqrs") == 0) {
+    response = perform_count_query(request, query_string);
+    if (response)
+      return response;
+  }
+
   query = librdf_new_query(world, lang, NULL, (unsigned char *) query_string, NULL);
   if (!query) {
     response = redstore_page_new_with_message(
@@ -116,6 +295,9 @@ redhttp_response_t *handle_sparql(redhttp_request_t * request, void *user_data)
   query_string = redhttp_request_get_argument(request, "query");
   if (query_string) {
     response = perform_query(request, query_string);
+  } else if (strcmp(method, "POST")==0 && (redhttp_request_argument_exists(request, "update") ||
+             redstore_is_sparql_update_request(request))) {
+    response = handle_update(request, user_data);
   } else if (strcmp(method, "GET")==0) {
     response = handle_description_get(request, user_data);
   } else {
@@ -0,0 +1,843 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "redstore.h"
+
+
+// An index of the statements whose objects are numbers, dates or
+// dateTimes, ordered by value for each predicate, so that a range of
+// values can be found without looking at every value of the predicate.
+// Numbers are compared as doubles, and dates and dateTimes as seconds
+// since 1970 in UTC; a date is the same as midnight at the start of it.
+//
+// Each predicate has a list for each kind of value. New entries are
+// added to the end of the list, and the list is only sorted again when
+// it is next searched, so that loading many values at once is cheap.
+// Removed entries are left as gaps until then. Each list also has a hash
+// table of the positions of its entries, so that an entry can be found
+// to remove it without searching the list.
+//
+// Only the default dataset is indexed.
+
+#define XSD_NAMESPACE "http://www.w3.org/2001/XMLSchema#"
+
+typedef struct range_entry_s {
+  double value;
+  uint64_t hash;                // Of the statement
+  librdf_node *subject;         // NULL once the entry has been removed
+  librdf_node *object;
+  librdf_node *graph;
+} range_entry_t;
+
+typedef struct range_list_s {
+  librdf_node *predicate;
+  uint64_t hash;
+  int kind;
+  range_entry_t *entries;
+  size_t count;
+  size_t size;
+  size_t sorted;                // The first sorted entries are in order
+  size_t removed;
+  size_t *positions;            // Open addressing table of entry positions plus one
+  size_t positions_size;
+  size_t positions_used;        // Including the slots of removed entries
+} range_list_t;
+
+typedef struct range_stream_s {
+  range_list_t *list;
+  size_t pos;
+  double max;
+  librdf_node *subject;
+  librdf_node *graph;
+  librdf_statement *statement;
+} range_stream_t;
+
+static const char *range_numeric_types[] = {
+  "integer", "decimal", "double", "float", "long", "int", "short", "byte",
+  "nonNegativeInteger", "positiveInteger", "nonPositiveInteger", "negativeInteger",
+  "unsignedLong", "unsignedInt", "unsignedShort", "unsignedByte", NULL
+};
+
+static int enabled = 0;
+
+// Set when the index no longer matches the store
+static int dirty = 0;
+
+// Lists, in an open addressing table keyed by predicate and kind
+static range_list_t *lists = NULL;
+static size_t lists_size = 0;
+static size_t lists_count = 0;
+static unsigned long entry_count = 0;
+
+
+// Reads a fixed number of digits; returns non-zero if they aren't all digits
+static int range_parse_digits(const char **str, int digits, int *value)
+{
+  *value = 0;
+  while (digits-- > 0) {
+    if (!isdigit((unsigned char) **str))
+      return 1;
+    *value = *value * 10 + (**str - '0');
+    (*str)++;
+  }
+
+  return 0;
+}
+
+// Days between 1970-01-01 and a date in the proleptic Gregorian calendar
+static double range_days_from_civil(long year, int month, int day)
+{
+  long era, yoe, doy, doe;
+
+  year -= month <= 2;
+  era = (year >= 0 ? year : year - 399) / 400;
+  yoe = year - era * 400;
+  doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+  return (double) (era * 146097 + doe - 719468);
+}
+
+// Parses an xsd:date, or an xsd:dateTime if with_time is set, into seconds since 1970
+static int range_parse_time(const char *str, int with_time, double *value)
+{
+  int month, day, hour = 0, minute = 0, second = 0, tz_hour, tz_minute;
+  double fraction = 0.0, scale = 0.1;
+  long year = 0;
+  int negative = 0, digits = 0;
+
+  if (*str == '-') {
+    negative = 1;
+    str++;
+  }
+  while (isdigit((unsigned char) *str)) {
+    year = year * 10 + (*str++ - '0');
+    if (++digits > 9)
+      return 1;
+  }
+  if (digits < 4 || *str++ != '-')
+    return 1;
+  if (negative)
+    year = -year;
+
+  if (range_parse_digits(&str, 2, &month) || *str++ != '-' || range_parse_digits(&str, 2, &day))
+    return 1;
+  if (month < 1 || month > 12 || day < 1 || day > 31)
+    return 1;
+
+  if (with_time) {
+    if (*str++ != 'T' || range_parse_digits(&str, 2, &hour) || *str++ != ':' ||
+        range_parse_digits(&str, 2, &minute) || *str++ != ':' ||
+        range_parse_digits(&str, 2, &second))
+      return 1;
+    if (*str == '.') {
+      str++;
+      if (!isdigit((unsigned char) *str))
+        return 1;
+      while (isdigit((unsigned char) *str)) {
+        fraction += (*str++ - '0') * scale;
+        scale /= 10;
+      }
+    }
+    if (hour > 24 || minute > 59 || second > 60)
+      return 1;
+  }
+
+  *value = range_days_from_civil(year, month, day) * 86400.0 +
+      hour * 3600.0 + minute * 60.0 + second + fraction;
+
+  // Times without a timezone are taken to be in UTC
+  if (*str == 'Z') {
+    str++;
+  } else if (*str == '+' || *str == '-') {
+    int sign = (*str++ == '+') ? 1 : -1;
+    if (range_parse_digits(&str, 2, &tz_hour) || *str++ != ':' ||
+        range_parse_digits(&str, 2, &tz_minute))
+      return 1;
+    *value -= sign * (tz_hour * 3600.0 + tz_minute * 60.0);
+  }
+
+  return *str != '\0';
+}
+
+// Checks that a number is in the form its XSD type allows. strtod() also
+// accepts hexadecimal, infinities and NaN, which aren't indexed.
+static int range_check_number(const char *str, int fraction, int exponent)
+{
+  int digits = 0;
+
+  if (*str == '+' || *str == '-')
+    str++;
+  for (; isdigit((unsigned char) *str); str++)
+    digits++;
+  if (fraction && *str == '.') {
+    for (str++; isdigit((unsigned char) *str); str++)
+      digits++;
+  }
+  if (digits == 0)
+    return 1;
+
+  if (exponent && (*str == 'e' || *str == 'E')) {
+    str++;
+    if (*str == '+' || *str == '-')
+      str++;
+    if (!isdigit((unsigned char) *str))
+      return 1;
+    while (isdigit((unsigned char) *str))
+      str++;
+  }
+
+  return *str != '\0';
+}
+
+// Works out the kind and value of a typed literal; returns non-zero if it isn't indexed
+int range_node_value(librdf_node * node, int *kind, double *value)
+{
+  librdf_uri *datatype = NULL;
+  const char *type = NULL, *str = NULL;
+  int i, is_float;
+
+  if (!node || !librdf_node_is_literal(node))
+    return 1;
+
+  datatype = librdf_node_get_literal_value_datatype_uri(node);
+  if (!datatype)
+    return 1;
+
+  type = (const char *) librdf_uri_as_string(datatype);
+  if (strncmp(type, XSD_NAMESPACE, strlen(XSD_NAMESPACE)) != 0)
+    return 1;
+  type += strlen(XSD_NAMESPACE);
+
+  str = (const char *) librdf_node_get_literal_value(node);
+  if (!str || !*str)
+    return 1;
+
+  if (strcmp(type, "dateTime") == 0 || strcmp(type, "date") == 0) {
+    *kind = RANGE_TEMPORAL;
+    return range_parse_time(str, type[4] == 'T', value);
+  }
+
+  for (i = 0; range_numeric_types[i]; i++) {
+    if (strcmp(type, range_numeric_types[i]) == 0)
+      break;
+  }
+  if (!range_numeric_types[i])
+    return 1;
+
+  is_float = (strcmp(type, "double") == 0 || strcmp(type, "float") == 0);
+  if (range_check_number(str, is_float || strcmp(type, "decimal") == 0, is_float))
+    return 1;
+
+  *kind = RANGE_NUMERIC;
+  *value = strtod(str, NULL);
+
+  return 0;
+}
+
+
+static uint64_t range_hash(librdf_node * predicate, int kind)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  const unsigned char *uri = NULL;
+  size_t len = 0, i;
+
+  uri = librdf_uri_as_counted_string(librdf_node_get_uri(predicate), &len);
+  for (i = 0; i < len; i++) {
+    hash ^= uri[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash ^ (uint64_t) kind;
+}
+
+// Returns the list for a predicate and kind, or the empty slot where it would go
+static range_list_t *range_list_find(librdf_node * predicate, int kind, uint64_t hash)
+{
+  size_t mask = lists_size - 1;
+  size_t i = (size_t) hash & mask;
+
+  while (lists[i].predicate) {
+    range_list_t *list = &lists[i];
+    if (list->hash == hash && list->kind == kind && librdf_node_equals(list->predicate, predicate))
+      return list;
+    i = (i + 1) & mask;
+  }
+
+  return &lists[i];
+}
+
+static range_list_t *range_list_lookup(librdf_node * predicate, int kind)
+{
+  range_list_t *list = NULL;
+
+  if (!lists_size || !librdf_node_is_resource(predicate))
+    return NULL;
+
+  list = range_list_find(predicate, kind, range_hash(predicate, kind));
+  return list->predicate ? list : NULL;
+}
+
+static int range_lists_grow(void)
+{
+  range_list_t *old = lists;
+  size_t old_size = lists_size, i;
+
+  lists_size = old_size ? old_size * 2 : 64;
+  lists = calloc(lists_size, sizeof(range_list_t));
+  if (!lists) {
+    lists = old;
+    lists_size = old_size;
+    return 1;
+  }
+
+  for (i = 0; i < old_size; i++) {
+    if (old[i].predicate)
+      *range_list_find(old[i].predicate, old[i].kind, old[i].hash) = old[i];
+  }
+  if (old)
+    free(old);
+
+  return 0;
+}
+
+static range_list_t *range_list_intern(librdf_node * predicate, int kind)
+{
+  uint64_t hash = range_hash(predicate, kind);
+  range_list_t *list = NULL;
+
+  // Keep the table at most half full
+  if ((lists_count + 1) * 2 > lists_size && range_lists_grow())
+    return NULL;
+
+  list = range_list_find(predicate, kind, hash);
+  if (list->predicate)
+    return list;
+
+  list->predicate = librdf_new_node_from_node(predicate);
+  if (!list->predicate)
+    return NULL;
+  list->hash = hash;
+  list->kind = kind;
+  lists_count++;
+
+  return list;
+}
+
+static void range_entry_clear(range_entry_t * entry)
+{
+  if (!entry->subject)
+    return;
+
+  librdf_free_node(entry->subject);
+  librdf_free_node(entry->object);
+  if (entry->graph)
+    librdf_free_node(entry->graph);
+  entry->subject = NULL;
+}
+
+static void range_clear(void)
+{
+  size_t i, j;
+
+  for (i = 0; i < lists_size; i++) {
+    range_list_t *list = &lists[i];
+    if (!list->predicate)
+      continue;
+    for (j = 0; j < list->count; j++)
+      range_entry_clear(&list->entries[j]);
+    if (list->entries)
+      free(list->entries);
+    if (list->positions)
+      free(list->positions);
+    librdf_free_node(list->predicate);
+  }
+  if (lists)
+    free(lists);
+
+  lists = NULL;
+  lists_size = 0;
+  lists_count = 0;
+  entry_count = 0;
+}
+
+static int range_entry_matches(range_entry_t * entry, librdf_node * graph,
+                               librdf_statement * statement)
+{
+  if (!entry->subject)
+    return 0;
+
+  if (graph ? !entry->graph || !librdf_node_equals(entry->graph, graph) : entry->graph != NULL)
+    return 0;
+
+  return librdf_node_equals(entry->subject, librdf_statement_get_subject(statement)) &&
+      librdf_node_equals(entry->object, librdf_statement_get_object(statement));
+}
+
+static void range_positions_insert(range_list_t * list, size_t pos)
+{
+  size_t mask = list->positions_size - 1;
+  size_t slot = (size_t) list->entries[pos].hash & mask;
+
+  while (list->positions[slot])
+    slot = (slot + 1) & mask;
+  list->positions[slot] = pos + 1;
+  list->positions_used++;
+}
+
+// Makes a new table of the positions of the entries, with room for
+// at least min_count; the slots of removed entries are left out
+static int range_positions_rebuild(range_list_t * list, size_t min_count)
+{
+  size_t size = 64, i;
+  size_t *positions = NULL;
+
+  while (size < min_count * 2)
+    size *= 2;
+
+  positions = calloc(size, sizeof(size_t));
+  if (!positions)
+    return 1;
+
+  if (list->positions)
+    free(list->positions);
+  list->positions = positions;
+  list->positions_size = size;
+  list->positions_used = 0;
+
+  for (i = 0; i < list->count; i++) {
+    if (list->entries[i].subject)
+      range_positions_insert(list, i);
+  }
+
+  return 0;
+}
+
+// Returns the position of the entry for a statement, or list->count if there isn't one
+static size_t range_positions_lookup(range_list_t * list, uint64_t hash, librdf_node * graph,
+                                     librdf_statement * statement)
+{
+  size_t mask = list->positions_size - 1;
+  size_t slot;
+
+  if (!list->positions)
+    return list->count;
+
+  for (slot = (size_t) hash & mask; list->positions[slot]; slot = (slot + 1) & mask) {
+    range_entry_t *entry = &list->entries[list->positions[slot] - 1];
+    if (entry->hash == hash && range_entry_matches(entry, graph, statement))
+      return list->positions[slot] - 1;
+  }
+
+  return list->count;
+}
+
+static int range_compare_entries(const void *a, const void *b)
+{
+  const range_entry_t *ea = (const range_entry_t *) a;
+  const range_entry_t *eb = (const range_entry_t *) b;
+
+  if (ea->value < eb->value)
+    return -1;
+  return ea->value > eb->value;
+}
+
+// Puts the whole list in order, without the gaps left by removed entries
+static void range_list_sort(range_list_t * list)
+{
+  size_t i, count = 0;
+
+  if (list->sorted == list->count && !list->removed)
+    return;
+
+  for (i = 0; i < list->count; i++) {
+    if (list->entries[i].subject)
+      list->entries[count++] = list->entries[i];
+  }
+  list->count = count;
+  list->removed = 0;
+
+  qsort(list->entries, list->count, sizeof(range_entry_t), range_compare_entries);
+  list->sorted = list->count;
+
+  // The entries have moved
+  if (range_positions_rebuild(list, list->count)) {
+    redstore_debug("Failed to update the range index; it will be built again");
+    dirty = 1;
+  }
+}
+
+// Returns the position of the first sorted entry with a value of at least min
+static size_t range_list_lower_bound(range_list_t * list, double min)
+{
+  size_t low = 0, high = list->sorted;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (list->entries[mid].value < min) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+
+static int range_index_statement(librdf_node * graph, librdf_statement * statement)
+{
+  librdf_node *predicate = librdf_statement_get_predicate(statement);
+  librdf_node *object = librdf_statement_get_object(statement);
+  range_list_t *list = NULL;
+  range_entry_t *entry = NULL;
+  double value;
+  int kind;
+
+  if (range_node_value(object, &kind, &value) || !librdf_node_is_resource(predicate))
+    return 0;
+
+  list = range_list_intern(predicate, kind);
+  if (!list)
+    return 1;
+
+  // Keep the table of positions at most half full
+  if ((list->positions_used + 1) * 2 > list->positions_size &&
+      range_positions_rebuild(list, list->count - list->removed + 1))
+    return 1;
+
+  if (list->count == list->size) {
+    size_t size = list->size ? list->size * 2 : 16;
+    range_entry_t *tmp = realloc(list->entries, size * sizeof(range_entry_t));
+    if (!tmp)
+      return 1;
+    list->entries = tmp;
+    list->size = size;
+  }
+
+  entry = &list->entries[list->count];
+  entry->value = value;
+  entry->hash = redstore_statement_hash(statement);
+  entry->subject = librdf_new_node_from_node(librdf_statement_get_subject(statement));
+  entry->object = librdf_new_node_from_node(object);
+  entry->graph = graph ? librdf_new_node_from_node(graph) : NULL;
+  if (!entry->subject || !entry->object || (graph && !entry->graph)) {
+    if (entry->subject)
+      librdf_free_node(entry->subject);
+    if (entry->object)
+      librdf_free_node(entry->object);
+    if (entry->graph)
+      librdf_free_node(entry->graph);
+    return 1;
+  }
+
+  // Values added in order don't have to be sorted again
+  if (list->sorted == list->count && (list->count == 0 || list->entries[list->count - 1].value <= value))
+    list->sorted++;
+  range_positions_insert(list, list->count);
+  list->count++;
+  entry_count++;
+
+  return 0;
+}
+
+static int range_unindex_statement(librdf_node * graph, librdf_statement * statement)
+{
+  range_list_t *list = NULL;
+  double value;
+  size_t i;
+  int kind;
+
+  if (range_node_value(librdf_statement_get_object(statement), &kind, &value))
+    return 0;
+
+  list = range_list_lookup(librdf_statement_get_predicate(statement), kind);
+  if (!list)
+    return 1;
+
+  i = range_positions_lookup(list, redstore_statement_hash(statement), graph, statement);
+  if (i == list->count)
+    return 1;
+
+  range_entry_clear(&list->entries[i]);
+  list->removed++;
+  entry_count--;
+
+  return 0;
+}
+
+static void range_update(int remove, librdf_node * graph, librdf_statement * statement)
+{
+  int err;
+
+  if (!enabled || dirty || !datasets_is_default())
+    return;
+
+  if (remove) {
+    err = range_unindex_statement(graph, statement);
+  } else {
+    err = range_index_statement(graph, statement);
+  }
+
+  // Build the index again, rather than use an incomplete one
+  if (err) {
+    redstore_debug("Failed to update the range index; it will be built again");
+    dirty = 1;
+  }
+}
+
+void range_add_statement(librdf_node * graph, librdf_statement * statement)
+{
+  range_update(0, graph, statement);
+}
+
+void range_remove_statement(librdf_node * graph, librdf_statement * statement)
+{
+  range_update(1, graph, statement);
+}
+
+// Removes the entries for a graph (NULL for the default graph)
+void range_remove_graph(librdf_node * graph)
+{
+  size_t i, j;
+
+  if (!enabled || dirty || !datasets_is_default())
+    return;
+
+  for (i = 0; i < lists_size; i++) {
+    range_list_t *list = &lists[i];
+    if (!list->predicate)
+      continue;
+
+    for (j = 0; j < list->count; j++) {
+      range_entry_t *entry = &list->entries[j];
+      if (!entry->subject)
+        continue;
+      if (graph ? entry->graph && librdf_node_equals(entry->graph, graph) : !entry->graph) {
+        range_entry_clear(entry);
+        list->removed++;
+        entry_count--;
+      }
+    }
+  }
+}
+
+// Called when the store has been changed in a way that the index can't follow
+void range_invalidate(void)
+{
+  if (enabled && datasets_is_default())
+    dirty = 1;
+}
+
+// Called when the whole store has been emptied
+void range_reset(void)
+{
+  if (enabled && datasets_is_default()) {
+    range_clear();
+    dirty = 0;
+  }
+}
+
+static int range_build(void)
+{
+  librdf_stream *stream = NULL;
+  int err = 0;
+
+  range_clear();
+
+  stream = librdf_model_as_stream(model);
+  if (!stream) {
+    redstore_error("Failed to stream model to build the range index");
+    return 1;
+  }
+
+  while (!librdf_stream_end(stream)) {
+    if (range_index_statement(librdf_stream_get_context2(stream),
+                              librdf_stream_get_object(stream))) {
+      err = 1;
+      break;
+    }
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+
+  if (err) {
+    redstore_error("Failed to build the range index");
+    range_clear();
+    return 1;
+  }
+
+  redstore_info("Indexed %lu typed values of %lu predicates", entry_count,
+                (unsigned long) lists_count);
+  dirty = 0;
+
+  return 0;
+}
+
+int range_init(int enable)
+{
+  enabled = enable;
+  if (!enabled)
+    return 0;
+
+  return range_build();
+}
+
+int range_is_enabled(void)
+{
+  return enabled && datasets_is_default();
+}
+
+
+// Moves on to the next entry in range that matches the subject and graph
+static void range_stream_skip(range_stream_t * scontext)
+{
+  range_list_t *list = scontext->list;
+
+  while (scontext->pos < list->count) {
+    range_entry_t *entry = &list->entries[scontext->pos];
+
+    if (entry->value > scontext->max) {
+      scontext->pos = list->count;
+      break;
+    }
+    if ((!scontext->subject || librdf_node_equals(entry->subject, scontext->subject)) &&
+        (!scontext->graph || (entry->graph && librdf_node_equals(entry->graph, scontext->graph))))
+      break;
+    scontext->pos++;
+  }
+}
+
+static int range_stream_is_end(void *context)
+{
+  range_stream_t *scontext = (range_stream_t *) context;
+  return !scontext->list || scontext->pos >= scontext->list->count;
+}
+
+static int range_stream_next(void *context)
+{
+  range_stream_t *scontext = (range_stream_t *) context;
+
+  if (scontext->statement) {
+    librdf_free_statement(scontext->statement);
+    scontext->statement = NULL;
+  }
+
+  if (!range_stream_is_end(context)) {
+    scontext->pos++;
+    range_stream_skip(scontext);
+  }
+
+  return range_stream_is_end(context);
+}
+
+static void *range_stream_get(void *context, int flags)
+{
+  range_stream_t *scontext = (range_stream_t *) context;
+  range_entry_t *entry = NULL;
+
+  if (range_stream_is_end(context))
+    return NULL;
+  entry = &scontext->list->entries[scontext->pos];
+
+  switch (flags) {
+  case LIBRDF_STREAM_GET_METHOD_GET_OBJECT:
+    if (!scontext->statement) {
+      scontext->statement = librdf_new_statement_from_nodes(world,
+                                                            librdf_new_node_from_node(entry->subject),
+                                                            librdf_new_node_from_node(scontext->list->predicate),
+                                                            librdf_new_node_from_node(entry->object));
+    }
+    return scontext->statement;
+
+  case LIBRDF_STREAM_GET_METHOD_GET_CONTEXT:
+    return entry->graph;
+
+  default:
+    redstore_error("Unknown iterator method flag %d", flags);
+    return NULL;
+  }
+}
+
+static void range_stream_finished(void *context)
+{
+  range_stream_t *scontext = (range_stream_t *) context;
+
+  if (scontext->statement)
+    librdf_free_statement(scontext->statement);
+  if (scontext->subject)
+    librdf_free_node(scontext->subject);
+  if (scontext->graph)
+    librdf_free_node(scontext->graph);
+  free(scontext);
+}
+
+// Returns the statements with the predicate and a value of the kind
+// between min and max, inclusive, in order of value. The subject and
+// graph may be NULL, to match any. The index must not be changed while
+// the stream is in use.
+librdf_stream *range_find(librdf_node * predicate, int kind, double min, double max,
+                          librdf_node * subject, librdf_node * graph)
+{
+  range_stream_t *scontext = NULL;
+  librdf_stream *stream = NULL;
+
+  if (!range_is_enabled())
+    return NULL;
+
+  if (dirty && range_build())
+    return NULL;
+
+  scontext = calloc(1, sizeof(range_stream_t));
+  if (!scontext)
+    return NULL;
+
+  scontext->list = range_list_lookup(predicate, kind);
+  scontext->max = max;
+  if (subject)
+    scontext->subject = librdf_new_node_from_node(subject);
+  if (graph)
+    scontext->graph = librdf_new_node_from_node(graph);
+
+  if (scontext->list) {
+    range_list_sort(scontext->list);
+    scontext->pos = range_list_lower_bound(scontext->list, min);
+    range_stream_skip(scontext);
+  }
+
+  stream = librdf_new_stream(world, scontext, range_stream_is_end, range_stream_next,
+                             range_stream_get, range_stream_finished);
+  if (!stream)
+    range_stream_finished(scontext);
+
+  return stream;
+}
+
+void range_free(void)
+{
+  range_clear();
+  enabled = 0;
+  dirty = 0;
+}
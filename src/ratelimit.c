@@ -0,0 +1,244 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "redstore.h"
+
+
+// Per-client rate limiting: each remote address has a token bucket
+// that refills at a fixed rate. The buckets are kept in a number of
+// small hash tables (shards), so that each one stays short and
+// idle clients can be swept out of one shard at a time. Each shard
+// holds at most RATELIMIT_SHARD_MAX buckets.
+
+typedef struct client_bucket_s {
+  char *addr;
+  double tokens;
+  time_t updated;
+  struct client_bucket_s *next;
+} client_bucket_t;
+
+typedef struct client_shard_s {
+  client_bucket_t *slots[RATELIMIT_SHARD_SLOTS];
+  unsigned int count;
+} client_shard_t;
+
+static client_shard_t shards[RATELIMIT_SHARDS];
+static double rate_limit = 0.0;
+static double burst_size = 0.0;
+static int concurrency_limit = 0;
+
+
+static unsigned long hash_addr(const char *addr)
+{
+  unsigned long hash = 5381;
+  const unsigned char *ptr;
+
+  for (ptr = (const unsigned char *) addr; *ptr; ptr++)
+    hash = ((hash << 5) + hash) + *ptr;
+
+  return hash;
+}
+
+static double refill(client_bucket_t * bucket, time_t now)
+{
+  if (now > bucket->updated) {
+    bucket->tokens += (double) (now - bucket->updated) * rate_limit;
+    if (bucket->tokens > burst_size)
+      bucket->tokens = burst_size;
+    bucket->updated = now;
+  }
+  return bucket->tokens;
+}
+
+// Remove buckets that have filled up again; they are no different to a new client
+static void sweep_shard(client_shard_t * shard, time_t now)
+{
+  int i;
+
+  for (i = 0; i < RATELIMIT_SHARD_SLOTS; i++) {
+    client_bucket_t **ptr = &shard->slots[i];
+    while (*ptr) {
+      client_bucket_t *bucket = *ptr;
+      if (refill(bucket, now) >= burst_size) {
+        *ptr = bucket->next;
+        free(bucket->addr);
+        free(bucket);
+        shard->count--;
+      } else {
+        ptr = &bucket->next;
+      }
+    }
+  }
+}
+
+// Remove the bucket that was used longest ago, so that a shard can't grow
+// without limit when many clients are using their tokens at the same time
+static void evict_oldest(client_shard_t * shard)
+{
+  client_bucket_t **oldest = NULL;
+  client_bucket_t *bucket = NULL;
+  int i;
+
+  for (i = 0; i < RATELIMIT_SHARD_SLOTS; i++) {
+    client_bucket_t **ptr;
+    for (ptr = &shard->slots[i]; *ptr; ptr = &(*ptr)->next) {
+      if (!oldest || (*ptr)->updated < (*oldest)->updated)
+        oldest = ptr;
+    }
+  }
+
+  if (oldest) {
+    bucket = *oldest;
+    *oldest = bucket->next;
+    free(bucket->addr);
+    free(bucket);
+    shard->count--;
+  }
+}
+
+static client_bucket_t *lookup_bucket(const char *addr, time_t now)
+{
+  unsigned long hash = hash_addr(addr);
+  client_shard_t *shard = &shards[hash % RATELIMIT_SHARDS];
+  client_bucket_t **slot = &shard->slots[(hash / RATELIMIT_SHARDS) % RATELIMIT_SHARD_SLOTS];
+  client_bucket_t *bucket = NULL;
+
+  for (bucket = *slot; bucket; bucket = bucket->next) {
+    if (strcmp(bucket->addr, addr) == 0)
+      return bucket;
+  }
+
+  if (shard->count >= RATELIMIT_SHARD_SLOTS * 4)
+    sweep_shard(shard, now);
+  if (shard->count >= RATELIMIT_SHARD_MAX)
+    evict_oldest(shard);
+
+  bucket = calloc(1, sizeof(client_bucket_t));
+  if (!bucket)
+    return NULL;
+
+  bucket->addr = malloc(strlen(addr) + 1);
+  if (!bucket->addr) {
+    free(bucket);
+    return NULL;
+  }
+  strcpy(bucket->addr, addr);
+  bucket->tokens = burst_size;
+  bucket->updated = now;
+  bucket->next = *slot;
+  *slot = bucket;
+  shard->count++;
+
+  return bucket;
+}
+
+// Takes a token from the client's bucket. Returns 0 if the request may
+// go ahead, otherwise the number of seconds until the client may retry.
+int ratelimit_take(const char *addr, time_t now)
+{
+  client_bucket_t *bucket = NULL;
+  int wait;
+
+  if (rate_limit <= 0.0 || !addr)
+    return 0;
+
+  bucket = lookup_bucket(addr, now);
+  if (!bucket) {
+    // Don't turn clients away because we are short of memory
+    return 0;
+  }
+
+  if (refill(bucket, now) >= 1.0) {
+    bucket->tokens -= 1.0;
+    return 0;
+  }
+
+  wait = (int) ((1.0 - bucket->tokens) / rate_limit);
+  return wait < 1 ? 1 : wait;
+}
+
+// Called by the HTTP server for each connection that it accepts, before
+// the request is read or queued. Returns 0 if the request may go ahead,
+// otherwise the number of seconds until the client may retry.
+int ratelimit_admit(const char *addr, int connections, void *user_data)
+{
+  int retry_after;
+
+  if (concurrency_limit > 0 && connections >= concurrency_limit) {
+    redstore_debug("Too many concurrent requests from %s.", addr);
+    return 1;
+  }
+
+  retry_after = ratelimit_take(addr, time(NULL));
+  if (retry_after)
+    redstore_debug("Too many requests from %s.", addr);
+
+  return retry_after;
+}
+
+// Returns the number of clients that have a bucket
+unsigned int ratelimit_count_buckets(void)
+{
+  unsigned int count = 0;
+  int s;
+
+  for (s = 0; s < RATELIMIT_SHARDS; s++)
+    count += shards[s].count;
+
+  return count;
+}
+
+void ratelimit_init(double rate, int max_concurrent)
+{
+  rate_limit = rate;
+  burst_size = rate * RATELIMIT_BURST_SECONDS;
+  if (burst_size < 1.0)
+    burst_size = 1.0;
+  concurrency_limit = max_concurrent;
+
+  if (rate_limit > 0.0)
+    redstore_info("Limiting clients to %g requests per second.", rate_limit);
+  if (concurrency_limit > 0)
+    redstore_info("Limiting clients to %d concurrent requests.", concurrency_limit);
+}
+
+void ratelimit_free(void)
+{
+  int s, i;
+
+  for (s = 0; s < RATELIMIT_SHARDS; s++) {
+    for (i = 0; i < RATELIMIT_SHARD_SLOTS; i++) {
+      client_bucket_t *bucket = shards[s].slots[i];
+      while (bucket) {
+        client_bucket_t *next = bucket->next;
+        free(bucket->addr);
+        free(bucket);
+        bucket = next;
+      }
+      shards[s].slots[i] = NULL;
+    }
+    shards[s].count = 0;
+  }
+}
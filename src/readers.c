@@ -0,0 +1,175 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "redstore.h"
+
+
+// Long reads are served from a snapshot of the store, so that they don't
+// hold up writes. A child process is forked for each one: it sees the
+// store as it was at the time of the fork, while copy-on-write pages let
+// the parent carry on changing it. The child handles the request as
+// normal and then exits.
+//
+// This only works for storages that are held entirely in memory; the
+// files and connections of other storages can't be shared with a child.
+//
+// Each page that the parent changes while a reader is running is copied,
+// so a long read during heavy writes can cost up to another copy of the
+// store; the number of readers at once is capped for that reason.
+
+// Maximum number of readers at once; 0 means that reads are never forked
+static int max_readers = 0;
+
+static pid_t *readers = NULL;
+static int reader_count = 0;
+
+// True in a child process
+static int is_reader = 0;
+
+// Requests that have been handed to a reader; the parent closes its copy
+// of the connection once the handler has returned
+static redhttp_request_t **detached = NULL;
+static int detached_count = 0;
+
+
+int readers_init(int max)
+{
+  if (max <= 0)
+    return 0;
+
+  if (!store_is_in_memory()) {
+    redstore_warn("Reads can only be served from snapshots of storages held in memory.");
+    return 0;
+  }
+
+  readers = calloc(max, sizeof(pid_t));
+  detached = calloc(max, sizeof(redhttp_request_t *));
+  if (!readers || !detached) {
+    readers_free();
+    return -1;
+  }
+
+  max_readers = max;
+  redstore_info("Serving up to %d long reads from snapshots.", max_readers);
+
+  return 0;
+}
+
+// Dumps of the store and SPARQL queries
+static int is_long_read(redhttp_request_t * request)
+{
+  const char *method = redhttp_request_get_method(request);
+  const char *path = redhttp_request_get_path(request);
+
+  if (strcmp(method, "GET") == 0 && strncmp(path, "/data", 5) == 0)
+    return 1;
+
+  if (strcmp(method, "GET") != 0 && strcmp(method, "POST") != 0)
+    return 0;
+
+  if (strcmp(path, "/query") != 0 && strcmp(path, "/sparql") != 0 && strcmp(path, "/sparql/") != 0)
+    return 0;
+
+  return redhttp_request_argument_exists(request, "query");
+}
+
+// Forks a reader for long reads; the child then carries on handling the request
+redhttp_response_t *handle_readers(redhttp_request_t * request, void *user_data)
+{
+  pid_t pid;
+
+  if (!max_readers || reader_count >= max_readers || is_reader)
+    return NULL;
+
+  // Nothing can take long in a small store, and a fork isn't free
+  if (stats_get_total() < READERS_MIN_STATEMENTS || !is_long_read(request))
+    return NULL;
+
+  pid = fork();
+  if (pid < 0) {
+    redstore_error("Failed to fork reader: %s", strerror(errno));
+    return NULL;
+  } else if (pid == 0) {
+    // The other connections belong to the parent
+    is_reader = 1;
+    redhttp_server_close_connections(redhttp_request_get_server(request));
+    return NULL;
+  }
+
+  redstore_debug("Forked reader %d for %s", (int) pid, redhttp_request_get_path(request));
+  readers[reader_count++] = pid;
+  detached[detached_count++] = request;
+
+  return redhttp_request_defer(request);
+}
+
+// Called from the main loop, straight after a request has been handled
+void readers_tick(void)
+{
+  int i, status;
+
+  // A reader exits once it has handled its request, without any of the
+  // parent's clean-up, such as syncing the write-ahead log
+  if (is_reader)
+    _exit(EXIT_SUCCESS);
+
+  for (i = 0; i < detached_count; i++)
+    redhttp_request_free(detached[i]);
+  detached_count = 0;
+
+  for (i = 0; i < reader_count;) {
+    pid_t pid = waitpid(readers[i], &status, WNOHANG);
+    if (pid == 0) {
+      i++;
+      continue;
+    }
+
+    if (pid > 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+      redstore_warn("Reader %d did not exit cleanly", (int) readers[i]);
+    readers[i] = readers[--reader_count];
+  }
+}
+
+void readers_free(void)
+{
+  int i;
+
+  for (i = 0; i < detached_count; i++)
+    redhttp_request_free(detached[i]);
+  detached_count = 0;
+
+  // Readers that are still running are left to finish their responses
+  if (readers)
+    free(readers);
+  readers = NULL;
+  if (detached)
+    free(detached);
+  detached = NULL;
+  reader_count = 0;
+  max_readers = 0;
+}
@@ -46,6 +46,9 @@ enum redhttp_status_code {
   REDHTTP_NOT_FOUND = 404,
   REDHTTP_METHOD_NOT_ALLOWED = 405,
   REDHTTP_NOT_ACCEPTABLE = 406,
+  REDHTTP_GONE = 410,
+  REDHTTP_REQUEST_ENTITY_TOO_LARGE = 413,
+  REDHTTP_TOO_MANY_REQUESTS = 429,
 
   REDHTTP_INTERNAL_SERVER_ERROR = 500,
   REDHTTP_NOT_IMPLEMENTED = 501,
@@ -62,6 +65,25 @@ typedef struct redhttp_server_s redhttp_server_t;
 typedef struct redhttp_negotiate_s redhttp_negotiate_t;
 
 typedef redhttp_response_t *(*redhttp_handler_func) (redhttp_request_t * request, void *user_data);
+typedef int (*redhttp_classify_func) (redhttp_request_t * request, void *user_data);
+typedef int (*redhttp_limit_func) (const char *remote_addr, int connections, void *user_data);
+
+// Number of request queues; queue 0 has the highest priority
+#define REDHTTP_MAX_QUEUES  (8)
+
+// Limits on the requests that are read before they are queued. A request
+// isn't read until all of its headers (and the body of a form) have arrived,
+// so these are kept well within the default size of a socket's receive buffer.
+#define REDHTTP_MAX_HEADER_SIZE  (16 * 1024)
+#define REDHTTP_MAX_FORM_SIZE    (64 * 1024)
+
+// Number of connections that can be waiting for the rest of their request,
+// and the number of seconds that they can wait for
+#define REDHTTP_MAX_PENDING      (64)
+#define REDHTTP_PENDING_TIMEOUT  (30)
+
+// Number of pending connections that one client address can have
+#define REDHTTP_MAX_PENDING_PER_CLIENT  (8)
 
 
 void redhttp_headers_print(redhttp_header_t ** first, FILE * socket);
@@ -109,12 +131,17 @@ const char *redhttp_request_get_server_addr(redhttp_request_t * request);
 const char *redhttp_request_get_server_port(redhttp_request_t * request);
 void redhttp_request_set_socket(redhttp_request_t * request, FILE * socket);
 FILE *redhttp_request_get_socket(redhttp_request_t * request);
+redhttp_server_t *redhttp_request_get_server(redhttp_request_t * request);
 void redhttp_request_set_socket(redhttp_request_t * request, FILE * socket);
 char *redhttp_request_get_content_buffer(redhttp_request_t * request);
 size_t redhttp_request_get_content_length(redhttp_request_t * request);
 int redhttp_request_read_status_line(redhttp_request_t * request);
+int redhttp_request_is_complete(const char *buffer, size_t len);
 int redhttp_request_read(redhttp_request_t * request);
 void redhttp_request_free(redhttp_request_t * request);
+redhttp_response_t *redhttp_request_defer(redhttp_request_t * request);
+int redhttp_request_is_deferred(redhttp_request_t * request);
+void redhttp_request_send_deferred(redhttp_request_t * request, redhttp_response_t * response);
 
 
 const char* redhttp_response_status_message_for_code(int code);
@@ -158,6 +185,13 @@ void redhttp_server_set_signature(redhttp_server_t * server, const char *signatu
 const char *redhttp_server_get_signature(redhttp_server_t * server);
 void redhttp_server_set_backlog_size(redhttp_server_t * server, int backlog_size);
 int redhttp_server_get_backlog_size(redhttp_server_t * server);
+void redhttp_server_set_poll_interval(redhttp_server_t * server, int poll_interval);
+int redhttp_server_get_poll_interval(redhttp_server_t * server);
+void redhttp_server_set_classifier(redhttp_server_t * server, redhttp_classify_func func, void *user_data);
+void redhttp_server_set_limiter(redhttp_server_t * server, redhttp_limit_func func, void *user_data);
+void redhttp_server_set_queue_limits(redhttp_server_t * server, int queue, int max_depth, int max_wait);
+int redhttp_server_count_queued(redhttp_server_t * server, const char *remote_addr);
+void redhttp_server_close_connections(redhttp_server_t * server);
 void redhttp_server_free(redhttp_server_t * server);
 
 int redhttp_negotiate_compare_types(const char *server_type, const char *client_type);
@@ -24,6 +24,7 @@
 #include <unistd.h>
 #include <ctype.h>
 
+#include "redhttp.h"
 
 
 #ifndef _REDHTTP_PRIVATE_H_
@@ -71,6 +72,10 @@ struct redhttp_request_s {
   size_t content_length;
 
   struct redhttp_type_q_s *accept;
+
+  time_t received;
+  int deferred;                 // The response will be sent later
+  struct redhttp_request_s *next;
 };
 
 struct redhttp_response_s {
@@ -101,15 +106,45 @@ struct redhttp_negotiate_s {
   struct redhttp_negotiate_s *next;
 };
 
+struct redhttp_queue_s {
+  struct redhttp_request_s *first;
+  struct redhttp_request_s *last;
+  int depth;
+  int max_depth;
+  int max_wait;
+};
+
+// A connection that has been accepted, but whose request hasn't all arrived yet
+struct redhttp_pending_s {
+  int socket;
+  time_t accepted;
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  char remote_addr[NI_MAXHOST];
+  int retry_after;              // Turned away by the limiter if non-zero
+};
+
 struct redhttp_server_s {
   int sockets[FD_SETSIZE];
   int socket_count;
   int socket_max;
 
   int backlog_size;
+  int poll_interval;
   char *signature;
 
   struct redhttp_handler_s *handlers;
+
+  struct redhttp_queue_s queues[REDHTTP_MAX_QUEUES];
+  int queued;
+  redhttp_classify_func classifier;
+  void *classifier_data;
+  redhttp_limit_func limiter;
+  void *limiter_data;
+
+  struct redhttp_pending_s pending[REDHTTP_MAX_PENDING];
+  int pending_count;
+  char *peek_buffer;
 };
 
 static inline char* redhttp_strndup(const char* str1, size_t str1_len)
@@ -415,6 +415,11 @@ FILE *redhttp_request_get_socket(redhttp_request_t * request)
   return request->socket;
 }
 
+redhttp_server_t *redhttp_request_get_server(redhttp_request_t * request)
+{
+  return request->server;
+}
+
 char *redhttp_request_get_content_buffer(redhttp_request_t * request)
 {
   return request->content_buffer;
@@ -489,6 +494,84 @@ int redhttp_request_read_status_line(redhttp_request_t * request)
 }
 
 
+// Finds a header in the raw headers of a request, and returns a pointer to its value
+static const char *find_raw_header(const char *headers, size_t len, const char *name)
+{
+  size_t name_len = strlen(name);
+  const char *line = headers;
+  const char *end = headers + len;
+
+  while (line < end) {
+    const char *next = memchr(line, '\n', end - line);
+    if (!next)
+      break;
+    if ((size_t) (next - line) > name_len && line[name_len] == ':') {
+      size_t i;
+      for (i = 0; i < name_len && tolower((unsigned char) line[i]) == tolower((unsigned char) name[i]); i++)
+        continue;
+      if (i == name_len) {
+        const char *value = line + name_len + 1;
+        while (value < next && (*value == ' ' || *value == '\t'))
+          value++;
+        return value;
+      }
+    }
+    line = next + 1;
+  }
+
+  return NULL;
+}
+
+// Checks whether the start of a request that has been received so far can be
+// read without waiting for more. Returns 0 if it can, -1 if more is needed,
+// or the status code to respond with if the request is too large.
+int redhttp_request_is_complete(const char *buffer, size_t len)
+{
+  const char *line_end = memchr(buffer, '\n', len);
+  const char *headers_end = NULL;
+  const char *content_type = NULL;
+  const char *content_length = NULL;
+  size_t headers_len, i;
+
+  if (!line_end)
+    return len < REDHTTP_MAX_HEADER_SIZE ? -1 : REDHTTP_BAD_REQUEST;
+
+  // HTTP/0.9 requests don't have any headers
+  for (i = 0; buffer + i + 5 <= line_end; i++) {
+    if (strncmp(buffer + i, "HTTP/", 5) == 0 || strncmp(buffer + i, "http/", 5) == 0)
+      break;
+  }
+  if (buffer + i + 5 > line_end)
+    return 0;
+
+  // Find the blank line at the end of the headers
+  for (i = line_end - buffer; i + 1 < len; i++) {
+    if (buffer[i] == '\n' && (buffer[i + 1] == '\n' ||
+                              (buffer[i + 1] == '\r' && i + 2 < len && buffer[i + 2] == '\n'))) {
+      headers_end = buffer + i + (buffer[i + 1] == '\n' ? 2 : 3);
+      break;
+    }
+  }
+  if (!headers_end)
+    return len < REDHTTP_MAX_HEADER_SIZE ? -1 : REDHTTP_BAD_REQUEST;
+  headers_len = headers_end - buffer;
+  if (headers_len > REDHTTP_MAX_HEADER_SIZE)
+    return REDHTTP_BAD_REQUEST;
+
+  // The body of a form is read along with the headers
+  if (strncmp(buffer, "POST", 4) != 0)
+    return 0;
+  content_type = find_raw_header(buffer, headers_len, "Content-Type");
+  content_length = find_raw_header(buffer, headers_len, "Content-Length");
+  if (!content_type || !content_length ||
+      strncmp(content_type, "application/x-www-form-urlencoded", 33) != 0)
+    return 0;
+  if (atol(content_length) < 0 || atol(content_length) > REDHTTP_MAX_FORM_SIZE)
+    return REDHTTP_REQUEST_ENTITY_TOO_LARGE;
+
+  return len >= headers_len + atol(content_length) ? 0 : -1;
+}
+
 int redhttp_request_read(redhttp_request_t * request)
 {
   int result = redhttp_request_read_status_line(request);
@@ -517,8 +600,10 @@ int redhttp_request_read(redhttp_request_t * request)
       if (content_type == NULL || content_length == NULL) {
         return REDHTTP_BAD_REQUEST;
       } else if (strncmp(content_type, "application/x-www-form-urlencoded", 33) == 0) {
-        request->content_length = atoi(content_length);
-        // FIXME: set maximum POST size
+        long length = atol(content_length);
+        if (length < 0 || length > REDHTTP_MAX_FORM_SIZE)
+          return REDHTTP_REQUEST_ENTITY_TOO_LARGE;
+        request->content_length = (size_t) length;
         request->content_buffer = calloc(1, request->content_length + 1);
         if (request->content_buffer) {
           bytes_read = fread(request->content_buffer, 1, request->content_length, request->socket);
@@ -568,3 +653,32 @@ void redhttp_request_free(redhttp_request_t * request)
 
   free(request);
 }
+
+// Called by a handler that will respond to the request later, using
+// redhttp_request_send_deferred(); the handler should return the response
+// that this returns, which is never sent
+redhttp_response_t *redhttp_request_defer(redhttp_request_t * request)
+{
+  assert(request != NULL);
+
+  request->deferred = 1;
+
+  return redhttp_response_new_empty(REDHTTP_ACCEPTED);
+}
+
+int redhttp_request_is_deferred(redhttp_request_t * request)
+{
+  return request->deferred;
+}
+
+// Sends the response to a deferred request, and frees both of them
+void redhttp_request_send_deferred(redhttp_request_t * request, redhttp_response_t * response)
+{
+  assert(request != NULL);
+  assert(response != NULL);
+
+  redhttp_response_send(response, request);
+
+  redhttp_request_free(request);
+  redhttp_response_free(response);
+}
@@ -51,6 +51,9 @@ static struct redhttp_message_s {
   REDHTTP_NOT_FOUND, "Not Found"}, {
   REDHTTP_METHOD_NOT_ALLOWED, "Method Not Allowed"}, {
   REDHTTP_NOT_ACCEPTABLE, "Not Acceptable"}, {
+  REDHTTP_GONE, "Gone"}, {
+  REDHTTP_REQUEST_ENTITY_TOO_LARGE, "Request Entity Too Large"}, {
+  REDHTTP_TOO_MANY_REQUESTS, "Too Many Requests"}, {
   REDHTTP_INTERNAL_SERVER_ERROR, "Internal Server Error"}, {
   REDHTTP_NOT_IMPLEMENTED, "Not Implemented"}, {
   REDHTTP_BAD_GATEWAY, "Bad Gateway"}, {
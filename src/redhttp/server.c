@@ -154,23 +154,280 @@ void redhttp_server_add_handler(redhttp_server_t * server, const char *method,
   }
 }
 
+static redhttp_request_t *request_new_for_socket(redhttp_server_t * server, int socket,
+                                                 struct sockaddr *sa, size_t sa_len);
+static void process_request(redhttp_server_t * server, redhttp_request_t * request);
+
+static void send_service_unavailable(redhttp_request_t * request, int retry_after)
+{
+  redhttp_response_t *response = NULL;
+  char retry_str[16];
+
+  response = redhttp_response_new_error_page(REDHTTP_SERVICE_UNAVAILABLE,
+                                             "The server is too busy, please try again later.");
+  snprintf(retry_str, sizeof(retry_str), "%d", retry_after > 0 ? retry_after : 1);
+  redhttp_response_add_header(response, "Retry-After", retry_str);
+  redhttp_response_send(response, request);
+  redhttp_response_free(response);
+}
+
+// Read in a new request and add it to the queue chosen by the classifier
+static void enqueue_connection(redhttp_server_t * server, int socket,
+                               struct sockaddr *sa, size_t sa_len)
+{
+  redhttp_request_t *request = NULL;
+  struct redhttp_queue_s *queue = NULL;
+  int index = 0, status;
+
+  request = request_new_for_socket(server, socket, sa, sa_len);
+  if (!request) {
+    close(socket);
+    return;
+  }
+
+  // All of the request has arrived, so this doesn't wait for the client
+  status = redhttp_request_read(request);
+  if (status) {
+    // Invalid request
+    redhttp_response_t *response = redhttp_response_new_error_page(status, NULL);
+    redhttp_response_send(response, request);
+    redhttp_response_free(response);
+    redhttp_request_free(request);
+    return;
+  }
+
+  if (server->classifier)
+    index = server->classifier(request, server->classifier_data);
+  if (index < 0 || index >= REDHTTP_MAX_QUEUES)
+    index = REDHTTP_MAX_QUEUES - 1;
+  queue = &server->queues[index];
+
+  if (queue->max_depth && queue->depth >= queue->max_depth) {
+    send_service_unavailable(request, queue->max_wait);
+    redhttp_request_free(request);
+    return;
+  }
+
+  request->received = time(NULL);
+  request->next = NULL;
+  if (queue->last) {
+    queue->last->next = request;
+  } else {
+    queue->first = request;
+  }
+  queue->last = request;
+  queue->depth++;
+  server->queued++;
+}
+
+// Removes the oldest request from the highest priority queue that isn't empty.
+// Requests that have waited for too long are turned away.
+static redhttp_request_t *dequeue_request(redhttp_server_t * server)
+{
+  time_t now = time(NULL);
+  int i;
+
+  for (i = 0; i < REDHTTP_MAX_QUEUES; i++) {
+    struct redhttp_queue_s *queue = &server->queues[i];
+
+    while (queue->first) {
+      redhttp_request_t *request = queue->first;
+      queue->first = request->next;
+      if (!queue->first)
+        queue->last = NULL;
+      request->next = NULL;
+      queue->depth--;
+      server->queued--;
+
+      if (queue->max_wait && now - request->received > queue->max_wait) {
+        send_service_unavailable(request, queue->max_wait);
+        redhttp_request_free(request);
+        continue;
+      }
+
+      return request;
+    }
+  }
+
+  return NULL;
+}
+
+// Rejects a connection whose request is too large to be read, or whose
+// client has been turned away by the limiter. What has arrived so far is
+// discarded, so that closing the socket doesn't reset the connection
+// before the client has seen the response.
+static void reject_connection(redhttp_server_t * server, struct redhttp_pending_s *pending,
+                              int status, size_t len)
+{
+  redhttp_request_t *request = NULL;
+  redhttp_response_t *response = NULL;
+  int has_status_line = (memchr(server->peek_buffer, '\n', len) != NULL);
+
+  if (recv(pending->socket, server->peek_buffer, len, 0) < 0)
+    perror("recv");
+
+  request = request_new_for_socket(server, pending->socket, (struct sockaddr *) &pending->addr,
+                                   pending->addr_len);
+  if (!request) {
+    close(pending->socket);
+    return;
+  }
+
+  // Requests without a version have been accepted by now
+  if (has_status_line)
+    redhttp_request_set_version(request, "1.0");
+
+  response = redhttp_response_new_error_page(status, NULL);
+  if (pending->retry_after > 0) {
+    char retry_str[16];
+    snprintf(retry_str, sizeof(retry_str), "%d", pending->retry_after);
+    redhttp_response_add_header(response, "Retry-After", retry_str);
+  }
+  redhttp_response_send(response, request);
+  redhttp_response_free(response);
+  redhttp_request_free(request);
+}
+
+// Looks at what a pending connection has sent so far, without reading it.
+// Returns non-zero once the connection is no longer pending.
+static int check_pending(redhttp_server_t * server, struct redhttp_pending_s *pending)
+{
+  ssize_t len;
+  int status, lowat;
+
+  if (!server->peek_buffer) {
+    server->peek_buffer = malloc(REDHTTP_MAX_HEADER_SIZE + REDHTTP_MAX_FORM_SIZE);
+    if (!server->peek_buffer) {
+      perror("failed to allocate memory for peek buffer");
+      close(pending->socket);
+      return 1;
+    }
+  }
+
+  len = recv(pending->socket, server->peek_buffer,
+             REDHTTP_MAX_HEADER_SIZE + REDHTTP_MAX_FORM_SIZE, MSG_PEEK);
+  if (len <= 0) {
+    // The client has gone away
+    if (len < 0 && errno == EINTR)
+      return 0;
+    close(pending->socket);
+    return 1;
+  }
+
+  status = redhttp_request_is_complete(server->peek_buffer, len);
+  if (status < 0) {
+    // Don't wake up again until more of the request has arrived
+    lowat = (int) len + 1;
+    setsockopt(pending->socket, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+    return 0;
+  }
+
+  // Reads of the socket from now on shouldn't wait for more than they need
+  lowat = 1;
+  setsockopt(pending->socket, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+
+  if (status > 0) {
+    reject_connection(server, pending, status, len);
+  } else if (pending->retry_after) {
+    reject_connection(server, pending, REDHTTP_TOO_MANY_REQUESTS, len);
+  } else {
+    enqueue_connection(server, pending->socket, (struct sockaddr *) &pending->addr,
+                       pending->addr_len);
+  }
+
+  return 1;
+}
+
+// Counts the connections from a client that are waiting to be read
+static int count_pending(redhttp_server_t * server, const char *remote_addr)
+{
+  int i, count = 0;
+
+  for (i = 0; i < server->pending_count; i++) {
+    if (strcmp(server->pending[i].remote_addr, remote_addr) == 0)
+      count++;
+  }
+
+  return count;
+}
+
+// Decides whether a connection that has just been accepted is kept, and
+// whether its request will be turned away. This happens before anything
+// is read, so that a client over its limits doesn't use up the queues.
+// Returns non-zero if the connection should be closed straight away.
+static int admit_pending(redhttp_server_t * server, struct redhttp_pending_s *pending)
+{
+  int pending_from_client, queued_from_client;
+
+  pending->retry_after = 0;
+  if (getnameinfo((struct sockaddr *) &pending->addr, pending->addr_len,
+                  pending->remote_addr, sizeof(pending->remote_addr),
+                  NULL, 0, NI_NUMERICHOST)) {
+    pending->remote_addr[0] = '\0';
+    return 0;
+  }
+
+  // A single client can't take all of the pending connections
+  pending_from_client = count_pending(server, pending->remote_addr);
+  if (pending_from_client >= REDHTTP_MAX_PENDING_PER_CLIENT)
+    return 1;
+
+  if (server->limiter) {
+    queued_from_client = redhttp_server_count_queued(server, pending->remote_addr);
+    pending->retry_after = server->limiter(pending->remote_addr,
+                                           pending_from_client + queued_from_client,
+                                           server->limiter_data);
+  }
+
+  return 0;
+}
+
+static void remove_pending(redhttp_server_t * server, int index)
+{
+  server->pending_count--;
+  server->pending[index] = server->pending[server->pending_count];
+}
+
 void redhttp_server_run(redhttp_server_t * server)
 {
-  struct sockaddr_storage ss;
-  struct sockaddr *sa = (struct sockaddr *) &ss;
-  socklen_t len = sizeof(ss);
+  struct timeval timeout = { 0, 0 };
+  struct timeval *wait = NULL;
   int nfds = server->socket_max + 1;
+  redhttp_request_t *request = NULL;
+  time_t now;
   fd_set rfd;
   int i, m;
 
   assert(server != NULL);
 
   FD_ZERO(&rfd);
-  for (i = 0; i < server->socket_count; i++) {
-    FD_SET(server->sockets[i], &rfd);
+  // Stop accepting new connections while too many are waiting to be read
+  if (server->pending_count < REDHTTP_MAX_PENDING) {
+    for (i = 0; i < server->socket_count; i++) {
+      FD_SET(server->sockets[i], &rfd);
+    }
+  }
+  for (i = 0; i < server->pending_count; i++) {
+    FD_SET(server->pending[i].socket, &rfd);
+    if (server->pending[i].socket >= nfds)
+      nfds = server->pending[i].socket + 1;
   }
 
-  m = select(nfds, &rfd, NULL, NULL, NULL);
+  // Only wait for new connections if there is nothing queued
+  if (server->queued) {
+    wait = &timeout;
+  } else if (server->poll_interval > 0) {
+    // Return regularly, so that the caller can do other work
+    timeout.tv_sec = server->poll_interval / 1000;
+    timeout.tv_usec = (server->poll_interval % 1000) * 1000;
+    wait = &timeout;
+  } else if (server->pending_count) {
+    // Return regularly, so that pending connections can time out
+    timeout.tv_sec = 1;
+    wait = &timeout;
+  }
+
+  m = select(nfds, &rfd, NULL, NULL, wait);
   if (m < 0) {
     if (errno == EINTR)
       return;
@@ -178,18 +435,49 @@ void redhttp_server_run(redhttp_server_t * server)
     exit(EXIT_FAILURE);
   }
 
-  for (i = 0; i < server->socket_count; i++) {
-    if (FD_ISSET(server->sockets[i], &rfd)) {
-      int cs = accept(server->sockets[i], sa, &len);
-      if (cs < 0) {
+  // Queue the connections whose requests have all arrived, and drop those
+  // that have waited too long. New connections are accepted after this,
+  // so that their sockets aren't mistaken for ones that select() returned.
+  now = time(NULL);
+  for (i = server->pending_count - 1; i >= 0; i--) {
+    struct redhttp_pending_s *pending = &server->pending[i];
+    if (m > 0 && FD_ISSET(pending->socket, &rfd)) {
+      if (check_pending(server, pending))
+        remove_pending(server, i);
+    } else if (now - pending->accepted > REDHTTP_PENDING_TIMEOUT) {
+      close(pending->socket);
+      remove_pending(server, i);
+    }
+  }
+
+  if (m > 0 && server->pending_count < REDHTTP_MAX_PENDING) {
+    for (i = 0; i < server->socket_count; i++) {
+      struct redhttp_pending_s *pending = &server->pending[server->pending_count];
+      if (!FD_ISSET(server->sockets[i], &rfd))
+        continue;
+
+      pending->addr_len = sizeof(pending->addr);
+      pending->socket = accept(server->sockets[i], (struct sockaddr *) &pending->addr,
+                               &pending->addr_len);
+      if (pending->socket < 0) {
         perror("accept");
         exit(EXIT_FAILURE);
-      } else {
-        redhttp_server_handle_request(server, cs, sa, len);
-        close(cs);
+      } else if (pending->socket >= FD_SETSIZE || admit_pending(server, pending)) {
+        // It couldn't be waited for using select(), or its client has too many already
+        close(pending->socket);
+        continue;
       }
+      pending->accepted = now;
+      server->pending_count++;
+      if (server->pending_count == REDHTTP_MAX_PENDING)
+        break;
     }
   }
+
+  // Handle one of the queued requests, even if there were new connections
+  request = dequeue_request(server);
+  if (request)
+    process_request(server, request);
 }
 
 static int match_route(redhttp_handler_t * handler, redhttp_request_t * request)
@@ -240,18 +528,14 @@ static int get_server_addr(redhttp_request_t * request, int socket)
   return 0;
 }
 
-int redhttp_server_handle_request(redhttp_server_t * server, int socket,
-                                  struct sockaddr *sa, size_t sa_len)
+static redhttp_request_t *request_new_for_socket(redhttp_server_t * server, int socket,
+                                                 struct sockaddr *sa, size_t sa_len)
 {
   redhttp_request_t *request = NULL;
-  redhttp_response_t *response = NULL;
-
-  assert(server != NULL);
-  assert(socket >= 0);
 
   request = redhttp_request_new();
   if (!request)
-    return -1;
+    return NULL;
   request->server = server;
   request->socket = fdopen(socket, "r+");;
   if (getnameinfo(sa, sa_len,
@@ -260,28 +544,60 @@ int redhttp_server_handle_request(redhttp_server_t * server, int socket,
                   NI_NUMERICHOST | NI_NUMERICSERV)) {
     perror("could not get numeric hostname of client");
     redhttp_request_free(request);
-    return -1;
+    return NULL;
   }
 
   if (get_server_addr(request, socket)) {
     perror("could not get numeric hostname of server");
     redhttp_request_free(request);
-    return -1;
+    return NULL;
   }
 
-  if (redhttp_request_read(request)) {
-    // Invalid request
-    response = redhttp_response_new_error_page(REDHTTP_BAD_REQUEST, NULL);
+  return request;
+}
+
+// Dispatch a request that has already been read, send the response and free it
+static void process_request(redhttp_server_t * server, redhttp_request_t * request)
+{
+  redhttp_response_t *response = NULL;
+
+  response = redhttp_server_dispatch_request(server, request);
+
+  // The handler has taken the request, and will respond to it later
+  if (request->deferred) {
+    redhttp_response_free(response);
+    return;
   }
-  // Dispatch the request
-  if (!response)
-    response = redhttp_server_dispatch_request(server, request);
 
   // Send response
   redhttp_response_send(response, request);
 
   redhttp_request_free(request);
   redhttp_response_free(response);
+}
+
+int redhttp_server_handle_request(redhttp_server_t * server, int socket,
+                                  struct sockaddr *sa, size_t sa_len)
+{
+  redhttp_request_t *request = NULL;
+
+  assert(server != NULL);
+  assert(socket >= 0);
+
+  request = request_new_for_socket(server, socket, sa, sa_len);
+  if (!request)
+    return -1;
+
+  if (redhttp_request_read(request)) {
+    // Invalid request
+    redhttp_response_t *response = redhttp_response_new_error_page(REDHTTP_BAD_REQUEST, NULL);
+    redhttp_response_send(response, request);
+    redhttp_request_free(request);
+    redhttp_response_free(response);
+    return 0;
+  }
+
+  process_request(server, request);
 
   // Success
   return 0;
@@ -442,6 +758,102 @@ int redhttp_server_get_backlog_size(redhttp_server_t * server)
   return server->backlog_size;
 }
 
+// The longest time, in milliseconds, that redhttp_server_run() waits for a
+// new connection; 0 means wait indefinitely
+void redhttp_server_set_poll_interval(redhttp_server_t * server, int poll_interval)
+{
+  server->poll_interval = poll_interval;
+}
+
+int redhttp_server_get_poll_interval(redhttp_server_t * server)
+{
+  return server->poll_interval;
+}
+
+void redhttp_server_set_classifier(redhttp_server_t * server, redhttp_classify_func func, void *user_data)
+{
+  assert(server != NULL);
+
+  server->classifier = func;
+  server->classifier_data = user_data;
+}
+
+// The limiter is called for each connection that is accepted, with the
+// number of other connections from the same address that are waiting.
+// It returns 0 to let the request through, or the number of seconds
+// that the client should wait before trying again.
+void redhttp_server_set_limiter(redhttp_server_t * server, redhttp_limit_func func, void *user_data)
+{
+  assert(server != NULL);
+
+  server->limiter = func;
+  server->limiter_data = user_data;
+}
+
+// A max_depth or max_wait (in seconds) of zero means no limit
+void redhttp_server_set_queue_limits(redhttp_server_t * server, int queue, int max_depth, int max_wait)
+{
+  assert(server != NULL);
+  assert(queue >= 0 && queue < REDHTTP_MAX_QUEUES);
+
+  server->queues[queue].max_depth = max_depth;
+  server->queues[queue].max_wait = max_wait;
+}
+
+// Count the requests waiting to be handled, from one address or from anywhere if NULL
+int redhttp_server_count_queued(redhttp_server_t * server, const char *remote_addr)
+{
+  redhttp_request_t *it;
+  int i, count = 0;
+
+  assert(server != NULL);
+
+  if (!remote_addr)
+    return server->queued;
+
+  for (i = 0; i < REDHTTP_MAX_QUEUES; i++) {
+    for (it = server->queues[i].first; it; it = it->next) {
+      if (strcmp(it->remote_addr, remote_addr) == 0)
+        count++;
+    }
+  }
+
+  return count;
+}
+
+// Closes the listening sockets and every other connection, without sending
+// anything on them; for a child process that only handles the request it
+// was forked for
+void redhttp_server_close_connections(redhttp_server_t * server)
+{
+  int i;
+
+  assert(server != NULL);
+
+  for (i = 0; i < server->socket_count; i++) {
+    close(server->sockets[i]);
+  }
+  server->socket_count = 0;
+  server->socket_max = -1;
+
+  for (i = 0; i < REDHTTP_MAX_QUEUES; i++) {
+    redhttp_request_t *request, *next_request;
+    for (request = server->queues[i].first; request; request = next_request) {
+      next_request = request->next;
+      redhttp_request_free(request);
+    }
+    server->queues[i].first = NULL;
+    server->queues[i].last = NULL;
+    server->queues[i].depth = 0;
+  }
+  server->queued = 0;
+
+  for (i = 0; i < server->pending_count; i++) {
+    close(server->pending[i].socket);
+  }
+  server->pending_count = 0;
+}
+
 void redhttp_server_free(redhttp_server_t * server)
 {
   redhttp_handler_t *it, *next;
@@ -453,6 +865,14 @@ void redhttp_server_free(redhttp_server_t * server)
     close(server->sockets[i]);
   }
 
+  for (i = 0; i < REDHTTP_MAX_QUEUES; i++) {
+    redhttp_request_t *request, *next_request;
+    for (request = server->queues[i].first; request; request = next_request) {
+      next_request = request->next;
+      redhttp_request_free(request);
+    }
+  }
+
   for (it = server->handlers; it; it = next) {
     next = it->next;
     free(it->method);
@@ -460,8 +880,14 @@ void redhttp_server_free(redhttp_server_t * server)
     free(it);
   }
 
+  for (i = 0; i < server->pending_count; i++) {
+    close(server->pending[i].socket);
+  }
+
   if (server->signature)
     free(server->signature);
+  if (server->peek_buffer)
+    free(server->peek_buffer);
 
   free(server);
 }
@@ -172,8 +172,9 @@ static int redstore_load_input_file(librdf_model* model, const char* filename, c
   return result;
 }
 
-static librdf_storage *redstore_setup_storage(const char *name, const char *type,
-                                              const char *options, int new)
+// Opens a storage; the options, without passwords, are stored in public_options
+librdf_storage *redstore_setup_storage(const char *name, const char *type,
+                                       const char *options, int new, char **public_options)
 {
   librdf_storage *storage = NULL;
   librdf_hash *hash = NULL;
@@ -194,9 +195,9 @@ static librdf_storage *redstore_setup_storage(const char *name, const char *type
   redstore_info("Storage name: %s", name);
   redstore_info("Storage type: %s", type);
 
-  public_storage_options = librdf_hash_to_string(hash, key_filter);
-  if (public_storage_options) {
-    redstore_info("Storage options: %s", public_storage_options);
+  *public_options = librdf_hash_to_string(hash, key_filter);
+  if (*public_options) {
+    redstore_info("Storage options: %s", *public_options);
   } else {
     redstore_warn("Failed to convert storage options hash into a string.");
   }
@@ -224,12 +225,17 @@ static redhttp_server_t *redstore_setup_http_server()
   redhttp_server_add_handler(server, NULL, NULL, request_counter, &request_count);
   redhttp_server_add_handler(server, NULL, NULL, request_log, NULL);
   redhttp_server_add_handler(server, NULL, NULL, reset_error_buffer, NULL);
+  redhttp_server_add_handler(server, NULL, NULL, handle_datasets, NULL);
+  redhttp_server_add_handler(server, NULL, NULL, handle_follower, NULL);
+  redhttp_server_add_handler(server, NULL, NULL, handle_coalesce, NULL);
+  redhttp_server_add_handler(server, NULL, NULL, handle_readers, NULL);
   redhttp_server_add_handler(server, "GET", "/query", handle_query, NULL);
   redhttp_server_add_handler(server, "GET", "/sparql", handle_sparql, NULL);
   redhttp_server_add_handler(server, "GET", "/sparql/", handle_sparql, NULL);
   redhttp_server_add_handler(server, "POST", "/query", handle_query, NULL);
   redhttp_server_add_handler(server, "POST", "/sparql", handle_sparql, NULL);
   redhttp_server_add_handler(server, "POST", "/sparql/", handle_sparql, NULL);
+  redhttp_server_add_handler(server, "POST", "/update", handle_update, NULL);
   redhttp_server_add_handler(server, "HEAD", "/data*", handle_data_head, NULL);
   redhttp_server_add_handler(server, "GET", "/data*", handle_data_get, NULL);
   redhttp_server_add_handler(server, "PUT", "/data*", handle_data_put, NULL);
@@ -239,7 +245,13 @@ static redhttp_server_t *redstore_setup_http_server()
   redhttp_server_add_handler(server, "POST", "/insert", handle_insert_post, NULL);
   redhttp_server_add_handler(server, "GET", "/delete", handle_page_update_form, "Delete Triples");
   redhttp_server_add_handler(server, "POST", "/delete", handle_delete_post, NULL);
+  redhttp_server_add_handler(server, "POST", "/patch", handle_patch_post, NULL);
   redhttp_server_add_handler(server, "GET", "/graphs", handle_graph_index, NULL);
+  redhttp_server_add_handler(server, "GET", "/changes", handle_changes, NULL);
+  redhttp_server_add_handler(server, "GET", "/jobs/*", handle_job_get, NULL);
+  redhttp_server_add_handler(server, "DELETE", "/jobs/*", handle_job_delete, NULL);
+  redhttp_server_add_handler(server, "GET", "/fragments", handle_fragments, NULL);
+  redhttp_server_add_handler(server, "GET", "/search", handle_search, NULL);
   redhttp_server_add_handler(server, "GET", "/load", handle_page_load_form, NULL);
   redhttp_server_add_handler(server, "POST", "/load", handle_load_post, NULL);
   redhttp_server_add_handler(server, "GET", "/", handle_page_home, NULL);
@@ -252,6 +264,12 @@ static redhttp_server_t *redstore_setup_http_server()
   // Set the server signature
   redhttp_server_set_signature(server, PACKAGE_NAME "/" PACKAGE_VERSION);
 
+  // Serve requests in order of priority
+  admission_init(server);
+
+  // Turn away clients over their limits before their requests are queued
+  redhttp_server_set_limiter(server, ratelimit_admit, NULL);
+
   return server;
 }
 
@@ -271,6 +289,7 @@ static void usage()
     printf("      %-12s   %s\n", help_name, help_label);
   }
   printf("   -t <options>    Storage options\n");
+  printf("   -D <spec>       Serve <name>:<type>[:<options>] as another dataset under /ds/<name>/\n");
   printf("   -n              Create a new store / replace old (default no)\n");
   printf("   -f <filename>   Input file to load at startup\n");
   printf("   -F <format>     Format of the input file (default guess)\n");
@@ -280,6 +299,20 @@ static void usage()
       break;
     printf("      %-12s   %s\n", desc->names[0], desc->label);
   }
+  printf("   -S <filename>   Write a snapshot of a native store and exit\n");
+  printf("   -l <filename>   Record changes in a write-ahead log, and replay it at startup\n");
+  printf("   -L <millisecs>  Interval between syncs of the log (default 0, every change)\n");
+  printf("   -B <count>      Commit large uploads every <count> triples (default all at once)\n");
+  printf("   -w <millisecs>  Group together writes that arrive within <millisecs> (default 0, off)\n");
+  printf("   -R <count>      Serve up to <count> long reads from snapshots (default 0, off)\n");
+  printf("   -J <dir>        Allow /load to load files from <dir> in the background\n");
+  printf("   -C <megabytes>  Keep <megabytes> of recent changes for /changes (default 0, off)\n");
+  printf("   -P <url>        Follow the changes of the RedStore at <url>, and refuse other changes\n");
+  printf("   -T <filename>   Save how far the follower has got, to carry on from there after a restart\n");
+  printf("   -x              Index the words in literals, for /search (default no)\n");
+  printf("   -i              Index numbers and dates, for ranges in /fragments (default no)\n");
+  printf("   -r <rate>       Limit each client to <rate> requests per second (default none)\n");
+  printf("   -c <count>      Limit each client to <count> concurrent requests (default none)\n");
   printf("   -v              Enable verbose mode\n");
   printf("   -q              Enable quiet mode\n");
   exit(1);
@@ -290,10 +323,24 @@ int main(int argc, char *argv[])
   redhttp_server_t *server = NULL;
   char *address = DEFAULT_ADDRESS;
   char *port = DEFAULT_PORT;
-  const char *storage_options = NULL;
   const char *input_filename = NULL;
   const char *input_format = NULL;
+  const char *snapshot_filename = NULL;
+  const char *log_filename = NULL;
+  const char *jobs_dir = NULL;
+  size_t changes_size = 0;
+  const char *primary_url = NULL;
+  const char *follower_filename = NULL;
+  int log_sync_interval = 0;
+  unsigned long batch_size = 0;
+  int coalesce_window = 0;
+  int max_readers = 0;
+  int poll_interval = 0;
   int storage_new = 0;
+  int search_enabled = 0;
+  int range_enabled = 0;
+  double rate_limit = 0.0;
+  int concurrency_limit = 0;
   int opt = -1;
 
   // Make STDOUT unbuffered - we use it for logging
@@ -308,9 +355,11 @@ int main(int argc, char *argv[])
   }
   librdf_world_open(world);
   librdf_world_set_logger(world, NULL, redland_log_handler);
+  native_storage_register(world);
+  sharded_storage_register(world);
 
   // Parse Switches
-  while ((opt = getopt(argc, argv, "p:b:s:t:nf:F:vqh")) != -1) {
+  while ((opt = getopt(argc, argv, "p:b:s:t:D:nf:F:S:l:L:B:w:R:J:C:P:T:xir:c:vqh")) != -1) {
     switch (opt) {
     case 'p':
       port = optarg;
@@ -324,6 +373,10 @@ int main(int argc, char *argv[])
     case 't':
       storage_options = optarg;
       break;
+    case 'D':
+      if (datasets_add(optarg))
+        usage();
+      break;
     case 'n':
       storage_new = 1;
       break;
@@ -333,6 +386,48 @@ int main(int argc, char *argv[])
     case 'F':
       input_format = optarg;
       break;
+    case 'S':
+      snapshot_filename = optarg;
+      break;
+    case 'l':
+      log_filename = optarg;
+      break;
+    case 'L':
+      log_sync_interval = atoi(optarg);
+      break;
+    case 'B':
+      batch_size = strtoul(optarg, NULL, 10);
+      break;
+    case 'w':
+      coalesce_window = atoi(optarg);
+      break;
+    case 'R':
+      max_readers = atoi(optarg);
+      break;
+    case 'J':
+      jobs_dir = optarg;
+      break;
+    case 'C':
+      changes_size = strtoul(optarg, NULL, 10) * 1024 * 1024;
+      break;
+    case 'P':
+      primary_url = optarg;
+      break;
+    case 'T':
+      follower_filename = optarg;
+      break;
+    case 'x':
+      search_enabled = 1;
+      break;
+    case 'i':
+      range_enabled = 1;
+      break;
+    case 'r':
+      rate_limit = atof(optarg);
+      break;
+    case 'c':
+      concurrency_limit = atoi(optarg);
+      break;
     case 'v':
       verbose = 1;
       break;
@@ -373,6 +468,12 @@ int main(int argc, char *argv[])
     storage_options = DEFAULT_STORAGE_OPTIONS;
   }
 
+  store_set_batch_size(batch_size);
+  coalesce_init(coalesce_window);
+
+  // Configure per-client limits
+  ratelimit_init(rate_limit, concurrency_limit);
+
   // Setup signal handlers
   signal(SIGTERM, termination_handler);
   signal(SIGINT, termination_handler);
@@ -386,7 +487,8 @@ int main(int argc, char *argv[])
   }
 
   // Create storage
-  storage = redstore_setup_storage(storage_name, storage_type, storage_options, storage_new);
+  storage = redstore_setup_storage(storage_name, storage_type, storage_options, storage_new,
+                                   &public_storage_options);
   if (!storage) {
     redstore_fatal("Failed to open librdf storage.");
     goto cleanup;
@@ -402,6 +504,72 @@ int main(int argc, char *argv[])
     redstore_fatal("Failed to load input file.");
     goto cleanup;
   }
+  // Write a snapshot and exit, rather than starting the server
+  if (snapshot_filename) {
+    if (strcmp(storage_type, "native") != 0) {
+      redstore_fatal("Snapshots can only be written from the native storage type.");
+    } else if (native_storage_write_snapshot(storage, snapshot_filename)) {
+      redstore_fatal("Failed to write snapshot: %s", snapshot_filename);
+    } else {
+      redstore_info("Wrote snapshot: %s", snapshot_filename);
+    }
+    goto cleanup;
+  }
+  // Count the statements in the store
+  if (stats_init()) {
+    redstore_fatal("Failed to count statements in the store.");
+    goto cleanup;
+  }
+  // Open the other datasets
+  if (datasets_init()) {
+    redstore_fatal("Failed to open datasets.");
+    goto cleanup;
+  }
+  // Replay and then append to the write-ahead log
+  if (log_filename) {
+    if (wal_open(log_filename, log_sync_interval)) {
+      redstore_fatal("Failed to open write-ahead log: %s", log_filename);
+      goto cleanup;
+    }
+    poll_interval = WAL_POLL_INTERVAL;
+  }
+  // Start the ETags of fragments afresh
+  fragments_init();
+  // Index the store, as it is after replaying the log
+  if (search_init(search_enabled)) {
+    redstore_fatal("Failed to build the word index.");
+    goto cleanup;
+  }
+  if (range_init(range_enabled)) {
+    redstore_fatal("Failed to build the range index.");
+    goto cleanup;
+  }
+  // Wake up in time to commit groups of writes
+  if (coalesce_window > 0 && (poll_interval == 0 || coalesce_window < poll_interval))
+    poll_interval = coalesce_window;
+  // Serve long reads from snapshots, and wake up to collect finished readers
+  if (readers_init(max_readers)) {
+    redstore_fatal("Failed to initialise readers.");
+    goto cleanup;
+  }
+  if (max_readers > 0 && poll_interval == 0)
+    poll_interval = READERS_POLL_INTERVAL;
+  if (jobs_init(jobs_dir)) {
+    redstore_fatal("Failed to initialise load jobs.");
+    goto cleanup;
+  }
+  // Changes replayed from the log are not part of the feed
+  changes_init(changes_size);
+  if (changes_size > 0 && (poll_interval == 0 || CHANGES_POLL_INTERVAL < poll_interval))
+    poll_interval = CHANGES_POLL_INTERVAL;
+  // Wake up often enough to read the primary's responses as they arrive
+  if (follower_init(primary_url, follower_filename)) {
+    redstore_fatal("Failed to initialise follower.");
+    goto cleanup;
+  }
+  if (primary_url && (poll_interval == 0 || FOLLOWER_POLL_INTERVAL < poll_interval))
+    poll_interval = FOLLOWER_POLL_INTERVAL;
+  redhttp_server_set_poll_interval(server, poll_interval);
   // Create service description
   if (description_init()) {
     redstore_fatal("Failed to initialise Service Description.");
@@ -416,11 +584,31 @@ int main(int argc, char *argv[])
 
   while (running) {
     redhttp_server_run(server);
+    datasets_tick();
+    readers_tick();
+    coalesce_tick();
+    search_tick();
+    wal_tick();
+    changes_tick();
+    follower_tick();
+    // Don't wait for new connections while there is a job to get on with
+    redhttp_server_set_poll_interval(server, jobs_tick() ? 1 : poll_interval);
   }
 
 
 cleanup:
+  jobs_free();
+  readers_free();
+  coalesce_free();
+  datasets_free();
+  follower_free();
+  changes_free();
+  search_free();
+  range_free();
+  wal_close();
   description_free();
+  stats_free();
+  ratelimit_free();
 
   // Free up memory used by the error buffer
   reset_error_buffer(NULL, NULL);
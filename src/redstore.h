@@ -38,9 +38,47 @@
 #define DEFAULT_STORAGE_TYPE    "hashes"
 #define DEFAULT_STORAGE_OPTIONS "hash-type='memory'"
 #define DEFAULT_QUERY_LANGUAGE  "laqrs"
+#define DEFAULT_UPDATE_LANGUAGE "sparql11-update"
 #define DEFAULT_GRAPH_FORMAT    "rdfxml"
 #define DEFAULT_PARSE_FORMAT    "ntriples"
 #define DEFAULT_RESULTS_FORMAT  "xml"
+#define FRAGMENTS_PAGE_SIZE     (100)
+#define FRAGMENTS_MAX_PAGE_SIZE (10000)
+#define FRAGMENTS_COUNT_LIMIT   (10000)
+#define NATIVE_NODE_CACHE_SIZE  (64 * 1024)
+#define RATELIMIT_SHARDS        (16)
+#define RATELIMIT_SHARD_SLOTS   (64)
+#define RATELIMIT_SHARD_MAX     (RATELIMIT_SHARD_SLOTS * 8)
+#define RATELIMIT_BURST_SECONDS (5)
+#define WAL_CHECKPOINT_SIZE     (64 * 1024 * 1024)
+#define WAL_CHECKPOINT_RETRY    (10)
+#define WAL_CHECKPOINT_MAX_RETRY (600)
+#define WAL_POLL_INTERVAL       (100)
+#define COALESCE_MAX_STATEMENTS (10000)
+#define READERS_MIN_STATEMENTS  (100000)
+#define READERS_POLL_INTERVAL   (1000)
+#define JOBS_MAX                (64)
+#define JOBS_SLICE_STATEMENTS   (5000)
+#define BLOOM_BITS_PER_ENTRY    (10)
+#define BLOOM_PROBES            (7)
+#define BLOOM_MIN_CAPACITY      (1024)
+#define BLOOM_MAX_CAPACITY      (64 * 1024 * 1024)
+#define CHANGES_MAX_WAITING     (64)
+#define CHANGES_POLL_TIMEOUT    (30)
+#define CHANGES_MAX_POLL_TIMEOUT (300)
+#define CHANGES_POLL_INTERVAL   (1000)
+#define FOLLOWER_POLL_INTERVAL  (100)
+#define FOLLOWER_RETRY_INTERVAL (5)
+#define DATASETS_MAX            (16)
+#define SHARDED_DEFAULT_SHARDS  (4)
+#define SHARDED_MAX_SHARDS      (64)
+#define SEARCH_MAX_WORDS        (16)
+#define SEARCH_MAX_WORD_LENGTH  (64)
+#define SEARCH_DEFAULT_LIMIT    (100)
+#define SEARCH_MAX_JOURNAL      (1024 * 1024)
+#define SEARCH_BUILD_RETRY      (60)
+#define RANGE_NUMERIC           (0)
+#define RANGE_TEMPORAL          (1)
 
 
 // ------- Logging ---------
@@ -76,6 +114,7 @@ extern unsigned long import_count;
 extern unsigned long request_count;
 extern const char *storage_name;
 extern const char *storage_type;
+extern const char *storage_options;
 extern char *public_storage_options;
 extern librdf_world *world;
 extern librdf_storage *storage;
@@ -96,6 +135,44 @@ typedef redhttp_response_t *(*redstore_stream_processor) (redhttp_request_t * re
 typedef const raptor_syntax_description* (*description_proc_t) (librdf_world *world, unsigned int c);
 
 
+// ------- Types ---------
+
+typedef enum {
+  TOKEN_END = 0,
+  TOKEN_IRI,
+  TOKEN_VAR,
+  TOKEN_STRING,
+  TOKEN_WORD,
+  TOKEN_PUNCT
+} lexer_token_type_t;
+
+typedef struct lexer_token_s {
+  lexer_token_type_t type;
+  const char *start;
+  size_t len;
+} lexer_token_t;
+
+typedef enum {
+  ADMISSION_ADMIN = 0,
+  ADMISSION_INTERACTIVE,
+  ADMISSION_WRITE,
+  ADMISSION_BATCH,
+  ADMISSION_CLASS_COUNT
+} admission_class_type_t;
+
+typedef struct bloom_s bloom_t;
+
+typedef struct stats_state_s stats_state_t;
+
+typedef struct graph_stats_s {
+  char *uri;                    // Or "_:" and the identifier of a blank node
+  int blank;
+  unsigned long count;
+  time_t modified;
+  bloom_t *filter;
+} graph_stats_t;
+
+
 // ------- Prototypes -------
 
 int description_init(void);
@@ -131,6 +208,13 @@ redhttp_response_t *handle_data_put(redhttp_request_t * request, void *user_data
 redhttp_response_t *handle_data_post(redhttp_request_t * request, void *user_data);
 redhttp_response_t *handle_data_delete(redhttp_request_t * request, void *user_data);
 
+void fragments_init(void);
+redhttp_response_t *handle_fragments(redhttp_request_t * request, void *user_data);
+
+redhttp_response_t *handle_update(redhttp_request_t * request, void *user_data);
+redhttp_response_t *perform_update(redhttp_request_t * request, const char *update_string);
+int redstore_is_sparql_update_request(redhttp_request_t * request);
+
 
 redhttp_response_t *load_stream_into_new_graph(redhttp_request_t * request, librdf_stream * stream,
                                                librdf_node * graph_node);
@@ -144,6 +228,8 @@ redhttp_response_t *parse_data_from_buffer(redhttp_request_t * request, unsigned
                                            size_t content_length, const char *parser_name,
                                            librdf_node *graph_node,
                                            redstore_stream_processor stream_proc);
+redhttp_response_t *read_request_body(redhttp_request_t * request,
+                                      unsigned char **buffer, size_t *length);
 redhttp_response_t *parse_data_from_request_body(redhttp_request_t * request,
                                                  librdf_node *graph_node,
                                                  redstore_stream_processor stream_proc);
@@ -151,13 +237,182 @@ redhttp_response_t *handle_load_post(redhttp_request_t * request, void *user_dat
 redhttp_response_t *handle_insert_post(redhttp_request_t * request, void *user_data);
 redhttp_response_t *handle_delete_post(redhttp_request_t * request, void *user_data);
 
+redhttp_response_t *handle_patch_post(redhttp_request_t * request, void *user_data);
+int patch_apply(char *text);
+
+int diff_replace_graph(librdf_node * graph, librdf_stream * stream,
+                       unsigned long *added, unsigned long *removed);
+
 redhttp_response_t *format_bindings_query_result(redhttp_request_t * request,
                                                  librdf_query_results * results);
 
 redhttp_response_t *format_graph_stream(redhttp_request_t * request, librdf_stream * stream);
+redhttp_response_t *format_graph_stream_with_response(redhttp_request_t * request,
+                                                      librdf_stream * stream,
+                                                      redhttp_response_t * response);
+
+redhttp_response_t *format_bindings_table(redhttp_request_t * request,
+                                          const char **names, int width,
+                                          librdf_node ** values, int rows);
 
 redhttp_response_t *handle_image_favicon(redhttp_request_t * request, void *user_data);
 
+int redstore_classify_request(redhttp_request_t * request, void *user_data);
+void admission_init(redhttp_server_t * server);
+
+void coalesce_init(int window_ms);
+int coalesce_is_enabled(void);
+void coalesce_flush(void);
+void coalesce_tick(void);
+redhttp_response_t *handle_coalesce(redhttp_request_t * request, void *user_data);
+redhttp_response_t *coalesce_stream(redhttp_request_t * request, librdf_stream * stream,
+                                    librdf_node * graph, int remove);
+void coalesce_free(void);
+
+int jobs_init(const char *dir);
+int jobs_requested(redhttp_request_t * request);
+redhttp_response_t *jobs_load_uri(redhttp_request_t * request, librdf_parser * parser,
+                                  librdf_uri * uri, librdf_uri * base_uri, librdf_node * graph);
+redhttp_response_t *jobs_load_file(redhttp_request_t * request, const char *filename,
+                                   const char *parser_name, const char *base_arg,
+                                   const char *graph_arg);
+redhttp_response_t *jobs_load_request_body(redhttp_request_t * request, librdf_node * graph);
+int jobs_tick(void);
+redhttp_response_t *handle_job_get(redhttp_request_t * request, void *user_data);
+redhttp_response_t *handle_job_delete(redhttp_request_t * request, void *user_data);
+void jobs_free(void);
+
+void changes_init(size_t max_size);
+int changes_is_enabled(void);
+void changes_log_statement(int remove, librdf_node * graph, librdf_statement * statement);
+void changes_log_graph(librdf_node * graph);
+void changes_reset(void);
+size_t changes_get_mark(void);
+void changes_rollback(size_t mark);
+void changes_commit(void);
+void changes_tick(void);
+redhttp_response_t *handle_changes(redhttp_request_t * request, void *user_data);
+void changes_free(void);
+
+int follower_init(const char *url, const char *state_filename);
+int follower_is_enabled(void);
+void follower_tick(void);
+redhttp_response_t *handle_follower(redhttp_request_t * request, void *user_data);
+const char *follower_get_primary(void);
+unsigned long follower_get_sequence(void);
+long follower_get_lag(void);
+void follower_free(void);
+
+int datasets_add(const char *spec);
+int datasets_get_count(void);
+int datasets_is_default(void);
+int datasets_init(void);
+redhttp_response_t *handle_datasets(redhttp_request_t * request, void *user_data);
+void datasets_tick(void);
+void datasets_free(void);
+
+int search_init(int enable);
+void search_add_statement(librdf_node * graph, librdf_statement * statement);
+void search_remove_statement(librdf_node * graph, librdf_statement * statement);
+void search_remove_graph(librdf_node * graph);
+void search_reindex_graph(librdf_node * graph);
+void search_invalidate(void);
+void search_reset(void);
+void search_journal_start(void);
+void search_journal_commit(void);
+void search_journal_rollback(void);
+void search_tick(void);
+redhttp_response_t *handle_search(redhttp_request_t * request, void *user_data);
+void search_free(void);
+
+int range_init(int enable);
+int range_is_enabled(void);
+int range_node_value(librdf_node * node, int *kind, double *value);
+void range_add_statement(librdf_node * graph, librdf_statement * statement);
+void range_remove_statement(librdf_node * graph, librdf_statement * statement);
+void range_remove_graph(librdf_node * graph);
+void range_invalidate(void);
+void range_reset(void);
+librdf_stream *range_find(librdf_node * predicate, int kind, double min, double max,
+                          librdf_node * subject, librdf_node * graph);
+void range_free(void);
+
+int readers_init(int max);
+redhttp_response_t *handle_readers(redhttp_request_t * request, void *user_data);
+void readers_tick(void);
+void readers_free(void);
+
+void ratelimit_init(double rate, int max_concurrent);
+int ratelimit_take(const char *addr, time_t now);
+int ratelimit_admit(const char *addr, int connections, void *user_data);
+unsigned int ratelimit_count_buckets(void);
+void ratelimit_free(void);
+
+int store_contains_statement(librdf_node * graph, librdf_statement * statement);
+int store_add_statement(librdf_node * graph, librdf_statement * statement);
+int store_add_stream(librdf_node * graph, librdf_stream * stream, unsigned long *added);
+int store_remove_statement(librdf_node * graph, librdf_statement * statement);
+int store_remove_stream(librdf_node * graph, librdf_stream * stream, unsigned long *removed);
+int store_remove_graph(librdf_node * graph);
+int store_remove_all(void);
+int store_is_in_memory(void);
+int store_size_is_known(void);
+void store_set_logging(int enabled);
+unsigned long store_get_generation(void);
+void store_set_batch_size(unsigned long size);
+int store_transaction_start(void);
+int store_transaction_commit(void);
+int store_transaction_rollback(void);
+void store_batch_start(void);
+int store_batch_end(void);
+int store_in_transaction(void);
+
+int wal_open(const char *filename, int sync_interval);
+int wal_is_open(void);
+void wal_log_statement(int remove, librdf_node * graph, librdf_statement * statement);
+void wal_log_remove_graph(librdf_node * graph);
+void wal_log_remove_all(void);
+size_t wal_get_mark(void);
+void wal_rollback(size_t mark);
+int wal_commit(void);
+void wal_set_checkpoint_size(uint64_t size);
+void wal_tick(void);
+void wal_close(void);
+
+int stats_init(void);
+void stats_add(librdf_node * graph, long delta);
+void stats_clear_graph(librdf_node * graph);
+int stats_recount_graph(librdf_node * graph);
+librdf_node *stats_new_graph_node(graph_stats_t * gs);
+void stats_journal_start(void);
+void stats_journal_commit(void);
+int stats_journal_rollback(void);
+void stats_clear_all(void);
+graph_stats_t *stats_lookup_graph(librdf_node * graph);
+unsigned long stats_get_total(void);
+unsigned long stats_get_named_total(void);
+unsigned long stats_get_graph_count(void);
+unsigned long stats_get_graph_size(librdf_node * graph);
+time_t stats_get_modified(librdf_node * graph);
+raptor_avltree_iterator *stats_new_graph_iterator(void);
+void stats_free(void);
+stats_state_t *stats_state_new(void);
+void stats_swap(stats_state_t * state);
+int stats_may_contain(librdf_node * graph, librdf_statement * statement);
+void stats_filter_add(librdf_node * graph, librdf_statement * statement);
+
+bloom_t *bloom_new(unsigned long capacity);
+void bloom_add(bloom_t * bloom, uint64_t hash);
+int bloom_may_contain(bloom_t * bloom, uint64_t hash);
+void bloom_free(bloom_t * bloom);
+
+int native_storage_write_snapshot(librdf_storage * storage, const char *filename);
+int native_storage_register(librdf_world * world);
+
+int sharded_storage_register(librdf_world * world);
+
+librdf_storage *redstore_setup_storage(const char *name, const char *type,
+                                       const char *options, int new, char **public_options);
 void redstore_log(librdf_log_level level, const char *format, ...);
 
 const raptor_syntax_description* redstore_get_format_by_name(description_proc_t desc_proc, const char* format_name);
@@ -167,7 +422,18 @@ int redstore_is_html_format(const char *str);
 int redstore_is_text_format(const char *str);
 int redstore_is_nquads_format(const char *str);
 
+librdf_node *redstore_new_node_from_integer(unsigned long i);
+int redstore_get_integer_argument(redhttp_request_t * request, const char *name,
+                                  long def, long *value);
+char *redstore_unescape_string(const char *start, size_t len);
+uint64_t redstore_statement_hash(librdf_statement * statement);
+
 char* redstore_genid(void);
 
+const char *lexer_next(const char *ptr, lexer_token_t * token);
+int lexer_token_is(const lexer_token_t * token, const char *str);
+char *lexer_token_value(const lexer_token_t * token);
+const char *lexer_skip_prologue(const char *ptr);
+
 
 #endif
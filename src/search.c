@@ -0,0 +1,969 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "redstore.h"
+
+
+// An inverted index of the words in literals: for each word, the subjects
+// of the statements whose objects contain it, in each graph, and how many
+// times. For each graph, it also keeps the words that appear in it, so
+// that dropping a graph only has to visit those words.
+//
+// It is kept up to date as statements are added and removed, and the
+// changes made during a transaction are undone if it is rolled back.
+// Only a change that can't be followed, such as a storage that fails to
+// roll back, marks it as out of date; it is then built again from the
+// main loop, and searches fail until it has been.
+//
+// Words are runs of letters and digits. ASCII letters are folded to
+// lower case; other characters are compared as they are.
+//
+// Only the default dataset is indexed.
+
+typedef struct search_posting_s {
+  unsigned long id;                // For words: the subject; for graphs: the word
+  unsigned long graph;             // For words: the graph; 0 for graphs
+  unsigned long count;
+} search_posting_t;
+
+typedef struct search_entry_s {
+  char *name;
+  uint64_t hash;
+  unsigned long id;                // The position in the table's names
+  search_posting_t *postings;      // For words: the subjects that they appear in, in
+                                   // each graph; for graphs: the words that appear in them
+  size_t posting_count;
+  size_t posting_size;
+} search_entry_t;
+
+typedef struct search_table_s {
+  search_entry_t *entries;
+  size_t size;
+  size_t count;
+  char **names;                    // Names by ID; IDs start at 1
+  size_t names_size;
+} search_table_t;
+
+typedef struct search_hit_s {
+  unsigned long subject;
+  unsigned int words;
+  double score;
+} search_hit_t;
+
+// A change to one posting of a word
+typedef struct search_change_s {
+  unsigned long word;
+  unsigned long subject;
+  unsigned long graph;
+  long delta;
+} search_change_t;
+
+// Where the words of a literal are being added or removed
+typedef struct search_target_s {
+  unsigned long subject;
+  unsigned long graph;
+} search_target_t;
+
+static int enabled = 0;
+
+// Set when the index no longer matches the store
+static int dirty = 0;
+
+// When building the index last failed
+static time_t build_failed = 0;
+
+static search_table_t words;
+static search_table_t subjects;
+static search_table_t graphs;
+
+// The changes made since search_journal_start()
+static search_change_t *journal = NULL;
+static size_t journal_count = 0;
+static size_t journal_size = 0;
+static int journal_enabled = 0;
+
+
+static uint64_t search_hash(const char *str, size_t len)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= (unsigned char) str[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+// Returns the entry for a name, or the empty entry where it would go
+static search_entry_t *search_table_find(search_table_t * table, const char *name,
+                                         size_t len, uint64_t hash)
+{
+  size_t mask = table->size - 1;
+  size_t i = (size_t) hash & mask;
+
+  while (table->entries[i].name) {
+    search_entry_t *entry = &table->entries[i];
+    if (entry->hash == hash && strlen(entry->name) == len && memcmp(entry->name, name, len) == 0)
+      return entry;
+    i = (i + 1) & mask;
+  }
+
+  return &table->entries[i];
+}
+
+static search_entry_t *search_table_lookup(search_table_t * table, const char *name, size_t len)
+{
+  search_entry_t *entry = NULL;
+
+  if (!table->size)
+    return NULL;
+
+  entry = search_table_find(table, name, len, search_hash(name, len));
+  return entry->name ? entry : NULL;
+}
+
+// Returns the entry with an ID; entries move whenever the table grows
+static search_entry_t *search_table_get(search_table_t * table, unsigned long id)
+{
+  if (id == 0 || id > table->count)
+    return NULL;
+
+  return search_table_lookup(table, table->names[id], strlen(table->names[id]));
+}
+
+static int search_table_grow(search_table_t * table)
+{
+  search_entry_t *old = table->entries;
+  size_t old_size = table->size, i;
+
+  table->size = old_size ? old_size * 2 : 1024;
+  table->entries = calloc(table->size, sizeof(search_entry_t));
+  if (!table->entries) {
+    table->entries = old;
+    table->size = old_size;
+    return 1;
+  }
+
+  for (i = 0; i < old_size; i++) {
+    if (old[i].name)
+      *search_table_find(table, old[i].name, strlen(old[i].name), old[i].hash) = old[i];
+  }
+  if (old)
+    free(old);
+
+  return 0;
+}
+
+// Returns the entry for a name, adding it and giving it an ID if it isn't there yet
+static search_entry_t *search_table_intern(search_table_t * table, const char *name, size_t len)
+{
+  uint64_t hash = search_hash(name, len);
+  search_entry_t *entry = NULL;
+
+  // Keep the table at most half full
+  if ((table->count + 1) * 2 > table->size && search_table_grow(table))
+    return NULL;
+
+  entry = search_table_find(table, name, len, hash);
+  if (entry->name)
+    return entry;
+
+  if (table->count + 1 >= table->names_size) {
+    size_t size = table->names_size ? table->names_size * 2 : 1024;
+    char **tmp = realloc(table->names, size * sizeof(char *));
+    if (!tmp)
+      return NULL;
+    table->names = tmp;
+    table->names_size = size;
+  }
+
+  entry->name = malloc(len + 1);
+  if (!entry->name)
+    return NULL;
+  memcpy(entry->name, name, len);
+  entry->name[len] = '\0';
+  entry->hash = hash;
+  entry->id = ++table->count;
+  table->names[entry->id] = entry->name;
+
+  return entry;
+}
+
+static void search_table_free(search_table_t * table)
+{
+  size_t i;
+
+  for (i = 0; i < table->size; i++) {
+    if (table->entries[i].name)
+      free(table->entries[i].name);
+    if (table->entries[i].postings)
+      free(table->entries[i].postings);
+  }
+  if (table->entries)
+    free(table->entries);
+  if (table->names)
+    free(table->names);
+  memset(table, 0, sizeof(search_table_t));
+}
+
+static void search_journal_clear(void)
+{
+  journal_count = 0;
+}
+
+// Remembers a change, so that search_journal_rollback() can undo it
+static void search_journal_add(unsigned long word, unsigned long subject, unsigned long graph,
+                               long delta)
+{
+  search_change_t *change = NULL;
+
+  if (journal_enabled <= 0)
+    return;
+
+  if (journal_count == journal_size) {
+    size_t size = journal_size ? journal_size * 2 : 64;
+    search_change_t *tmp = NULL;
+
+    // A transaction that changes that much is undone by building the index again
+    if (size > SEARCH_MAX_JOURNAL) {
+      journal_enabled = -1;
+      return;
+    }
+
+    tmp = realloc(journal, size * sizeof(search_change_t));
+    if (!tmp) {
+      journal_enabled = -1;
+      return;
+    }
+    journal = tmp;
+    journal_size = size;
+  }
+
+  change = &journal[journal_count++];
+  change->word = word;
+  change->subject = subject;
+  change->graph = graph;
+  change->delta = delta;
+}
+
+static void search_clear(void)
+{
+  search_table_free(&words);
+  search_table_free(&subjects);
+  search_table_free(&graphs);
+
+  // The changes recorded so far can no longer be undone
+  search_journal_clear();
+  if (journal_enabled)
+    journal_enabled = -1;
+}
+
+
+// Gets the ID of a subject or a graph; the default graph is the empty name.
+// The ID is 0 if it isn't in the table and create isn't set.
+static int search_node_id(search_table_t * table, librdf_node * node, int create,
+                          unsigned long *id)
+{
+  char *name = NULL;
+  search_entry_t *entry = NULL;
+  const char *key = "";
+
+  *id = 0;
+  if (node) {
+    name = (char *) librdf_node_to_string(node);
+    if (!name)
+      return 1;
+    key = name;
+  }
+
+  if (create) {
+    entry = search_table_intern(table, key, strlen(key));
+  } else {
+    entry = search_table_lookup(table, key, strlen(key));
+  }
+
+  if (name)
+    free(name);
+
+  if (entry) {
+    *id = entry->id;
+  } else if (create) {
+    return 1;
+  }
+
+  return 0;
+}
+
+// Calls proc for each word in a string; stops and returns non-zero if proc does
+static int search_each_word(const char *str, size_t len,
+                            int (*proc) (const char *word, size_t len, void *data), void *data)
+{
+  char word[SEARCH_MAX_WORD_LENGTH];
+  size_t i, word_len = 0;
+  int too_long = 0;
+
+  for (i = 0; i <= len; i++) {
+    unsigned char c = i < len ? (unsigned char) str[i] : ' ';
+
+    if (isalnum(c) || c >= 0x80) {
+      if (word_len < sizeof(word)) {
+        word[word_len++] = (char) tolower(c);
+      } else {
+        too_long = 1;
+      }
+    } else if (word_len > 0) {
+      // Words that are too long to be worth searching for are left out
+      if (!too_long && proc(word, word_len, data))
+        return 1;
+      word_len = 0;
+      too_long = 0;
+    }
+  }
+
+  return 0;
+}
+
+// Postings are kept in order of ID and then graph; returns where one is, or would go
+static size_t search_posting_find(search_entry_t * entry, unsigned long id, unsigned long graph)
+{
+  size_t low = 0, high = entry->posting_count;
+  search_posting_t *last = high > 0 ? &entry->postings[high - 1] : NULL;
+
+  // Subjects are usually new, or the last one added to
+  if (last && (last->id < id || (last->id == id && last->graph < graph)))
+    return high;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    search_posting_t *posting = &entry->postings[mid];
+    if (posting->id < id || (posting->id == id && posting->graph < graph)) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low;
+}
+
+static int search_posting_is_at(search_entry_t * entry, size_t i, unsigned long id,
+                                unsigned long graph)
+{
+  return i < entry->posting_count && entry->postings[i].id == id &&
+      entry->postings[i].graph == graph;
+}
+
+static int search_posting_insert(search_entry_t * entry, size_t i, unsigned long id,
+                                 unsigned long graph, unsigned long count)
+{
+  if (entry->posting_count == entry->posting_size) {
+    size_t size = entry->posting_size ? entry->posting_size * 2 : 4;
+    search_posting_t *tmp = realloc(entry->postings, size * sizeof(search_posting_t));
+    if (!tmp)
+      return 1;
+    entry->postings = tmp;
+    entry->posting_size = size;
+  }
+
+  memmove(&entry->postings[i + 1], &entry->postings[i],
+          (entry->posting_count - i) * sizeof(search_posting_t));
+  entry->postings[i].id = id;
+  entry->postings[i].graph = graph;
+  entry->postings[i].count = count;
+  entry->posting_count++;
+
+  return 0;
+}
+
+static void search_posting_delete(search_entry_t * entry, size_t i)
+{
+  entry->posting_count--;
+  memmove(&entry->postings[i], &entry->postings[i + 1],
+          (entry->posting_count - i) * sizeof(search_posting_t));
+}
+
+// Counts the subjects that a word has in a graph, in the graph's list of words
+static int search_graph_word_change(unsigned long graph, unsigned long word, long delta)
+{
+  search_entry_t *entry = search_table_get(&graphs, graph);
+  size_t i;
+
+  if (!entry)
+    return 1;
+
+  i = search_posting_find(entry, word, 0);
+  if (!search_posting_is_at(entry, i, word, 0))
+    return delta > 0 ? search_posting_insert(entry, i, word, 0, delta) : 1;
+
+  if (delta < 0 && (unsigned long) -delta > entry->postings[i].count)
+    return 1;
+  entry->postings[i].count += delta;
+  if (entry->postings[i].count == 0)
+    search_posting_delete(entry, i);
+
+  return 0;
+}
+
+// Changes the number of times that a word appears in the literals of a subject in a graph
+static int search_posting_change(search_entry_t * word, unsigned long subject,
+                                 unsigned long graph, long delta)
+{
+  size_t i = search_posting_find(word, subject, graph);
+
+  if (search_posting_is_at(word, i, subject, graph)) {
+    if (delta < 0 && (unsigned long) -delta > word->postings[i].count)
+      return 1;
+    word->postings[i].count += delta;
+    if (word->postings[i].count == 0) {
+      search_posting_delete(word, i);
+      if (search_graph_word_change(graph, word->id, -1))
+        return 1;
+    }
+  } else if (delta > 0) {
+    if (search_posting_insert(word, i, subject, graph, delta))
+      return 1;
+    if (search_graph_word_change(graph, word->id, 1))
+      return 1;
+  } else {
+    return 1;
+  }
+
+  search_journal_add(word->id, subject, graph, delta);
+
+  return 0;
+}
+
+static int search_add_word(const char *word, size_t len, void *data)
+{
+  search_target_t *target = (search_target_t *) data;
+  search_entry_t *entry = search_table_intern(&words, word, len);
+
+  if (!entry)
+    return 1;
+
+  return search_posting_change(entry, target->subject, target->graph, 1);
+}
+
+static int search_remove_word(const char *word, size_t len, void *data)
+{
+  search_target_t *target = (search_target_t *) data;
+  search_entry_t *entry = search_table_lookup(&words, word, len);
+
+  if (!entry)
+    return 1;
+
+  return search_posting_change(entry, target->subject, target->graph, -1);
+}
+
+// Adds or removes the words in a statement's object; returns non-zero on error
+static int search_index_statement(int remove, librdf_node * graph, librdf_statement * statement)
+{
+  librdf_node *object = librdf_statement_get_object(statement);
+  search_target_t target;
+  const char *value = NULL;
+  size_t len = 0;
+
+  if (!librdf_node_is_literal(object))
+    return 0;
+
+  value = (const char *) librdf_node_get_literal_value_as_counted_string(object, &len);
+  if (!value)
+    return 1;
+
+  if (search_node_id(&subjects, librdf_statement_get_subject(statement), !remove, &target.subject) ||
+      search_node_id(&graphs, graph, !remove, &target.graph))
+    return 1;
+
+  // Words can only be removed from a subject that has some
+  if (!target.subject || !target.graph)
+    return 1;
+
+  return search_each_word(value, len, remove ? search_remove_word : search_add_word, &target);
+}
+
+// Removes the postings of every word in a graph
+static int search_clear_graph(unsigned long graph)
+{
+  search_entry_t *entry = search_table_get(&graphs, graph);
+  size_t i, j, kept;
+
+  if (!entry)
+    return 1;
+
+  for (i = 0; i < entry->posting_count; i++) {
+    search_entry_t *word = search_table_get(&words, entry->postings[i].id);
+    if (!word)
+      return 1;
+
+    for (j = 0, kept = 0; j < word->posting_count; j++) {
+      search_posting_t *posting = &word->postings[j];
+      if (posting->graph == graph) {
+        search_journal_add(word->id, posting->id, graph, -(long) posting->count);
+      } else {
+        word->postings[kept++] = *posting;
+      }
+    }
+    word->posting_count = kept;
+  }
+  entry->posting_count = 0;
+
+  return 0;
+}
+
+static int search_is_followed(void)
+{
+  return enabled && !dirty && datasets_is_default();
+}
+
+static void search_update(int remove, librdf_node * graph, librdf_statement * statement)
+{
+  if (!search_is_followed())
+    return;
+
+  // Build the index again, rather than search an incomplete one
+  if (search_index_statement(remove, graph, statement)) {
+    redstore_debug("Failed to update the word index; it will be built again");
+    dirty = 1;
+  }
+}
+
+void search_add_statement(librdf_node * graph, librdf_statement * statement)
+{
+  search_update(0, graph, statement);
+}
+
+void search_remove_statement(librdf_node * graph, librdf_statement * statement)
+{
+  search_update(1, graph, statement);
+}
+
+// Called when all the statements in a graph have been removed
+void search_remove_graph(librdf_node * graph)
+{
+  unsigned long id = 0;
+
+  if (!search_is_followed())
+    return;
+
+  if (search_node_id(&graphs, graph, 0, &id) || (id && search_clear_graph(id))) {
+    redstore_debug("Failed to remove a graph from the word index; it will be built again");
+    dirty = 1;
+  }
+}
+
+// Indexes a graph again, after an error left only some of it removed
+void search_reindex_graph(librdf_node * graph)
+{
+  librdf_stream *stream = NULL;
+
+  search_remove_graph(graph);
+  if (!search_is_followed())
+    return;
+
+  if (graph) {
+    stream = librdf_model_context_as_stream(model, graph);
+  } else {
+    stream = librdf_model_as_stream(model);
+  }
+  if (!stream) {
+    redstore_error("Failed to stream graph to index its words");
+    dirty = 1;
+    return;
+  }
+
+  while (!librdf_stream_end(stream)) {
+    if ((graph || librdf_stream_get_context2(stream) == NULL) &&
+        search_index_statement(0, graph, librdf_stream_get_object(stream))) {
+      dirty = 1;
+      break;
+    }
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+}
+
+// Called when the store has been changed in a way that the index can't follow
+void search_invalidate(void)
+{
+  if (enabled && datasets_is_default())
+    dirty = 1;
+}
+
+// Called when the whole store has been emptied
+void search_reset(void)
+{
+  if (enabled && datasets_is_default()) {
+    search_clear();
+    dirty = 0;
+  }
+}
+
+// Starts recording changes to the index, when a transaction is started
+void search_journal_start(void)
+{
+  search_journal_clear();
+  journal_enabled = 1;
+}
+
+// Forgets the recorded changes, once they have been committed
+void search_journal_commit(void)
+{
+  search_journal_clear();
+  journal_enabled = 0;
+}
+
+// Undoes the changes recorded since search_journal_start(). If they
+// weren't all recorded, the index is built again instead.
+void search_journal_rollback(void)
+{
+  int complete = (journal_enabled > 0);
+  size_t i;
+
+  journal_enabled = 0;
+  if (search_is_followed() && !complete)
+    dirty = 1;
+
+  for (i = journal_count; i > 0 && search_is_followed(); i--) {
+    search_change_t *change = &journal[i - 1];
+    search_entry_t *word = search_table_get(&words, change->word);
+
+    if (!word || search_posting_change(word, change->subject, change->graph, -change->delta)) {
+      redstore_debug("Failed to undo a change to the word index; it will be built again");
+      dirty = 1;
+    }
+  }
+  search_journal_clear();
+}
+
+static int search_build(void)
+{
+  librdf_stream *stream = NULL;
+  unsigned long count = 0;
+  int err = 0;
+
+  search_clear();
+  dirty = 1;
+
+  stream = librdf_model_as_stream(model);
+  if (!stream) {
+    redstore_error("Failed to stream model to build the word index");
+    build_failed = time(NULL);
+    return 1;
+  }
+
+  while (!librdf_stream_end(stream)) {
+    librdf_node *graph = librdf_stream_get_context2(stream);
+    if (search_index_statement(0, graph, librdf_stream_get_object(stream))) {
+      err = 1;
+      break;
+    }
+    count++;
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+
+  if (err) {
+    redstore_error("Failed to build the word index");
+    search_clear();
+    build_failed = time(NULL);
+    return 1;
+  }
+
+  redstore_info("Indexed %lu words in %lu statements", (unsigned long) words.count, count);
+  dirty = 0;
+  build_failed = 0;
+
+  return 0;
+}
+
+int search_init(int enable)
+{
+  enabled = enable;
+  if (!enabled)
+    return 0;
+
+  return search_build();
+}
+
+// Called from the main loop, to build the index again once it is out of date
+void search_tick(void)
+{
+  if (!enabled || !dirty || !datasets_is_default())
+    return;
+
+  // Don't keep reading the whole store if building the index keeps failing
+  if (build_failed && time(NULL) - build_failed < SEARCH_BUILD_RETRY)
+    return;
+
+  search_build();
+}
+
+
+static search_hit_t *search_hit_find(search_hit_t * hits, size_t size, unsigned long subject)
+{
+  size_t mask = size - 1;
+  size_t i = (size_t) (subject * 2654435761UL) & mask;
+
+  while (hits[i].subject && hits[i].subject != subject)
+    i = (i + 1) & mask;
+
+  return &hits[i];
+}
+
+static int search_compare_postings(const void *a, const void *b)
+{
+  const search_entry_t *ea = *((const search_entry_t **) a);
+  const search_entry_t *eb = *((const search_entry_t **) b);
+
+  if (ea->posting_count < eb->posting_count)
+    return -1;
+  return ea->posting_count > eb->posting_count;
+}
+
+static int search_compare_hits(const void *a, const void *b)
+{
+  const search_hit_t *ha = (const search_hit_t *) a;
+  const search_hit_t *hb = (const search_hit_t *) b;
+
+  if (ha->score > hb->score)
+    return -1;
+  if (ha->score < hb->score)
+    return 1;
+  return strcmp(subjects.names[ha->subject], subjects.names[hb->subject]);
+}
+
+typedef struct search_query_s {
+  search_entry_t *entries[SEARCH_MAX_WORDS];
+  unsigned int count;
+  int missing;
+} search_query_t;
+
+static int search_query_add_word(const char *word, size_t len, void *data)
+{
+  search_query_t *query = (search_query_t *) data;
+  search_entry_t *entry = search_table_lookup(&words, word, len);
+  unsigned int i;
+
+  if (!entry || entry->posting_count == 0) {
+    query->missing = 1;
+    return 1;
+  }
+
+  for (i = 0; i < query->count; i++) {
+    if (query->entries[i] == entry)
+      return 0;
+  }
+
+  if (query->count < SEARCH_MAX_WORDS)
+    query->entries[query->count++] = entry;
+
+  return 0;
+}
+
+// Finds the subjects that have every word in the text, best first.
+// Each word counts for more the fewer subjects it appears in.
+// Returns the number of hits, or -1 on error.
+static long search_find(const char *text, search_hit_t ** results)
+{
+  search_query_t query;
+  search_hit_t *hits = NULL;
+  size_t size = 2, i, count = 0;
+  unsigned int w;
+
+  memset(&query, 0, sizeof(query));
+  *results = NULL;
+
+  search_each_word(text, strlen(text), search_query_add_word, &query);
+  if (query.missing || query.count == 0)
+    return 0;
+
+  // Start with the subjects of the rarest word, and narrow them down
+  qsort(query.entries, query.count, sizeof(search_entry_t *), search_compare_postings);
+  while (size < query.entries[0]->posting_count * 2)
+    size *= 2;
+
+  hits = calloc(size, sizeof(search_hit_t));
+  if (!hits)
+    return -1;
+
+  for (w = 0; w < query.count; w++) {
+    search_entry_t *entry = query.entries[w];
+    double weight = 1.0 / (double) entry->posting_count;
+
+    for (i = 0; i < entry->posting_count; i++) {
+      search_posting_t *posting = &entry->postings[i];
+      search_hit_t *hit = search_hit_find(hits, size, posting->id);
+
+      // A subject may have a posting for the same word in more than one graph
+      if (w == 0)
+        hit->subject = posting->id;
+      if (hit->words == w) {
+        hit->words++;
+      } else if (hit->words != w + 1) {
+        continue;
+      }
+      hit->score += weight * (double) posting->count;
+    }
+  }
+
+  // Keep the subjects that had every word
+  for (i = 0; i < size; i++) {
+    if (hits[i].subject && hits[i].words == query.count)
+      hits[count++] = hits[i];
+  }
+  qsort(hits, count, sizeof(search_hit_t), search_compare_hits);
+
+  *results = hits;
+
+  return (long) count;
+}
+
+
+static redhttp_response_t *format_search_html(redhttp_request_t * request, const char *text,
+                                              search_hit_t * hits, long count, long limit)
+{
+  redhttp_response_t *response = redstore_page_new(REDHTTP_OK, "Search");
+  char buffer[32];
+  long i;
+
+  if (!response)
+    return NULL;
+
+  redstore_page_append_string(response, "<form action=\"/search\" method=\"get\"><p>");
+  redstore_page_append_string(response, "<input type=\"text\" name=\"q\" size=\"40\" value=\"");
+  redstore_page_append_escaped(response, text, '"');
+  redstore_page_append_string(response, "\" /> <input type=\"submit\" value=\"Search\" />");
+  redstore_page_append_string(response, "</p></form>\n");
+
+  if (count > 0) {
+    redstore_page_append_string(response, "<ol>\n");
+    for (i = 0; i < count && (!limit || i < limit); i++) {
+      snprintf(buffer, sizeof(buffer), "%.4f", hits[i].score);
+      redstore_page_append_string(response, "<li>");
+      redstore_page_append_escaped(response, subjects.names[hits[i].subject], 0);
+      redstore_page_append_strings(response, " (", buffer, ")</li>\n", NULL);
+    }
+    redstore_page_append_string(response, "</ol>\n");
+  } else if (text[0]) {
+    redstore_page_append_string(response, "<p>Nothing found.</p>\n");
+  }
+
+  redstore_page_end(response);
+
+  return response;
+}
+
+static redhttp_response_t *format_search_text(redhttp_request_t * request,
+                                              search_hit_t * hits, long count, long limit)
+{
+  redhttp_response_t *response = redhttp_response_new_with_type(REDHTTP_OK, NULL, "text/plain");
+  FILE *socket = redhttp_request_get_socket(request);
+  long i;
+
+  if (!response)
+    return NULL;
+
+  redhttp_response_send(response, request);
+
+  for (i = 0; i < count && (!limit || i < limit); i++)
+    fprintf(socket, "%s\t%.4f\n", subjects.names[hits[i].subject], hits[i].score);
+
+  return response;
+}
+
+redhttp_response_t *handle_search(redhttp_request_t * request, void *user_data)
+{
+  const char *text = redhttp_request_get_argument(request, "q");
+  redhttp_response_t *response = NULL;
+  search_hit_t *hits = NULL;
+  char *format_str = NULL;
+  long limit = 0, count = 0;
+
+  if (!enabled || !datasets_is_default()) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_NOT_FOUND, "The word index is not enabled."
+    );
+  }
+
+  if (redstore_get_integer_argument(request, "limit", SEARCH_DEFAULT_LIMIT, &limit)) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "Invalid 'limit' argument."
+    );
+  }
+
+  if (dirty) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_SERVICE_UNAVAILABLE,
+      "The word index is being built again. Please try again later."
+    );
+  }
+
+  if (text) {
+    count = search_find(text, &hits);
+    if (count < 0) {
+      return redstore_page_new_with_message(
+        request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Out of memory."
+      );
+    }
+  }
+
+  format_str = redstore_negotiate_string(request, "text/plain,text/html,application/xhtml+xml", "text/plain");
+  if (!format_str) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to negotiate format."
+    );
+  } else if (redstore_is_text_format(format_str)) {
+    response = format_search_text(request, hits, count, limit);
+  } else if (redstore_is_html_format(format_str)) {
+    response = format_search_html(request, text ? text : "", hits, count, limit);
+  } else {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_NOT_ACCEPTABLE, "No acceptable format supported."
+    );
+  }
+
+  if (format_str)
+    free(format_str);
+  if (hits)
+    free(hits);
+
+  return response;
+}
+
+void search_free(void)
+{
+  search_clear();
+  if (journal)
+    free(journal);
+  journal = NULL;
+  journal_size = 0;
+  journal_enabled = 0;
+  enabled = 0;
+  dirty = 0;
+  build_failed = 0;
+}
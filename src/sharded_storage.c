@@ -0,0 +1,644 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "redstore.h"
+
+
+// A librdf storage module that partitions the named graphs between
+// several other storages (shards), which may each be in a different
+// directory, on a different disk. The shard that holds a graph is chosen
+// by a hash of its name; the default graph is always in the first shard.
+//
+// Anything that is for one graph goes straight to its shard. Anything
+// else, such as a query over the union of all the graphs, is asked of
+// every shard and their results are returned one after another.
+
+typedef struct sharded_storage_s {
+  librdf_storage **shards;
+  int count;
+} sharded_storage_t;
+
+// The results from every shard; only one of streams and iterators is used
+typedef struct sharded_cursor_s {
+  librdf_stream **streams;
+  librdf_iterator **iterators;
+  int count;
+  int current;
+} sharded_cursor_t;
+
+// The options that are for the sharded storage, rather than for each shard;
+// 'dir' is only left out when each shard is given its own directory
+static const char *sharded_option_keys[] = { "shards", "shard-type", "shard-dirs", NULL };
+static const char *sharded_option_keys_with_dir[] = { "shards", "shard-type", "shard-dirs", "dir", NULL };
+
+
+// Returns the shard that holds a graph
+static int sharded_storage_choose(sharded_storage_t * instance, librdf_node * context)
+{
+  unsigned char *str = NULL, *ptr = NULL;
+  uint64_t hash = 14695981039346656037ULL;
+
+  if (!context || instance->count == 1)
+    return 0;
+
+  str = librdf_node_to_string(context);
+  if (!str)
+    return 0;
+
+  for (ptr = str; *ptr; ptr++) {
+    hash ^= *ptr;
+    hash *= 1099511628211ULL;
+  }
+  free(str);
+
+  return (int) (hash % (uint64_t) instance->count);
+}
+
+static librdf_storage *sharded_storage_get_shard(librdf_storage * storage, librdf_node * context)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  return instance->shards[sharded_storage_choose(instance, context)];
+}
+
+
+static int sharded_cursor_part_is_end(sharded_cursor_t * cursor, int i)
+{
+  if (cursor->streams)
+    return librdf_stream_end(cursor->streams[i]);
+  return librdf_iterator_end(cursor->iterators[i]);
+}
+
+// Moves on to the next shard that still has results
+static void sharded_cursor_skip_ended(sharded_cursor_t * cursor)
+{
+  while (cursor->current < cursor->count && sharded_cursor_part_is_end(cursor, cursor->current))
+    cursor->current++;
+}
+
+static int sharded_cursor_is_end(void *context)
+{
+  sharded_cursor_t *cursor = (sharded_cursor_t *) context;
+  return cursor->current >= cursor->count;
+}
+
+static int sharded_cursor_next(void *context)
+{
+  sharded_cursor_t *cursor = (sharded_cursor_t *) context;
+
+  if (cursor->current < cursor->count) {
+    if (cursor->streams) {
+      librdf_stream_next(cursor->streams[cursor->current]);
+    } else {
+      librdf_iterator_next(cursor->iterators[cursor->current]);
+    }
+    sharded_cursor_skip_ended(cursor);
+  }
+
+  return cursor->current >= cursor->count;
+}
+
+static void *sharded_stream_get(void *context, int flags)
+{
+  sharded_cursor_t *cursor = (sharded_cursor_t *) context;
+  librdf_stream *stream = NULL;
+
+  if (cursor->current >= cursor->count)
+    return NULL;
+  stream = cursor->streams[cursor->current];
+
+  switch (flags) {
+  case LIBRDF_STREAM_GET_METHOD_GET_OBJECT:
+    return librdf_stream_get_object(stream);
+
+  case LIBRDF_STREAM_GET_METHOD_GET_CONTEXT:
+    return librdf_stream_get_context2(stream);
+
+  default:
+    redstore_error("Unknown iterator method flag %d", flags);
+    return NULL;
+  }
+}
+
+static void *sharded_iterator_get(void *context, int flags)
+{
+  sharded_cursor_t *cursor = (sharded_cursor_t *) context;
+  librdf_iterator *iterator = NULL;
+
+  if (cursor->current >= cursor->count)
+    return NULL;
+  iterator = cursor->iterators[cursor->current];
+
+  switch (flags) {
+  case LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT:
+    return librdf_iterator_get_object(iterator);
+
+  case LIBRDF_ITERATOR_GET_METHOD_GET_CONTEXT:
+    return librdf_iterator_get_context(iterator);
+
+  default:
+    redstore_error("Unknown iterator method flag %d", flags);
+    return NULL;
+  }
+}
+
+static void sharded_cursor_finished(void *context)
+{
+  sharded_cursor_t *cursor = (sharded_cursor_t *) context;
+  int i;
+
+  for (i = 0; i < cursor->count; i++) {
+    if (cursor->streams && cursor->streams[i])
+      librdf_free_stream(cursor->streams[i]);
+    if (cursor->iterators && cursor->iterators[i])
+      librdf_free_iterator(cursor->iterators[i]);
+  }
+  if (cursor->streams)
+    free(cursor->streams);
+  if (cursor->iterators)
+    free(cursor->iterators);
+  free(cursor);
+}
+
+static sharded_cursor_t *sharded_cursor_new(sharded_storage_t * instance, int streams)
+{
+  sharded_cursor_t *cursor = calloc(1, sizeof(sharded_cursor_t));
+
+  if (!cursor)
+    return NULL;
+
+  cursor->count = instance->count;
+  if (streams) {
+    cursor->streams = calloc(cursor->count, sizeof(librdf_stream *));
+  } else {
+    cursor->iterators = calloc(cursor->count, sizeof(librdf_iterator *));
+  }
+
+  if (!cursor->streams && !cursor->iterators) {
+    free(cursor);
+    return NULL;
+  }
+
+  return cursor;
+}
+
+// Asks every shard for the statements that match, and returns them all in one stream
+static librdf_stream *sharded_storage_scatter(librdf_storage * storage, librdf_statement * statement)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  sharded_cursor_t *cursor = sharded_cursor_new(instance, 1);
+  librdf_stream *stream = NULL;
+  int i;
+
+  if (!cursor)
+    return NULL;
+
+  for (i = 0; i < instance->count; i++) {
+    if (statement) {
+      cursor->streams[i] = librdf_storage_find_statements(instance->shards[i], statement);
+    } else {
+      cursor->streams[i] = librdf_storage_serialise(instance->shards[i]);
+    }
+    if (!cursor->streams[i]) {
+      sharded_cursor_finished(cursor);
+      return NULL;
+    }
+  }
+  sharded_cursor_skip_ended(cursor);
+
+  stream = librdf_new_stream(librdf_storage_get_world(storage), cursor, sharded_cursor_is_end,
+                             sharded_cursor_next, sharded_stream_get, sharded_cursor_finished);
+  if (!stream)
+    sharded_cursor_finished(cursor);
+
+  return stream;
+}
+
+
+static int sharded_storage_init(librdf_storage * storage, const char *name, librdf_hash * options)
+{
+  librdf_world *world = librdf_storage_get_world(storage);
+  sharded_storage_t *instance = NULL;
+  char *shards = NULL, *type = NULL, *dirs = NULL, *shard_options = NULL;
+  char *shard_name = NULL, *dir = NULL;
+  int count = SHARDED_DEFAULT_SHARDS, dir_count = 0, i;
+  int err = 1;
+
+  if (!options || !name) {
+    redstore_error("The sharded storage needs a name and options");
+    if (options)
+      librdf_free_hash(options);
+    return 1;
+  }
+
+  shards = librdf_hash_get(options, "shards");
+  type = librdf_hash_get(options, "shard-type");
+  dirs = librdf_hash_get(options, "shard-dirs");
+
+  if (shards) {
+    char *end = NULL;
+    count = (int) strtol(shards, &end, 10);
+    if (*end != '\0' || count < 1 || count > SHARDED_MAX_SHARDS) {
+      redstore_error("The number of shards must be between 1 and %d", SHARDED_MAX_SHARDS);
+      goto CLEANUP;
+    }
+  }
+
+  if (type && strcmp(type, "sharded") == 0) {
+    redstore_error("Shards can't be sharded storages themselves");
+    goto CLEANUP;
+  }
+
+  // Everything else, such as 'hash-type' and 'new', is passed on to each shard
+  shard_options = librdf_hash_to_string(options, dirs ? sharded_option_keys_with_dir :
+                                        sharded_option_keys);
+  if (!shard_options)
+    goto CLEANUP;
+
+  // The shards are spread across the directories, in turn
+  if (dirs) {
+    char *ptr = NULL;
+    for (ptr = dirs, dir_count = 1; *ptr; ptr++) {
+      if (*ptr == ':')
+        dir_count++;
+    }
+  }
+
+  // The shards that were opened are closed by terminate, if this fails
+  instance = calloc(1, sizeof(sharded_storage_t));
+  if (!instance)
+    goto CLEANUP;
+  librdf_storage_set_instance(storage, instance);
+  instance->shards = calloc(count, sizeof(librdf_storage *));
+  if (!instance->shards)
+    goto CLEANUP;
+
+  shard_name = malloc(strlen(name) + 16);
+  if (!shard_name)
+    goto CLEANUP;
+
+  for (i = 0; i < count; i++) {
+    librdf_hash *hash = librdf_new_hash_from_string(world, NULL, shard_options);
+    if (!hash)
+      goto CLEANUP;
+
+    sprintf(shard_name, "%s-%d", name, i);
+
+    if (dirs) {
+      // Find the i'th directory in the list, modulo the number of directories
+      const char *start = dirs;
+      int n = i % dir_count;
+      size_t len;
+
+      while (n-- > 0)
+        start = strchr(start, ':') + 1;
+      len = strcspn(start, ":");
+
+      dir = malloc(len + 1);
+      if (!dir) {
+        librdf_free_hash(hash);
+        goto CLEANUP;
+      }
+      memcpy(dir, start, len);
+      dir[len] = '\0';
+      librdf_hash_put_strings(hash, "dir", dir);
+    }
+
+    redstore_debug("Opening shard %d: %s storage '%s'%s%s", i, type ? type : "hashes",
+                   shard_name, dir ? " in " : "", dir ? dir : "");
+    instance->shards[i] = librdf_new_storage_with_options(world, type ? type : "hashes",
+                                                          shard_name, hash);
+    librdf_free_hash(hash);
+    if (dir) {
+      free(dir);
+      dir = NULL;
+    }
+
+    if (!instance->shards[i]) {
+      redstore_error("Failed to open shard %d of sharded storage '%s'", i, name);
+      goto CLEANUP;
+    }
+    instance->count++;
+  }
+
+  redstore_info("Partitioning graphs between %d shards", count);
+  err = 0;
+
+CLEANUP:
+  if (shards)
+    librdf_free_memory(shards);
+  if (type)
+    librdf_free_memory(type);
+  if (dirs)
+    librdf_free_memory(dirs);
+  if (shard_options)
+    librdf_free_memory(shard_options);
+  if (shard_name)
+    free(shard_name);
+  librdf_free_hash(options);
+
+  return err;
+}
+
+static void sharded_storage_terminate(librdf_storage * storage)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  int i;
+
+  if (!instance)
+    return;
+
+  for (i = 0; i < instance->count; i++)
+    librdf_free_storage(instance->shards[i]);
+  if (instance->shards)
+    free(instance->shards);
+  free(instance);
+}
+
+static int sharded_storage_open(librdf_storage * storage, librdf_model * model)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  int i;
+
+  for (i = 0; i < instance->count; i++) {
+    if (librdf_storage_open(instance->shards[i], model)) {
+      redstore_error("Failed to open shard %d", i);
+      while (--i >= 0)
+        librdf_storage_close(instance->shards[i]);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int sharded_storage_close(librdf_storage * storage)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  int i, err = 0;
+
+  for (i = 0; i < instance->count; i++)
+    err |= librdf_storage_close(instance->shards[i]);
+
+  return err;
+}
+
+static int sharded_storage_size(librdf_storage * storage)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  int i, total = 0;
+
+  for (i = 0; i < instance->count; i++) {
+    int size = librdf_storage_size(instance->shards[i]);
+    if (size < 0)
+      return -1;
+    total += size;
+  }
+
+  return total;
+}
+
+static int sharded_storage_context_add_statement(librdf_storage * storage, librdf_node * context,
+                                                 librdf_statement * statement)
+{
+  librdf_storage *shard = sharded_storage_get_shard(storage, context);
+
+  if (!context)
+    return librdf_storage_add_statement(shard, statement);
+
+  return librdf_storage_context_add_statement(shard, context, statement);
+}
+
+static int sharded_storage_add_statement(librdf_storage * storage, librdf_statement * statement)
+{
+  return sharded_storage_context_add_statement(storage, NULL, statement);
+}
+
+static int sharded_storage_add_statements(librdf_storage * storage, librdf_stream * stream)
+{
+  int err = 0;
+
+  while (!librdf_stream_end(stream)) {
+    librdf_statement *statement = librdf_stream_get_object(stream);
+    if (!statement || sharded_storage_add_statement(storage, statement)) {
+      err = 1;
+      break;
+    }
+    librdf_stream_next(stream);
+  }
+
+  return err;
+}
+
+static int sharded_storage_context_remove_statement(librdf_storage * storage,
+                                                    librdf_node * context,
+                                                    librdf_statement * statement)
+{
+  librdf_storage *shard = sharded_storage_get_shard(storage, context);
+
+  if (!context)
+    return librdf_storage_remove_statement(shard, statement);
+
+  return librdf_storage_context_remove_statement(shard, context, statement);
+}
+
+static int sharded_storage_remove_statement(librdf_storage * storage, librdf_statement * statement)
+{
+  return sharded_storage_context_remove_statement(storage, NULL, statement);
+}
+
+static int sharded_storage_context_remove_statements(librdf_storage * storage,
+                                                     librdf_node * context)
+{
+  return librdf_storage_context_remove_statements(sharded_storage_get_shard(storage, context),
+                                                  context);
+}
+
+static int sharded_storage_contains_statement(librdf_storage * storage,
+                                              librdf_statement * statement)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  int i;
+
+  for (i = 0; i < instance->count; i++) {
+    if (librdf_storage_contains_statement(instance->shards[i], statement) > 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+static librdf_stream *sharded_storage_find_statements(librdf_storage * storage,
+                                                      librdf_statement * statement)
+{
+  return sharded_storage_scatter(storage, statement);
+}
+
+static librdf_stream *sharded_storage_serialise(librdf_storage * storage)
+{
+  return sharded_storage_scatter(storage, NULL);
+}
+
+static librdf_stream *sharded_storage_find_statements_in_context(librdf_storage * storage,
+                                                                 librdf_statement * statement,
+                                                                 librdf_node * context)
+{
+  return librdf_storage_find_statements_in_context(sharded_storage_get_shard(storage, context),
+                                                   statement, context);
+}
+
+static librdf_stream *sharded_storage_context_serialise(librdf_storage * storage,
+                                                        librdf_node * context)
+{
+  return librdf_storage_context_as_stream(sharded_storage_get_shard(storage, context), context);
+}
+
+// Each graph is only in one shard, so the lists of graphs don't overlap
+static librdf_iterator *sharded_storage_get_contexts(librdf_storage * storage)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  sharded_cursor_t *cursor = sharded_cursor_new(instance, 0);
+  librdf_iterator *iterator = NULL;
+  int i;
+
+  if (!cursor)
+    return NULL;
+
+  for (i = 0; i < instance->count; i++) {
+    cursor->iterators[i] = librdf_storage_get_contexts(instance->shards[i]);
+    if (!cursor->iterators[i]) {
+      sharded_cursor_finished(cursor);
+      return NULL;
+    }
+  }
+  sharded_cursor_skip_ended(cursor);
+
+  iterator = librdf_new_iterator(librdf_storage_get_world(storage), cursor,
+                                 sharded_cursor_is_end, sharded_cursor_next,
+                                 sharded_iterator_get, sharded_cursor_finished);
+  if (!iterator)
+    sharded_cursor_finished(cursor);
+
+  return iterator;
+}
+
+static int sharded_storage_sync(librdf_storage * storage)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  int i, err = 0;
+
+  for (i = 0; i < instance->count; i++)
+    err |= librdf_storage_sync(instance->shards[i]);
+
+  return err;
+}
+
+// A transaction is started in every shard; it is committed in each shard
+// in turn, so a failure part of the way through can leave some committed.
+static int sharded_storage_transaction_start(librdf_storage * storage)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  int i;
+
+  for (i = 0; i < instance->count; i++) {
+    if (librdf_storage_transaction_start(instance->shards[i])) {
+      while (--i >= 0)
+        librdf_storage_transaction_rollback(instance->shards[i]);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int sharded_storage_transaction_commit(librdf_storage * storage)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  int i, err = 0;
+
+  for (i = 0; i < instance->count; i++)
+    err |= librdf_storage_transaction_commit(instance->shards[i]);
+
+  return err;
+}
+
+static int sharded_storage_transaction_rollback(librdf_storage * storage)
+{
+  sharded_storage_t *instance = (sharded_storage_t *) librdf_storage_get_instance(storage);
+  int i, err = 0;
+
+  for (i = 0; i < instance->count; i++)
+    err |= librdf_storage_transaction_rollback(instance->shards[i]);
+
+  return err;
+}
+
+static librdf_node *sharded_storage_get_feature(librdf_storage * storage, librdf_uri * feature)
+{
+  const char *uri = NULL;
+
+  if (!feature)
+    return NULL;
+
+  uri = (const char *) librdf_uri_as_string(feature);
+  if (uri && strcmp(uri, LIBRDF_MODEL_FEATURE_CONTEXTS) == 0) {
+    return librdf_new_node_from_typed_literal(librdf_storage_get_world(storage),
+                                              (const unsigned char *) "1", NULL, NULL);
+  }
+
+  return NULL;
+}
+
+static void sharded_storage_register_factory(librdf_storage_factory * factory)
+{
+  factory->version = LIBRDF_STORAGE_INTERFACE_VERSION;
+  factory->init = sharded_storage_init;
+  factory->terminate = sharded_storage_terminate;
+  factory->open = sharded_storage_open;
+  factory->close = sharded_storage_close;
+  factory->size = sharded_storage_size;
+  factory->add_statement = sharded_storage_add_statement;
+  factory->add_statements = sharded_storage_add_statements;
+  factory->remove_statement = sharded_storage_remove_statement;
+  factory->contains_statement = sharded_storage_contains_statement;
+  factory->serialise = sharded_storage_serialise;
+  factory->find_statements = sharded_storage_find_statements;
+  factory->context_add_statement = sharded_storage_context_add_statement;
+  factory->context_remove_statement = sharded_storage_context_remove_statement;
+  factory->context_remove_statements = sharded_storage_context_remove_statements;
+  factory->context_serialise = sharded_storage_context_serialise;
+  factory->find_statements_in_context = sharded_storage_find_statements_in_context;
+  factory->get_contexts = sharded_storage_get_contexts;
+  factory->sync = sharded_storage_sync;
+  factory->transaction_start = sharded_storage_transaction_start;
+  factory->transaction_commit = sharded_storage_transaction_commit;
+  factory->transaction_rollback = sharded_storage_transaction_rollback;
+  factory->get_feature = sharded_storage_get_feature;
+}
+
+// Register the 'sharded' storage module with librdf
+int sharded_storage_register(librdf_world * world)
+{
+  return librdf_storage_register_factory(world, "sharded", "Graphs partitioned between storages",
+                                         sharded_storage_register_factory);
+}
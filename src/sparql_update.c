@@ -0,0 +1,1026 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "redstore.h"
+
+
+// SPARQL 1.1 Update. rasqal parses the request into operations, but
+// doesn't execute them, so the operations are applied here. The WHERE
+// clause of an operation is evaluated by running its parsed graph pattern
+// as a SELECT query.
+
+typedef struct quad_list_s {
+  librdf_statement **statements;
+  librdf_node **graphs;
+  int count;
+  int size;
+} quad_list_t;
+
+typedef struct update_context_s {
+  const char *base_uri;
+  char *bnode_prefix;
+  quad_list_t deletes;
+  quad_list_t inserts;
+  const char *error;
+  int unsupported;
+} update_context_t;
+
+
+static int quad_list_add(quad_list_t * list, librdf_statement * statement, librdf_node * graph)
+{
+  if (list->count == list->size) {
+    int size = list->size ? list->size * 2 : 64;
+    librdf_statement **statements = realloc(list->statements, size * sizeof(librdf_statement *));
+    librdf_node **graphs = NULL;
+    if (!statements)
+      return 1;
+    list->statements = statements;
+    graphs = realloc(list->graphs, size * sizeof(librdf_node *));
+    if (!graphs)
+      return 1;
+    list->graphs = graphs;
+    list->size = size;
+  }
+
+  list->statements[list->count] = statement;
+  list->graphs[list->count] = graph;
+  list->count++;
+
+  return 0;
+}
+
+static void quad_list_clear(quad_list_t * list)
+{
+  int i;
+
+  for (i = 0; i < list->count; i++) {
+    librdf_free_statement(list->statements[i]);
+    if (list->graphs[i])
+      librdf_free_node(list->graphs[i]);
+  }
+  list->count = 0;
+}
+
+static void quad_list_free(quad_list_t * list)
+{
+  quad_list_clear(list);
+  if (list->statements)
+    free(list->statements);
+  if (list->graphs)
+    free(list->graphs);
+  list->statements = NULL;
+  list->graphs = NULL;
+  list->size = 0;
+}
+
+
+static librdf_node *new_node_from_raptor_uri(raptor_uri * uri)
+{
+  if (!uri)
+    return NULL;
+  return librdf_new_node_from_uri_string(world, raptor_uri_as_string(uri));
+}
+
+// Creates a librdf node from a term in a template. Variables are looked up in
+// the current row of results and blank nodes are made unique to the row.
+static librdf_node *new_node_from_literal(update_context_t * context, rasqal_literal * literal,
+                                          librdf_query_results * results, int row)
+{
+  librdf_node *node = NULL;
+
+  switch (literal->type) {
+  case RASQAL_LITERAL_VARIABLE:
+    if (results) {
+      rasqal_variable *variable = rasqal_literal_as_variable(literal);
+      node = librdf_query_results_get_binding_value_by_name(results, (const char *) variable->name);
+    }
+    break;
+
+  case RASQAL_LITERAL_URI:
+    node = new_node_from_raptor_uri(literal->value.uri);
+    break;
+
+  case RASQAL_LITERAL_BLANK: {
+    size_t len = strlen(context->bnode_prefix) + strlen((const char *) literal->string) + 16;
+    char *id = malloc(len);
+    if (id) {
+      snprintf(id, len, "%s%s_%d", context->bnode_prefix, literal->string, row);
+      node = librdf_new_node_from_blank_identifier(world, (unsigned char *) id);
+      free(id);
+    }
+    break;
+  }
+
+  default: {
+    raptor_uri *datatype = rasqal_literal_datatype(literal);
+    librdf_uri *datatype_uri = NULL;
+    if (datatype)
+      datatype_uri = librdf_new_uri(world, raptor_uri_as_string(datatype));
+    node = librdf_new_node_from_typed_literal(world, literal->string, literal->language, datatype_uri);
+    if (datatype_uri)
+      librdf_free_uri(datatype_uri);
+    break;
+  }
+  }
+
+  return node;
+}
+
+// Turns templates into statements, using a row of results if there is one.
+// Templates with unbound variables or invalid terms are skipped.
+static int instantiate_templates(update_context_t * context, raptor_sequence * templates,
+                                 raptor_uri * with_uri, librdf_query_results * results,
+                                 int row, quad_list_t * list)
+{
+  int i, size = templates ? raptor_sequence_size(templates) : 0;
+
+  for (i = 0; i < size; i++) {
+    rasqal_triple *triple = (rasqal_triple *) raptor_sequence_get_at(templates, i);
+    librdf_node *subject = new_node_from_literal(context, triple->subject, results, row);
+    librdf_node *predicate = new_node_from_literal(context, triple->predicate, results, row);
+    librdf_node *object = new_node_from_literal(context, triple->object, results, row);
+    librdf_node *graph = NULL;
+    librdf_statement *statement = NULL;
+
+    if (triple->origin) {
+      graph = new_node_from_literal(context, triple->origin, results, row);
+    } else {
+      graph = new_node_from_raptor_uri(with_uri);
+    }
+
+    if (!subject || !predicate || !object ||
+        librdf_node_is_literal(subject) || !librdf_node_is_resource(predicate) ||
+        (graph && !librdf_node_is_resource(graph)) || ((triple->origin || with_uri) && !graph)) {
+      if (subject)
+        librdf_free_node(subject);
+      if (predicate)
+        librdf_free_node(predicate);
+      if (object)
+        librdf_free_node(object);
+      if (graph)
+        librdf_free_node(graph);
+      continue;
+    }
+
+    statement = librdf_new_statement_from_nodes(world, subject, predicate, object);
+    if (!statement || quad_list_add(list, statement, graph)) {
+      context->error = "Failed to create statement from template.";
+      if (statement)
+        librdf_free_statement(statement);
+      if (graph)
+        librdf_free_node(graph);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int apply_quad_lists(update_context_t * context)
+{
+  int i, removed = 0, err = 0;
+
+  for (i = 0; i < context->deletes.count; i++) {
+    librdf_node *graph = context->deletes.graphs[i];
+    // Deleting a statement that isn't in the store is not an error
+    if (store_remove_statement(graph, context->deletes.statements[i]) == 0)
+      removed++;
+  }
+
+  for (i = 0; i < context->inserts.count; i++) {
+    if (store_add_statement(context->inserts.graphs[i], context->inserts.statements[i]) < 0)
+      err++;
+  }
+
+  redstore_debug("Removed %d of %d statements", removed, context->deletes.count);
+
+  quad_list_clear(&context->deletes);
+  quad_list_clear(&context->inserts);
+
+  if (err)
+    context->error = "Failed to apply changes to the store.";
+
+  return err;
+}
+
+// The WHERE clause of an operation is written back out as a SELECT query,
+// from the graph pattern that rasqal has already parsed. The prefixes and
+// base URI have been expanded by the parser, so no prologue is needed.
+// These return non-zero if the pattern uses something that isn't supported.
+
+static void append_string(raptor_stringbuffer * sb, const char *str)
+{
+  raptor_stringbuffer_append_string(sb, (const unsigned char *) str, 1);
+}
+
+static void append_quoted_string(raptor_stringbuffer * sb, const unsigned char *str)
+{
+  append_string(sb, "\"");
+  for (; *str; str++) {
+    switch (*str) {
+    case '"':
+      append_string(sb, "\\\"");
+      break;
+    case '\\':
+      append_string(sb, "\\\\");
+      break;
+    case '\n':
+      append_string(sb, "\\n");
+      break;
+    case '\r':
+      append_string(sb, "\\r");
+      break;
+    case '\t':
+      append_string(sb, "\\t");
+      break;
+    default:
+      raptor_stringbuffer_append_counted_string(sb, str, 1, 1);
+      break;
+    }
+  }
+  append_string(sb, "\"");
+}
+
+static int write_literal(raptor_stringbuffer * sb, rasqal_literal * literal)
+{
+  switch (literal->type) {
+  case RASQAL_LITERAL_VARIABLE: {
+    rasqal_variable *variable = rasqal_literal_as_variable(literal);
+    const unsigned char *name = variable->name;
+    if (variable->type == RASQAL_VARIABLE_TYPE_ANONYMOUS) {
+      // Blank nodes in the pattern; their names aren't valid variable names
+      append_string(sb, "?_anon_");
+      for (; *name; name++) {
+        if (isalnum(*name))
+          raptor_stringbuffer_append_counted_string(sb, name, 1, 1);
+      }
+    } else {
+      append_string(sb, "?");
+      append_string(sb, (const char *) name);
+    }
+    break;
+  }
+
+  case RASQAL_LITERAL_URI:
+    append_string(sb, "<");
+    append_string(sb, (const char *) raptor_uri_as_string(literal->value.uri));
+    append_string(sb, ">");
+    break;
+
+  case RASQAL_LITERAL_BLANK:
+    append_string(sb, "_:");
+    append_string(sb, (const char *) literal->string);
+    break;
+
+  case RASQAL_LITERAL_UNKNOWN:
+  case RASQAL_LITERAL_QNAME:
+    return 1;
+
+  default: {
+    raptor_uri *datatype = rasqal_literal_datatype(literal);
+    append_quoted_string(sb, literal->string);
+    if (literal->language) {
+      append_string(sb, "@");
+      append_string(sb, literal->language);
+    } else if (datatype) {
+      append_string(sb, "^^<");
+      append_string(sb, (const char *) raptor_uri_as_string(datatype));
+      append_string(sb, ">");
+    }
+    break;
+  }
+  }
+
+  return 0;
+}
+
+static int write_expression(raptor_stringbuffer * sb, rasqal_expression * e);
+
+static int write_expression_list(raptor_stringbuffer * sb, raptor_sequence * args)
+{
+  int i, size = args ? raptor_sequence_size(args) : 0;
+
+  append_string(sb, "(");
+  for (i = 0; i < size; i++) {
+    if (i)
+      append_string(sb, ", ");
+    if (write_expression(sb, (rasqal_expression *) raptor_sequence_get_at(args, i)))
+      return 1;
+  }
+  append_string(sb, ")");
+
+  return 0;
+}
+
+static int write_expression(raptor_stringbuffer * sb, rasqal_expression * e)
+{
+  const char *infix = NULL, *call = NULL;
+  int err = 0;
+
+  switch (e->op) {
+  case RASQAL_EXPR_AND: infix = " && "; break;
+  case RASQAL_EXPR_OR: infix = " || "; break;
+  case RASQAL_EXPR_EQ: infix = " = "; break;
+  case RASQAL_EXPR_NEQ: infix = " != "; break;
+  case RASQAL_EXPR_LT: infix = " < "; break;
+  case RASQAL_EXPR_GT: infix = " > "; break;
+  case RASQAL_EXPR_LE: infix = " <= "; break;
+  case RASQAL_EXPR_GE: infix = " >= "; break;
+  case RASQAL_EXPR_PLUS: infix = " + "; break;
+  case RASQAL_EXPR_MINUS: infix = " - "; break;
+  case RASQAL_EXPR_STAR: infix = " * "; break;
+  case RASQAL_EXPR_SLASH: infix = " / "; break;
+  case RASQAL_EXPR_BOUND: call = "BOUND"; break;
+  case RASQAL_EXPR_STR: call = "STR"; break;
+  case RASQAL_EXPR_LANG: call = "LANG"; break;
+  case RASQAL_EXPR_DATATYPE: call = "DATATYPE"; break;
+  case RASQAL_EXPR_ISURI: call = "isIRI"; break;
+  case RASQAL_EXPR_ISBLANK: call = "isBLANK"; break;
+  case RASQAL_EXPR_ISLITERAL: call = "isLITERAL"; break;
+  case RASQAL_EXPR_LANGMATCHES: call = "LANGMATCHES"; break;
+  case RASQAL_EXPR_SAMETERM: call = "sameTerm"; break;
+  case RASQAL_EXPR_REGEX: call = "REGEX"; break;
+
+  case RASQAL_EXPR_LITERAL:
+    return write_literal(sb, e->literal);
+
+  case RASQAL_EXPR_UMINUS:
+  case RASQAL_EXPR_BANG:
+    append_string(sb, e->op == RASQAL_EXPR_BANG ? "!(" : "-(");
+    err = write_expression(sb, e->arg1);
+    append_string(sb, ")");
+    return err;
+
+  case RASQAL_EXPR_FUNCTION:
+    append_string(sb, "<");
+    append_string(sb, (const char *) raptor_uri_as_string(e->name));
+    append_string(sb, ">");
+    return write_expression_list(sb, e->args);
+
+  case RASQAL_EXPR_IN:
+  case RASQAL_EXPR_NOT_IN:
+    append_string(sb, "(");
+    err = write_expression(sb, e->arg1);
+    append_string(sb, e->op == RASQAL_EXPR_IN ? " IN " : " NOT IN ");
+    if (!err)
+      err = write_expression_list(sb, e->args);
+    append_string(sb, ")");
+    return err;
+
+  default:
+    return 1;
+  }
+
+  if (infix) {
+    append_string(sb, "(");
+    err = write_expression(sb, e->arg1);
+    append_string(sb, infix);
+    if (!err)
+      err = write_expression(sb, e->arg2);
+    append_string(sb, ")");
+  } else {
+    append_string(sb, call);
+    append_string(sb, "(");
+    err = write_expression(sb, e->arg1);
+    if (!err && e->arg2) {
+      append_string(sb, ", ");
+      err = write_expression(sb, e->arg2);
+    }
+    if (!err && e->arg3) {
+      append_string(sb, ", ");
+      err = write_expression(sb, e->arg3);
+    }
+    append_string(sb, ")");
+  }
+
+  return err;
+}
+
+static int write_graph_pattern(raptor_stringbuffer * sb, rasqal_graph_pattern * gp);
+
+// Writes the sub-patterns of a pattern inside a group, joined by 'separator'
+static int write_sub_graph_patterns(raptor_stringbuffer * sb, rasqal_graph_pattern * gp,
+                                    const char *separator)
+{
+  rasqal_graph_pattern *sgp = NULL;
+  int i;
+
+  append_string(sb, "{ ");
+  for (i = 0; (sgp = rasqal_graph_pattern_get_sub_graph_pattern(gp, i)); i++) {
+    if (i && separator)
+      append_string(sb, separator);
+    if (write_graph_pattern(sb, sgp))
+      return 1;
+  }
+  append_string(sb, "} ");
+
+  return 0;
+}
+
+static int write_graph_pattern(raptor_stringbuffer * sb, rasqal_graph_pattern * gp)
+{
+  rasqal_triple *triple = NULL;
+  rasqal_expression *filter = NULL;
+  int i;
+
+  switch (rasqal_graph_pattern_get_operator(gp)) {
+  case RASQAL_GRAPH_PATTERN_OPERATOR_BASIC:
+    for (i = 0; (triple = rasqal_graph_pattern_get_triple(gp, i)); i++) {
+      if (write_literal(sb, triple->subject))
+        return 1;
+      append_string(sb, " ");
+      if (write_literal(sb, triple->predicate))
+        return 1;
+      append_string(sb, " ");
+      if (write_literal(sb, triple->object))
+        return 1;
+      append_string(sb, " . ");
+    }
+    return 0;
+
+  case RASQAL_GRAPH_PATTERN_OPERATOR_GROUP:
+    return write_sub_graph_patterns(sb, gp, NULL);
+
+  case RASQAL_GRAPH_PATTERN_OPERATOR_OPTIONAL:
+    append_string(sb, "OPTIONAL ");
+    return write_sub_graph_patterns(sb, gp, NULL);
+
+  case RASQAL_GRAPH_PATTERN_OPERATOR_MINUS:
+    append_string(sb, "MINUS ");
+    return write_sub_graph_patterns(sb, gp, NULL);
+
+  case RASQAL_GRAPH_PATTERN_OPERATOR_UNION:
+    return write_sub_graph_patterns(sb, gp, "UNION ");
+
+  case RASQAL_GRAPH_PATTERN_OPERATOR_GRAPH:
+    append_string(sb, "GRAPH ");
+    if (write_literal(sb, rasqal_graph_pattern_get_origin(gp)))
+      return 1;
+    append_string(sb, " ");
+    return write_sub_graph_patterns(sb, gp, NULL);
+
+  case RASQAL_GRAPH_PATTERN_OPERATOR_FILTER:
+    filter = rasqal_graph_pattern_get_filter_expression(gp);
+    if (!filter)
+      return 1;
+    append_string(sb, "FILTER (");
+    if (write_expression(sb, filter))
+      return 1;
+    append_string(sb, ") ");
+    return 0;
+
+  default:
+    return 1;
+  }
+}
+
+// Creates a SELECT query that finds the solutions to the WHERE clause of an
+// operation. If the operation has a WITH clause, it is the default graph.
+static char *new_where_query(rasqal_update_operation * operation)
+{
+  raptor_stringbuffer *sb = raptor_new_stringbuffer();
+  char *where_query = NULL;
+  int err = 0;
+
+  if (!sb)
+    return NULL;
+
+  append_string(sb, "SELECT * WHERE { ");
+  if (operation->graph_uri) {
+    append_string(sb, "GRAPH <");
+    append_string(sb, (const char *) raptor_uri_as_string(operation->graph_uri));
+    append_string(sb, "> { ");
+  }
+  err = write_graph_pattern(sb, operation->where);
+  if (operation->graph_uri)
+    append_string(sb, "} ");
+  append_string(sb, "}");
+
+  if (!err) {
+    where_query = malloc(raptor_stringbuffer_length(sb) + 1);
+    if (where_query)
+      strcpy(where_query, (const char *) raptor_stringbuffer_as_string(sb));
+  }
+
+  raptor_free_stringbuffer(sb);
+
+  return where_query;
+}
+
+static int perform_modify(update_context_t * context, rasqal_update_operation * operation)
+{
+  librdf_query_results *results = NULL;
+  librdf_query *query = NULL;
+  librdf_uri *base_uri = NULL;
+  char *where_query = NULL;
+  int row, err = 0;
+
+  if (!operation->where) {
+    // INSERT DATA and DELETE DATA
+    if (instantiate_templates(context, operation->delete_templates, operation->graph_uri, NULL, -1,
+                              &context->deletes) ||
+        instantiate_templates(context, operation->insert_templates, operation->graph_uri, NULL, -1,
+                              &context->inserts))
+      return 1;
+    return apply_quad_lists(context);
+  }
+
+  where_query = new_where_query(operation);
+  if (!where_query) {
+    context->error = "The WHERE clause uses a feature that is not supported.";
+    context->unsupported = 1;
+    return 1;
+  }
+
+  redstore_debug("where_query='%s'", where_query);
+
+  base_uri = librdf_new_uri(world, (const unsigned char *) context->base_uri);
+  query = librdf_new_query(world, "sparql", NULL, (const unsigned char *) where_query, base_uri);
+  if (!query) {
+    context->error = "There was an error while creating the query for the WHERE clause.";
+    err = 1;
+    goto CLEANUP;
+  }
+
+  results = librdf_model_query_execute(model, query);
+  if (!results) {
+    context->error = "There was an error while executing the WHERE clause.";
+    err = 1;
+    goto CLEANUP;
+  }
+
+  // All the solutions are found before the store is changed
+  for (row = 0; !librdf_query_results_finished(results); row++) {
+    if (instantiate_templates(context, operation->delete_templates, operation->graph_uri, results,
+                              row, &context->deletes) ||
+        instantiate_templates(context, operation->insert_templates, operation->graph_uri, results,
+                              row, &context->inserts)) {
+      err = 1;
+      goto CLEANUP;
+    }
+    librdf_query_results_next(results);
+  }
+
+  librdf_free_query_results(results);
+  results = NULL;
+
+  err = apply_quad_lists(context);
+
+CLEANUP:
+  if (results)
+    librdf_free_query_results(results);
+  if (query)
+    librdf_free_query(query);
+  if (base_uri)
+    librdf_free_uri(base_uri);
+  if (where_query)
+    free(where_query);
+
+  return err;
+}
+
+// Removes every named graph in the store
+static int clear_named_graphs(void)
+{
+  raptor_avltree_iterator *iterator = NULL;
+  quad_list_t graphs;
+  int i, err = 0;
+
+  memset(&graphs, 0, sizeof(graphs));
+
+  // Copy the list first, because removing a graph changes the table
+  iterator = stats_new_graph_iterator();
+  while (iterator && !raptor_avltree_iterator_is_end(iterator)) {
+    graph_stats_t *gs = (graph_stats_t *) raptor_avltree_iterator_get(iterator);
+    if (gs) {
+      librdf_node *graph = stats_new_graph_node(gs);
+      if (!graph || quad_list_add(&graphs, NULL, graph)) {
+        err++;
+        break;
+      }
+    }
+    raptor_avltree_iterator_next(iterator);
+  }
+  if (iterator)
+    raptor_free_avltree_iterator(iterator);
+
+  for (i = 0; i < graphs.count; i++) {
+    if (store_remove_graph(graphs.graphs[i]))
+      err++;
+    librdf_free_node(graphs.graphs[i]);
+  }
+  if (graphs.statements)
+    free(graphs.statements);
+  if (graphs.graphs)
+    free(graphs.graphs);
+
+  return err;
+}
+
+static int perform_clear(update_context_t * context, rasqal_update_operation * operation)
+{
+  int silent = (operation->flags & RASQAL_UPDATE_FLAGS_SILENT);
+  librdf_node *graph = NULL;
+  int err = 0;
+
+  switch (operation->applies) {
+  case RASQAL_UPDATE_GRAPH_ONE:
+    graph = new_node_from_raptor_uri(operation->graph_uri);
+    if (!graph) {
+      context->error = "Failed to create node for graph.";
+      return 1;
+    }
+    if (!stats_get_graph_size(graph)) {
+      if (!silent) {
+        context->error = "Graph not found.";
+        err = 1;
+      }
+    } else if (store_remove_graph(graph)) {
+      err = 1;
+    }
+    librdf_free_node(graph);
+    break;
+  case RASQAL_UPDATE_GRAPH_DEFAULT:
+    err = store_remove_graph(NULL);
+    break;
+  case RASQAL_UPDATE_GRAPH_NAMED:
+    err = clear_named_graphs();
+    break;
+  case RASQAL_UPDATE_GRAPH_ALL:
+    err = store_remove_all();
+    break;
+  }
+
+  if (err && !context->error)
+    context->error = "Error while trying to delete graph.";
+
+  return silent ? 0 : err;
+}
+
+static int perform_create(update_context_t * context, rasqal_update_operation * operation)
+{
+  librdf_node *graph = new_node_from_raptor_uri(operation->graph_uri);
+  int err = 0;
+
+  if (!graph) {
+    context->error = "Failed to create node for graph.";
+    return 1;
+  }
+
+  // Graphs without any statements don't exist in a quad store, so there is nothing to create
+  if (stats_get_graph_size(graph) && !(operation->flags & RASQAL_UPDATE_FLAGS_SILENT)) {
+    context->error = "Graph already exists.";
+    err = 1;
+  }
+
+  librdf_free_node(graph);
+
+  return err;
+}
+
+static int perform_load(update_context_t * context, rasqal_update_operation * operation)
+{
+  librdf_uri *uri = NULL;
+  librdf_parser *parser = NULL;
+  librdf_stream *stream = NULL;
+  librdf_node *graph = NULL;
+  int err = 0;
+
+  uri = librdf_new_uri(world, raptor_uri_as_string(operation->document_uri));
+  if (!uri) {
+    context->error = "librdf_new_uri failed for URI";
+    err = 1;
+    goto CLEANUP;
+  }
+
+  if (operation->graph_uri) {
+    graph = new_node_from_raptor_uri(operation->graph_uri);
+    if (!graph) {
+      context->error = "Failed to create node for graph.";
+      err = 1;
+      goto CLEANUP;
+    }
+  }
+
+  redstore_info("Loading URI: %s", librdf_uri_as_string(uri));
+
+  parser = librdf_new_parser(world, "guess", NULL, NULL);
+  if (!parser) {
+    context->error = "Failed to create parser";
+    err = 1;
+    goto CLEANUP;
+  }
+
+  stream = librdf_parser_parse_as_stream(parser, uri, uri);
+  if (!stream) {
+    context->error = "Failed to parse RDF as stream.";
+    err = 1;
+    goto CLEANUP;
+  }
+
+  if (store_add_stream(graph, stream, NULL)) {
+    context->error = "Failed to add triples to graph.";
+    err = 1;
+  }
+
+CLEANUP:
+  if (stream)
+    librdf_free_stream(stream);
+  if (parser)
+    librdf_free_parser(parser);
+  if (graph)
+    librdf_free_node(graph);
+  if (uri)
+    librdf_free_uri(uri);
+
+  if (operation->flags & RASQAL_UPDATE_FLAGS_SILENT)
+    return 0;
+
+  return err;
+}
+
+// ADD, MOVE and COPY: graph_uri is the source and document_uri the destination
+static int perform_transfer(update_context_t * context, rasqal_update_operation * operation)
+{
+  librdf_node *source = new_node_from_raptor_uri(operation->graph_uri);
+  librdf_node *destination = new_node_from_raptor_uri(operation->document_uri);
+  librdf_stream *stream = NULL;
+  int err = 0;
+
+  if ((operation->graph_uri && !source) || (operation->document_uri && !destination)) {
+    context->error = "Failed to create node for graph.";
+    err = 1;
+    goto CLEANUP;
+  }
+
+  // Nothing to do if the source and destination are the same graph
+  if ((!source && !destination) || (source && destination && librdf_node_equals(source, destination)))
+    goto CLEANUP;
+
+  if (source && !stats_get_graph_size(source)) {
+    if (!(operation->flags & RASQAL_UPDATE_FLAGS_SILENT)) {
+      context->error = "Graph not found.";
+      err = 1;
+    }
+    goto CLEANUP;
+  }
+
+  // Take a copy of the source first, because the store is changed while it is read
+  if (source) {
+    stream = librdf_model_context_as_stream(model, source);
+    while (stream && !librdf_stream_end(stream)) {
+      librdf_statement *statement = librdf_new_statement_from_statement(librdf_stream_get_object(stream));
+      librdf_node *graph = destination ? librdf_new_node_from_node(destination) : NULL;
+      if (!statement || quad_list_add(&context->inserts, statement, graph)) {
+        err = 1;
+        break;
+      }
+      librdf_stream_next(stream);
+    }
+  } else {
+    stream = librdf_model_as_stream(model);
+    while (stream && !librdf_stream_end(stream)) {
+      if (librdf_stream_get_context2(stream) == NULL) {
+        librdf_statement *statement =
+            librdf_new_statement_from_statement(librdf_stream_get_object(stream));
+        librdf_node *graph = librdf_new_node_from_node(destination);
+        if (!statement || quad_list_add(&context->inserts, statement, graph)) {
+          err = 1;
+          break;
+        }
+      }
+      librdf_stream_next(stream);
+    }
+  }
+  if (!stream || err) {
+    context->error = "Failed to read source graph.";
+    err = 1;
+    goto CLEANUP;
+  }
+
+  if (operation->type != RASQAL_UPDATE_TYPE_ADD) {
+    if (store_remove_graph(destination)) {
+      context->error = "Error while trying to clear destination graph.";
+      err = 1;
+      goto CLEANUP;
+    }
+  }
+
+  err = apply_quad_lists(context);
+
+  if (!err && operation->type == RASQAL_UPDATE_TYPE_MOVE) {
+    if (store_remove_graph(source)) {
+      context->error = "Error while trying to delete source graph.";
+      err = 1;
+    }
+  }
+
+CLEANUP:
+  quad_list_clear(&context->inserts);
+  if (stream)
+    librdf_free_stream(stream);
+  if (source)
+    librdf_free_node(source);
+  if (destination)
+    librdf_free_node(destination);
+
+  return err;
+}
+
+static int perform_operation(update_context_t * context, rasqal_update_operation * operation)
+{
+  switch (operation->type) {
+  case RASQAL_UPDATE_TYPE_UPDATE:
+    return perform_modify(context, operation);
+  case RASQAL_UPDATE_TYPE_CLEAR:
+  case RASQAL_UPDATE_TYPE_DROP:
+    return perform_clear(context, operation);
+  case RASQAL_UPDATE_TYPE_CREATE:
+    return perform_create(context, operation);
+  case RASQAL_UPDATE_TYPE_LOAD:
+    return perform_load(context, operation);
+  case RASQAL_UPDATE_TYPE_ADD:
+  case RASQAL_UPDATE_TYPE_MOVE:
+  case RASQAL_UPDATE_TYPE_COPY:
+    return perform_transfer(context, operation);
+  default:
+    context->error = "Unsupported update operation.";
+    return 1;
+  }
+}
+
+
+redhttp_response_t *perform_update(redhttp_request_t * request, const char *update_string)
+{
+  rasqal_world *rasqal = librdf_world_get_rasqal(world);
+  raptor_world *raptor = librdf_world_get_raptor(world);
+  redhttp_response_t *response = NULL;
+  rasqal_query *query = NULL;
+  raptor_uri *base_uri = NULL;
+  raptor_sequence *operations = NULL;
+  update_context_t context;
+  int count = 0, err = 0, transaction = 0, i;
+
+  memset(&context, 0, sizeof(context));
+  context.base_uri = redhttp_request_get_url(request);
+
+  redstore_debug("update_string='%s'", update_string);
+
+  query = rasqal_new_query(rasqal, DEFAULT_UPDATE_LANGUAGE, NULL);
+  base_uri = raptor_new_uri(raptor, (const unsigned char *) context.base_uri);
+  if (!query || !base_uri) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
+      "There was an error while creating the update."
+    );
+    goto CLEANUP;
+  }
+
+  if (rasqal_query_prepare(query, (const unsigned char *) update_string, base_uri)) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_BAD_REQUEST, "Failed to parse the update."
+    );
+    goto CLEANUP;
+  }
+
+  operations = rasqal_query_get_update_operations_sequence(query);
+  count = operations ? raptor_sequence_size(operations) : 0;
+  if (count == 0) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_OK, "No update operations to perform."
+    );
+    goto CLEANUP;
+  }
+
+  // rasqal records the graphs of USING clauses as the data graphs of the query
+  if (rasqal_query_get_data_graph(query, 0)) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_NOT_IMPLEMENTED, "USING clauses are not supported."
+    );
+    goto CLEANUP;
+  }
+
+  context.bnode_prefix = redstore_genid();
+  if (!context.bnode_prefix) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
+      "Failed to allocate memory for the update."
+    );
+    goto CLEANUP;
+  }
+
+  // Apply all the operations in a single transaction, and a single write to the log
+  store_batch_start();
+  transaction = (store_transaction_start() == 0);
+
+  for (i = 0; i < count; i++) {
+    rasqal_update_operation *operation = rasqal_query_get_update_operation(query, i);
+    if (!operation)
+      break;
+
+    err = perform_operation(&context, operation);
+    if (err)
+      break;
+  }
+
+  if (err) {
+    int status = context.unsupported ? REDHTTP_NOT_IMPLEMENTED : REDHTTP_INTERNAL_SERVER_ERROR;
+    if (transaction && store_transaction_rollback() == 0) {
+      store_batch_end();
+      response = redstore_page_new_with_message(
+        request, LIBRDF_LOG_INFO, status,
+        "%s No changes were made.", context.error ? context.error : "Error while performing update."
+      );
+    } else {
+      store_batch_end();
+      response = redstore_page_new_with_message(
+        request, LIBRDF_LOG_INFO, status,
+        "%s The update was only partially applied.",
+        context.error ? context.error : "Error while performing update."
+      );
+    }
+  } else if (transaction && store_transaction_commit()) {
+    store_batch_end();
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to commit the update."
+    );
+  } else if (store_batch_end()) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
+      "The update was applied, but could not be written to the log."
+    );
+  } else {
+    import_count++;
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_OK, "Successfully performed %d update operations.", count
+    );
+  }
+
+CLEANUP:
+  quad_list_free(&context.deletes);
+  quad_list_free(&context.inserts);
+  if (context.bnode_prefix)
+    free(context.bnode_prefix);
+  if (base_uri)
+    raptor_free_uri(base_uri);
+  if (query)
+    rasqal_free_query(query);
+
+  return response;
+}
+
+int redstore_is_sparql_update_request(redhttp_request_t * request)
+{
+  const char *content_type = redhttp_request_get_header(request, "Content-Type");
+  return (content_type && strncmp(content_type, "application/sparql-update", 25) == 0);
+}
+
+redhttp_response_t *handle_update(redhttp_request_t * request, void *user_data)
+{
+  const char *update_string = redhttp_request_get_argument(request, "update");
+  redhttp_response_t *response = NULL;
+  unsigned char *buffer = NULL;
+  size_t length = 0;
+
+  if (!update_string && redstore_is_sparql_update_request(request)) {
+    response = read_request_body(request, &buffer, &length);
+    if (response)
+      return response;
+    update_string = (const char *) buffer;
+  }
+
+  if (update_string) {
+    response = perform_update(request, update_string);
+  } else {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "Missing update string."
+    );
+  }
+
+  if (buffer)
+    free(buffer);
+
+  return response;
+}
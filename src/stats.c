@@ -0,0 +1,606 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "redstore.h"
+
+
+// Statement counts, maintained by the write paths in store.c so that
+// the description page and COUNT queries don't have to scan the store.
+// The table of graphs is also the index of which named graphs exist.
+// Graphs are keyed by their URI, or by "_:" and the identifier of a blank node.
+//
+// While a transaction is open, every change to the counts is also kept
+// in a journal, so that the counts can be put back if it is rolled back.
+
+static raptor_avltree *graph_stats = NULL;
+static unsigned long default_graph_count = 0;
+static unsigned long named_graphs_count = 0;
+
+// Time of the last change to anything in the store
+static time_t store_modified = 0;
+
+// Bloom filter of the statements in the default graph, if it has been built
+static bloom_t *default_graph_filter = NULL;
+
+// True if the filters were built when the store was counted
+static int filters_enabled = 0;
+
+// Changes to the counts of one graph (NULL key for the default graph)
+typedef struct stats_change_s {
+  char *key;
+  int blank;
+  long delta;
+} stats_change_t;
+
+static stats_change_t *journal = NULL;
+static size_t journal_count = 0;
+static size_t journal_size = 0;
+static int journal_enabled = 0;
+
+// The counts for a store other than the one in use; see stats_swap()
+struct stats_state_s {
+  raptor_avltree *graph_stats;
+  unsigned long default_graph_count;
+  unsigned long named_graphs_count;
+  time_t store_modified;
+  bloom_t *default_graph_filter;
+  int filters_enabled;
+};
+
+
+static int graph_stats_compare(const void *a, const void *b)
+{
+  const graph_stats_t *ga = (const graph_stats_t *) a;
+  const graph_stats_t *gb = (const graph_stats_t *) b;
+  return strcmp(ga->uri, gb->uri);
+}
+
+static void graph_stats_free(void *data)
+{
+  graph_stats_t *gs = (graph_stats_t *) data;
+  bloom_free(gs->filter);
+  free(gs->uri);
+  free(gs);
+}
+
+// Returns the key of a named graph; *allocated is set if it has to be freed
+static const char *graph_key(librdf_node * graph, char **allocated)
+{
+  const char *id = NULL;
+  librdf_uri *uri = NULL;
+
+  *allocated = NULL;
+  if (librdf_node_is_blank(graph)) {
+    id = (const char *) librdf_node_get_blank_identifier(graph);
+    if (!id)
+      return NULL;
+    *allocated = malloc(strlen(id) + 3);
+    if (!*allocated)
+      return NULL;
+    sprintf(*allocated, "_:%s", id);
+    return *allocated;
+  }
+
+  uri = librdf_node_get_uri(graph);
+  if (!uri)
+    return NULL;
+  return (const char *) librdf_uri_as_string(uri);
+}
+
+static graph_stats_t *stats_lookup_key(const char *key)
+{
+  graph_stats_t search;
+
+  if (!graph_stats || !key)
+    return NULL;
+
+  search.uri = (char *) key;
+  return (graph_stats_t *) raptor_avltree_search(graph_stats, &search);
+}
+
+graph_stats_t *stats_lookup_graph(librdf_node * graph)
+{
+  graph_stats_t *gs = NULL;
+  char *allocated = NULL;
+
+  if (!graph_stats || !graph)
+    return NULL;
+
+  gs = stats_lookup_key(graph_key(graph, &allocated));
+  if (allocated)
+    free(allocated);
+
+  return gs;
+}
+
+static graph_stats_t *stats_lookup_or_add_key(const char *key, int blank)
+{
+  graph_stats_t *gs = stats_lookup_key(key);
+
+  if (gs || !graph_stats || !key)
+    return gs;
+
+  gs = calloc(1, sizeof(graph_stats_t));
+  if (!gs)
+    return NULL;
+
+  gs->uri = calloc(1, strlen(key) + 1);
+  if (!gs->uri) {
+    free(gs);
+    return NULL;
+  }
+  strcpy(gs->uri, key);
+  gs->blank = blank;
+
+  if (raptor_avltree_add(graph_stats, gs)) {
+    redstore_error("Failed to add graph to statistics table: %s", key);
+    return NULL;
+  }
+
+  return gs;
+}
+
+static void stats_remove_graph(graph_stats_t * gs)
+{
+  named_graphs_count -= gs->count;
+  raptor_avltree_delete(graph_stats, gs);
+}
+
+// Remembers a change, so that stats_journal_rollback() can undo it
+static void stats_journal_add(const char *key, int blank, long delta)
+{
+  stats_change_t *last = journal_count ? &journal[journal_count - 1] : NULL;
+
+  // Changes to the same graph, one after another, are kept together
+  if (last && ((!key && !last->key) || (key && last->key && strcmp(key, last->key) == 0))) {
+    last->delta += delta;
+    return;
+  }
+
+  if (journal_count == journal_size) {
+    size_t size = journal_size ? journal_size * 2 : 64;
+    stats_change_t *tmp = realloc(journal, size * sizeof(stats_change_t));
+    if (!tmp)
+      goto FAIL;
+    journal = tmp;
+    journal_size = size;
+  }
+
+  last = &journal[journal_count];
+  last->key = NULL;
+  if (key) {
+    last->key = malloc(strlen(key) + 1);
+    if (!last->key)
+      goto FAIL;
+    strcpy(last->key, key);
+  }
+  last->blank = blank;
+  last->delta = delta;
+  journal_count++;
+  return;
+
+FAIL:
+  // The counts can't be put back exactly; they are counted again instead
+  redstore_error("Failed to record change to the statement counts");
+  journal_enabled = -1;
+}
+
+static void stats_add_key(const char *key, int blank, long delta)
+{
+  if (delta == 0)
+    return;
+
+  store_modified = time(NULL);
+  if (key) {
+    graph_stats_t *gs = stats_lookup_or_add_key(key, blank);
+    if (!gs)
+      return;
+
+    if (delta < 0 && (unsigned long) -delta > gs->count)
+      delta = -(long) gs->count;
+    gs->count += delta;
+    gs->modified = store_modified;
+    named_graphs_count += delta;
+
+    // A graph without any statements no longer exists
+    if (gs->count == 0)
+      stats_remove_graph(gs);
+  } else {
+    if (delta < 0 && (unsigned long) -delta > default_graph_count)
+      delta = -(long) default_graph_count;
+    default_graph_count += delta;
+  }
+
+  if (journal_enabled > 0)
+    stats_journal_add(key, blank, delta);
+}
+
+void stats_add(librdf_node * graph, long delta)
+{
+  char *allocated = NULL;
+
+  if (!graph) {
+    stats_add_key(NULL, 0, delta);
+    return;
+  }
+
+  stats_add_key(graph_key(graph, &allocated), librdf_node_is_blank(graph), delta);
+  if (allocated)
+    free(allocated);
+}
+
+void stats_clear_graph(librdf_node * graph)
+{
+  store_modified = time(NULL);
+  stats_add(graph, -(long) stats_get_graph_size(graph));
+  if (!graph) {
+    bloom_free(default_graph_filter);
+    default_graph_filter = NULL;
+  }
+}
+
+// Counts the statements in one graph again, after an error left it unknown
+int stats_recount_graph(librdf_node * graph)
+{
+  librdf_stream *stream = NULL;
+  unsigned long count = 0;
+
+  if (graph) {
+    stream = librdf_model_context_as_stream(model, graph);
+  } else {
+    stream = librdf_model_as_stream(model);
+  }
+  if (!stream) {
+    redstore_error("Failed to stream graph while counting statements");
+    return -1;
+  }
+
+  while (!librdf_stream_end(stream)) {
+    if (graph || librdf_stream_get_context2(stream) == NULL)
+      count++;
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+
+  stats_add(graph, (long) count - (long) stats_get_graph_size(graph));
+
+  return 0;
+}
+
+// Creates a node for a graph in the table; it must be freed by the caller
+librdf_node *stats_new_graph_node(graph_stats_t * gs)
+{
+  if (gs->blank)
+    return librdf_new_node_from_blank_identifier(world, (unsigned char *) gs->uri + 2);
+
+  return librdf_new_node_from_uri_string(world, (unsigned char *) gs->uri);
+}
+
+static void stats_journal_clear(void)
+{
+  size_t i;
+
+  for (i = 0; i < journal_count; i++) {
+    if (journal[i].key)
+      free(journal[i].key);
+  }
+  journal_count = 0;
+}
+
+// Starts recording changes to the counts, when a transaction is started
+void stats_journal_start(void)
+{
+  stats_journal_clear();
+  journal_enabled = 1;
+}
+
+// Forgets the recorded changes, once they have been committed
+void stats_journal_commit(void)
+{
+  stats_journal_clear();
+  journal_enabled = 0;
+}
+
+// Undoes the changes recorded since stats_journal_start(). Returns non-zero
+// if they weren't all recorded, in which case the store is counted again.
+int stats_journal_rollback(void)
+{
+  int complete = (journal_enabled > 0);
+  size_t i;
+
+  journal_enabled = 0;
+  if (!complete) {
+    stats_journal_clear();
+    return stats_init();
+  }
+
+  for (i = journal_count; i > 0; i--) {
+    stats_change_t *change = &journal[i - 1];
+    stats_add_key(change->key, change->blank, -change->delta);
+  }
+  stats_journal_clear();
+
+  return 0;
+}
+
+void stats_clear_all(void)
+{
+  if (graph_stats)
+    raptor_free_avltree(graph_stats);
+  graph_stats = raptor_new_avltree(graph_stats_compare, graph_stats_free, 0);
+  default_graph_count = 0;
+  named_graphs_count = 0;
+  bloom_free(default_graph_filter);
+  default_graph_filter = NULL;
+  store_modified = time(NULL);
+}
+
+unsigned long stats_get_total(void)
+{
+  return default_graph_count + named_graphs_count;
+}
+
+unsigned long stats_get_named_total(void)
+{
+  return named_graphs_count;
+}
+
+unsigned long stats_get_graph_count(void)
+{
+  if (!graph_stats)
+    return 0;
+  return raptor_avltree_size(graph_stats);
+}
+
+unsigned long stats_get_graph_size(librdf_node * graph)
+{
+  if (graph) {
+    graph_stats_t *gs = stats_lookup_graph(graph);
+    return gs ? gs->count : 0;
+  } else {
+    return default_graph_count;
+  }
+}
+
+// Returns the time that a named graph was last changed, or, for NULL,
+// the time that anything in the store was last changed
+time_t stats_get_modified(librdf_node * graph)
+{
+  if (graph) {
+    graph_stats_t *gs = stats_lookup_graph(graph);
+    return gs ? gs->modified : 0;
+  } else {
+    return store_modified;
+  }
+}
+
+// Returns an iterator over the named graphs, in order of their URIs.
+// Each item is a graph_stats_t; the table must not be changed while it is in use.
+raptor_avltree_iterator *stats_new_graph_iterator(void)
+{
+  if (!graph_stats)
+    return NULL;
+
+  return raptor_new_avltree_iterator(graph_stats, NULL, NULL, 1);
+}
+
+// Each graph may have a Bloom filter of the statements in it, so that
+// statements that are certainly new can be added without first asking
+// the storage whether they are already there. The filters are built
+// when the store is counted, and a graph that is added after that has
+// one from its first statement. A graph that is cleared loses its
+// filter, and a filter that can no longer be trusted is dropped.
+
+static bloom_t **stats_filter_for_graph(librdf_node * graph)
+{
+  if (graph) {
+    graph_stats_t *gs = stats_lookup_graph(graph);
+    return gs ? &gs->filter : NULL;
+  } else {
+    return &default_graph_filter;
+  }
+}
+
+// Sizes a filter for a graph from its count; graphs that are too large have none
+static bloom_t *stats_new_filter(unsigned long count)
+{
+  if (count * 2 > BLOOM_MAX_CAPACITY)
+    return NULL;
+
+  return bloom_new(count * 2);
+}
+
+// Drops the filters of every graph, when they can no longer be trusted
+static void stats_drop_filters(void)
+{
+  raptor_avltree_iterator *iterator = NULL;
+
+  iterator = stats_new_graph_iterator();
+  while (iterator && !raptor_avltree_iterator_is_end(iterator)) {
+    graph_stats_t *gs = (graph_stats_t *) raptor_avltree_iterator_get(iterator);
+    if (gs) {
+      bloom_free(gs->filter);
+      gs->filter = NULL;
+    }
+    raptor_avltree_iterator_next(iterator);
+  }
+  if (iterator)
+    raptor_free_avltree_iterator(iterator);
+
+  bloom_free(default_graph_filter);
+  default_graph_filter = NULL;
+  filters_enabled = 0;
+}
+
+// Builds the filters for every graph in one pass over the store
+static void stats_build_filters(void)
+{
+  raptor_avltree_iterator *iterator = NULL;
+  librdf_stream *stream = NULL;
+
+  iterator = stats_new_graph_iterator();
+  while (iterator && !raptor_avltree_iterator_is_end(iterator)) {
+    graph_stats_t *gs = (graph_stats_t *) raptor_avltree_iterator_get(iterator);
+    if (gs)
+      gs->filter = stats_new_filter(gs->count);
+    raptor_avltree_iterator_next(iterator);
+  }
+  if (iterator)
+    raptor_free_avltree_iterator(iterator);
+  default_graph_filter = stats_new_filter(default_graph_count);
+
+  stream = librdf_model_as_stream(model);
+  if (!stream) {
+    redstore_error("Failed to stream model while building filters");
+    stats_drop_filters();
+    return;
+  }
+
+  while (!librdf_stream_end(stream)) {
+    bloom_t **filter = stats_filter_for_graph(librdf_stream_get_context2(stream));
+    if (filter && *filter)
+      bloom_add(*filter, redstore_statement_hash(librdf_stream_get_object(stream)));
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+
+  filters_enabled = 1;
+  redstore_debug("Built filters for %lu named graphs", stats_get_graph_count());
+}
+
+// Returns 0 if the statement is certainly not in the graph, 1 if it may be,
+// and -1 if the graph has no filter
+int stats_may_contain(librdf_node * graph, librdf_statement * statement)
+{
+  bloom_t **filter = NULL;
+
+  if (!graph_stats)
+    return -1;
+
+  // There is no entry for a named graph that doesn't have any statements
+  filter = stats_filter_for_graph(graph);
+  if (!filter)
+    return graph ? 0 : -1;
+  if (!*filter)
+    return -1;
+
+  return bloom_may_contain(*filter, redstore_statement_hash(statement));
+}
+
+// Called for every statement that is added, after it has been counted,
+// so that the filters stay complete
+void stats_filter_add(librdf_node * graph, librdf_statement * statement)
+{
+  bloom_t **filter = stats_filter_for_graph(graph);
+
+  if (!filter)
+    return;
+
+  // A graph that was empty until this statement has a complete filter from the start
+  if (!*filter && filters_enabled && stats_get_graph_size(graph) == 1)
+    *filter = bloom_new(0);
+
+  if (*filter)
+    bloom_add(*filter, redstore_statement_hash(statement));
+}
+
+int stats_init(void)
+{
+  librdf_stream *stream = NULL;
+
+  filters_enabled = 0;
+  stats_clear_all();
+  if (!graph_stats) {
+    redstore_error("Failed to create graph statistics table");
+    return -1;
+  }
+
+  // Count the statements in the store once, at startup.
+  stream = librdf_model_as_stream(model);
+  if (!stream) {
+    redstore_error("Failed to stream model while counting statements");
+    return -1;
+  }
+
+  while (!librdf_stream_end(stream)) {
+    librdf_node *graph = librdf_stream_get_context2(stream);
+    stats_add(graph, 1);
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+
+  redstore_info("Counted %lu statements in %lu named graphs",
+                stats_get_total(), stats_get_graph_count());
+
+  // The filters are only needed if the storage has to be asked whether it has a statement
+  if (!store_size_is_known())
+    stats_build_filters();
+
+  return 0;
+}
+
+void stats_free(void)
+{
+  stats_journal_commit();
+  if (journal)
+    free(journal);
+  journal = NULL;
+  journal_size = 0;
+
+  if (graph_stats) {
+    raptor_free_avltree(graph_stats);
+    graph_stats = NULL;
+  }
+  default_graph_count = 0;
+  named_graphs_count = 0;
+  bloom_free(default_graph_filter);
+  default_graph_filter = NULL;
+}
+
+stats_state_t *stats_state_new(void)
+{
+  return calloc(1, sizeof(stats_state_t));
+}
+
+// Exchanges the counts in use with those in state, so that each of several
+// stores can keep its own while only one of them is in use at a time
+void stats_swap(stats_state_t * state)
+{
+  stats_state_t tmp = *state;
+
+  state->graph_stats = graph_stats;
+  state->default_graph_count = default_graph_count;
+  state->named_graphs_count = named_graphs_count;
+  state->store_modified = store_modified;
+  state->default_graph_filter = default_graph_filter;
+  state->filters_enabled = filters_enabled;
+
+  graph_stats = tmp.graph_stats;
+  default_graph_count = tmp.default_graph_count;
+  named_graphs_count = tmp.named_graphs_count;
+  store_modified = tmp.store_modified;
+  default_graph_filter = tmp.default_graph_filter;
+  filters_enabled = tmp.filters_enabled;
+}
@@ -0,0 +1,696 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "redstore.h"
+
+
+// All changes to the store go through these functions, so that
+// everything derived from the store's contents can be kept up to date.
+
+// Incremented every time the contents of the store change
+static unsigned long generation = 0;
+
+// True while there is an open storage transaction
+static int in_transaction = 0;
+
+// Nesting depth of store_batch_start() calls
+static int batch_depth = 0;
+
+// Position in the write-ahead log's buffer when the transaction started
+static size_t transaction_mark = 0;
+
+// Position in the change feed's pending changes when the transaction started
+static size_t changes_mark = 0;
+
+// Streams are committed every transaction_batch_size changes (0 for never)
+static unsigned long transaction_batch_size = 0;
+static unsigned long transaction_changes = 0;
+
+// True if part of the current transaction has already been committed
+static int transaction_split = 0;
+
+// Changes are only logged, and put in the change feed, for the default dataset
+static int logging = 1;
+
+
+// Writes changes to the write-ahead log, unless they are part of a larger group
+static int store_log_commit(void)
+{
+  if (batch_depth || in_transaction)
+    return 0;
+
+  changes_commit();
+  return wal_commit();
+}
+
+
+// Looks for a statement in a graph; if quick is set, all the graphs are checked first
+static int store_find_statement(librdf_node * graph, librdf_statement * statement, int quick)
+{
+  librdf_stream *stream = NULL;
+  int found = 0;
+
+  if (quick && !librdf_model_contains_statement(model, statement))
+    return 0;
+
+  if (graph) {
+    stream = librdf_model_find_statements_in_context(model, statement, graph);
+    if (stream)
+      found = !librdf_stream_end(stream);
+  } else {
+    stream = librdf_model_find_statements(model, statement);
+    while (stream && !librdf_stream_end(stream)) {
+      if (librdf_stream_get_context2(stream) == NULL) {
+        found = 1;
+        break;
+      }
+      librdf_stream_next(stream);
+    }
+  }
+
+  if (stream)
+    librdf_free_stream(stream);
+
+  return found;
+}
+
+// Returns true if the statement is already in the graph (NULL for the default graph)
+int store_contains_statement(librdf_node * graph, librdf_statement * statement)
+{
+  return store_find_statement(graph, statement, 1);
+}
+
+// True if the storage knows its size without a scan. Adding a statement
+// that is already there doesn't change the size, so the storage doesn't
+// have to be asked whether it has the statement first.
+int store_size_is_known(void)
+{
+  return storage_type && strcmp(storage_type, "native") == 0;
+}
+
+// Returns 0 if the statement was added, >0 if it was already there and <0 on error
+int store_add_statement(librdf_node * graph, librdf_statement * statement)
+{
+  int err, filter, size = -1;
+
+  if (store_size_is_known()) {
+    size = librdf_storage_size(storage);
+  } else {
+    // The storage only needs to be asked if the graph's filter has seen something like it.
+    // If it has, the statement is most likely in that graph, so skip the quick check.
+    filter = stats_may_contain(graph, statement);
+    if (filter != 0 && store_find_statement(graph, statement, filter < 0))
+      return 1;
+  }
+
+  if (graph) {
+    err = librdf_model_context_add_statement(model, graph, statement);
+  } else {
+    err = librdf_model_add_statement(model, statement);
+  }
+
+  if (err)
+    return -1;
+  if (size >= 0 && librdf_storage_size(storage) == size)
+    return 1;
+
+  stats_add(graph, 1);
+  stats_filter_add(graph, statement);
+  search_add_statement(graph, statement);
+  range_add_statement(graph, statement);
+  generation++;
+  transaction_changes++;
+  if (logging) {
+    wal_log_statement(0, graph, statement);
+    changes_log_statement(0, graph, statement);
+  }
+  store_log_commit();
+
+  return 0;
+}
+
+// Commits a large transaction part way through, so that the storage
+// doesn't have to hold all of the changes at once
+static int store_transaction_next_batch(void)
+{
+  if (!in_transaction || !transaction_batch_size || transaction_changes < transaction_batch_size)
+    return 0;
+
+  redstore_debug("Committing a batch of %lu changes", transaction_changes);
+  if (store_transaction_commit() || store_transaction_start())
+    return 1;
+
+  transaction_split = 1;
+  return 0;
+}
+
+// Returns the number of errors; the number of new statements is stored in added
+int store_add_stream(librdf_node * graph, librdf_stream * stream, unsigned long *added)
+{
+  int errors = 0;
+
+  if (added)
+    *added = 0;
+
+  store_batch_start();
+  while (!librdf_stream_end(stream)) {
+    librdf_statement *statement = librdf_stream_get_object(stream);
+    int result;
+
+    if (!statement) {
+      redstore_error("librdf_stream_get_object returned NULL in store_add_stream()");
+      errors++;
+      break;
+    }
+
+    result = store_add_statement(graph, statement);
+    if (result < 0) {
+      errors++;
+    } else if (result == 0 && added) {
+      (*added)++;
+    }
+
+    if (store_transaction_next_batch()) {
+      errors++;
+      break;
+    }
+
+    librdf_stream_next(stream);
+  }
+
+  if (store_batch_end())
+    errors++;
+
+  return errors;
+}
+
+// Returns 0 if the statement was removed and non-zero otherwise
+int store_remove_statement(librdf_node * graph, librdf_statement * statement)
+{
+  // Nothing to do if the graph's filter has never seen the statement
+  if (graph && stats_may_contain(graph, statement) == 0)
+    return 1;
+
+  if (librdf_model_context_remove_statement(model, graph, statement))
+    return 1;
+
+  stats_add(graph, -1);
+  search_remove_statement(graph, statement);
+  range_remove_statement(graph, statement);
+  generation++;
+  transaction_changes++;
+  if (logging) {
+    wal_log_statement(1, graph, statement);
+    changes_log_statement(1, graph, statement);
+  }
+  store_log_commit();
+
+  return 0;
+}
+
+// Returns the number of errors; the number of statements removed is stored in removed
+int store_remove_stream(librdf_node * graph, librdf_stream * stream, unsigned long *removed)
+{
+  int errors = 0;
+
+  if (removed)
+    *removed = 0;
+
+  store_batch_start();
+  while (!librdf_stream_end(stream)) {
+    librdf_statement *statement = librdf_stream_get_object(stream);
+
+    if (!statement) {
+      redstore_error("librdf_stream_get_object returned NULL in store_remove_stream()");
+      errors++;
+      break;
+    }
+
+    if (store_remove_statement(graph, statement) == 0 && removed)
+      (*removed)++;
+
+    if (store_transaction_next_batch()) {
+      errors++;
+      break;
+    }
+
+    librdf_stream_next(stream);
+  }
+
+  if (store_batch_end())
+    errors++;
+
+  return errors;
+}
+
+// Statements in the default graph can't be removed using
+// librdf_model_context_remove_statements(), so find and remove them one by one
+static int store_remove_default_graph(void)
+{
+  librdf_statement **statements = NULL;
+  librdf_stream *stream = NULL;
+  int count = 0, size = 0, err = 0, i;
+
+  stream = librdf_model_as_stream(model);
+  if (!stream) {
+    redstore_error("Failed to stream model.");
+    return 1;
+  }
+
+  while (!librdf_stream_end(stream)) {
+    if (librdf_stream_get_context2(stream) == NULL) {
+      if (count == size) {
+        librdf_statement **tmp;
+        size = size ? size * 2 : 64;
+        tmp = realloc(statements, size * sizeof(librdf_statement *));
+        if (!tmp) {
+          err++;
+          break;
+        }
+        statements = tmp;
+      }
+      statements[count] = librdf_new_statement_from_statement(librdf_stream_get_object(stream));
+      if (statements[count])
+        count++;
+    }
+    librdf_stream_next(stream);
+  }
+  librdf_free_stream(stream);
+
+  for (i = 0; i < count; i++) {
+    if (librdf_model_context_remove_statement(model, NULL, statements[i])) {
+      err++;
+    } else {
+      stats_add(NULL, -1);
+      search_remove_statement(NULL, statements[i]);
+      if (logging)
+        changes_log_statement(1, NULL, statements[i]);
+    }
+    librdf_free_statement(statements[i]);
+  }
+  if (statements)
+    free(statements);
+
+  return err;
+}
+
+int store_remove_graph(librdf_node * graph)
+{
+  int err = 0;
+
+  if (graph) {
+    size_t mark = changes_get_mark();
+    if (logging)
+      changes_log_graph(graph);
+    if (librdf_model_context_remove_statements(model, graph)) {
+      changes_rollback(mark);
+      // Some of the graph may have been removed
+      stats_recount_graph(graph);
+      search_reindex_graph(graph);
+      return 1;
+    }
+    stats_clear_graph(graph);
+    search_remove_graph(graph);
+  } else {
+    // The counts are kept up to date for each statement that is removed
+    err = store_remove_default_graph();
+    if (!err)
+      stats_clear_graph(NULL);
+  }
+
+  // Some of the default graph may have been removed, even on error
+  if (logging)
+    wal_log_remove_graph(graph);
+  store_log_commit();
+  generation++;
+
+  if (err) {
+    range_invalidate();
+  } else {
+    range_remove_graph(graph);
+  }
+
+  return err;
+}
+
+static int storage_type_is_in_memory(const char *type, librdf_hash * options)
+{
+  char *hash_type = NULL;
+  int in_memory = 0;
+
+  if (strcmp(type, "memory") == 0 || strcmp(type, "native") == 0 || strcmp(type, "trees") == 0)
+    return 1;
+
+  if (strcmp(type, "hashes") != 0 || !options)
+    return 0;
+
+  hash_type = librdf_hash_get(options, "hash-type");
+  if (hash_type) {
+    in_memory = (strcmp(hash_type, "memory") == 0);
+    librdf_free_memory(hash_type);
+  }
+
+  return in_memory;
+}
+
+// Returns true if the storage is held entirely in memory, rather than in files or a database
+int store_is_in_memory(void)
+{
+  librdf_hash *hash = NULL;
+  char *shard_type = NULL;
+  int in_memory = 0;
+
+  if (storage_options)
+    hash = librdf_new_hash_from_string(world, NULL, storage_options);
+
+  // A sharded storage is held in memory if its shards are
+  if (strcmp(storage_type, "sharded") == 0) {
+    if (hash)
+      shard_type = librdf_hash_get(hash, "shard-type");
+    in_memory = storage_type_is_in_memory(shard_type ? shard_type : "hashes", hash);
+    if (shard_type)
+      librdf_free_memory(shard_type);
+  } else {
+    in_memory = storage_type_is_in_memory(storage_type, hash);
+  }
+
+  if (hash)
+    librdf_free_hash(hash);
+
+  return in_memory;
+}
+
+// Storage types that are emptied by opening them again with new=yes
+static const char *store_recreate_types[] = {
+  "hashes", "memory", "mysql", "native", "postgresql", "sharded", "sqlite", "trees", NULL
+};
+
+// Empties the store by opening the storage again with new=yes, which
+// takes the same time however many statements it holds.
+// Returns -1 if the storage can't be emptied this way, and the old
+// storage is still open.
+static int store_recreate(void)
+{
+  librdf_storage *new_storage = NULL;
+  librdf_model *new_model = NULL;
+  librdf_hash *hash = NULL;
+  int i;
+
+  // Other changes in the transaction would be lost
+  if (in_transaction)
+    return -1;
+
+  for (i = 0; store_recreate_types[i]; i++) {
+    if (strcmp(storage_type, store_recreate_types[i]) == 0)
+      break;
+  }
+  if (!store_recreate_types[i])
+    return -1;
+
+  hash = librdf_new_hash_from_string(world, NULL, storage_options);
+  if (!hash) {
+    redstore_error("Failed to create storage options hash");
+    return -1;
+  }
+  librdf_hash_put_strings(hash, "contexts", "yes");
+  librdf_hash_put_strings(hash, "write", "yes");
+  librdf_hash_put_strings(hash, "new", "yes");
+
+  redstore_debug("Re-creating %s storage '%s'", storage_type, storage_name);
+
+  // Nothing is shared with a storage held in memory, so the old one
+  // is only replaced once the new one has been opened
+  if (store_is_in_memory()) {
+    new_storage = librdf_new_storage_with_options(world, storage_type, storage_name, hash);
+    if (new_storage)
+      new_model = librdf_new_model(world, new_storage, NULL);
+    librdf_free_hash(hash);
+
+    if (!new_model) {
+      redstore_error("Failed to re-create %s storage '%s'", storage_type, storage_name);
+      if (new_storage)
+        librdf_free_storage(new_storage);
+      return -1;
+    }
+
+    librdf_free_model(model);
+    librdf_free_storage(storage);
+    model = new_model;
+    storage = new_storage;
+    return 0;
+  }
+
+  // The files of other storages have to be released first
+  librdf_free_model(model);
+  model = NULL;
+  librdf_free_storage(storage);
+  storage = librdf_new_storage_with_options(world, storage_type, storage_name, hash);
+  if (storage)
+    model = librdf_new_model(world, storage, NULL);
+
+  if (!model) {
+    // Open what is left of the old storage, so that it can be emptied one graph at a time
+    redstore_error("Failed to re-create %s storage '%s'", storage_type, storage_name);
+    if (storage)
+      librdf_free_storage(storage);
+    librdf_hash_put_strings(hash, "new", "no");
+    storage = librdf_new_storage_with_options(world, storage_type, storage_name, hash);
+    if (storage)
+      model = librdf_new_model(world, storage, NULL);
+    librdf_free_hash(hash);
+
+    if (!model) {
+      redstore_fatal("Failed to open %s storage '%s' again", storage_type, storage_name);
+      return 1;
+    }
+    stats_init();
+    search_invalidate();
+    return -1;
+  }
+  librdf_free_hash(hash);
+
+  return 0;
+}
+
+// Removes every graph one at a time, keeping the counts up to date;
+// returns the number of errors
+static int store_remove_each(void)
+{
+  librdf_iterator *iterator = NULL;
+  int err = 0;
+
+  // First:  delete all the named graphs
+  iterator = librdf_storage_get_contexts(storage);
+  if (!iterator) {
+    redstore_error("Failed to get list of graphs.");
+    return 1;
+  }
+
+  while (!librdf_iterator_end(iterator)) {
+    librdf_node *graph = (librdf_node *) librdf_iterator_get_object(iterator);
+    if (!graph) {
+      redstore_error("librdf_iterator_get_next returned NULL");
+      break;
+    }
+
+    if (librdf_model_context_remove_statements(model, graph)) {
+      err++;
+      stats_recount_graph(graph);
+      search_reindex_graph(graph);
+    } else {
+      stats_clear_graph(graph);
+      search_remove_graph(graph);
+    }
+
+    librdf_iterator_next(iterator);
+  }
+  librdf_free_iterator(iterator);
+
+
+  // Second: delete the triples in the default graph
+  if (store_remove_default_graph()) {
+    err++;
+  } else {
+    stats_clear_graph(NULL);
+  }
+
+  return err;
+}
+
+// Returns the number of errors
+int store_remove_all(void)
+{
+  int err = 0, recreated = 0;
+
+  // The storage is replaced without any locking: requests are handled one
+  // at a time, so nothing else can be using the old storage at this point.
+  err = store_recreate();
+  recreated = (err == 0);
+
+  // The storage could not be opened again, and the server is stopping
+  if (err > 0)
+    return err;
+
+  if (err < 0)
+    err = store_remove_each();
+  generation++;
+
+  if (logging) {
+    wal_log_remove_all();
+    changes_reset();
+  }
+  store_log_commit();
+
+  // The counts were kept up to date if the graphs were removed one by one
+  if (err) {
+    range_invalidate();
+  } else {
+    if (recreated)
+      stats_clear_all();
+    search_reset();
+    range_reset();
+  }
+
+  return err;
+}
+
+// Turns the write-ahead log and the change feed on or off for the changes that follow
+void store_set_logging(int enabled)
+{
+  logging = enabled;
+}
+
+unsigned long store_get_generation(void)
+{
+  return generation;
+}
+
+// Sets the number of changes after which a stream is committed part way through
+void store_set_batch_size(unsigned long size)
+{
+  transaction_batch_size = size;
+}
+
+// Groups the changes made until store_batch_end() into a single write to
+// the write-ahead log. Batches can be nested.
+void store_batch_start(void)
+{
+  batch_depth++;
+}
+
+// Returns non-zero if the changes could not be written to the log
+int store_batch_end(void)
+{
+  if (batch_depth > 0)
+    batch_depth--;
+
+  return store_log_commit();
+}
+
+// Returns non-zero while changes are being grouped into a transaction or a batch,
+// and so aren't ready to be written to the write-ahead log
+int store_in_transaction(void)
+{
+  return in_transaction || batch_depth > 0;
+}
+
+// Returns 0 if a transaction was started. Storages that don't support
+// transactions return non-zero, and changes are then applied immediately.
+int store_transaction_start(void)
+{
+  if (in_transaction)
+    return 0;
+
+  transaction_split = 0;
+
+  if (librdf_model_transaction_start(model)) {
+    redstore_debug("Storage does not support transactions");
+    return 1;
+  }
+
+  in_transaction = 1;
+  transaction_mark = wal_get_mark();
+  changes_mark = changes_get_mark();
+  transaction_changes = 0;
+  stats_journal_start();
+  search_journal_start();
+
+  return 0;
+}
+
+int store_transaction_commit(void)
+{
+  if (!in_transaction)
+    return 0;
+
+  in_transaction = 0;
+  if (librdf_model_transaction_commit(model)) {
+    redstore_error("Failed to commit transaction");
+    wal_rollback(transaction_mark);
+    changes_rollback(changes_mark);
+    stats_journal_rollback();
+    search_journal_commit();
+    search_invalidate();
+    range_invalidate();
+    generation++;
+    return 1;
+  }
+
+  stats_journal_commit();
+  search_journal_commit();
+  return store_log_commit();
+}
+
+// Returns non-zero if the changes could not all be undone
+int store_transaction_rollback(void)
+{
+  int err;
+
+  if (!in_transaction)
+    return 1;
+
+  in_transaction = 0;
+  wal_rollback(transaction_mark);
+  changes_rollback(changes_mark);
+  err = librdf_model_transaction_rollback(model);
+  if (err)
+    redstore_error("Failed to roll back transaction");
+
+  // The statement counts and the indexes were updated as the changes were made.
+  // If the storage couldn't undo the changes, count what it has instead.
+  if (err) {
+    stats_journal_commit();
+    stats_init();
+    search_journal_commit();
+    search_invalidate();
+  } else {
+    stats_journal_rollback();
+    search_journal_rollback();
+  }
+  range_invalidate();
+  generation++;
+
+  // Earlier batches of the transaction have already been committed
+  return err || transaction_split;
+}
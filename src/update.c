@@ -21,28 +21,49 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "redstore.h"
 
 
+// Each request that changes the store is applied in a single transaction,
+// where the storage supports them. Returns the text to add to an error
+// message once the changes have been abandoned.
+static const char *abandon_changes(int transaction)
+{
+  if (transaction && store_transaction_rollback() == 0)
+    return "No changes were made.";
+
+  return "Some of the changes may have been applied.";
+}
+
 redhttp_response_t *load_stream_into_new_graph(redhttp_request_t * request, librdf_stream * stream,
                                            librdf_node * graph_node)
 {
   redhttp_response_t *response = NULL;
   librdf_uri *graph_uri = librdf_node_get_uri(graph_node);
   const char *graph_str = (const char *) librdf_uri_as_string(graph_uri);
+  int transaction = 0;
 
-  if (librdf_model_context_add_statements(model, graph_node, stream)) {
+  // The new graph is created in a transaction of its own
+  coalesce_flush();
+  transaction = (store_transaction_start() == 0);
+
+  if (store_add_stream(graph_node, stream, NULL)) {
     return redstore_page_new_with_message(
       request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
-      "Failed to add triples to graph."
+      "Failed to add triples to graph. %s", abandon_changes(transaction)
     );
   }
 
   if (error_buffer) {
     return redstore_page_new_with_message(
       request, LIBRDF_LOG_INFO, REDHTTP_INTERNAL_SERVER_ERROR,
-      "Error while adding triples to new graph: %s", graph_str
+      "Error while adding triples to new graph: %s %s", graph_str, abandon_changes(transaction)
+    );
+  } else if (transaction && store_transaction_commit()) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to commit the changes."
     );
   } else {
     response = redstore_page_new_with_message(
@@ -55,14 +76,15 @@ redhttp_response_t *load_stream_into_new_graph(redhttp_request_t * request, libr
   return response;
 }
 
-redhttp_response_t *load_stream_into_graph(redhttp_request_t * request, librdf_stream * stream,
-                                           librdf_node * graph)
+static redhttp_response_t *load_stream_in_transaction(redhttp_request_t * request, librdf_stream * stream,
+                                                      librdf_node * graph, int transaction)
 {
   const char *graph_str = NULL;
 
-  if (librdf_model_context_add_statements(model, graph, stream)) {
+  if (store_add_stream(graph, stream, NULL)) {
     return redstore_page_new_with_message(
-      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to add triples to graph."
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
+      "Failed to add triples to graph. %s", abandon_changes(transaction)
     );
   }
 
@@ -76,7 +98,12 @@ redhttp_response_t *load_stream_into_graph(redhttp_request_t * request, librdf_s
 
   if (error_buffer) {
     return redstore_page_new_with_message(
-      request, LIBRDF_LOG_INFO, REDHTTP_INTERNAL_SERVER_ERROR, "Error while adding triples to: %s", graph_str
+      request, LIBRDF_LOG_INFO, REDHTTP_INTERNAL_SERVER_ERROR, "Error while adding triples to: %s %s",
+      graph_str, abandon_changes(transaction)
+    );
+  } else if (transaction && store_transaction_commit()) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to commit the changes."
     );
   } else {
     return redstore_page_new_with_message(
@@ -85,35 +112,108 @@ redhttp_response_t *load_stream_into_graph(redhttp_request_t * request, librdf_s
   }
 }
 
+redhttp_response_t *load_stream_into_graph(redhttp_request_t * request, librdf_stream * stream,
+                                           librdf_node * graph)
+{
+  int transaction = 0;
+
+  if (coalesce_is_enabled())
+    return coalesce_stream(request, stream, graph, 0);
+
+  transaction = (store_transaction_start() == 0);
+
+  return load_stream_in_transaction(request, stream, graph, transaction);
+}
+
+// Replaces a graph that already has statements in it with only the changes
+static redhttp_response_t *replace_graph(redhttp_request_t * request, librdf_stream * stream,
+                                         librdf_node * graph)
+{
+  const char *graph_str = (const char *) librdf_uri_as_string(librdf_node_get_uri(graph));
+  unsigned long added = 0, removed = 0;
+  int transaction = (store_transaction_start() == 0);
+  int err;
+
+  store_batch_start();
+  err = diff_replace_graph(graph, stream, &added, &removed);
+  store_batch_end();
+
+  if (err > 0) {
+    // The new triples are all read before anything is changed
+    if (transaction)
+      store_transaction_commit();
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_INTERNAL_SERVER_ERROR,
+      "Error while adding triples to: %s No changes were made.", graph_str
+    );
+  } else if (err < 0) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
+      "Failed to replace triples in graph. %s", abandon_changes(transaction)
+    );
+  } else if (transaction && store_transaction_commit()) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to commit the changes."
+    );
+  } else {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_INFO, REDHTTP_OK,
+      "Successfully replaced triples in: %s (%lu added and %lu deleted)", graph_str, added, removed
+    );
+  }
+}
+
 redhttp_response_t *clear_and_load_stream_into_graph(redhttp_request_t * request,
                                                      librdf_stream * stream, librdf_node * graph)
 {
-  if (graph) {
-    librdf_model_context_remove_statements(model, graph);
+  int transaction = 0;
+
+  // Only the differences need to be applied to a graph that is already there
+  if (graph && stats_lookup_graph(graph))
+    return replace_graph(request, stream, graph);
+
+  // Replace the graph in one transaction, so that it is never left half-loaded
+  transaction = (store_transaction_start() == 0);
+
+  if (graph && store_remove_graph(graph)) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
+      "Failed to clear graph. %s", abandon_changes(transaction)
+    );
   }
 
-  return load_stream_into_graph(request, stream, graph);
+  return load_stream_in_transaction(request, stream, graph, transaction);
 }
 
 redhttp_response_t *delete_stream_from_graph(redhttp_request_t * request, librdf_stream * stream,
                                              librdf_node * graph)
 {
-  int count = 0;
+  unsigned long count = 0;
+  int transaction = 0, err = 0;
 
-  while (!librdf_stream_end(stream)) {
-    librdf_statement *statement = librdf_stream_get_object(stream);
-    if (librdf_model_context_remove_statement(model, graph, statement) == 0)
-      count++;
-    librdf_stream_next(stream);
-  }
+  if (coalesce_is_enabled())
+    return coalesce_stream(request, stream, graph, 1);
+
+  transaction = (store_transaction_start() == 0);
+  err = store_remove_stream(graph, stream, &count);
 
   if (error_buffer) {
     return redstore_page_new_with_message(
-      request, LIBRDF_LOG_INFO, REDHTTP_INTERNAL_SERVER_ERROR, "Error while deleting triples."
+      request, LIBRDF_LOG_INFO, REDHTTP_INTERNAL_SERVER_ERROR, "Error while deleting triples. %s",
+      abandon_changes(transaction)
+    );
+  } else if (err) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to delete triples. %s",
+      abandon_changes(transaction)
+    );
+  } else if (transaction && store_transaction_commit()) {
+    return redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to commit the changes."
     );
   } else if (count > 0) {
     return redstore_page_new_with_message(
-      request, LIBRDF_LOG_INFO, REDHTTP_OK, "Successfully deleted %d triples.", count
+      request, LIBRDF_LOG_INFO, REDHTTP_OK, "Successfully deleted %lu triples.", count
     );
   } else {
     return redstore_page_new_with_message(
@@ -185,51 +285,72 @@ CLEANUP:
   return response;
 }
 
-redhttp_response_t *parse_data_from_request_body(redhttp_request_t * request,
-                                                 librdf_node *graph_node,
-                                                 redstore_stream_processor stream_proc)
+// Reads the whole of the request body into a new buffer, which is
+// followed by a nul, so that it can also be used as a string.
+// Returns an error page if it could not be read.
+redhttp_response_t *read_request_body(redhttp_request_t * request,
+                                      unsigned char **buffer, size_t *length)
 {
   const char *content_length_str = redhttp_request_get_header(request, "Content-Length");
-  const char *content_type = redhttp_request_get_header(request, "Content-Type");
-  redhttp_response_t *response = NULL;
-  unsigned char *buffer = NULL;
-  const char *parser_name = NULL;
-  size_t content_length;
+  long content_length = 0;
   size_t data_read;
+  char *end = NULL;
+
+  *buffer = NULL;
+  *length = 0;
 
   // Check we have a content_length header
   if (content_length_str) {
-    content_length = atoi(content_length_str);
-    if (content_length <= 0) {
-      response = redstore_page_new_with_message(
+    content_length = strtol(content_length_str, &end, 10);
+    if (end == content_length_str || *end != '\0' || content_length <= 0 ||
+        content_length == LONG_MAX) {
+      return redstore_page_new_with_message(
         request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "Invalid content length header."
       );
-      goto CLEANUP;
     }
   } else {
-    response = redstore_page_new_with_message(
+    return redstore_page_new_with_message(
       request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "Missing content length header."
     );
-    goto CLEANUP;
   }
 
   // Allocate memory and read in the input data
-  buffer = malloc(content_length);
-  if (!buffer) {
-    response = redstore_page_new_with_message(
+  *buffer = malloc((size_t) content_length + 1);
+  if (!*buffer) {
+    return redstore_page_new_with_message(
       request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
       "Failed to allocate memory for input data."
     );
-    goto CLEANUP;
   }
 
-  data_read = fread(buffer, 1, content_length, redhttp_request_get_socket(request));
-  if (data_read != content_length) {
-    response = redstore_page_new_with_message(
+  data_read = fread(*buffer, 1, content_length, redhttp_request_get_socket(request));
+  if (data_read != (size_t) content_length) {
+    free(*buffer);
+    *buffer = NULL;
+    return redstore_page_new_with_message(
       request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Error reading content from client."
     );
-    goto CLEANUP;
   }
+  (*buffer)[data_read] = '\0';
+
+  *length = data_read;
+
+  return NULL;
+}
+
+redhttp_response_t *parse_data_from_request_body(redhttp_request_t * request,
+                                                 librdf_node *graph_node,
+                                                 redstore_stream_processor stream_proc)
+{
+  const char *content_type = redhttp_request_get_header(request, "Content-Type");
+  redhttp_response_t *response = NULL;
+  unsigned char *buffer = NULL;
+  const char *parser_name = NULL;
+  size_t data_read;
+
+  response = read_request_body(request, &buffer, &data_read);
+  if (response)
+    goto CLEANUP;
 
   parser_name = librdf_parser_guess_name2(world, content_type, buffer, NULL);
   if (!parser_name) {
@@ -256,12 +377,17 @@ redhttp_response_t *handle_load_post(redhttp_request_t * request, void *user_dat
   const char *base_arg = redhttp_request_get_argument(request, "base-uri");
   const char *graph_arg = redhttp_request_get_argument(request, "graph");
   const char *parser_arg = redhttp_request_get_argument(request, "parser");
+  const char *file_arg = redhttp_request_get_argument(request, "file");
   librdf_uri *uri = NULL, *base_uri = NULL, *graph_uri = NULL;
   redhttp_response_t *response = NULL;
   librdf_parser *parser = NULL;
   librdf_stream *stream = NULL;
   librdf_node *graph = NULL;
 
+  // Files on the server are always loaded in the background
+  if (file_arg && !uri_arg)
+    return jobs_load_file(request, file_arg, parser_arg, base_arg, graph_arg);
+
   if (!uri_arg) {
     response = redstore_page_new_with_message(
       request, LIBRDF_LOG_DEBUG, REDHTTP_BAD_REQUEST, "Missing URI to load."
@@ -319,20 +445,29 @@ redhttp_response_t *handle_load_post(redhttp_request_t * request, void *user_dat
     goto CLEANUP;
   }
 
-  stream = librdf_parser_parse_as_stream(parser, uri, base_uri);
-  if (!stream) {
+  graph = librdf_new_node_from_uri(world, graph_uri);
+  if (!graph) {
     response = redstore_page_new_with_message(
-      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to parse RDF as stream."
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
+      "librdf_new_node_from_uri failed for graph-uri."
     );
     goto CLEANUP;
   }
 
-  graph = librdf_new_node_from_uri(world, graph_uri);
-  if (!graph) {
-    return redstore_page_new_with_message(
-      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR,
-      "librdf_new_node_from_uri failed for graph-uri."
+  // The job takes the parser and graph
+  if (jobs_requested(request)) {
+    response = jobs_load_uri(request, parser, uri, base_uri, graph);
+    parser = NULL;
+    graph = NULL;
+    goto CLEANUP;
+  }
+
+  stream = librdf_parser_parse_as_stream(parser, uri, base_uri);
+  if (!stream) {
+    response = redstore_page_new_with_message(
+      request, LIBRDF_LOG_ERROR, REDHTTP_INTERNAL_SERVER_ERROR, "Failed to parse RDF as stream."
     );
+    goto CLEANUP;
   }
 
   response = load_stream_into_graph(request, stream, graph);
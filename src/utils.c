@@ -191,6 +191,202 @@ char *redstore_negotiate_string(redhttp_request_t * request, const char* support
   return format_str;
 }
 
+librdf_node *redstore_new_node_from_integer(unsigned long i)
+{
+  librdf_uri *xsd_integer_uri = NULL;
+  librdf_node *node = NULL;
+  char string[32];
+
+  snprintf(string, sizeof(string), "%lu", i);
+
+  xsd_integer_uri =
+      librdf_new_uri(world, (unsigned char *) "http://www.w3.org/2001/XMLSchema#integer");
+  if (!xsd_integer_uri)
+    return NULL;
+
+  node = librdf_new_node_from_typed_literal(world, (unsigned char *) string, NULL, xsd_integer_uri);
+
+  librdf_free_uri(xsd_integer_uri);
+
+  return node;
+}
+
+// Returns non-zero if the argument is not a non-negative integer; def is used if it is missing
+int redstore_get_integer_argument(redhttp_request_t * request, const char *name,
+                                  long def, long *value)
+{
+  const char *str = redhttp_request_get_argument(request, name);
+  char *end = NULL;
+
+  *value = def;
+  if (!str || str[0] == '\0')
+    return 0;
+
+  *value = strtol(str, &end, 10);
+  return (*end != '\0' || *value < 0);
+}
+
+// Adds the length and then the bytes of a string to an FNV-1a hash
+static uint64_t hash_counted_string(uint64_t hash, const unsigned char *str, size_t len)
+{
+  uint64_t n = len;
+  size_t i;
+
+  for (i = 0; i < sizeof(n); i++) {
+    hash ^= (unsigned char) (n >> (i * 8));
+    hash *= 1099511628211ULL;
+  }
+  for (i = 0; i < len; i++) {
+    hash ^= str[i];
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+static uint64_t hash_string(uint64_t hash, const unsigned char *str)
+{
+  return hash_counted_string(hash, str, str ? strlen((const char *) str) : 0);
+}
+
+static uint64_t hash_uri(uint64_t hash, librdf_uri * uri)
+{
+  const unsigned char *str = NULL;
+  size_t len = 0;
+
+  if (uri)
+    str = librdf_uri_as_counted_string(uri, &len);
+
+  return hash_counted_string(hash, str, len);
+}
+
+// An FNV-1a hash of the subject, predicate and object of a statement.
+// The parts of each node are hashed where they are, so that it can't fail.
+uint64_t redstore_statement_hash(librdf_statement * statement)
+{
+  librdf_node *nodes[3];
+  uint64_t hash = 14695981039346656037ULL;
+  int n;
+
+  nodes[0] = librdf_statement_get_subject(statement);
+  nodes[1] = librdf_statement_get_predicate(statement);
+  nodes[2] = librdf_statement_get_object(statement);
+
+  for (n = 0; n < 3; n++) {
+    librdf_node *node = nodes[n];
+    unsigned char type = node ? (unsigned char) librdf_node_get_type(node) : 0;
+
+    hash ^= type;
+    hash *= 1099511628211ULL;
+
+    if (!node) {
+      continue;
+    } else if (librdf_node_is_resource(node)) {
+      hash = hash_uri(hash, librdf_node_get_uri(node));
+    } else if (librdf_node_is_blank(node)) {
+      hash = hash_string(hash, librdf_node_get_blank_identifier(node));
+    } else if (librdf_node_is_literal(node)) {
+      const unsigned char *value = NULL;
+      size_t len = 0;
+
+      value = librdf_node_get_literal_value_as_counted_string(node, &len);
+      hash = hash_counted_string(hash, value, len);
+      hash = hash_string(hash, (const unsigned char *) librdf_node_get_literal_value_language(node));
+      hash = hash_uri(hash, librdf_node_get_literal_value_datatype_uri(node));
+    }
+  }
+
+  return hash;
+}
+
+// Writes the code point in a string of hex digits as UTF-8
+static int append_code_point(const char *hex, size_t digits, char **out)
+{
+  unsigned long c = 0;
+  char *ptr = *out;
+  size_t i;
+
+  for (i = 0; i < digits; i++) {
+    c <<= 4;
+    if (hex[i] >= '0' && hex[i] <= '9')
+      c |= hex[i] - '0';
+    else if (hex[i] >= 'a' && hex[i] <= 'f')
+      c |= hex[i] - 'a' + 10;
+    else if (hex[i] >= 'A' && hex[i] <= 'F')
+      c |= hex[i] - 'A' + 10;
+    else
+      return 1;
+  }
+
+  if (c < 0x80) {
+    *ptr++ = (char) c;
+  } else if (c < 0x800) {
+    *ptr++ = (char) (0xC0 | (c >> 6));
+    *ptr++ = (char) (0x80 | (c & 0x3F));
+  } else if (c < 0x10000) {
+    *ptr++ = (char) (0xE0 | (c >> 12));
+    *ptr++ = (char) (0x80 | ((c >> 6) & 0x3F));
+    *ptr++ = (char) (0x80 | (c & 0x3F));
+  } else if (c <= 0x10FFFF) {
+    *ptr++ = (char) (0xF0 | (c >> 18));
+    *ptr++ = (char) (0x80 | ((c >> 12) & 0x3F));
+    *ptr++ = (char) (0x80 | ((c >> 6) & 0x3F));
+    *ptr++ = (char) (0x80 | (c & 0x3F));
+  } else {
+    return 1;
+  }
+
+  *out = ptr;
+  return 0;
+}
+
+// Unescapes the body of a string literal written in N-Triples or Turtle
+// syntax. The result should be freed with free().
+char *redstore_unescape_string(const char *start, size_t len)
+{
+  char *value = malloc(len + 1);
+  char *out = value;
+  size_t i, digits;
+
+  if (!value)
+    return NULL;
+
+  for (i = 0; i < len; i++) {
+    if (start[i] == '\\' && i + 1 < len) {
+      i++;
+      switch (start[i]) {
+      case 'n':
+        *out++ = '\n';
+        break;
+      case 'r':
+        *out++ = '\r';
+        break;
+      case 't':
+        *out++ = '\t';
+        break;
+      case 'u':
+      case 'U':
+        // Code points are written as four or eight hex digits
+        digits = (start[i] == 'u') ? 4 : 8;
+        if (i + digits < len && append_code_point(start + i + 1, digits, &out) == 0) {
+          i += digits;
+        } else {
+          *out++ = start[i];
+        }
+        break;
+      default:
+        *out++ = start[i];
+        break;
+      }
+    } else {
+      *out++ = start[i];
+    }
+  }
+  *out = '\0';
+
+  return value;
+}
+
 int redstore_is_html_format(const char *str)
 {
   if (strcmp(str, "html") == 0 ||
@@ -0,0 +1,711 @@
+/*
+    RedStore - a lightweight RDF triplestore powered by Redland
+    Copyright (C) 2010-2011 Nicholas J Humfrey <njh@aelius.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "redstore.h"
+
+
+// The write-ahead log: every change made through store.c is appended to
+// a log file as a record, and the log is replayed at startup.
+//
+// Records are collected in a buffer and written when an operation (or a
+// group of them, such as a SPARQL Update request) is complete. The log is
+// either synced after every write, or every sync_interval milliseconds.
+//
+// Once the log is large enough, a child process is forked to write a
+// checkpoint: a record for every statement in the store, along with the
+// generation and length of the log at the time of the fork. When the
+// child has finished, the records written since then are copied into a
+// new log, with the next generation number. Neither happens while a
+// transaction is open, because its records are still in the buffer and
+// may yet be rolled back. A checkpoint that fails is tried again later,
+// waiting longer after each failure.
+
+#define WAL_MAGIC               "RSWAL001"
+#define WAL_CHECKPOINT_MAGIC    "RSCKP001"
+#define WAL_HEADER_SIZE         (16)
+#define WAL_MAX_RECORD_SIZE     (64 * 1024 * 1024)
+
+#define WAL_ADD                 'A'
+#define WAL_REMOVE              'D'
+#define WAL_REMOVE_GRAPH        'G'
+#define WAL_REMOVE_ALL          'Z'
+
+static char *log_filename = NULL;
+static char *checkpoint_filename = NULL;
+static int log_fd = -1;
+static uint64_t log_generation = 0;
+static uint64_t log_size = 0;
+
+static unsigned char *buffer = NULL;
+static size_t buffer_len = 0;
+static size_t buffer_size = 0;
+
+static int sync_interval = 0;
+static int unsynced = 0;
+static struct timeval last_sync;
+
+static pid_t checkpoint_pid = 0;
+static uint64_t checkpoint_offset = 0;
+static uint64_t checkpoint_size = WAL_CHECKPOINT_SIZE;
+static time_t checkpoint_retry = 0;     // Don't start another checkpoint before then
+static int checkpoint_backoff = 0;
+
+
+static uint32_t checksum(const unsigned char *data, size_t len)
+{
+  uint32_t hash = 2166136261U;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 16777619U;
+  }
+
+  return hash;
+}
+
+static char *new_filename(const char *filename, const char *suffix)
+{
+  char *str = malloc(strlen(filename) + strlen(suffix) + 1);
+  if (str)
+    sprintf(str, "%s%s", filename, suffix);
+  return str;
+}
+
+static int buffer_reserve(size_t len)
+{
+  if (buffer_len + len > buffer_size) {
+    size_t size = buffer_size ? buffer_size : 65536;
+    unsigned char *tmp = NULL;
+    while (buffer_len + len > size)
+      size *= 2;
+    tmp = realloc(buffer, size);
+    if (!tmp)
+      return 1;
+    buffer = tmp;
+    buffer_size = size;
+  }
+  return 0;
+}
+
+// A record is its length, an operation, a count of terms,
+// the terms in librdf's binary encoding, and a checksum
+static int append_record(unsigned char op, librdf_node ** nodes, int count)
+{
+  size_t start = buffer_len;
+  uint32_t len = 2, sum;
+  int i;
+
+  for (i = 0; i < count; i++)
+    len += librdf_node_encode(nodes[i], NULL, 0);
+
+  if (buffer_reserve(sizeof(len) + len + sizeof(sum)))
+    return 1;
+
+  memcpy(buffer + buffer_len, &len, sizeof(len));
+  buffer_len += sizeof(len);
+  buffer[buffer_len++] = op;
+  buffer[buffer_len++] = (unsigned char) count;
+  for (i = 0; i < count; i++)
+    buffer_len += librdf_node_encode(nodes[i], buffer + buffer_len, buffer_size - buffer_len);
+
+  sum = checksum(buffer + start + sizeof(len), len);
+  memcpy(buffer + buffer_len, &sum, sizeof(sum));
+  buffer_len += sizeof(sum);
+
+  return 0;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+  const unsigned char *ptr = data;
+
+  while (len > 0) {
+    ssize_t written = write(fd, ptr, len);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return 1;
+    }
+    ptr += written;
+    len -= written;
+  }
+
+  return 0;
+}
+
+static int write_header(int fd, const char *magic, uint64_t generation)
+{
+  unsigned char header[WAL_HEADER_SIZE];
+
+  memcpy(header, magic, 8);
+  memcpy(header + 8, &generation, sizeof(generation));
+
+  return write_all(fd, header, sizeof(header));
+}
+
+static int read_header(FILE * file, const char *magic, uint64_t * generation)
+{
+  unsigned char header[WAL_HEADER_SIZE];
+
+  if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, magic, 8) != 0)
+    return 1;
+  memcpy(generation, header + 8, sizeof(*generation));
+
+  return 0;
+}
+
+// Applies the change in a record to the store
+static int apply_record(unsigned char *body, size_t len)
+{
+  librdf_node *nodes[4] = { NULL, NULL, NULL, NULL };
+  librdf_statement *statement = NULL;
+  unsigned char op = body[0];
+  int count = body[1], i, err = 0;
+  size_t pos = 2;
+
+  if (count > 4)
+    return 1;
+
+  for (i = 0; i < count; i++) {
+    size_t used = 0;
+    nodes[i] = librdf_node_decode(world, &used, body + pos, len - pos);
+    if (!nodes[i]) {
+      err = 1;
+      goto CLEANUP;
+    }
+    pos += used;
+  }
+
+  switch (op) {
+  case WAL_ADD:
+  case WAL_REMOVE:
+    if (count < 3) {
+      err = 1;
+      break;
+    }
+    statement = librdf_new_statement_from_nodes(world, nodes[0], nodes[1], nodes[2]);
+    nodes[0] = nodes[1] = nodes[2] = NULL;
+    if (!statement) {
+      err = 1;
+    } else if (op == WAL_ADD) {
+      err = (store_add_statement(nodes[3], statement) < 0);
+    } else {
+      store_remove_statement(nodes[3], statement);
+    }
+    break;
+  case WAL_REMOVE_GRAPH:
+    err = store_remove_graph(nodes[0]);
+    break;
+  case WAL_REMOVE_ALL:
+    err = store_remove_all();
+    break;
+  default:
+    err = 1;
+    break;
+  }
+
+CLEANUP:
+  if (statement)
+    librdf_free_statement(statement);
+  for (i = 0; i < 4; i++) {
+    if (nodes[i])
+      librdf_free_node(nodes[i]);
+  }
+
+  return err;
+}
+
+// Applies the records in a file, starting at the current position. Returns the
+// offset after the last complete record; anything after it was never committed.
+static uint64_t replay_file(FILE * file, uint64_t offset, unsigned long *count)
+{
+  unsigned char *body = NULL;
+  size_t body_size = 0;
+
+  while (1) {
+    uint32_t len, sum;
+
+    if (fread(&len, sizeof(len), 1, file) != 1 || len < 2 || len > WAL_MAX_RECORD_SIZE)
+      break;
+
+    if (len > body_size) {
+      unsigned char *tmp = realloc(body, len);
+      if (!tmp)
+        break;
+      body = tmp;
+      body_size = len;
+    }
+
+    if (fread(body, 1, len, file) != len || fread(&sum, sizeof(sum), 1, file) != 1)
+      break;
+
+    if (sum != checksum(body, len)) {
+      redstore_warn("Checksum mismatch in log record at offset %lu", (unsigned long) offset);
+      break;
+    }
+
+    if (apply_record(body, len))
+      redstore_error("Failed to apply log record at offset %lu", (unsigned long) offset);
+
+    offset += sizeof(len) + len + sizeof(sum);
+    (*count)++;
+  }
+
+  if (body)
+    free(body);
+
+  return offset;
+}
+
+// Loads the last checkpoint and replays the log written since then
+static int recover(void)
+{
+  FILE *file = NULL;
+  uint64_t checkpoint_generation = 0, offset = 0, end;
+  unsigned long count = 0;
+  int have_checkpoint = 0;
+  struct stat st;
+
+  file = fopen(checkpoint_filename, "rb");
+  if (file) {
+    unsigned char header[8];
+    if (read_header(file, WAL_CHECKPOINT_MAGIC, &checkpoint_generation) ||
+        fread(header, 1, sizeof(header), file) != sizeof(header)) {
+      redstore_error("Invalid checkpoint file: %s", checkpoint_filename);
+      fclose(file);
+      return 1;
+    }
+    memcpy(&offset, header, sizeof(offset));
+    replay_file(file, 0, &count);
+    fclose(file);
+    have_checkpoint = 1;
+    redstore_info("Loaded %lu statements from checkpoint: %s", count, checkpoint_filename);
+  }
+
+  file = fopen(log_filename, "rb");
+  if (!file) {
+    // Start a new log, which follows on from the checkpoint
+    log_generation = checkpoint_generation + 1;
+    log_size = 0;
+    return 0;
+  }
+
+  if (read_header(file, WAL_MAGIC, &log_generation)) {
+    redstore_error("Invalid log file: %s", log_filename);
+    fclose(file);
+    return 1;
+  }
+
+  if (!have_checkpoint && log_generation > 1) {
+    redstore_error("Log file %s follows on from a checkpoint that is missing", log_filename);
+    fclose(file);
+    return 1;
+  } else if (!have_checkpoint || log_generation == checkpoint_generation + 1) {
+    // The whole log was written after the checkpoint
+    offset = WAL_HEADER_SIZE;
+  } else if (log_generation != checkpoint_generation) {
+    redstore_error("Log file %s does not follow on from the checkpoint", log_filename);
+    fclose(file);
+    return 1;
+  }
+
+  count = 0;
+  if (fseek(file, (long) offset, SEEK_SET) == 0) {
+    end = replay_file(file, offset, &count);
+  } else {
+    end = WAL_HEADER_SIZE;
+  }
+  redstore_info("Replayed %lu changes from log: %s", count, log_filename);
+
+  if (fstat(fileno(file), &st) == 0 && (uint64_t) st.st_size > end) {
+    // It is truncated once the log has been opened for writing
+    redstore_warn("Discarding incomplete record at the end of the log.");
+  }
+  log_size = end;
+  fclose(file);
+
+  return 0;
+}
+
+// Replays the log and opens it for writing. The sync interval is in
+// milliseconds; 0 means that the log is synced whenever it is written to.
+int wal_open(const char *filename, int interval)
+{
+  log_filename = new_filename(filename, "");
+  checkpoint_filename = new_filename(filename, ".checkpoint");
+  if (!log_filename || !checkpoint_filename)
+    return 1;
+
+  sync_interval = interval;
+  gettimeofday(&last_sync, NULL);
+
+  if (recover())
+    return 1;
+
+  log_fd = open(log_filename, O_WRONLY | O_CREAT, 0644);
+  if (log_fd < 0) {
+    redstore_error("Failed to open log %s: %s", log_filename, strerror(errno));
+    return 1;
+  }
+
+  if (log_size == 0) {
+    if (write_header(log_fd, WAL_MAGIC, log_generation) || fsync(log_fd)) {
+      redstore_error("Failed to write log header: %s", strerror(errno));
+      return 1;
+    }
+    log_size = WAL_HEADER_SIZE;
+  } else if (ftruncate(log_fd, (off_t) log_size) || lseek(log_fd, (off_t) log_size, SEEK_SET) < 0) {
+    redstore_error("Failed to truncate log: %s", strerror(errno));
+    return 1;
+  }
+
+  redstore_info("Writing changes to log: %s", log_filename);
+
+  return 0;
+}
+
+int wal_is_open(void)
+{
+  return log_fd >= 0;
+}
+
+void wal_log_statement(int remove, librdf_node * graph, librdf_statement * statement)
+{
+  librdf_node *nodes[4];
+
+  if (log_fd < 0)
+    return;
+
+  nodes[0] = librdf_statement_get_subject(statement);
+  nodes[1] = librdf_statement_get_predicate(statement);
+  nodes[2] = librdf_statement_get_object(statement);
+  nodes[3] = graph;
+  if (append_record(remove ? WAL_REMOVE : WAL_ADD, nodes, graph ? 4 : 3))
+    redstore_error("Failed to add record to log");
+}
+
+void wal_log_remove_graph(librdf_node * graph)
+{
+  if (log_fd >= 0 && append_record(WAL_REMOVE_GRAPH, &graph, graph ? 1 : 0))
+    redstore_error("Failed to add record to log");
+}
+
+void wal_log_remove_all(void)
+{
+  if (log_fd >= 0 && append_record(WAL_REMOVE_ALL, NULL, 0))
+    redstore_error("Failed to add record to log");
+}
+
+// Returns a mark that wal_rollback() can go back to
+size_t wal_get_mark(void)
+{
+  return buffer_len;
+}
+
+// Forgets records that haven't been written yet
+void wal_rollback(size_t mark)
+{
+  if (mark < buffer_len)
+    buffer_len = mark;
+}
+
+static int wal_sync(void)
+{
+  gettimeofday(&last_sync, NULL);
+  unsynced = 0;
+
+  if (fsync(log_fd)) {
+    redstore_error("Failed to sync log: %s", strerror(errno));
+    return 1;
+  }
+
+  return 0;
+}
+
+// Writes the buffered records to the log; returns non-zero on error
+int wal_commit(void)
+{
+  if (log_fd < 0 || buffer_len == 0)
+    return 0;
+
+  if (write_all(log_fd, buffer, buffer_len)) {
+    redstore_error("Failed to write to log: %s", strerror(errno));
+    // Don't leave part of a record at the end of the log
+    if (ftruncate(log_fd, (off_t) log_size) == 0)
+      lseek(log_fd, (off_t) log_size, SEEK_SET);
+    buffer_len = 0;
+    return 1;
+  }
+
+  log_size += buffer_len;
+  buffer_len = 0;
+
+  if (sync_interval == 0)
+    return wal_sync();
+
+  unsynced = 1;
+  return 0;
+}
+
+// Runs in the child process: writes every statement in the store to a new checkpoint file
+static int write_checkpoint(uint64_t generation, uint64_t offset)
+{
+  char *tmp_filename = new_filename(checkpoint_filename, ".tmp");
+  librdf_stream *stream = NULL;
+  int fd = -1, err = 1;
+
+  if (!tmp_filename)
+    return 1;
+
+  fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    goto CLEANUP;
+
+  if (write_header(fd, WAL_CHECKPOINT_MAGIC, generation) || write_all(fd, &offset, sizeof(offset)))
+    goto CLEANUP;
+
+  stream = librdf_model_as_stream(model);
+  if (!stream)
+    goto CLEANUP;
+
+  buffer_len = 0;
+  while (!librdf_stream_end(stream)) {
+    librdf_statement *statement = librdf_stream_get_object(stream);
+    librdf_node *nodes[4];
+
+    nodes[0] = librdf_statement_get_subject(statement);
+    nodes[1] = librdf_statement_get_predicate(statement);
+    nodes[2] = librdf_statement_get_object(statement);
+    nodes[3] = librdf_stream_get_context2(stream);
+    if (append_record(WAL_ADD, nodes, nodes[3] ? 4 : 3))
+      goto CLEANUP;
+
+    if (buffer_len >= 65536) {
+      if (write_all(fd, buffer, buffer_len))
+        goto CLEANUP;
+      buffer_len = 0;
+    }
+    librdf_stream_next(stream);
+  }
+
+  if (write_all(fd, buffer, buffer_len) || fsync(fd))
+    goto CLEANUP;
+
+  if (close(fd) == 0) {
+    fd = -1;
+    err = rename(tmp_filename, checkpoint_filename);
+  }
+
+CLEANUP:
+  if (stream)
+    librdf_free_stream(stream);
+  if (fd >= 0)
+    close(fd);
+  if (err)
+    unlink(tmp_filename);
+  free(tmp_filename);
+
+  return err;
+}
+
+static void checkpoint_failed(void)
+{
+  if (checkpoint_backoff == 0)
+    checkpoint_backoff = WAL_CHECKPOINT_RETRY;
+  else if (checkpoint_backoff < WAL_CHECKPOINT_MAX_RETRY / 2)
+    checkpoint_backoff *= 2;
+  else
+    checkpoint_backoff = WAL_CHECKPOINT_MAX_RETRY;
+
+  checkpoint_retry = time(NULL) + checkpoint_backoff;
+  redstore_warn("Trying the checkpoint again in %d seconds", checkpoint_backoff);
+}
+
+static void start_checkpoint(void)
+{
+  pid_t pid;
+
+  if (wal_commit() || wal_sync()) {
+    checkpoint_failed();
+    return;
+  }
+
+  checkpoint_offset = log_size;
+  pid = fork();
+  if (pid < 0) {
+    redstore_error("Failed to fork checkpoint process: %s", strerror(errno));
+    checkpoint_failed();
+  } else if (pid == 0) {
+    // The child has a copy of the store, as it was when the log reached checkpoint_offset
+    _exit(write_checkpoint(log_generation, checkpoint_offset) ? EXIT_FAILURE : EXIT_SUCCESS);
+  } else {
+    redstore_info("Started checkpoint process %d", (int) pid);
+    checkpoint_pid = pid;
+  }
+}
+
+// Called once the checkpoint has been written: start a new log with the records since then
+static int finish_checkpoint(void)
+{
+  char *tmp_filename = new_filename(log_filename, ".tmp");
+  unsigned char copy[65536];
+  uint64_t new_size = WAL_HEADER_SIZE;
+  int old_fd = -1, new_fd = -1, err = 1;
+  ssize_t len;
+
+  if (!tmp_filename || wal_commit())
+    goto CLEANUP;
+
+  old_fd = open(log_filename, O_RDONLY);
+  new_fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (old_fd < 0 || new_fd < 0 || lseek(old_fd, (off_t) checkpoint_offset, SEEK_SET) < 0)
+    goto CLEANUP;
+
+  if (write_header(new_fd, WAL_MAGIC, log_generation + 1))
+    goto CLEANUP;
+
+  while ((len = read(old_fd, copy, sizeof(copy))) > 0) {
+    if (write_all(new_fd, copy, len))
+      goto CLEANUP;
+    new_size += len;
+  }
+
+  if (len < 0 || fsync(new_fd) || rename(tmp_filename, log_filename))
+    goto CLEANUP;
+
+  close(log_fd);
+  log_fd = new_fd;
+  new_fd = -1;
+  log_generation++;
+  log_size = new_size;
+  unsynced = 0;
+  err = 0;
+
+  redstore_info("Checkpoint complete; log is now %lu bytes", (unsigned long) log_size);
+
+CLEANUP:
+  if (err)
+    redstore_error("Failed to start a new log after the checkpoint");
+  if (old_fd >= 0)
+    close(old_fd);
+  if (new_fd >= 0) {
+    close(new_fd);
+    unlink(tmp_filename);
+  }
+  if (tmp_filename)
+    free(tmp_filename);
+
+  return err;
+}
+
+static void check_checkpoint(int block)
+{
+  int status = 0;
+  pid_t pid;
+
+  if (!checkpoint_pid)
+    return;
+
+  pid = waitpid(checkpoint_pid, &status, block ? 0 : WNOHANG);
+  if (pid == 0)
+    return;
+
+  checkpoint_pid = 0;
+  if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+    if (finish_checkpoint() == 0) {
+      checkpoint_backoff = 0;
+      return;
+    }
+  } else {
+    redstore_error("Checkpoint process failed");
+  }
+  checkpoint_failed();
+}
+
+// Sets the size that the log grows to before a checkpoint is written
+void wal_set_checkpoint_size(uint64_t size)
+{
+  checkpoint_size = size;
+}
+
+// Called regularly from the main loop
+void wal_tick(void)
+{
+  struct timeval now;
+  long elapsed;
+
+  if (log_fd < 0)
+    return;
+
+  if (unsynced) {
+    gettimeofday(&now, NULL);
+    elapsed = (now.tv_sec - last_sync.tv_sec) * 1000 + (now.tv_usec - last_sync.tv_usec) / 1000;
+    if (elapsed >= sync_interval)
+      wal_sync();
+  }
+
+  // Commit a group of writes now, rather than putting off the checkpoint
+  if (!checkpoint_pid && log_size >= checkpoint_size && time(NULL) >= checkpoint_retry)
+    coalesce_flush();
+
+  // Both starting and finishing a checkpoint write out the buffer
+  if (store_in_transaction())
+    return;
+
+  check_checkpoint(0);
+  if (!checkpoint_pid && log_size >= checkpoint_size && time(NULL) >= checkpoint_retry)
+    start_checkpoint();
+}
+
+void wal_close(void)
+{
+  if (log_fd >= 0) {
+    wal_commit();
+    wal_sync();
+    check_checkpoint(1);
+    close(log_fd);
+    log_fd = -1;
+  }
+
+  if (buffer)
+    free(buffer);
+  buffer = NULL;
+  buffer_len = buffer_size = 0;
+
+  if (log_filename)
+    free(log_filename);
+  log_filename = NULL;
+  if (checkpoint_filename)
+    free(checkpoint_filename);
+  checkpoint_filename = NULL;
+}
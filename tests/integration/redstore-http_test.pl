@@ -7,7 +7,7 @@ use redstore_testlib;
 use warnings;
 use strict;
 
-use Test::More tests => 94;
+use Test::More tests => 151;
 
 my $RFC822_DATE = qr/^(\w{3},)? \d{1,2} \w{3} \d{2} \d{2}:\d{2}:\d{2}/;
 
@@ -16,7 +16,7 @@ my ($request, $response, @lines);
 my $ua = new_redstore_client();
 
 # Start RedStore
-my ($pid, $base_url) = start_redstore();
+my ($pid, $base_url) = start_redstore('memory', undef, undef, 0, '-C', 1, '-D', 'books:memory', '-x', '-i');
 
 # Double check that the server is running
 is_running($pid);
@@ -136,6 +136,46 @@ is($response->content_type, 'text/html', "Graph list is of type text/html");
 like($response->content, qr[<li><a href="$TEST_URI">$TEST_URI</a></li>], "List of graphs page contains graph that was added");
 is_valid_xhtml($response->content, "Graph list should be valid XHTML");
 
+# Test getting pages of the list of graphs
+$response = $ua->get($base_url.'graphs?limit=1');
+is($response->content, "$TEST_URI\n", "First page of graphs contains graph that was added");
+$response = $ua->get($base_url.'graphs?offset=1');
+is($response->code, 200, "Getting page past the end of the list of graphs is successful");
+is($response->content, '', "Page past the end of the list of graphs is empty");
+$response = $ua->get($base_url.'graphs?offset=first');
+is($response->code, 400, "Getting list of graphs with an invalid offset fails");
+
+# Test that a graph has a last modified date
+$response = $ua->head($TEST_URI);
+is($response->code, 200, "HEAD of graph that was added is successful");
+like($response->last_modified, qr/^\d{10}$/, "Graph should have a last modified date set");
+
+# Test getting a triple pattern fragment
+$response = $ua->get($base_url.'fragments?p=http%3A%2F%2Fexample.org%2Fvalue', 'Accept' => 'text/plain');
+is($response->code, 200, "Getting a triple pattern fragment is successful");
+is($response->content_type, 'text/plain', "Triple pattern fragment is of type text/plain");
+is($response->header('X-Cardinality'), 1, "Triple pattern fragment has the correct cardinality");
+@lines = split(/[\r\n]+/, $response->content);
+is(scalar(@lines), 1, "Triple pattern fragment contains the matching triple");
+
+# Test getting a triple pattern fragment with an invalid term
+$response = $ua->get($base_url.'fragments?o=%22unterminated', 'Accept' => 'text/plain');
+is($response->code, 400, "Getting a triple pattern fragment with an invalid term fails");
+
+# Test getting a triple pattern fragment with an offset that is too large
+$response = $ua->get($base_url.'fragments?offset=2147483647', 'Accept' => 'text/plain');
+is($response->code, 400, "Getting a triple pattern fragment with a huge offset fails");
+
+# Test searching for the words in literals
+$response = $ua->get($base_url.'search?q=V', 'Accept' => 'text/plain');
+is($response->code, 200, "Searching for a word is successful");
+is($response->content_type, 'text/plain', "Search results are of type text/plain");
+like($response->content, qr[^<http://example.org/dir/file#frag>\t], "Search results contain the subject with the word");
+$response = $ua->get($base_url.'search?q=v+missing', 'Accept' => 'text/plain');
+is($response->content, '', "Search results are empty when a word is missing");
+$response = $ua->get($base_url.'search?q=v', 'Accept' => 'text/html');
+is_valid_xhtml($response->content, "Search results page should be valid XHTML");
+
 # Test POSTing a url to be loaded
 {
     $ua->request(HTTP::Request->new( 'DELETE', $base_url.'data/foaf.rdf' ));
@@ -149,8 +189,43 @@ is_valid_xhtml($response->content, "Graph list should be valid XHTML");
     $response = $ua->get($base_url.'data/foaf.rdf', 'Accept' => 'text/plain');
     @lines = split(/[\r\n]+/, $response->content);
     is(scalar(@lines), 14, "Number of triples in loaded graph is correct");
+
+    # The words in the graph can be searched for
+    $response = $ua->get($base_url.'search?q=bloggs', 'Accept' => 'text/plain');
+    like($response->content, qr[^<http://www.example.com/joe#me>\t]m, "Search results contain a subject in the loaded graph");
+}
+
+# Test loading a url in the background
+{
+    $ua->request(HTTP::Request->new( 'DELETE', $base_url.'data/foaf.rdf' ));
+
+    # The words in a graph that has been deleted are no longer found
+    $response = $ua->get($base_url.'search?q=bloggs', 'Accept' => 'text/plain');
+    is($response->code, 200, "Searching after deleting a graph is successful");
+    is($response->content, '', "Search results are empty after deleting the graph");
+
+    $response = $ua->post( $base_url.'load', {'uri' => fixture_url('foaf.ttl'), 'graph' => $base_url.'data/foaf.rdf', 'async' => 1});
+    is($response->code, 202, "POSTing URL to load in the background is accepted");
+    like($response->header('Location'), qr[^/jobs/\d+$], "Response has the location of the job");
+
+    my $job_url = $base_url.substr($response->header('Location'), 1);
+    for (1..50) {
+        $response = $ua->get($job_url);
+        last unless ($response->content =~ /state: running/);
+        select(undef, undef, undef, 0.1);
+    }
+    like($response->content, qr/state: finished/, "Load job finished");
+    like($response->content, qr/statements: 14/, "Load job added all the triples");
 }
 
+# Test getting a job that doesn't exist
+$response = $ua->get($base_url.'jobs/999');
+is($response->code, 404, "Getting a job that doesn't exist fails");
+
+# Test loading a file when loading files isn't enabled
+$response = $ua->post( $base_url.'load', {'file' => 'foaf.ttl'});
+is($response->code, 403, "POSTing a file to /load when it isn't enabled is forbidden");
+
 # Test POSTing to /load without a uri
 $response = $ua->post( $base_url.'load');
 is($response->code, 400, "POSTing to /load without a URI should fail");
@@ -182,6 +257,39 @@ like($response->content, qr/Missing URI to load/, "Response mentions missing URI
     is($response->content, "Successfully deleted 1 triples.\n", "Response messages is correct");
 }
 
+# Test looking up a range of typed values
+{
+    my $XSD_INTEGER = '%5E%5E%3Chttp%3A%2F%2Fwww.w3.org%2F2001%2FXMLSchema%23integer%3E';
+    $response = $ua->post( $base_url.'insert', {
+        'content' => "<test:a> <test:price> \"500\"^^<http://www.w3.org/2001/XMLSchema#integer> .\n".
+                     "<test:b> <test:price> \"5\"^^<http://www.w3.org/2001/XMLSchema#integer> .\n".
+                     "<test:c> <test:price> \"50\"^^<http://www.w3.org/2001/XMLSchema#integer> .\n",
+        'content-type' => 'ntriples',
+        'graph' => 'test:prices'
+    });
+    is($response->code, 200, "POSTing typed values to /insert is successful");
+
+    $response = $ua->get($base_url."fragments?p=test%3Aprice&min=%2210%22$XSD_INTEGER&max=%22100%22$XSD_INTEGER", 'Accept' => 'text/plain');
+    is($response->code, 200, "Getting a range of values is successful");
+    @lines = split(/[\r\n]+/, $response->content);
+    is(scalar(@lines), 1, "Range of values contains the one value in range");
+
+    $response = $ua->get($base_url."fragments?p=test%3Aprice&min=%221%22$XSD_INTEGER", 'Accept' => 'text/plain');
+    @lines = split(/[\r\n]+/, $response->content);
+    like($lines[0], qr[<test:b>], "Range of values starts with the lowest value");
+    like($lines[2], qr[<test:a>], "Range of values ends with the highest value");
+
+    $response = $ua->get($base_url."fragments?min=%221%22$XSD_INTEGER", 'Accept' => 'text/plain');
+    is($response->code, 400, "Getting a range of values without a predicate fails");
+
+    $response = $ua->get($base_url."fragments?p=test%3Aprice&min=%220x10%22$XSD_INTEGER", 'Accept' => 'text/plain');
+    is($response->code, 400, "Getting a range of values from a hexadecimal number fails");
+
+    my $XSD_DOUBLE = '%5E%5E%3Chttp%3A%2F%2Fwww.w3.org%2F2001%2FXMLSchema%23double%3E';
+    $response = $ua->get($base_url."fragments?p=test%3Aprice&max=%22inf%22$XSD_DOUBLE", 'Accept' => 'text/plain');
+    is($response->code, 400, "Getting a range of values up to infinity fails");
+}
+
 
 # Test POSTing triples to /insert with a graph parameter
 {
@@ -227,7 +335,104 @@ $response = $ua->post( $base_url.'delete');
 is($response->code, 400, "POSTing to /delete without any content should fail");
 like($response->content, qr/Missing the 'content' argument/, "Response mentions missing content argument");
 
+# Test POSTing an RDF Patch to /patch
+{
+    $response = $ua->post( $base_url.'patch',
+        'Content-Type' => 'application/rdf-patch',
+        'Content' => "PA test: <test:> .\nTX .\nA test:s5 test:p5 \"o5\"\@en test:g .\nD <test:s4> <test:p4> <test:o4> <test:g> .\nTC .\n"
+    );
+    is($response->code, 200, "POSTing a patch to /patch is successful");
+    like($response->content, qr/Applied 1 transactions: 1 triples added and 1 deleted/, "Response messages is correct");
 
+    $response = $ua->get($base_url.'data/?graph=test%3Ag', 'Accept' => 'text/plain');
+    @lines = split(/[\r\n]+/, $response->content);
+    is_deeply(\@lines, ['<test:s5> <test:p5> "o5"@en .'], "Graph contains the patched triples");
+}
+
+# Test that a patch with an error in a transaction doesn't change anything
+{
+    $response = $ua->post( $base_url.'patch',
+        'Content-Type' => 'application/rdf-patch',
+        'Content' => "TX .\nA \"s\" <test:p> <test:o> .\nD <test:s5> <test:p5> \"o5\"\@en <test:g> .\nTC .\n"
+    );
+    is($response->code, 400, "POSTing an invalid patch to /patch should fail");
+    like($response->content, qr/Invalid quad on line 2/, "Response mentions the invalid row");
+
+    $response = $ua->get($base_url.'data/?graph=test%3Ag', 'Accept' => 'text/plain');
+    @lines = split(/[\r\n]+/, $response->content);
+    is(scalar(@lines), 1, "Graph is unchanged after the failed patch");
+}
+
+# Test following the change feed
+{
+    $response = $ua->get($base_url.'changes');
+    is($response->code, 200, "Getting the position of the change feed is successful");
+    is($response->content_type, 'application/rdf-patch', "Change feed is of type application/rdf-patch");
+    my ($epoch, $sequence) = ($response->content =~ /^H epoch "(\d+)" \.\nH sequence "(\d+)" \.\n$/);
+    ok(defined $sequence, "Change feed reports its epoch and sequence number");
+
+    $ua->post( $base_url.'insert', {
+        'content' => "<test:s6> <test:p6> <test:o6> .\n",
+        'content-type' => 'ntriples',
+    });
+    $response = $ua->get($base_url."changes?since=$sequence&epoch=$epoch");
+    is($response->code, 200, "Getting the changes since then is successful");
+    like($response->content, qr/\nTX \.\nA <test:s6> <test:p6> <test:o6> \.\nTC \.\n$/, "Change feed contains the insert");
+
+    $sequence++;
+    $response = $ua->get($base_url."changes?since=$sequence&epoch=$epoch&timeout=1");
+    is($response->code, 200, "Waiting for new changes is successful");
+    unlike($response->content, qr/TX/, "There are no new changes");
+
+    $response = $ua->get($base_url."changes?since=$sequence&epoch=1");
+    is($response->code, 410, "Asking for changes from another epoch should fail");
+}
+
+# Test keeping triples in a second dataset
+{
+    $response = $ua->post( $base_url.'ds/books/insert', {
+        'content' => "<test:s9> <test:p9> <test:o9> .\n",
+        'content-type' => 'ntriples',
+    });
+    is($response->code, 200, "Inserting into a second dataset is successful");
+
+    $response = $ua->get($base_url.'ds/books/data/?default', 'Accept' => 'text/plain');
+    is($response->content, "<test:s9> <test:p9> <test:o9> .\n", "Second dataset contains only its own triples");
+
+    $response = $ua->get($base_url.'data/?default', 'Accept' => 'text/plain');
+    unlike($response->content, qr/test:s9/, "Default dataset doesn't contain the second dataset's triples");
+
+    $response = $ua->get($base_url.'ds/nope/sparql');
+    is($response->code, 404, "Getting an unknown dataset should fail");
+}
+
+# Test running a read-only copy that follows the change feed
+{
+    my ($follower_pid, $follower_url) = start_redstore('memory', undef, 'redstore-follower', 0, '-P', $base_url);
+
+    $response = $ua->get($follower_url.'data/?graph=test%3Ag', 'Accept' => 'text/plain');
+    is($response->content, "<test:s5> <test:p5> \"o5\"\@en .\n", "Follower has a copy of the store");
+
+    $ua->post( $base_url.'insert', {
+        'content' => "<test:s7> <test:p7> <test:o7> .\n",
+        'content-type' => 'ntriples',
+    });
+    sleep(1);
+    $response = $ua->get($follower_url.'data/?default', 'Accept' => 'text/plain');
+    like($response->content, qr/<test:s7> <test:p7> <test:o7> \./, "Follower has applied a new change");
+
+    $response = $ua->post( $follower_url.'insert', {
+        'content' => "<test:s8> <test:p8> <test:o8> .\n",
+        'content-type' => 'ntriples',
+    });
+    is($response->code, 403, "Follower refuses changes from clients");
+    like($response->content, qr/read-only copy/, "Response explains that the store is a copy");
+
+    $response = $ua->get($follower_url.'description', 'Accept' => 'text/html');
+    like($response->content, qr/Replication Lag<\/th><td>\d+ seconds/, "Description shows the replication lag");
+
+    stop_redstore($follower_pid);
+}
 
 
 END {
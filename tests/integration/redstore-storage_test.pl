@@ -7,7 +7,7 @@ use redstore_testlib;
 use warnings;
 use strict;
 
-use Test::More tests => 49;
+use Test::More tests => 65;
 
 # Create a libwww-perl user agent
 my ($request, $response);
@@ -70,6 +70,11 @@ sub test_storage
     test_storage("hashes", "hash-type='memory'");
 }
 
+# In-memory hashes, with the graphs partitioned between three of them
+{
+    test_storage("sharded", "shards='3',hash-type='memory'");
+}
+
 # SQLite
 {
     test_storage("sqlite", undef, 'redstore-test.sqlite', 1);
@@ -78,6 +83,33 @@ sub test_storage
     ok(unlink('redstore-test.sqlite'), "Deleting sqlite storage file");
 }
 
+# SQLite supports transactions; aborting an empty one in a patch mustn't leave it open
+{
+    my ($pid, $base_url) = start_redstore('sqlite', undef, 'redstore-patch.sqlite', 1, '-C', 1);
+
+    $response = $ua->post( $base_url.'patch',
+        'Content-Type' => 'application/rdf-patch',
+        'Content' => "TX .\nTA .\n"
+    );
+    is($response->code, 200, "sqlite - POSTing a patch with an empty aborted transaction is successful");
+
+    $response = $ua->get($base_url.'changes');
+    my ($epoch, $sequence) = ($response->content =~ /^H epoch "(\d+)" \.\nH sequence "(\d+)" \.\n$/);
+    ok(defined $sequence, "sqlite - Change feed reports its epoch and sequence number");
+
+    $response = $ua->post( $base_url.'insert', {
+        'content' => "<test:s1> <test:p1> <test:o1> .\n",
+        'content-type' => 'ntriples',
+    });
+    is($response->code, 200, "sqlite - Inserting after the aborted transaction is successful");
+
+    $response = $ua->get($base_url."changes?since=$sequence&epoch=$epoch");
+    like($response->content, qr/\nA <test:s1> <test:p1> <test:o1> \.\n/, "sqlite - Change feed contains the insert");
+
+    stop_redstore($pid);
+    ok(unlink('redstore-patch.sqlite'), "Deleting sqlite storage file");
+}
+
 # BDB
 {
     test_storage("hashes", "hash-type='bdb',dir='.'", 'redstore-test', 1);
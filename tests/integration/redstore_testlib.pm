@@ -48,6 +48,7 @@ sub start_redstore {
     my $storage_options = shift || undef;
     my $storage_name = shift || 'redstore-test';
     my $storage_new = shift;
+    my @extra_args = @_;
 
     my ($pid, $port);
     my $count = 0;
@@ -69,6 +70,7 @@ sub start_redstore {
             );
             push(@args, '-n') if ($storage_new);
             push(@args, '-t', $storage_options) if ($storage_options);
+            push(@args, @extra_args);
             push(@args, $storage_name);
             print "# ".join(' ', @args)."\n";
             open(STDOUT, ">>redstore-test.log") or
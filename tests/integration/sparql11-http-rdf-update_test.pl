@@ -11,7 +11,7 @@ use warnings;
 use strict;
 
 
-use Test::More tests => 67;
+use Test::More tests => 70;
 
 my $TEST_CASE_URI = 'http://www.w3.org/2000/10/rdf-tests/rdfcore/xmlbase/test001.rdf';
 my $ESCAPED_TEST_CASE_URI = 'http%3A%2F%2Fwww.w3.org%2F2000%2F10%2Frdf-tests%2Frdfcore%2Fxmlbase%2Ftest001.rdf';
@@ -173,11 +173,21 @@ is($response->code, 400, "PUT response for both default and graph arguments shou
     $request->content_type( 'application/rdf+xml' );
     $response = $ua->request($request);
     is($response->code, 200, "Replacing data in a graph is successful");
+    like($response->content, qr/\(1 added and 14 deleted\)/, "Only the differences were applied");
 
     # Count the number of triples
     $response = $ua->get($base_url.'data/foaf.rdf', 'Accept' => 'text/plain');
     @lines = split(/[\r\n]+/, $response->content);
     is(scalar(@lines), 1, "New number of triples is correct");
+
+    # PUTing the same data again shouldn't change anything
+    $request = HTTP::Request->new( 'PUT', $base_url.'data/foaf.rdf' );
+    $request->content( read_fixture('test001.rdf') );
+    $request->content_length( length($request->content) );
+    $request->content_type( 'application/rdf+xml' );
+    $response = $ua->request($request);
+    is($response->code, 200, "Replacing a graph with the same data is successful");
+    like($response->content, qr/\(0 added and 0 deleted\)/, "No changes were applied");
 };
 
 # Test PUTing JSON
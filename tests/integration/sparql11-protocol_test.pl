@@ -11,7 +11,7 @@ use warnings;
 use strict;
 
 
-use Test::More tests => 88;
+use Test::More tests => 101;
 
 # Create a libwww-perl user agent
 my ($request, $response, @lines);
@@ -75,6 +75,13 @@ is(scalar(@lines), 2, "SPARQL response contains two lines");
 is($lines[0], "g", "First line of SPARQL response contains CSV header");
 is($lines[1], "$TEST_URI", "Second line of SPARQL response contains graph URI");
 
+# Test counting the triples in the store using SPARQL as CSV
+$response = $ua->get($base_url."query?query=SELECT+%28COUNT%28*%29+AS+%3Fc%29+WHERE+%7B%3Fs+%3Fp+%3Fo%7D&format=csv");
+is($response->code, 200, "Counting triples using SPARQL is successful");
+@lines = split(/[\r\n]+/,$response->content);
+is($lines[0], "c", "First line of SPARQL count response contains CSV header");
+is($lines[1], "1", "Second line of SPARQL count response contains the number of triples");
+
 
 # Test a SELECT query with an HTML response
 $response = $ua->get($base_url."query?query=SELECT+*+WHERE+%7B%3Fs+%3Fp+%3Fo%7D%0D%0A&format=html");
@@ -201,6 +208,44 @@ is_wellformed_xml($response->content, "SPARQL response is valid XML");
     is($response->code, 400, "POST response to /sparql without query is bad request");
 }
 
+# Test SPARQL 1.1 Update
+{
+    my $graph = 'http://example.org/update-test';
+
+    $response = $ua->post($base_url."update", {'update' => "INSERT DATA { GRAPH <$graph> { <http://example.org/s> <http://example.org/p> \"old\" } }"});
+    is($response->code, 200, "INSERT DATA update is successful");
+
+    $response = $ua->post($base_url."update",
+        'Content-Type' => 'application/sparql-update',
+        'Content' => "DELETE { GRAPH <$graph> { ?s ?p ?o } } INSERT { GRAPH <$graph> { ?s ?p \"new\" } } WHERE { GRAPH <$graph> { ?s ?p ?o } }"
+    );
+    is($response->code, 200, "DELETE/INSERT WHERE update is successful");
+
+    $response = $ua->get($base_url.'data/?graph='.$graph, 'Accept' => 'text/plain');
+    is($response->content, "<http://example.org/s> <http://example.org/p> \"new\" .\n", "Graph contains the updated triple");
+
+    $response = $ua->post($base_url."update", {'update' => "INSERT DATA { GRAPH <$graph> { <http://example.org/s2> <http://example.org/p> \"new\" . <http://example.org/s2> <http://example.org/q> \"q\" } }"});
+    is($response->code, 200, "Second INSERT DATA update is successful");
+
+    $response = $ua->post($base_url."update", {'update' => "WITH <$graph> DELETE { ?s ?p ?o } WHERE { ?s ?p ?o OPTIONAL { ?s <http://example.org/q> ?q } FILTER (!BOUND(?q) && STR(?o) = \"new\") }"});
+    is($response->code, 200, "WITH DELETE WHERE update with OPTIONAL and FILTER is successful");
+
+    $response = $ua->get($base_url.'data/?graph='.$graph, 'Accept' => 'text/plain');
+    is(scalar(@_ = split(/\n/, $response->content)), 2, "Only the unmatched triples are left in the graph");
+
+    $response = $ua->post($base_url."update", {'update' => "INSERT { ?s ?p ?o } USING <$graph> WHERE { ?s ?p ?o }"});
+    is($response->code, 501, "USING clause is not implemented");
+
+    $response = $ua->post($base_url."sparql", {'update' => "DROP GRAPH <$graph>"});
+    is($response->code, 200, "DROP GRAPH update to /sparql is successful");
+
+    $response = $ua->get($base_url.'data/?graph='.$graph, 'Accept' => 'text/plain');
+    is($response->code, 404, "Dropped graph no longer exists");
+
+    $response = $ua->post($base_url."update", {'update' => "INSERT DATA { <http://example.org/s> "});
+    is($response->code, 400, "Invalid update is a bad request");
+}
+
 
 
 END {